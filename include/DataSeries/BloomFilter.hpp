@@ -0,0 +1,92 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Per-extent Bloom filters of the key fields of a file
+*/
+
+#ifndef DATASERIES_BLOOMFILTER_HPP
+#define DATASERIES_BLOOMFILTER_HPP
+
+#include <inttypes.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <DataSeries/Extent.hpp>
+
+class ExtentSeries;
+
+namespace dataseries {
+
+/** \brief The Bloom filters of the extents of a file.
+
+    A filter holds the non-null values of one variable32, int32 or int64
+    field marked with opt_bloom_filter="yes" in one extent.  It can say
+    for certain that a value is not in the extent, but may wrongly say
+    that one is, about 1% of the time.  DataSeriesSink builds the
+    filters of every extent it writes to a DSv2 file and stores them in
+    one extent of type ExtentType::getDataSeriesBloomFilterTypePtr()
+    just before the index; DataSeriesSource reads them back, and
+    TypeIndexModule::addKeyFilter uses them to skip extents.  Unlike a
+    zone map, a filter is useful for keys, such as file handles, whose
+    values are spread over the whole range in every extent. */
+class BloomFilters {
+  public:
+    struct Filter {
+        std::string field;
+        uint32_t nhashes;
+        /** The bit array, 64 bits per word; its size is a power of 2. */
+        std::vector<uint64_t> bits;
+
+        Filter() : nhashes(0) { }
+
+        /** Hashes of a value of a variable32 field and of an int32 or
+            int64 one; the hash of an integer doesn't depend on the
+            width of the field or the byte order of the machine. */
+        static uint64_t hash(const void *data, uint32_t size);
+        static uint64_t hash(int64_t value);
+
+        /** Sizes the filter for ndistinct values, about 10 bits each. */
+        void init(size_t ndistinct);
+        void add(uint64_t hash);
+        bool mayContain(uint64_t hash) const;
+    };
+    typedef std::vector<Filter> ExtentFilters;
+
+    /** Builds the filters of the opt_bloom_filter fields of e. */
+    static void computeFilters(const Extent &e, ExtentFilters &filters);
+
+    /** Appends a record to series, which has to be of the Bloom filter
+        type, for each of the filters of the extent at offset. */
+    static void appendFilters(ExtentSeries &series, int64_t offset,
+                              const ExtentFilters &filters);
+
+    /** Adds the filters stored in an extent of the Bloom filter type. */
+    void add(const Extent::Ptr &e);
+
+    void clear() { extent_filters.clear(); }
+    bool empty() const { return extent_filters.empty(); }
+
+    /** Returns the filter of field in the extent at offset, or NULL if
+        there is none. */
+    const Filter *find(int64_t offset, const std::string &field) const;
+
+    /** Returns false if the filter of field in the extent at offset
+        shows that none of the hashes are values of the field; returns
+        true if any may be, or there is no filter for the field. */
+    bool mayContainAny(int64_t offset, const std::string &field,
+                       const std::vector<uint64_t> &hashes) const;
+
+  private:
+    std::map<int64_t, ExtentFilters> extent_filters;
+};
+
+} // namespace dataseries
+
+#endif
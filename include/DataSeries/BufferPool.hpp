@@ -0,0 +1,65 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    The pool of memory that Extent::ByteArray allocates from
+*/
+
+#ifndef DATASERIES_BUFFERPOOL_HPP
+#define DATASERIES_BUFFERPOOL_HPP
+
+#include <stddef.h>
+#include <inttypes.h>
+
+namespace dataseries {
+
+/** \brief Keeps freed Extent::ByteArray buffers for reuse.
+
+    Scans allocate and free buffers of the same few sizes over and over:
+    the fixed and variable data of each extent, the compressed bytes,
+    and the temporaries used while packing.  Rather than returning them
+    to malloc, which for large sizes means an munmap and page faults on
+    the next allocation, freed buffers are kept in size classes (four
+    per power of two, from 4KiB to 64MiB).  Each thread keeps a cache of
+    its own, and spills to a shared cache when it is full, so buffers
+    freed by the thread consuming extents get reused by the threads
+    unpacking them.  Smaller and larger buffers go straight to malloc. */
+class BufferPool {
+  public:
+    static const size_t min_pooled_size = 4096;
+    static const size_t max_pooled_size = 64 * 1024 * 1024;
+
+    /** Returns a buffer of at least *size bytes, and sets *size to its
+        actual size, which has to be passed to free(). */
+    static uint8_t *allocate(size_t *size);
+    static void free(uint8_t *buffer, size_t size);
+
+    /** Sets how many bytes of free buffers each thread's cache and the
+        shared cache may hold; the defaults are 16MiB and 128MiB.  0 for
+        both turns pooling off.  Lowering the limits doesn't free the
+        buffers that are already cached. */
+    static void setCacheLimits(size_t per_thread_bytes, size_t shared_bytes);
+
+    /** If true, buffers of 2MiB and more are aligned to 2MiB and marked
+        with madvise(MADV_HUGEPAGE), so that Linux can back them with
+        transparent huge pages.  Off by default. */
+    static void setUseHugePages(bool use_huge_pages);
+
+    struct Stats {
+        uint64_t allocations; // of sizes that are pooled
+        uint64_t thread_hits, shared_hits;
+        uint64_t frees_to_system; // didn't fit in the caches
+        uint64_t cached_bytes; // in all of the caches right now
+        Stats() : allocations(0), thread_hits(0), shared_hits(0), frees_to_system(0),
+                  cached_bytes(0) { }
+    };
+    static Stats getStats();
+};
+
+} // namespace dataseries
+
+#endif
@@ -12,6 +12,8 @@
 #ifndef DATASERIES_BYTEFIELD_HPP
 #define DATASERIES_BYTEFIELD_HPP
 
+#include <DataSeries/FixedField.hpp>
+
 /** \brief Accessor for byte fields
  */
 class ByteField : public dataseries::detail::SimpleFixedField<uint8_t> {
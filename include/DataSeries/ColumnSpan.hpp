@@ -0,0 +1,129 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    A typed view of one fixed field across all the rows of an extent
+*/
+
+#ifndef DATASERIES_COLUMNSPAN_HPP
+#define DATASERIES_COLUMNSPAN_HPP
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include <vector>
+
+namespace dataseries {
+
+/** \brief The type ColumnSpan<T>::sum() adds into: int64_t for the
+    integer fields, so sums of bytes or int32s don't overflow, and double
+    for double. */
+template<typename T> struct ColumnSumType {
+    typedef int64_t type;
+};
+
+template<> struct ColumnSumType<double> {
+    typedef double type;
+};
+
+/** \brief The values of one fixed field in every row of an extent.
+
+    Returned by the column() function of Int32Field, Int64Field,
+    DoubleField and ByteField.  The values are read straight out of the
+    extent's records, stride bytes apart, with no virtual calls, series
+    position or null checks in between, so a loop over a span is as
+    tight as the compiler can make it:
+    \code
+    ColumnSpan<int64_t> bytes(bytes_field.column(extent));
+    int64_t total = 0;
+    for (size_t i = 0; i < bytes.size(); ++i) {
+        total += bytes[i];
+    }
+    \endcode
+    operator[] doesn't look at the null flag, and the value stored for a
+    null row is whatever was last set, so for nullable fields use
+    isNull() or nullBitmap() to skip them.  The span points into the
+    extent, so it is only valid while the extent is alive and its
+    records aren't added to. */
+template<typename T> class ColumnSpan {
+  public:
+    ColumnSpan() : base(NULL), stride_bytes(0), nrows(0), null_base(NULL), null_mask(0) { }
+
+    /** null_base points at the byte with the null flag in the first row,
+        and null_mask says which bit it is; null_mask is 0 for fields that
+        can't be null. */
+    ColumnSpan(const uint8_t *base, size_t stride_bytes, size_t nrows,
+               const uint8_t *null_base, uint8_t null_mask)
+        : base(base), stride_bytes(stride_bytes), nrows(nrows),
+          null_base(null_base), null_mask(null_mask) { }
+
+    size_t size() const { return nrows; }
+    bool empty() const { return nrows == 0; }
+
+    /** Bytes from one value to the next; equal to sizeof(T) if the
+        values are contiguous. */
+    size_t stride() const { return stride_bytes; }
+    bool dense() const { return stride_bytes == sizeof(T); }
+
+    T operator[](size_t row) const {
+        return *reinterpret_cast<const T *>(base + row * stride_bytes);
+    }
+
+    bool nullable() const { return null_mask != 0; }
+
+    bool isNull(size_t row) const {
+        return (null_base[row * stride_bytes] & null_mask) != 0;
+    }
+
+    /** Sets bitmap to one bit per row, bit (row % 64) of word (row / 64),
+        set if the row is null; all 0 if the field isn't nullable.  Words
+        that are 0 mean 64 rows in a row can be used without checking. */
+    void nullBitmap(std::vector<uint64_t> &bitmap) const {
+        bitmap.assign((nrows + 63) / 64, 0);
+        if (null_mask == 0) {
+            return;
+        }
+        const uint8_t *pos = null_base;
+        for (size_t row = 0; row < nrows; ++row, pos += stride_bytes) {
+            if (*pos & null_mask) {
+                bitmap[row / 64] |= static_cast<uint64_t>(1) << (row % 64);
+            }
+        }
+    }
+
+    /** Returns the sum of the non-null values, in a wider type for the
+        narrow fields; see ColumnSumType. */
+    typename ColumnSumType<T>::type sum() const {
+        typedef typename ColumnSumType<T>::type Sum;
+        Sum ret = 0;
+        const uint8_t *pos = base;
+        if (null_mask == 0) {
+            for (size_t row = 0; row < nrows; ++row, pos += stride_bytes) {
+                ret += *reinterpret_cast<const T *>(pos);
+            }
+        } else {
+            const uint8_t *null_pos = null_base;
+            for (size_t row = 0; row < nrows; ++row, pos += stride_bytes,
+                     null_pos += stride_bytes) {
+                // no branch, so the loop stays straight-line
+                Sum v = *reinterpret_cast<const T *>(pos);
+                ret += (*null_pos & null_mask) ? 0 : v;
+            }
+        }
+        return ret;
+    }
+
+  private:
+    const uint8_t *base;
+    size_t stride_bytes, nrows;
+    const uint8_t *null_base;
+    uint8_t null_mask;
+};
+
+} // namespace dataseries
+
+#endif
@@ -89,6 +89,15 @@ class DSExpr : boost::noncopyable {
   public:
     typedef std::vector<DSExpr *> List;
 
+    /// A range [min, max] that a field has to be in for an expression to be true.
+    struct FieldRange {
+        std::string field;
+        double min, max;
+        FieldRange(const std::string &field, double min, double max)
+            : field(field), min(min), max(max) { }
+    };
+    typedef std::vector<FieldRange> FieldRanges;
+
     virtual ~DSExpr() {}
 
     // t_Numeric is double or int64 or bool
@@ -103,6 +112,12 @@ class DSExpr : boost::noncopyable {
 
     virtual void dump(std::ostream &) = 0;
 
+    /// Append the ranges that fields have to be in for the expression to be true.  Only
+    /// comparisons between a field and a numeric constant, and conjunctions (&&) of them, imply
+    /// ranges; anything else is ignored, so the ranges may be looser than the expression.  A
+    /// null value compares as its field's default, so it may be outside the ranges.
+    virtual void getImpliedRanges(FieldRanges &ranges) { }
+
     /// Make an expression over a single series.
     static DSExpr *make(ExtentSeries &series, const std::string &expr_string) {
         boost::scoped_ptr<DSExprParser> parser(DSExprParser::MakeDefaultParser());
@@ -118,6 +133,10 @@ class DSExpr : boost::noncopyable {
         return parser->parse(field_name_to_selector, expr_string);
     }
 
+    /// Get the ranges implied by an expression, as for getImpliedRanges, without needing the
+    /// types of the fields; e.g. to skip the extents that can not match before reading them.
+    static FieldRanges impliedRanges(const std::string &expr_string);
+
     /// Get the current usage description for expressions.
     static std::string usage() {
         boost::scoped_ptr<DSExprParser> parser(DSExprParser::MakeDefaultParser());
@@ -12,12 +12,23 @@
     Class for writing DataSeries files.
 */
 
+#include <map>
+
 #include <Lintel/Deque.hpp>
+#include <Lintel/HashMap.hpp>
 #include <Lintel/HashUnique.hpp>
 #include <Lintel/PThread.hpp>
 
+#include <DataSeries/BloomFilter.hpp>
 #include <DataSeries/ExtentField.hpp>
 #include <DataSeries/IExtentSink.hpp>
+#include <DataSeries/TaskPool.hpp>
+#include <DataSeries/ZoneMap.hpp>
+
+namespace dataseries {
+    class OutputFile;
+    template<typename T> class SequencedRing;
+}
 
 /** \brief Writes Extents to a DataSeries file.
  */
@@ -63,7 +74,9 @@ class DataSeriesSink : public dataseries::IExtentSink {
     ~DataSeriesSink();
 
     typedef boost::function<void (off64_t, Extent &)> ExtentWriteCallback;
-    /** Sets a callback function for when extents are written out. */
+    /** Sets a callback function for when extents are written out.  It
+        is not called for the zone map and Bloom filter extents that
+        DSv2 files store before the index. */
     void setExtentWriteCallback(const ExtentWriteCallback &callback);
 
     /** Opens a closed data series file with the specified filename */
@@ -100,7 +113,7 @@ class DataSeriesSink : public dataseries::IExtentSink {
         If another thread is writing extents at the same time, this could
         wait forever. */
     void flushPending() {
-        worker_info.flushPending(mutex);
+        worker_info.waitForProgress(true);
     }
 
     /** See dataseries::IExtentSink documentation */
@@ -112,12 +125,14 @@ class DataSeriesSink : public dataseries::IExtentSink {
     static void verifyTail(ExtentType::byte *data, bool need_bitflip,
                            const std::string &filename);
     
-    /** Sets the number of threads that each @c DataSeriesSink uses to
-        compress Extents.
-        compressor_count == -1 ==> use # cpus or limit set by MAX_THREAD_COUNT (see DataSeriesSink.cpp)
+    /** Sets how many Extents each @c DataSeriesSink compresses at once;
+        the compression is done by the shared dataseries::TaskPool, so this
+        limits a sink's share of the pool rather than starting threads.
+        compressor_count == -1 ==> up to one less than the number of threads
+                                   in the pool (at least one)
         compressor_count == 0 ==> no threading;
         Only affects \link DataSeriesSink DataSeriesSinks \endlink
-        created after a call. */
+        opened after a call. */
     static void setCompressorCount(int compressor_count = -1);
 
     const std::string &getFilename() const {
@@ -125,95 +140,176 @@ class DataSeriesSink : public dataseries::IExtentSink {
     }
 
     void setMaxBytesInProgress(size_t nbytes) {
-        worker_info.setMaxBytesInProgress(mutex, nbytes);
+        worker_info.setMaxBytesInProgress(nbytes);
+    }
+
+    /** Sets the size of the blocks that the fixed and variable data of
+        large extents are split into before compression; 0 (the default)
+        compresses each of them as a single block.  Splitting lets one
+        large extent be compressed and uncompressed by multiple threads.
+        Should be called before any extents are written. */
+    void setCompressionBlockSize(uint32_t block_size) {
+        compression_block_size = block_size;
+    }
+
+    /** Sets the policy used to choose between the compression
+        algorithms; by default the smallest result is kept.  For timed
+        policies, all the algorithms are tried on one out of every
+        policy.sample_interval extents of each type, and the others are
+        compressed with the algorithms that trial picked.  Should be
+        called before any extents are written. */
+    void setCompressionPolicy(const Extent::CompressionPolicy &policy) {
+        INVARIANT(policy.sample_interval > 0, "compression policy sample interval must be > 0");
+        compression_policy = policy;
     }
 
+    /** Compresses extents of @param type with zstd using @param
+        dictionary, e.g. from Extent::trainCompressionDictionary.  The
+        dictionaries are stored in the file right after the extent type
+        library, so this has to be called before writeExtentLibrary.  Only
+        has an effect if zstd is one of the compression modes. */
+    void setCompressionDictionary(const ExtentType::Ptr type, const std::string &dictionary);
+
+    /** Sets the file format written: 1 (the default, unless the
+        environment variable DATASERIES_FORMAT_VERSION is set to 2) uses
+        the adler32 and bobJenkinsHash checksums that all readers
+        expect, and leaves out the compression algorithms that readers
+        older than DSv2 lack (see Extent::compress_v1_modes); 2
+        checksums extents with CRC32C and stores the zone map of every
+        extent (see dataseries::ZoneMap) and the Bloom filters of its
+        opt_bloom_filter fields (see dataseries::BloomFilters), but can
+        only be read by this version of DataSeries or later.  Has to be
+        called before writeExtentLibrary. */
+    void setFormatVersion(uint32_t version);
+    uint32_t getFormatVersion() const {
+        return format_version;
+    }
+
+    /** Writes the file with direct I/O, which bypasses the page cache, so
+        that writing a lot of data doesn't evict what is about to be
+        analyzed; the file contents are the same.  The default is false,
+        unless the environment variable DATASERIES_DIRECT_IO is set to 1.
+        The written extents are gathered in large aligned buffers, each
+        written with one O_DIRECT write; DATASERIES_WRITE_ENGINE=pwrite or
+        io_uring chooses how.  Without it, all of the extents ready to be
+        written are written with a single pwritev.  Has to be called
+        before writeExtentLibrary. */
+    void setDirectIO(bool direct = true);
+
   private:
     struct ToCompress {
         Extent::Ptr extent;
         Stats *to_update;
-        bool in_progress;
         uint32_t checksum;
         Extent::ByteArray compressed;
-        ToCompress(Extent::Ptr e, Stats *_to_update)
-                : extent(e), to_update(_to_update), in_progress(false), checksum(0) 
+        dataseries::ZoneMap::ExtentZones zones;
+        dataseries::BloomFilters::ExtentFilters bloom_filters;
+        // a summary of the other extents, which the callback doesn't see
+        bool summary;
+        ToCompress(Extent::Ptr e, Stats *_to_update, bool summary = false)
+                : extent(e), to_update(_to_update), checksum(0), summary(summary)
         { }
         void wipeExtent() {
             Extent tmp(extent->getTypePtr());
             tmp.swap(*extent);
         }
-        bool readyToWrite() {
-            return compressed.size() > 0 && !in_progress;
-        }
     };
 
-    // Structure for shared information among all workers.
+    // The algorithms picked by the last trial of the compression policy
+    // for one extent type.
+    struct PolicyChoice {
+        bool have_choice;
+        uint32_t extents_until_trial;
+        uint32_t fixed_modes, variable_modes;
+        PolicyChoice() : have_choice(false), extents_until_trial(0),
+                         fixed_modes(0), variable_modes(0) { }
+    };
+
+    // Structure for shared information among all workers.  Producers push
+    // extents onto pending_work, compress tasks claim and finish them, and
+    // the writer takes them off the front in order, none of them holding
+    // the mutex; the counters here are updated with atomics.
     struct WorkerInfo {
-        // protected by the standard mutex, users should have separate access to it.
-        bool keep_going;
+        bool keep_going; // written under the mutex, read without it
         size_t bytes_in_progress, max_bytes_in_progress;
-        Deque<ToCompress *> pending_work;
-
-        std::vector<PThread *> compressors;
+        // created by startThreads, deleted by close; the writer pops items
+        // with the mutex held, so they stay valid for removeStatsUpdate.
+        dataseries::SequencedRing<ToCompress> *pending_work;
+
+        // NULL if not threading; compressing counts the running compress
+        // tasks, each of which compresses extents until none are left, at
+        // most max_compressing.
+        dataseries::TaskPool::Queue *compress_queue;
+        unsigned compressing, max_compressing;
         PThread *writer;
-        PThreadCond available_queue_cond, available_work_cond, available_write_cond;
         WorkerInfo(size_t max_bytes_in_progress)
         : keep_going(false), bytes_in_progress(0), max_bytes_in_progress(max_bytes_in_progress),
-          pending_work(), compressors(), writer(), available_queue_cond(),
-          available_work_cond(), available_write_cond()
+          pending_work(NULL), compress_queue(NULL), compressing(0), max_compressing(0),
+          writer()
         { }
 
         bool canQueueWork() {
-            return bytes_in_progress < max_bytes_in_progress &&
-                    pending_work.size() < 2 * compressors.size();
+            return __atomic_load_n(&bytes_in_progress, __ATOMIC_SEQ_CST)
+                < __atomic_load_n(&max_bytes_in_progress, __ATOMIC_SEQ_CST);
         }
         void startThreads(PThreadScopedLock &lock, DataSeriesSink *sink);
         void stopThreads(PThreadScopedLock &lock);
-        void setMaxBytesInProgress(PThreadMutex &mutex, size_t nbytes);
-        void flushPending(PThreadMutex &mutex);
-        bool frontReadyToWrite() { // Assume lock is held
-            return pending_work.empty() ? false : pending_work.front()->readyToWrite();
-        }
+        void setMaxBytesInProgress(size_t nbytes);
+        void waitForProgress(bool flush);
+        bool reserveCompressor();
 
         bool isQuiesced() {
-            return !keep_going && bytes_in_progress == 0 && pending_work.empty()
-                    && compressors.empty() && writer == NULL;
+            return !keep_going && bytes_in_progress == 0 && pending_work == NULL
+                    && compress_queue == NULL && writer == NULL;
         }
     };
 
     // Structure for the writer.
     struct WriterInfo {
-        int fd;
+        dataseries::OutputFile *file;
         bool wrote_library, in_callback;
         off64_t cur_offset; // set to -1 when sink is closed
         uint32_t chained_checksum; 
         ExtentSeries index_series;
         Int64Field field_extentOffset;
         Variable32Field field_extentType;
+        // the zones of the extents written so far, if any
+        ExtentSeries zone_series;
+        // likewise the Bloom filters
+        ExtentSeries bloom_filter_series;
         ExtentWriteCallback extent_write_callback;
 
         WriterInfo()
-                : fd(-1), wrote_library(false), in_callback(false), cur_offset(-1), chained_checksum(0),
+                : file(NULL), wrote_library(false), in_callback(false), cur_offset(-1), chained_checksum(0),
                   index_series(ExtentType::getDataSeriesIndexTypeV0Ptr()), 
                   field_extentOffset(index_series,"offset"),
                   field_extentType(index_series,"extenttype"), 
+                  zone_series(ExtentType::getDataSeriesZoneMapTypePtr()),
+                  bloom_filter_series(ExtentType::getDataSeriesBloomFilterTypePtr()),
                   extent_write_callback()
         { }
         void writeOutPending(PThreadScopedLock &lock, WorkerInfo &worker_info);
         void checkedWrite(const void *buf, int bufsize);
         bool isQuiesced() {
-            return fd == -1 && wrote_library == false && cur_offset == -1
-                    && !index_series.hasExtent() && chained_checksum == 0;
+            return file == NULL && wrote_library == false && cur_offset == -1
+                    && !index_series.hasExtent() && !zone_series.hasExtent()
+                    && !bloom_filter_series.hasExtent() && chained_checksum == 0;
         }
     };
 
     void checkedWrite(const void *buf, int bufsize) {
         writer_info.checkedWrite(buf, bufsize);
     }
+    void writeFileType();
     void writeExtentType(ExtentType &et);
 
-    void queueWriteExtent(Extent::Ptr e, Stats *to_update);
-    void lockedProcessToCompress(PThreadScopedLock &lock, ToCompress *work);
+    void queueWriteExtent(Extent::Ptr e, Stats *to_update, bool wait_for_room = true);
+    void queueDictionaryEntries();
+    size_t lockedCompressAndWrite(PThreadScopedLock &lock, ToCompress *work);
+    void processToCompress(ToCompress *work);
+    void lockedWriteSummary(PThreadScopedLock &lock, ExtentSeries &series);
+    void startCompressing();
+    void compressTask();
 
     static int compressor_count;
 
@@ -223,13 +319,25 @@ class DataSeriesSink : public dataseries::IExtentSink {
                lintel::SharedPointerEqual<const ExtentType> > valid_types;
     const int compression_modes;
     const int compression_level;
+    uint32_t compression_block_size;
+    Extent::CompressionPolicy compression_policy;
+    HashMap<std::string, PolicyChoice> policy_choices; // protected by mutex
+    // type name to dictionary; fixed once the library is written
+    std::map<std::string, std::string> dictionaries;
+    HashMap<std::string, uint32_t> dictionary_ids;
+    uint32_t format_version;
+    bool direct_io;
+    // dictionaries of the pack_dictionary fields of the file being
+    // written; field_dictionary_mutex keeps the dictionary extents with
+    // new entries queued in the order the entries were added, and ahead
+    // of the extents that use them.
+    PThreadMutex field_dictionary_mutex;
+    dataseries::FieldDictionaries::Ptr field_dictionaries;
 
     WriterInfo writer_info;
     WorkerInfo worker_info;
                                    
     std::string filename;
-    friend class DataSeriesSinkPThreadCompressor;
-    void compressorThread();
     friend class DataSeriesSinkPThreadWriter;
     void writerThread();
 };
@@ -12,7 +12,9 @@
 #ifndef DATASERIES_SOURCE_H
 #define DATASERIES_SOURCE_H
 
+#include <DataSeries/BloomFilter.hpp>
 #include <DataSeries/Extent.hpp>
+#include <DataSeries/ZoneMap.hpp>
 
 /** \brief Reads Extents from a DataSeries file.
  *
@@ -66,9 +68,32 @@ class DataSeriesSource {
         to the size of the file.
         - isactive() */
     bool preadCompressed(off64_t &offset, Extent::ByteArray &bytes) {
-        return Extent::preadExtent(fd,offset, bytes, need_bitflip);
+        if (use_mmap) {
+            return Extent::mmapExtent(fd, offset, bytes, need_bitflip);
+        } else {
+            return Extent::preadExtent(fd,offset, bytes, need_bitflip);
+        }
     }
 
+    /** If true, extents that were stored uncompressed (e.g. written with
+        --compress none) are mapped rather than read, and unpacking them
+        leaves their fixed and variable data in the mapping rather than
+        copying it, which saves two copies of each extent.  The mapping
+        is private, so modifying the extent copies the modified pages
+        rather than changing the file; decoding relative packing or
+        flipping the byte order modifies the extent.  Mapping costs
+        system calls and page faults of its own, so it is a win for
+        large extents.  Defaults to true iff the environment variable
+        DATASERIES_READ_MMAP is set to 1. */
+    void setUseMmap(bool use) { use_mmap = use; }
+    bool getUseMmap() const { return use_mmap; }
+
+    /** Returns the size of the packed extent at offset, i.e. the distance to
+        the next extent in the index, or 0 if the index was not read or does
+        not have an extent at offset.  Lets readers get an extent with one
+        read rather than reading its header first. */
+    uint32_t extentSize(off64_t offset) const;
+
     /** Returns true if the file is currently open. */
     bool isactive() { return fd >= 0; }
 
@@ -112,10 +137,35 @@ class DataSeriesSource {
 
     /** get the Filename associated with this file */
     const std::string &getFilename() { return filename; }
+
+    /** Returns the dictionaries of the pack_dictionary fields in the
+        file, which extents unpacked from preadCompressed() data need
+        set as their Extent::dictionaries.  If the index was read, all
+        of the entries were loaded when the file was opened; otherwise
+        they are added as readExtent() passes the extents storing them. */
+    const dataseries::FieldDictionaries::Ptr &getFieldDictionaries() {
+        return field_dictionaries;
+    }
+    /** Returns the zone maps of the extents in the file, by their
+        offsets; empty if the index was not read or the file has none,
+        as files written as DSv1 don't. */
+    const dataseries::ZoneMap &getZoneMap() const {
+        return zone_map;
+    }
+    /** Returns the Bloom filters of the opt_bloom_filter fields of the
+        extents in the file, by their offsets; empty if the index was
+        not read or the file has none. */
+    const dataseries::BloomFilters &getBloomFilters() const {
+        return bloom_filters;
+    }
   private:
     void checkHeader();
     void readTypeExtent();
+    void readCompressionDictionaries();
     void readTailIndex();
+    void readFieldDictionaries();
+    void readSummaries();
+    void addFieldDictionaryEntries(const Extent::Ptr &e);
 
     ExtentTypeLibrary mylibrary;
 
@@ -123,7 +173,13 @@ class DataSeriesSource {
     typedef ExtentType::byte byte;
     int fd;
     off64_t cur_offset;
-    bool need_bitflip, read_index, check_tail;
+    bool need_bitflip, read_index, check_tail, use_mmap;
+    // sorted offsets of the extents in the index, followed by the offset
+    // of the index extent
+    std::vector<off64_t> extent_offsets;
+    dataseries::FieldDictionaries::Ptr field_dictionaries;
+    dataseries::ZoneMap zone_map;
+    dataseries::BloomFilters bloom_filters;
     int64_t mtime_nanosec;
 };
 
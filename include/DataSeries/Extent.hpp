@@ -57,6 +57,7 @@ extern "C" {
 #include <Lintel/TypeCompat.hpp>
 
 #include <DataSeries/ExtentType.hpp>
+#include <DataSeries/StringDictionary.hpp>
 
 
 // Defined and explained in DataSeriesSink.cpp
@@ -90,6 +91,14 @@ class Extent : boost::noncopyable, public boost::enable_shared_from_this<Extent>
     // arrays have to be contiguous, so we could switch back at some point.
     class ByteArray {
       public:
+        /** Something that keeps memory that a ByteArray borrows valid,
+            e.g. a mapping of part of a file; see borrow(). */
+        class Owner : boost::noncopyable {
+          public:
+            virtual ~Owner();
+        };
+        typedef boost::shared_ptr<Owner> OwnerPtr;
+
         ByteArray() { beginV = endV = maxV = NULL; }
         ~ByteArray();
         size_t size() const { return endV - beginV; }
@@ -114,16 +123,28 @@ class Extent : boost::noncopyable, public boost::enable_shared_from_this<Extent>
         byte *begin(size_t offset) const { return beginV + offset; }
         byte *end() const { return endV; };
         byte &operator[] (size_t offset) const { return *(begin(offset)); }
+
+        /** Refer to the size bytes at begin, which stay valid as long as
+            owner does, rather than to memory of our own.  Writes go
+            directly to the borrowed memory; growing the array first
+            copies it into memory of our own. */
+        void borrow(byte *begin, size_t size, const OwnerPtr &owner);
+        /** Returns the owner of the memory we borrowed, or NULL if we
+            own our memory. */
+        const OwnerPtr &getOwner() const { return owner; }
     
         void swap(ByteArray &with) {
             swap(beginV,with.beginV);
             swap(endV,with.endV);
             swap(maxV,with.maxV);
+            owner.swap(with.owner);
         }
       
         typedef byte * iterator;
       
-        // glibc prefers to use mmap to allocate large memory chunks; we 
+        // Our memory comes from dataseries::BufferPool, which reuses freed
+        // buffers of up to 64MiB.  For the ones it doesn't keep, glibc
+        // prefers to use mmap to allocate large memory chunks; we 
         // allocate and de-allocate those fairly regularly; so we increase
         // the threshold.  This function is automatically called once when
         // we have to resize a bytearray, if you disagree with the defaults,
@@ -140,7 +161,10 @@ class Extent : boost::noncopyable, public boost::enable_shared_from_this<Extent>
         }
       
         void copyResize(size_t newsize, bool zero_it);
+        // Frees our memory or drops the borrowed memory
+        void release();
         byte *beginV, *endV, *maxV;
+        OwnerPtr owner;
     };
   
     /// \cond INTERNAL_ONLY
@@ -224,12 +248,32 @@ class Extent : boost::noncopyable, public boost::enable_shared_from_this<Extent>
     static const Extent::byte compress_mode_snappy = 5;
     static const Extent::byte compress_mode_lz4 = 6;
     static const Extent::byte compress_mode_lz4hc = 7;
+    static const Extent::byte compress_mode_zstd = 8;
+    /** Or'd into the compression mode byte of the fixed or variable data
+        when it was split into independently compressed blocks; the low
+        bits then hold the mode used by the most blocks. */
+    static const Extent::byte compress_mode_chunked = 0x80;
+    /** The compression mode byte of the fixed data of a type with
+        column groups; the groups are compressed separately, each with
+        its own mode, and the low bits hold the mode used by the most
+        groups. */
+    static const Extent::byte compress_mode_grouped = 0x40;
     /// \endcond
 
+    /** The checksums stored in a packed extent; the header byte after
+        the type name length says which were used, so unpackData reads
+        either.  checksum_v1 is adler32 over the packed extent and
+        bobJenkinsHash over the partly unpacked data, as in DSv1 files.
+        checksum_crc32c uses CRC32C for both, with the sse4.2 crc32
+        instruction if the cpu has it; DataSeriesSink writes it in DSv2
+        files. */
+    static const Extent::byte checksum_v1 = 0;
+    static const Extent::byte checksum_crc32c = 1;
+
     // Should be equal to the number of constants compress_mode_{name}
     // specified above.  Careful: because of the way the compression bit flags
     // are stored in ints, this cannot ever be greater than 16.
-    static const int num_comp_algs = 8;
+    static const int num_comp_algs = 9;
 
     struct compression_alg 
     {
@@ -242,8 +286,74 @@ class Extent : boost::noncopyable, public boost::enable_shared_from_this<Extent>
     /* This array contains the available compression algorithms */
     static compression_alg compression_algs[];
 
-    /* Compress_all is set to the bitwise or of all the compress flags in compression_algs */
-    static const int compress_all = ~( INT_MIN >> ( sizeof(INT_MIN)*8 - num_comp_algs ) );
+    /* Compress_all is set to the bitwise or of all the compress flags in compression_algs,
+       except zstd, which has to be enabled by name (e.g. --enable zstd) */
+    static const int compress_all = ~( INT_MIN >> ( sizeof(INT_MIN)*8 - num_comp_algs ) )
+        & ~(1 << (compress_mode_zstd - 1));
+
+    /** The algorithms that readers older than zstd support; DataSeriesSink
+        only uses these when writing DSv1 files. */
+    static const int compress_v1_modes = ~( INT_MIN >> ( sizeof(INT_MIN)*8 - compress_mode_zstd ) );
+
+    /** \brief Chooses between the candidate compressed versions of data.
+
+        The default policy keeps the smallest candidate.  A policy with a
+        non-zero decompress_weight also times decompressing every
+        candidate (including leaving the data uncompressed) and keeps the
+        one minimizing decompress_weight * seconds + size_weight * bytes,
+        so for example a 3% smaller bz2 result loses to lzf if it takes
+        much longer to decompress.  Timed trials roughly double the cost
+        of packing, so DataSeriesSink only runs them on a sample of the
+        extents of each type. */
+    struct CompressionPolicy {
+        /// cost of one second of decompression
+        double decompress_weight;
+        /// cost of one compressed byte
+        double size_weight;
+        /// DataSeriesSink tries all the algorithms on one out of every
+        /// sample_interval extents of each type, and reuses the
+        /// algorithms chosen for the fixed and variable data of the
+        /// most recent trial for the others.
+        uint32_t sample_interval;
+        /// If true, fixed_modes and variable_modes replace the
+        /// compression_modes passed to packData for the fixed and
+        /// variable data respectively, and the smallest of them is used
+        /// without timing any decompression.
+        bool use_section_modes;
+        uint32_t fixed_modes, variable_modes;
+
+        CompressionPolicy(double decompress_weight = 0, double size_weight = 1,
+                          uint32_t sample_interval = 16)
+            : decompress_weight(decompress_weight), size_weight(size_weight),
+              sample_interval(sample_interval), use_section_modes(false),
+              fixed_modes(0), variable_modes(0) { }
+
+        bool timed() const { return decompress_weight > 0; }
+
+        /** Returns the policy named by @param name, one of smallest (the
+            default), balanced, read-optimized, or cost:F1,F2 for a
+            decompress_weight of F1 per second and a size_weight of F2 per
+            byte.  Aborts on an unknown name. */
+        static CompressionPolicy fromName(const std::string &name);
+    };
+
+    /** Makes a zstd dictionary, e.g. from Extent::trainCompressionDictionary,
+        available for packing and unpacking.  Extents compressed with a
+        dictionary record its id, so the dictionary has to be registered
+        before they can be unpacked; DataSeriesSource does this for the
+        dictionaries stored in a file.
+
+        \return the dictionary id to pass to packData, or 0 if DataSeries
+        was built without zstd. */
+    static uint32_t registerCompressionDictionary(const std::string &dictionary);
+
+    /** Trains a zstd dictionary of at most max_size bytes on the packed
+        but uncompressed fixed and variable data of the sample extents,
+        which should all be of the same type.  Returns an empty string if
+        there was not enough sample data, or DataSeries was built without
+        zstd. */
+    static std::string trainCompressionDictionary(const std::vector<Extent::Ptr> &samples,
+                                                  size_t max_size);
 
 
     /** \defgroup Extent_compress Extent::compress
@@ -274,6 +384,22 @@ class Extent : boost::noncopyable, public boost::enable_shared_from_this<Extent>
         the pre-compression size in bytes of the fixed size records.
         \arg variable_packed If variable_packed is not null, *variable_packed
         will recieve the pre-compression size of the string pool.
+
+        \arg compression_block_size If non-zero, fixed or variable data larger
+        than this many bytes is split into blocks of this size which are
+        compressed independently (and in parallel), so that unpacking can
+        also be done in parallel.  Readers older than this option can not
+        read such extents.
+
+        \arg policy If not null, selects between the compressed
+        candidates instead of keeping the smallest one; see
+        CompressionPolicy.
+
+        \arg dictionary_id If not 0, zstd compresses with this dictionary
+        from registerCompressionDictionary.
+
+        \arg checksum_kind checksum_crc32c or checksum_v1; readers older
+        than DSv2 can only check checksum_v1.
     
         \return a "checksum" calculated from the underlying checksums in the packed extent */
     uint32_t packData(Extent::ByteArray &into, 
@@ -281,7 +407,11 @@ class Extent : boost::noncopyable, public boost::enable_shared_from_this<Extent>
                       uint32_t compression_level = 9,
                       uint32_t *header_packed = NULL, 
                       uint32_t *fixed_packed = NULL, 
-                      uint32_t *variable_packed = NULL); 
+                      uint32_t *variable_packed = NULL,
+                      uint32_t compression_block_size = 0,
+                      const CompressionPolicy *policy = NULL,
+                      uint32_t dictionary_id = 0,
+                      Extent::byte checksum_kind = checksum_crc32c);
 
     /** Loads an Extent from the external representation.
 
@@ -291,9 +421,18 @@ class Extent : boost::noncopyable, public boost::enable_shared_from_this<Extent>
         Preconditions:
         - The type of the data must be the type of this Extent.
 
+        \arg columns If not null, only the parts of the extent needed for
+        these columns are uncompressed: the column groups that are not
+        selected read as 0 (or, for fields relative to a selected field,
+        as garbage), and if the variable data is not selected every
+        variable32 field is empty.  The unpacked checksum can't be
+        verified for such a partial extent, and it should not be written
+        out again.
+
         Note you can't unpack the same data twice, it may modify the
         input data */
-    void unpackData(Extent::ByteArray &from, bool need_bitflip);
+    void unpackData(Extent::ByteArray &from, bool need_bitflip,
+                    const ExtentType::ColumnSelection *columns = NULL);
 
     /** Returns true if position is inside the fixed data for this extent, otherwise false */
     bool insideExtentFixed(byte *position) const {
@@ -302,7 +441,8 @@ class Extent : boost::noncopyable, public boost::enable_shared_from_this<Extent>
 
     /** Returns the total size in bytes that an Extent created
         using @param from will need.  (This will be the result of size() after
-        unpacking.)
+        unpacking, plus the values added back to the variable data for
+        pack_dictionary fields.)
 
         \param from The byte array to use as input
         \param need_bitflip Do we need to flip the byte order when unpacking?
@@ -350,6 +490,12 @@ class Extent : boost::noncopyable, public boost::enable_shared_from_this<Extent>
                         Extent::ByteArray &into, int compression_level);
     static bool packLZ4HC(byte *input, int32 inputsize,
                           Extent::ByteArray &into, int compression_level);
+    static bool packZstd(byte *input, int32 inputsize,
+                         Extent::ByteArray &into, int compression_level);
+    // not in compression_algs[]; called by compressBytes when compressing
+    // zstd with a dictionary
+    static bool packZstdDictionary(byte *input, int32 inputsize, Extent::ByteArray &into,
+                                   int compression_level, uint32_t dictionary_id);
 
 
     // The unpack functions return true iff uncompression completed successfully
@@ -366,6 +512,8 @@ class Extent : boost::noncopyable, public boost::enable_shared_from_this<Extent>
                               int32 input_size, int32 &output_size );
     static bool unpackLZ4( byte* output, byte *input, 
                            int32 input_size, int32 &output_size );
+    static bool unpackZstd( byte* output, byte *input, 
+                            int32 input_size, int32 &output_size );
 
 
     static inline uint32_t flip4bytes(uint32 v) {
@@ -399,6 +547,13 @@ class Extent : boost::noncopyable, public boost::enable_shared_from_this<Extent>
     // updates offset to the end of the extent
     static bool preadExtent(int fd, off64_t &offset, Extent::ByteArray &into, bool need_bitflip);
 
+    // same as preadExtent, but if the extent is stored uncompressed,
+    // into borrows a private mapping of it rather than reading it.
+    // unpackData then leaves the fixed and variable data in the
+    // mapping; modifying them copies the modified pages rather than
+    // changing the file.
+    static bool mmapExtent(int fd, off64_t &offset, Extent::ByteArray &into, bool need_bitflip);
+
     // returns true if it read amount bytes, returns false if it read
     // 0 bytes and eof_ok; aborts otherwise
     static bool checkedPread(int fd, off64_t offset, byte *into, int amount, 
@@ -438,23 +593,74 @@ class Extent : boost::noncopyable, public boost::enable_shared_from_this<Extent>
     /// extents this will be -1.
     int64_t extent_source_offset;
 
+    /// The dictionaries of the file for the codes of the pack_dictionary
+    /// fields.  Set by DataSeriesSink before it packs the extent, and by
+    /// the readers before they unpack it; packData() only keeps codes
+    /// (rather than values) if this is set.
+    dataseries::FieldDictionaries::Ptr dictionaries;
+
     // This function is here to verify that we got the right
     // flip4bytes when we compiled DataSeries, it's used by
     // DataSeries/src/test.C
     static void run_flip4bytes(uint32_t *buf, unsigned buflen);
 
+    /** Sets the codes of the pack_dictionary fields of every record from
+        the dictionaries, adding the values that are not in them yet, and
+        makes them the dictionaries of the extent. */
+    void encodeDictionaryFields(const dataseries::FieldDictionaries::Ptr &with);
+
   private:
+    void decodeDictionaryFields();
+
     // you are responsible for deleting the return buffer
     static Extent::ByteArray *compressBytes(byte *input, int32 input_size,
                                             int compression_modes,
-                                            int compression_level, byte *mode);
+                                            int compression_level, byte *mode,
+                                            const CompressionPolicy *policy = NULL,
+                                            uint32_t dictionary_id = 0);
 
     static int32 uncompressBytes(byte *into, byte *from,
                                  byte compression_mode, int32 intosize,
                                  int32 fromsize);
 
+    // you are responsible for deleting the return buffer
+    static Extent::ByteArray *compressBytesChunked(byte *input, int32 input_size,
+                                                   int compression_modes,
+                                                   int compression_level,
+                                                   uint32_t block_size, byte *mode,
+                                                   const CompressionPolicy *policy,
+                                                   uint32_t dictionary_id);
+
+    static int32 uncompressBytesChunked(byte *into, byte *from, int32 intosize,
+                                        int32 fromsize, bool fix_endianness);
+    static void compressBlock(byte *input, int32 input_size, int compression_modes,
+                              int compression_level, const CompressionPolicy *policy,
+                              uint32_t dictionary_id, Extent::ByteArray **into, byte *mode);
+    static void uncompressBlock(byte *into, byte *from, byte compression_mode,
+                                int32 intosize, int32 fromsize, int32 *outsize);
+    static void compressColumnGroup(byte *input, int32 input_size, int compression_modes,
+                                    int compression_level, uint32_t block_size,
+                                    const CompressionPolicy *policy, uint32_t dictionary_id,
+                                    Extent::ByteArray **into, byte *mode);
+    // you are responsible for deleting the return buffer
+    Extent::ByteArray *compressColumnGroups(const Extent::ByteArray &fixed_coded,
+                                            int compression_modes, int compression_level,
+                                            uint32_t block_size, byte *mode,
+                                            const CompressionPolicy *policy,
+                                            uint32_t dictionary_id);
+    int32 uncompressColumnGroups(byte *from, int32 fromsize, uint32_t nrecords,
+                                 bool fix_endianness, const ExtentType::ColumnSelection *columns,
+                                 bool *partial);
+    void uncompressColumnGroup(uint32_t group, byte *from, int32 fromsize, byte mode,
+                               uint32_t nrecords, bool fix_endianness);
+
     void compactNulls(Extent::ByteArray &fixed_coded);
     void uncompactNulls(Extent::ByteArray &fixed_coded, int32_t &size);
+    void transposeToColumnar(Extent::ByteArray &fixed_coded);
+    void transposeFromColumnar(Extent::ByteArray &fixed_coded);
+    void packEncodedFields(Extent::ByteArray &fixed_coded);
+    void unpackEncodedFields(Extent::ByteArray &fixed_coded, int32_t &size,
+                             uint32_t nrecords, bool fix_endianness);
     friend class ExtentSeries;
     void createRecords(unsigned int nrecords); // will leave iterator pointing at the current record
     void init();
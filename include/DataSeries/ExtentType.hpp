@@ -45,10 +45,13 @@ namespace dataseries {
  <field type="int32" name="input1" pack_relative="input1" />
  <field type="int32" name="input2" pack_relative="input1" />
  <field type="int64" name="int64-1" pack_relative="int64-1" opt_nullable="yes" />
- <field type="int64" name="int64-2" />
+ <field type="int64" name="int64-2" pack_bitwidth="auto" />
  <field type="double" name="double1" pack_scale="1e-6" pack_relative="double1" />
+ <field type="double" name="double2" pack_encoding="xor" />
+ <field type="double" name="double3" pack_group="rare" />
  <field type="variable32" name="var1" pack_unique="yes"/>\n"
  <field type="variable32" name="var2"/>\n"
+ <field type="variable32" name="host" pack_dictionary="yes"/>\n"
  <field type="fixedwidth" name="fw1" size="7" note="experimental" />
  <field type="fixedwidth" name="fw2" size="20" note="experimental" />
  </ExtentType>
@@ -168,6 +171,40 @@ class ExtentType : boost::noncopyable, public boost::enable_shared_from_this<con
         FieldOrderingBigToSmallSepVar32,
     };
 
+    /** \brief Specifies how the fixed records are laid out when packed.
+
+        The in-memory Extent is always stored row-major; this option
+        only changes the order of the bytes handed to the compression
+        algorithms. Storing each column contiguously puts similar
+        values next to each other, which usually compresses better. */
+    enum PackLayout {
+        /** Compress the records in the same order as they are in
+            memory; the default option. */
+        LayoutRowMajor,
+        /** Transpose the records before compression so that each
+            field (and each run of boolean/padding bytes) is stored
+            contiguously for all the records in the extent. */
+        LayoutColumnar
+    };
+
+    /** \brief Specifies a lossless encoding for a double or int64 field.
+
+        The encoded values are stored as a bit stream after the rest of
+        the fixed data, and are then compressed with it; see
+        src/base/PackEncoding.hpp for the formats. */
+    enum PackEncoding {
+        /** Store the values in the records; the default option. */
+        EncodingNone,
+        /** Store each value xor the previous one, leaving out the
+            leading and trailing zero bits; good for slowly changing
+            doubles such as gauges and rates. */
+        EncodingXor,
+        /** Store the change in the difference between successive
+            values in as few bits as fit; good for regularly spaced
+            timestamps and counters. */
+        EncodingDelta2
+    };
+
     /** Returns the type of the Extent that stores the XML descriptions
         of all the ExtentTypes used in a DataSeries file. */
     static const ExtentType::Ptr getDataSeriesXMLTypePtr() {
@@ -183,6 +220,35 @@ class ExtentType : boost::noncopyable, public boost::enable_shared_from_this<con
     static const ExtentType &getDataSeriesIndexTypeV0() FUNC_DEPRECATED {
         return *dataseries_index_type_v0;
     }
+    /** Returns the type of the Extent that stores the zstd compression
+        dictionaries used in a DataSeries file; if present, it
+        immediately follows the type extent. */
+    static const ExtentType::Ptr getDataSeriesCompressionDictionaryTypePtr() {
+        return dataseries_compression_dictionary_type;
+    }
+
+    /** Returns the type of the Extents that store the values of the
+        pack_dictionary fields in a DataSeries file.  Each one holds
+        the entries added since the previous one, and precedes the
+        first extent that uses them. */
+    static const ExtentType::Ptr getDataSeriesStringDictionaryTypePtr() {
+        return dataseries_string_dictionary_type;
+    }
+
+    /** Returns the type of the Extent that stores the zone maps of the
+        extents in a DataSeries file; see dataseries::ZoneMap.  If
+        present, it immediately precedes the index. */
+    static const ExtentType::Ptr getDataSeriesZoneMapTypePtr() {
+        return dataseries_zone_map_type;
+    }
+
+    /** Returns the type of the Extent that stores the Bloom filters of
+        the opt_bloom_filter fields of the extents in a DataSeries file;
+        see dataseries::BloomFilters.  If present, it comes after the
+        zone maps, just before the index. */
+    static const ExtentType::Ptr getDataSeriesBloomFilterTypePtr() {
+        return dataseries_bloom_filter_type;
+    }
 
 
     // we have visible and invisible fields; visible fields are
@@ -257,6 +323,30 @@ class ExtentType : boost::noncopyable, public boost::enable_shared_from_this<con
         int cnum = getColumnNumber(rep, column, false);
         return getUnique(cnum);
     }
+    /** Returns true for a @c variable32 field which has been marked
+        with pack_dictionary="yes".  The values of such a field are
+        replaced in the fixed record by an integer code into a
+        dictionary that is shared by all the extents of a file; see
+        @c Variable32Field::code.
+
+        Preconditions:
+        - The field exists and is a @c variable32 field. */
+    bool getDictionary(const std::string &column) const {
+        int cnum = getColumnNumber(rep, column, false);
+        return getDictionary(cnum);
+    }
+    /** Returns true for a @c variable32, @c int32 or @c int64 field
+        marked with opt_bloom_filter="yes".  DataSeriesSink stores a
+        Bloom filter of the values of such a field in each extent, so
+        that lookups of a few keys can skip the extents that don't have
+        them; see TypeIndexModule::addKeyFilter.
+
+        Preconditions:
+        - The specified field exists. */
+    bool getBloomFilter(const std::string &column) const {
+        int cnum = getColumnNumber(rep, column, false);
+        return getBloomFilter(cnum);
+    }
     /** Returns true if a field is nullable. A nullable field does not have
         to be present in any given record.
 
@@ -280,6 +370,17 @@ class ExtentType : boost::noncopyable, public boost::enable_shared_from_this<con
         int cnum = getColumnNumber(rep, column, false);
         return getDoubleBase(cnum);
     }
+    /** Returns the pack_scale of a @c double field, or 0 if it has none.
+        Packing rounds the values of such a field to multiples of the
+        scale, so they can read back up to half a scale step away from
+        what was written.
+
+        Preconditions:
+        - The specified field exists. */
+    double getPackScale(const std::string &column) const {
+        int cnum = getColumnNumber(rep, column, false);
+        return getPackScale(cnum);
+    }
 
     /** Returns the name of a field at a particular index.
 
@@ -301,10 +402,53 @@ class ExtentType : boost::noncopyable, public boost::enable_shared_from_this<con
         has a value. */
     uint32_t getNFields() const { return rep.visible_fields.size(); };
 
+    /** Returns true if any of the fields are pack_dictionary fields. */
+    bool hasDictionaryFields() const { return !rep.dictionary_field_columns.empty(); }
+
+    /** Returns true if any of the fields are pack_bitwidth fields. */
+    bool hasBitwidthFields() const { return !rep.bitwidth_field_columns.empty(); }
+
+    /** Returns true if any of the fields are pack_bitwidth or
+        pack_encoding fields, which are stored after the rest of the
+        fixed data when an Extent is packed. */
+    bool hasEncodedFields() const {
+        return !rep.bitwidth_field_columns.empty() || !rep.pack_encoding.empty();
+    }
+
+    /** Returns true if the fields are split into column groups by
+        pack_group or pack_column_groups="auto".  Each group is
+        compressed separately, so readers that only need some of the
+        columns can skip uncompressing the other groups; see
+        selectColumns and IndexSourceModule::setColumns. */
+    bool hasColumnGroups() const { return !rep.column_groups.empty(); }
+
+    /** \brief The parts of a packed Extent that Extent::unpackData has to
+        uncompress to read some of the columns. */
+    struct ColumnSelection {
+        /** Indexed by column group; empty if the type has no groups.
+            Group 0, which holds the booleans (including the null
+            fields) and the fields without a group, is always needed. */
+        std::vector<bool> groups;
+        /** True if any of the columns is a variable32 field, so the
+            variable data is needed. */
+        bool variable;
+        ColumnSelection() : variable(false) { }
+    };
+
+    /** Returns what has to be uncompressed to read the named columns,
+        including the fields that pack_relative fields among them are
+        relative to.  Names that are not fields of this type are
+        ignored, so one list can be used for several types. */
+    ColumnSelection selectColumns(const std::vector<std::string> &columns) const;
+
     /** Returns the name of the hidden boolean field used to indicate
         whether the specified field is null. */
     static std::string nullableFieldname(const std::string &fieldname);
 
+    /** Returns the name of the hidden int32 field that holds the
+        dictionary code of the specified pack_dictionary field. */
+    static std::string dictionaryCodeFieldname(const std::string &fieldname);
+
     /** Returns the XML associated with the given field as a @c std::string */
     std::string xmlFieldDesc(const std::string &column) const {
         int cnum = getColumnNumber(rep, column, false);
@@ -344,6 +488,11 @@ class ExtentType : boost::noncopyable, public boost::enable_shared_from_this<con
     PackNullCompact getPackNullCompact() const { 
         return rep.pack_null_compact; 
     }
+    /** Returns a flag indicating how the fixed records are laid out when
+        writing to a file. */
+    PackLayout getPackLayout() const {
+        return rep.pack_layout;
+    }
     /** Returns the name of the ExtentType. This corresponds the the "name"
         attribute in the XML. */
     const std::string &getName() const { return rep.name; }
@@ -372,6 +521,14 @@ class ExtentType : boost::noncopyable, public boost::enable_shared_from_this<con
                             null_offset(0), null_bitmask(0) { }
     };
 
+    // A contiguous range of bytes in each fixed record that is stored
+    // as one column by pack_layout="columnar"; the runs cover the
+    // entire record.
+    struct columnarRun {
+        int32 offset, size;
+        columnarRun(int32 offset, int32 size) : offset(offset), size(size) { }
+    };
+
     struct fieldInfo {
         std::string name;
         fieldType type;
@@ -379,13 +536,19 @@ class ExtentType : boost::noncopyable, public boost::enable_shared_from_this<con
         // valid for bool fields.
         int32 size, offset, bitpos; 
         int null_fieldnum;
-        bool unique;
+        // code_fieldnum is the hidden int32 field holding the
+        // dictionary code of a pack_dictionary field, -1 otherwise.
+        int code_fieldnum;
+        // the column group the field is stored in, 0 unless it has a
+        // pack_group (or pack_column_groups="auto")
+        int column_group;
+        bool unique, bloom_filter;
         nullCompactInfo *null_compact_info;
         double doublebase;
         xmlNodePtr xmldesc;
         fieldInfo() : type(ft_unknown), size(-1), offset(-1), bitpos(-1),
-                      null_fieldnum(-1), unique(false), 
-                      null_compact_info(NULL), doublebase(0), xmldesc(NULL)
+                      null_fieldnum(-1), code_fieldnum(-1), column_group(0), unique(false),
+                      bloom_filter(false), null_compact_info(NULL), doublebase(0), xmldesc(NULL)
         { }
     };
 
@@ -397,6 +560,10 @@ class ExtentType : boost::noncopyable, public boost::enable_shared_from_this<con
   private:
     static const ExtentType::Ptr dataseries_xml_type;
     static const ExtentType::Ptr dataseries_index_type_v0;
+    static const ExtentType::Ptr dataseries_compression_dictionary_type;
+    static const ExtentType::Ptr dataseries_string_dictionary_type;
+    static const ExtentType::Ptr dataseries_zone_map_type;
+    static const ExtentType::Ptr dataseries_bloom_filter_type;
 
     // a compelling case has been made that identifying fields by
     // column number is not necessary (the only use so far is for
@@ -410,8 +577,11 @@ class ExtentType : boost::noncopyable, public boost::enable_shared_from_this<con
     int32 getOffset(int column) const;
     int getBitPos(int column) const;
     bool getUnique(int column) const;
+    bool getDictionary(int column) const;
+    bool getBloomFilter(int column) const;
     bool getNullable(int column) const;
     double getDoubleBase(int column) const;
+    double getPackScale(int column) const;
 
     std::string xmlFieldDesc(int field_num) const;
     xmlNodePtr xmlNodeFieldDesc(int field_num) const;
@@ -423,6 +593,11 @@ class ExtentType : boost::noncopyable, public boost::enable_shared_from_this<con
         pack_scaleT(int a, double b, bool warn) 
                 : field_num(a), scale(b), multiplier(1.0/b), warn(warn) {}
     };
+    struct pack_encodingT {
+        int field_num;
+        PackEncoding encoding;
+        pack_encodingT(int a, PackEncoding b) : field_num(a), encoding(b) {}
+    };
     struct pack_other_relativeT {
         int field_num, base_field_num;
         pack_other_relativeT(int a, int b) : field_num(a), base_field_num(b) {}
@@ -455,6 +630,17 @@ class ExtentType : boost::noncopyable, public boost::enable_shared_from_this<con
             nonbool_compact_info_size4, nonbool_compact_info_size8; 
         int bool_bytes;
         std::vector<int32> variable32_field_columns;
+        // the subset of variable32_field_columns with pack_dictionary
+        std::vector<int32> dictionary_field_columns;
+        // the pack_bitwidth="auto" fields, which are bit-packed after
+        // the rest of the fixed data, followed by the pack_encoding
+        // fields; the kept runs are the rest of the record, in the
+        // order they are stored, and add up to encoded_kept_size
+        // bytes per record.
+        std::vector<int32> bitwidth_field_columns;
+        std::vector<pack_encodingT> pack_encoding;
+        std::vector<columnarRun> encoded_kept_runs;
+        int32 encoded_kept_size;
         
         std::vector<pack_scaleT> pack_scale;
         std::vector<pack_other_relativeT> pack_other_relative;
@@ -466,6 +652,13 @@ class ExtentType : boost::noncopyable, public boost::enable_shared_from_this<con
         PackNullCompact pack_null_compact;
         PackPadRecord pad_record;
         PackFieldOrdering field_ordering;
+        PackLayout pack_layout;
+        std::vector<columnarRun> columnar_runs;
+        // the runs of each column group in the order they are stored,
+        // which together cover the record; group 0 has the booleans,
+        // the padding and the fields without a group.  Empty if no
+        // field has a group.
+        std::vector<std::vector<columnarRun> > column_groups;
         void sortAssignNCI(std::vector<nullCompactInfo> &nci);
 
         ~ParsedRepresentation() {
@@ -0,0 +1,87 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Runs several sequences of modules over one read of a source, each in
+    its own thread
+*/
+
+#ifndef DATASERIES_FANOUT_MODULE_HPP
+#define DATASERIES_FANOUT_MODULE_HPP
+
+#include <deque>
+#include <vector>
+
+#include <Lintel/PThread.hpp>
+
+#include <DataSeries/DataSeriesModule.hpp>
+#include <DataSeries/SequenceModule.hpp>
+
+/** \brief Shares the extents of one source among several branches, each
+    run in its own thread.
+
+    A SequenceModule runs all of its modules on one thread, one after
+    another.  Analyses that only read the extents, like most
+    RowAnalysisModules, can instead each go in a branch:
+    \code
+    FanoutModule fanout(source);
+    SequenceModule &a(fanout.addBranch());
+    a.addModule(new MyAnalysis(a.tail()));
+    SequenceModule &b(fanout.addBranch());
+    b.addModule(new OtherAnalysis(b.tail()));
+    fanout.getAndDeleteShared();
+    RowAnalysisModule::printAllResults(a, 1);
+    \endcode
+    The source is read, and its extents unpacked, once; each branch
+    gets every extent, read-shared, so the modules in a branch must not
+    change them.
+
+    getSharedExtent() returns the extents of the source, as they are
+    handed to the branches; the first call starts a thread per branch,
+    which reads its branch until it ends, and the last one, which
+    returns NULL, waits for all of the branches to finish.  The slowest
+    branch is kept at most max_lag extents behind, so that at most
+    max_lag extents are held in memory.  A branch may stop before the
+    end of the source; the others carry on without it. */
+class FanoutModule : public DataSeriesModule {
+  public:
+    FanoutModule(DataSeriesModule &source, unsigned max_lag = 8);
+    virtual ~FanoutModule();
+
+    /** Returns a new branch; its head is the source of the first module
+        added to it.  Has to be called before the first getSharedExtent(). */
+    SequenceModule &addBranch();
+
+    virtual Extent::Ptr getSharedExtent();
+
+  private:
+    class BranchSource;
+    class BranchThread;
+
+    Extent::Ptr nextExtent(unsigned branch);
+    void finishBranch(unsigned branch);
+    uint64_t slowestBranch() const;
+    void trimWindow();
+    void finishBranches();
+
+    DataSeriesModule &source;
+    const unsigned max_lag;
+    std::vector<SequenceModule *> branches;
+    std::vector<BranchThread *> threads;
+
+    PThreadMutex mutex;
+    PThreadCond cond;
+    // protected by mutex; window holds the extents from first_seq on, and
+    // branch i reads extent next[i] next, or has finished if it is the
+    // largest uint64_t
+    std::deque<Extent::Ptr> window;
+    uint64_t first_seq;
+    std::vector<uint64_t> next;
+    bool source_done;
+};
+
+#endif
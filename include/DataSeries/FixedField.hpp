@@ -12,6 +12,7 @@
 #ifndef DATASERIES_FIXEDFIELD_HPP
 #define DATASERIES_FIXEDFIELD_HPP
 
+#include <DataSeries/ColumnSpan.hpp>
 #include <DataSeries/Field.hpp>
 
 /** \brief Base class for fixed size fields. */
@@ -168,6 +169,28 @@ namespace dataseries { namespace detail {
                     this->set(val);
                 }
             }
+
+            /** Returns the values of the field in every row of e, which has to
+                have the type of the series; see ColumnSpan. */
+            ColumnSpan<T> column(const Extent &e) const {
+                DEBUG_SINVARIANT(e.getTypePtr() == this->dataseries.getTypePtr());
+                INVARIANT(this->offset >= 0, "field not ready; has the series' type been set?");
+                size_t stride = e.getTypePtr()->fixedrecordsize();
+                size_t nrows = e.fixeddata.size() / stride;
+                if (nrows == 0) {
+                    return ColumnSpan<T>();
+                }
+                const uint8_t *row0 = e.fixeddata.begin();
+                return ColumnSpan<T>(row0 + this->offset, stride, nrows,
+                                     this->nullable ? row0 + this->null_offset : NULL,
+                                     this->nullable ? this->null_bit_mask : 0);
+            }
+
+            /** Returns the values of the field in every row of the series'
+                current extent. */
+            ColumnSpan<T> column() const {
+                return column(this->dataseries.getExtentRef());
+            }
         };
 
     }} // namespace
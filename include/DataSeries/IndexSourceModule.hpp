@@ -18,6 +18,10 @@
 
 #include <DataSeries/DataSeriesModule.hpp>
 
+#include <DataSeries/TaskPool.hpp>
+
+namespace dataseries { class AsyncReader; }
+
 /** \brief Base class for source modules that select a subset of the
     \link Extent Extents \endlink in collection of files via an index file.
 
@@ -57,7 +61,9 @@
 // compressed reading would be a good idea.  With large disk subsystem
 // machines, and the really many cores we have now, it is not difficult to need
 // to have multiple threads reading in extents in order to read them fast
-// enough to keep the pipeline full.
+// enough to keep the pipeline full.  (Done for files with an index: their
+// extents are read asynchronously, see setMaxReadsInFlight.  The unpacking
+// is now done by the shared dataseries::TaskPool.)
 
 class IndexSourceModule : public SourceModule {
   public:
@@ -68,12 +74,33 @@ class IndexSourceModule : public SourceModule {
 
     /** call this to start prefetching; if you don't call it, it will
         be automatically called when you call getExtent; Max
-        compressed may slightly overrun because we don't know the size
-        of compressed extents until we read them. nthreads == -1 ==>
-        use # cpus */
+        compressed, which includes the extents being read, may
+        slightly overrun because we only check it before getting each
+        extent.  The extents are unpacked by the shared
+        dataseries::TaskPool; n_unpack_threads limits how many of this
+        module's extents are unpacked at once, -1 ==> up to the number of
+        threads in the pool. */
     virtual void startPrefetching(unsigned prefetch_max_compressed = 8 * 1024 * 1024,
                                   unsigned prefetch_max_unpacked = 32 * 1024 * 1024,
                                   int n_unpack_threads = -1);
+    /** Compressed extents in files whose index was read are read
+        asynchronously with up to this many reads in flight (default 8),
+        and adjacent ones are read together; see
+        dataseries::AsyncReader for the engines.  1 still overlaps reading
+        with unpacking.  Has to be called before prefetching starts. */
+    void setMaxReadsInFlight(unsigned max_reads);
+
+    /** The columns the downstream modules will read; for extent types
+        with column groups (see ExtentType::hasColumnGroups) only the
+        groups holding them are uncompressed, and for any type the
+        variable data is only uncompressed if one of them is a
+        variable32 field.  The other fields of the extents returned are
+        not valid, and the extents should not be written out again; see
+        Extent::unpackData.  Names that are not in a type are ignored.
+        Empty (the default) unpacks everything.  Has to be called before
+        prefetching starts. */
+    void setColumns(const std::vector<std::string> &columns);
+
     /** call this to start the index source module over again from the 
         beginning */
     virtual void resetPos();
@@ -96,8 +123,9 @@ class IndexSourceModule : public SourceModule {
     struct WaitStats {
         uint64_t nextents, consumer, compressed_downstream_full;
         uint64_t unpack_no_upstream, unpack_downstream_full;
-        uint64_t unpack_yield_front, unpack_yield_ready;
+        uint64_t unpack_yield_front, unpack_yield_ready; // 0 since unpacking moved to the TaskPool
         uint64_t skip_unpack_signal;
+        uint64_t async_reads, async_read_extents;
 
         Stats active_unpack_stats;
         int active_unpackers;
@@ -108,7 +136,8 @@ class IndexSourceModule : public SourceModule {
                 : nextents(0), consumer(0), compressed_downstream_full(0),
                   unpack_no_upstream(0), unpack_downstream_full(0),
                   unpack_yield_front(0), unpack_yield_ready(0),
-                  skip_unpack_signal(0), active_unpackers(0)
+                  skip_unpack_signal(0), async_reads(0), async_read_extents(0),
+                  active_unpackers(0)
         { }
     };
 
@@ -122,17 +151,34 @@ class IndexSourceModule : public SourceModule {
         ExtentType::Ptr type;
         Extent::Ptr unpacked;
         bool need_bitflip;
+        dataseries::FieldDictionaries::Ptr dictionaries;
+        // true until an asynchronous read of bytes finishes; bytes is empty
+        // until the read starts, read_size is the size it will be.
+        bool reading;
+        uint32_t read_size;
         std::string uncompressed_type, extent_source;
         int64_t extent_source_offset;
         PrefetchExtent() 
-                : type(), unpacked(), need_bitflip(false), extent_source_offset(-1) { }
+                : type(), unpacked(), need_bitflip(false), dictionaries(), reading(false),
+                  read_size(0),
+                  extent_source_offset(-1) { }
     };
 
   protected:
     bool startedPrefetching() { return prefetch != NULL; }
 
+    /** The mutex held while the locked*() functions are called; sub-classes
+        can wait on conditions of their own with it.  Only valid once
+        prefetching has started. */
+    PThreadMutex &prefetchMutex() {
+        SINVARIANT(prefetch != NULL);
+        return prefetch->mutex;
+    }
+
     /** utility function to read compressed data, it will unlock and relock
-        the mutex associated with prefetching */
+        the mutex associated with prefetching.  If the size of the extent
+        is known from the index, the data is instead read asynchronously,
+        and the returned extent is still reading. */
     PrefetchExtent *readCompressed(DataSeriesSource *dss,
                                    off64_t offset, 
                                    const std::string &uncompressed_type);
@@ -154,11 +200,19 @@ class IndexSourceModule : public SourceModule {
     void lockedStartThreads();
 
     friend class IndexSourceModuleCompressedPrefetchThread;
-    friend class IndexSourceModuleUnpackThread;
     void compressedPrefetchThread();
-    void unpackThread();
+    void unpackTask(PrefetchExtent *pe, uint32_t unpacked_size);
+
+    struct ReadFile;
+    struct CompressedRead;
+    void lockedAddToRead(PrefetchExtent *p);
+    void lockedSubmitRead();
+    void lockedWaitForRead();
+    void lockedStartUnpacks();
 
     bool getting_extent;
+    unsigned max_reads_in_flight;
+    std::vector<std::string> columns;
 
     struct Queue {
         Queue(unsigned _limit) : cur(0), limit(_limit) { }
@@ -203,20 +257,39 @@ class IndexSourceModule : public SourceModule {
         Queue compressed, unpacked;
         WaitStats stats;
         PThread *compressed_prefetch_thread;
-        std::vector<PThread *> unpack_threads;
         PThreadMutex mutex;
-        PThreadCond compressed_cond, unpack_cond, ready_cond;
+        PThreadCond compressed_cond, ready_cond;
         bool source_done;
         uint32_t abort_prefetching; // number of threads remaining to abort 
 
+        // unpacking is the number of unpack tasks submitted and not yet
+        // finished; at most max_unpacking.
+        dataseries::TaskPool::Queue *unpack_queue;
+        unsigned unpacking, max_unpacking;
+
+        // Only used by the compressed prefetch thread.  next_read collects
+        // adjacent extents until it is submitted, read_file is the file
+        // being read.
+        dataseries::AsyncReader *reader;
+        CompressedRead *next_read;
+        boost::shared_ptr<ReadFile> read_file;
+        uint32_t max_read_size;
+
         PrefetchInfo(unsigned cmm, unsigned tum) 
-                : compressed(cmm), unpacked(tum), source_done(false), abort_prefetching(0)
+                : compressed(cmm), unpacked(tum), compressed_prefetch_thread(NULL),
+                  source_done(false), abort_prefetching(0), unpack_queue(NULL), unpacking(0),
+                  max_unpacking(0), reader(NULL), next_read(NULL), max_read_size(0)
         { }
+        ~PrefetchInfo();
 
         bool allDone() {
             return source_done && compressed.empty() && unpacked.empty();
         }
 
+        bool compressedReady() {
+            return !compressed.empty() && !compressed.front()->reading;
+        }
+
         bool unpackedReady() {
             return unpacked.empty() == false && unpacked.front()->unpacked != NULL;
         }
@@ -0,0 +1,240 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Push-based execution of a chain of operators over extents, scheduled
+    as tasks on the shared TaskPool
+*/
+
+#ifndef DATASERIES_PIPELINE_HPP
+#define DATASERIES_PIPELINE_HPP
+
+#include <deque>
+#include <map>
+#include <vector>
+
+#include <boost/function.hpp>
+
+#include <DataSeries/DataSeriesModule.hpp>
+#include <DataSeries/GeneralField.hpp>
+#include <DataSeries/TaskPool.hpp>
+
+namespace dataseries {
+
+/** \brief Where an operator pushes the extents it makes. */
+class MorselSink {
+  public:
+    virtual ~MorselSink();
+    virtual void push(const Extent::Ptr &morsel) = 0;
+};
+
+/** \brief Base class for the operators in a Pipeline.
+
+    The pipeline runs up to Pipeline::setMaxInFlight() extents, the
+    morsels, through its operators at once, each in a task on the
+    shared TaskPool.  An operator keeps whatever it changes while
+    processing a morsel, e.g. its ExtentSeries or partial results, in a
+    Local; each task has its own Local for each operator, so the
+    operator itself is only read while the morsels are running.
+    Operators must not throw. */
+class PipelineOperator : boost::noncopyable {
+  public:
+    /** \brief The state of an operator in one task. */
+    class Local : boost::noncopyable {
+      public:
+        virtual ~Local();
+    };
+
+    virtual ~PipelineOperator();
+
+    /** Returns new per-task state, or NULL, the default, if the operator
+        needs none; called before its first morsel. */
+    virtual Local *newLocal();
+
+    /** Called in one thread once all the morsels have been through the
+        operator, for each Local in turn, e.g. to merge partial results;
+        the Local is deleted afterwards.  The default does nothing. */
+    virtual void finishLocal(Local *local);
+};
+
+/** \brief An operator that turns each morsel into zero or more output
+    morsels as it arrives, e.g. a filter or a projection.
+
+    process() is called from several threads at once, each with its own
+    local, and pushes its output to out, which runs the rest of the
+    pipeline on it in the same thread.  Morsels must not be changed, as
+    they may be shared; make new ones for the output. */
+class StreamOperator : public PipelineOperator {
+  public:
+    typedef boost::shared_ptr<StreamOperator> Ptr;
+
+    virtual void process(Local *local, const Extent::Ptr &in, MorselSink &out) = 0;
+};
+
+/** \brief An operator that needs all of its input before it can produce
+    any output, e.g. a sort or the build side of a hash join.
+
+    A breaker ends one stage of the pipeline and starts the next: the
+    morsels of the stage are consume()d by several threads at once, in no
+    particular order; seq numbers them in the order the stage read
+    them, and is the same for all the morsels made from one input
+    morsel, which arrive in the order they were made.  Once they have
+    all been consumed and each Local finished, finishInput() and then
+    produce() are called from one thread, and produce()'s extents are
+    the input of the next stage. */
+class BreakerOperator : public PipelineOperator {
+  public:
+    typedef boost::shared_ptr<BreakerOperator> Ptr;
+
+    virtual void consume(Local *local, uint64_t seq, const Extent::Ptr &in) = 0;
+
+    /** Called once after the last morsel; the default does nothing. */
+    virtual void finishInput();
+
+    /** Returns the next extent of output, or NULL at the end. */
+    virtual Extent::Ptr produce() = 0;
+};
+
+/** \brief Runs a chain of operators over the extents of a source on all
+    of the cores.
+
+    A Pipeline is divided into stages by its BreakerOperators.  Each
+    stage reads morsels from its input, the source for the first stage
+    and the previous breaker for the others, in the calling thread, and
+    runs up to max_in_flight of them at once through its
+    StreamOperators, each in one task, so a morsel is filtered,
+    projected and so on while it is in cache.  A stage finishes before
+    the next one starts.
+
+    A Pipeline is itself a DataSeriesModule: getSharedExtent() runs the
+    stages and returns the output of the last one in order, i.e. in
+    the order of the morsels it read, as a chain of pull modules would.
+    So existing modules can read from a pipeline, and read the source
+    of one; ModuleOperator puts a pull module in the middle of one. */
+class Pipeline : public DataSeriesModule {
+  public:
+    explicit Pipeline(DataSeriesModule &source);
+    virtual ~Pipeline();
+
+    /** Adds an operator to the end of the pipeline; returns *this, so
+        calls can be chained.  Has to be called before the first
+        getSharedExtent(). */
+    Pipeline &add(const StreamOperator::Ptr &op);
+    Pipeline &add(const BreakerOperator::Ptr &op);
+
+    /** Sets the most morsels a stage runs at once; 0, the default, means
+        one per thread in the shared TaskPool. */
+    void setMaxInFlight(unsigned max_in_flight);
+
+    virtual Extent::Ptr getSharedExtent();
+
+  private:
+    struct Stage;
+    struct Slot;
+    struct Result;
+    class StageSink;
+
+    void startStage(Stage &stage);
+    void finishStage(Stage &stage);
+    Extent::Ptr stageInput(Stage &stage);
+    void runMorsel(Stage *stage, uint64_t seq, Extent::Ptr in, Result *result);
+    void waitForMorsel(unsigned seen_running);
+
+    DataSeriesModule &source;
+    std::vector<Stage *> stages;
+    unsigned cur_stage, max_in_flight;
+    bool started;
+
+    // results of the last stage, oldest first; the dispatch thread only
+    // reads the results that running is done with
+    std::deque<Result *> results;
+    std::deque<Extent::Ptr> output;
+
+    PThreadMutex mutex;
+    PThreadCond done_cond;
+    // protected by mutex
+    std::vector<Slot *> idle;
+    unsigned running;
+
+    TaskPool::Queue queue;
+};
+
+/** \brief Runs a pull-style DataSeriesModule inside a Pipeline.
+
+    The morsels that arrive are kept, and once the last one has arrived
+    the module from factory is made to read them, in order, as its
+    source; its output is the output of the operator.  So the module is
+    a pipeline breaker, and runs in a single thread, as it does outside
+    of a pipeline.  For modules that process an extent at a time, a
+    StreamOperator avoids keeping the whole input. */
+class ModuleOperator : public BreakerOperator {
+  public:
+    typedef boost::function<DataSeriesModule::Ptr (DataSeriesModule &source)> Factory;
+
+    explicit ModuleOperator(const Factory &factory);
+    virtual ~ModuleOperator();
+
+    virtual void consume(Local *local, uint64_t seq, const Extent::Ptr &in);
+    virtual void finishInput();
+    virtual Extent::Ptr produce();
+
+  private:
+    class Buffered;
+
+    Factory factory;
+    PThreadMutex mutex;
+    std::map<uint64_t, std::vector<Extent::Ptr> > input; // protected by mutex
+    Buffered *buffered;
+    DataSeriesModule::Ptr module;
+};
+
+/** \brief Keeps the rows of each morsel that match a DSExpr where
+    expression, as a StreamOperator; the output has the type of the
+    input.  Each morsel becomes one extent, which is empty if no rows
+    match, so a selective expression makes many small extents; read the
+    pipeline through an ExtentMergeModule to combine them. */
+class SelectOperator : public StreamOperator {
+  public:
+    explicit SelectOperator(const std::string &where_expr_str);
+    virtual ~SelectOperator();
+
+    virtual Local *newLocal();
+    virtual void process(Local *local, const Extent::Ptr &in, MorselSink &out);
+
+  private:
+    struct SelectLocal;
+
+    const std::string where_expr_str;
+};
+
+/** \brief Merges the extents of its source, in order, into extents of
+    about target_size bytes, e.g. the output of a Pipeline with a
+    SelectOperator.  Empty extents are dropped, unless every extent of
+    the source is empty, in which case one is returned so the modules
+    after it still see the type.  All of the extents have to be of the
+    same type. */
+class ExtentMergeModule : public DataSeriesModule {
+  public:
+    explicit ExtentMergeModule(DataSeriesModule &source, size_t target_size = 96 * 1024);
+    virtual ~ExtentMergeModule();
+
+    virtual Extent::Ptr getSharedExtent();
+
+  private:
+    Extent::Ptr takeOutput();
+
+    DataSeriesModule &source;
+    const size_t target_size;
+    ExtentSeries input, output;
+    ExtentRecordCopy copier;
+    Extent::Ptr empty; // the first empty extent, until a row is seen
+    bool seen_rows;
+};
+
+} // namespace dataseries
+
+#endif
@@ -66,7 +66,19 @@ class RowAnalysisModule : public DataSeriesModule {
     virtual void prepareForProcessing();
 
     /** this function will get called to process each row. */
-    virtual void processRow() = 0;
+    virtual void processRow();
+
+    /** \brief Process all the rows of an extent at once.
+     *
+     * Called for each extent with the series set to e; the default
+     * calls processRow() for each row the where expression selects.
+     * Analyses can override it instead of processRow() to work down
+     * whole columns, e.g. with Int64Field::column(e), which is much
+     * cheaper per row than val().  An override is responsible for the
+     * where expression, if it allows one, and for counting the rows in
+     * processed_rows; calling RowAnalysisModule::processExtent() does
+     * both by falling back to processRow(). */
+    virtual void processExtent(const Extent &e);
 
     /** this function will get called once all data has been processed */
     virtual void completeProcessing();
@@ -81,9 +93,17 @@ class RowAnalysisModule : public DataSeriesModule {
      * evaluated, and if it evaluates to true, then processRow will be
      * called. An empty expression is treated as true for all values.
      *
+     * If skip_extents is true and the source is a TypeIndexModule, the
+     * expression is also pushed down to it with
+     * TypeIndexModule::addWhereFilter, so that the extents the zone
+     * maps show can not match are never read.  The source then does
+     * not return those extents to anything else, so only use this if
+     * this module is the only consumer of the source.
+     *
      * @param where_expression the expression to evaluate
+     * @param skip_extents push the expression down to the source
      */
-    void setWhereExpr(const std::string &where_expression);
+    void setWhereExpr(const std::string &where_expression, bool skip_extents = false);
 
     /** \brief iterate across the sequence printing results if possible.
      * Tries to dynamically case each module in the sequence to a
@@ -95,15 +115,79 @@ class RowAnalysisModule : public DataSeriesModule {
      * @return the number of modules that could not be printed */
     static int printAllResults(SequenceModule &sequence, int expected_nonprintable = -1);
 
+    /** \brief Process the extents on several threads.
+     *
+     * For modules whose results don't depend on the order of the rows,
+     * e.g. counts or sums grouped by a key.  Each of nworkers modules
+     * from newWorker() processes some of the extents, with its own
+     * series and state, on the dataseries::TaskPool; when the source
+     * runs out, each worker is merged into this module with
+     * mergeWorker(), in order, and then completeProcessing() is called
+     * on this module as usual.  The workers get the firstExtent(),
+     * newExtentHook() and prepareForProcessing() calls for the extents
+     * they see, and this module gets firstExtent() and
+     * prepareForProcessing() on the first extent, so it is set up for
+     * the merge, but never processRow().
+     *
+     * getSharedExtent() returns each extent while the workers may still
+     * be reading it, so the modules after this one must not change
+     * them; at most nworkers extents are in progress at once.  Modules
+     * that depend on the row order simply don't call this.
+     *
+     * @param nworkers the number of workers; 0 means one per thread in
+     *   the shared TaskPool */
+    void setParallel(unsigned nworkers = 0);
+
     uint64_t processed_rows, ignored_rows;
 
   protected:
+    /** Returns a new module like this one, with the same options but
+        no results, that setParallel() uses to process some of the
+        extents; it is never read from, so source can be anything.  The
+        default is to return NULL, for modules that can't run in
+        parallel. */
+    virtual RowAnalysisModule *newWorker();
+
+    /** Adds the results of a worker from newWorker() into this one. */
+    virtual void mergeWorker(RowAnalysisModule &worker);
+
     ExtentSeries series;
     DataSeriesModule &source;
     bool prepared;
 
     std::string where_expr_str;
     DSExpr *where_expr;
+
+  private:
+    struct Parallel;
+
+    void analyzeExtent(const Extent::Ptr &e);
+    void parallelExtent(const Extent::Ptr &e);
+    void workerTask(Extent::Ptr e);
+    void waitForWorkers(unsigned max_in_progress);
+    void finishParallel();
+
+    Parallel *parallel;
+};
+
+/** \brief A RowAnalysisModule that can run in parallel.
+ *
+ * Self, the derived class, supplies newWorker() and a
+ * merge(const Self &other) that adds other's results into its own;
+ * see RowAnalysisModule::setParallel(). */
+template<class Self> class ParallelRowAnalysisModule : public RowAnalysisModule {
+  public:
+    ParallelRowAnalysisModule(DataSeriesModule &source,
+                              ExtentSeries::typeCompatibilityT type_compatibility
+                              = ExtentSeries::typeExact)
+        : RowAnalysisModule(source, type_compatibility) { }
+
+  protected:
+    virtual void mergeWorker(RowAnalysisModule &worker) {
+        Self *other = dynamic_cast<Self *>(&worker);
+        INVARIANT(other != NULL, "newWorker() returned a module of another class");
+        static_cast<Self *>(this)->merge(*other);
+    }
 };
 
 #endif
@@ -0,0 +1,96 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Dictionaries for the pack_dictionary variable32 fields of a file
+*/
+
+#ifndef DATASERIES_STRINGDICTIONARY_HPP
+#define DATASERIES_STRINGDICTIONARY_HPP
+
+#include <inttypes.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+
+#include <Lintel/AssertBoost.hpp>
+#include <Lintel/HashMap.hpp>
+
+namespace dataseries {
+
+/** \brief The distinct values of one pack_dictionary field in one file.
+
+    Each value has a code; codes are handed out densely from 1 in the
+    order values are first written, and code 0 is the empty string.
+    The codes are only meaningful within one file. */
+class StringDictionary {
+  public:
+    StringDictionary();
+
+    /** Returns the code of the value, adding it if it is new. */
+    int32_t encode(const void *value, int32_t size);
+
+    /** Adds an entry read from a file.  Entries have to be added in
+        code order; adding an entry that is already present checks
+        that it has the same value. */
+    void add(int32_t code, const std::string &value);
+
+    const std::string &decode(int32_t code) const {
+        INVARIANT(code >= 0 && static_cast<size_t>(code) < values.size(),
+                  boost::format("dictionary code %d out of range [0..%d)")
+                  % code % values.size());
+        return values[code];
+    }
+
+    int32_t size() const { return values.size(); }
+
+    /** The entries from nwritten() on have been added by encode() but
+        not yet written to the file. */
+    int32_t nwritten() const { return written; }
+    void setWritten() { written = values.size(); }
+
+  private:
+    std::vector<std::string> values;
+    HashMap<std::string, int32_t> codes;
+    int32_t written;
+};
+
+/** \brief The dictionaries of all the pack_dictionary fields of a file,
+    by extent type name and field name. */
+class FieldDictionaries {
+  public:
+    typedef boost::shared_ptr<FieldDictionaries> Ptr;
+    typedef std::pair<std::string, std::string> Key; // type name, field name
+    typedef std::map<Key, StringDictionary> Map;
+
+    /** Returns the dictionary for the field, creating an empty one if
+        there is none. */
+    StringDictionary &get(const std::string &type_name, const std::string &field_name) {
+        return dictionaries[Key(type_name, field_name)];
+    }
+
+    /** Returns NULL if there is no dictionary for the field. */
+    const StringDictionary *find(const std::string &type_name,
+                                 const std::string &field_name) const {
+        Map::const_iterator i = dictionaries.find(Key(type_name, field_name));
+        return i == dictionaries.end() ? NULL : &i->second;
+    }
+
+    Map::iterator begin() { return dictionaries.begin(); }
+    Map::iterator end() { return dictionaries.end(); }
+    void clear() { dictionaries.clear(); }
+
+  private:
+    Map dictionaries;
+};
+
+} // namespace dataseries
+
+#endif
@@ -0,0 +1,109 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    A pool of threads shared by everything that packs or unpacks extents
+*/
+
+#ifndef DATASERIES_TASKPOOL_HPP
+#define DATASERIES_TASKPOOL_HPP
+
+#include <deque>
+#include <vector>
+
+#include <boost/function.hpp>
+#include <boost/utility.hpp>
+
+#include <Lintel/Deque.hpp>
+#include <Lintel/PThread.hpp>
+
+namespace dataseries {
+
+/** \brief Threads shared by all of the sources and sinks in a process.
+
+    Each IndexSourceModule submits its unpacking, and each DataSeriesSink
+    its compression, as tasks to the shared pool, so a program with many
+    sources and sinks runs one set of threads rather than a set per
+    module.  Every module submits to its own Queue; tasks from one queue
+    start in the order they were submitted, and idle threads take turns
+    between the queues that have work, so a module with a long backlog
+    can not starve the others.
+
+    Tasks must not wait for other tasks, except through runAll(), in
+    which the waiting thread runs the tasks itself.
+
+    The queues with work are kept in one list under one mutex, rather
+    than in per-thread deques that idle threads steal from; a task packs
+    or unpacks a whole extent or block, which takes far longer than
+    taking the mutex. */
+class TaskPool : boost::noncopyable {
+  public:
+    typedef boost::function<void ()> Task;
+
+    /** \brief One client's tasks. */
+    class Queue : boost::noncopyable {
+      public:
+        explicit Queue(TaskPool &pool = TaskPool::shared());
+        /** waits for all the submitted tasks to finish */
+        ~Queue();
+
+        void submit(const Task &task);
+
+        /** Runs the next task that hasn't started in the calling thread;
+            returns false if there wasn't one. */
+        bool runOne();
+
+        /** Waits until all of the submitted tasks have finished. */
+        void wait();
+
+      private:
+        friend class TaskPool;
+        TaskPool &pool;
+        // protected by pool.mutex; listed is true while we are in pool.ready
+        Deque<Task> tasks;
+        unsigned running;
+        bool listed;
+        PThreadCond idle_cond;
+    };
+
+    /** The pool used by the sources and sinks; it is created with
+        getSharedThreads() threads the first time it is used. */
+    static TaskPool &shared();
+
+    /** Sets the number of threads in the shared pool; -1, the default,
+        uses the value of the environment variable DATASERIES_THREADS if it
+        is set, and the number of cpus (up to MAX_THREADS) otherwise.  Has
+        to be called before the shared pool is first used, i.e. before any
+        sources or sinks start. */
+    static void setSharedThreads(int nthreads = -1);
+    static unsigned getSharedThreads();
+
+    explicit TaskPool(unsigned nthreads);
+    ~TaskPool();
+
+    unsigned nThreads() const { return threads.size(); }
+
+    /** Runs all of the tasks, on the pool's threads and the calling thread,
+        and returns once they are done.  Can be called from a task. */
+    void runAll(const std::vector<Task> &tasks);
+
+  private:
+    void workerThread();
+
+    PThreadMutex mutex;
+    PThreadCond ready_cond;
+    std::deque<Queue *> ready; // queues with tasks that haven't started
+    std::vector<PThread *> threads;
+    bool stopping;
+
+    static int shared_threads;
+    static TaskPool *shared_pool;
+};
+
+} // namespace dataseries
+
+#endif
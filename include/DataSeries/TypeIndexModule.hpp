@@ -13,6 +13,7 @@
 #ifndef __DATASERIES_TYPEINDEXMODULE_H
 #define __DATASERIES_TYPEINDEXMODULE_H
 
+#include <DataSeries/GeneralField.hpp>
 #include <DataSeries/IndexSourceModule.hpp>
 
 /** \brief Source module that returns extents matching a particular type
@@ -41,6 +42,49 @@ class TypeIndexModule : public IndexSourceModule {
     void addSource(const std::string &filename);
     bool haveSources() { return !inputFiles.empty(); }
 
+    /** Open up to nfiles of the input files at a time, in background
+        threads, so that opening a file and reading its index overlaps
+        with reading the extents of the files before it.  nfiles counts
+        the file being read, so 1, the default, opens each file when the
+        previous one is done.  If keep_file_order is false, the files are
+        read in the order they finish opening rather than the order they
+        were added; the extents of each file are still in order.  Has to
+        be called before prefetching starts. */
+    void setParallelFiles(unsigned nfiles, bool keep_file_order = true);
+
+    /** Skip the extents whose zone maps show that field has no value
+        in [min, max], without reading them.  With multiple ranges, only
+        the extents that may have values in all of them are returned.
+        Extents without a zone for the field, such as those of files
+        written as DSv1, are always returned, so the caller still has to
+        check the values of the records.  Has to be called before
+        prefetching starts. */
+    void addRangeFilter(const std::string &field, const GeneralValue &min,
+                        const GeneralValue &max);
+
+    /** Skip the extents that the zone maps show can not have a record
+        for which where_expression is true, using the ranges the
+        expression implies its fields are in (see
+        DSExpr::impliedRanges).  The expression still has to be
+        evaluated on the records of the extents returned.  The ranges
+        apply to every extent returned, so this should only be used if
+        every consumer of the extents applies the same expression.
+        Returns the number of ranges added.  Has to be called before
+        prefetching starts. */
+    unsigned addWhereFilter(const std::string &where_expression);
+
+    /** Skip the extents whose Bloom filters show that field has none
+        of the keys, without reading them; field has to be marked with
+        opt_bloom_filter="yes".  The filters may let through extents
+        without any of the keys, and extents without a filter for the
+        field are always returned, so the caller still has to check the
+        values of the records.  Keys of an int32 field are given as
+        int64s.  With multiple calls, only the extents that may have one
+        of the keys of each are returned.  Has to be called before
+        prefetching starts. */
+    void addKeyFilter(const std::string &field, const std::vector<std::string> &keys);
+    void addKeyFilter(const std::string &field, const std::vector<int64_t> &keys);
+
     void sameInputFiles(TypeIndexModule &from) {
         inputFiles = from.inputFiles;
     }
@@ -62,12 +106,47 @@ class TypeIndexModule : public IndexSourceModule {
     virtual PrefetchExtent *lockedGetCompressedExtent();
 
   private:
-    const ExtentType::Ptr matchType(); // May return NULL
+    struct RangeFilter {
+        std::string field;
+        GeneralValue min, max;
+        bool nulls_match;
+        RangeFilter(const std::string &field, const GeneralValue &min, const GeneralValue &max,
+                    bool nulls_match)
+                : field(field), min(min), max(max), nulls_match(nulls_match) { }
+    };
+
+    struct KeyFilter {
+        std::string field;
+        std::vector<uint64_t> hashes;
+        KeyFilter(const std::string &field) : field(field) { }
+    };
 
-    unsigned int cur_file;
+    const ExtentType::Ptr matchType(); // May return NULL
+    bool mayMatchRanges(off64_t offset) const;
+    bool mayMatchKeys(off64_t offset) const;
+    DataSeriesSource *lockedOpenSource();
+    void lockedCloseSource();
+    void lockedStopOpeners();
+    void openerThread();
+
+    unsigned int cur_file; // number of files done
     DataSeriesSource *cur_source;
     std::vector<std::string> inputFiles;
     ExtentType::Ptr my_type;
+    std::vector<RangeFilter> range_filters;
+    std::vector<KeyFilter> key_filters;
+
+    // For setParallelFiles(); protected by the prefetch mutex.  opened has
+    // the sources (and their file numbers) the openers have finished, in
+    // the order they finished.  open_files counts the files being opened,
+    // opened, and read.
+    unsigned parallel_files;
+    bool keep_file_order;
+    std::vector<PThread *> openers;
+    unsigned running_openers, next_to_open, open_files;
+    bool stop_opening;
+    std::vector<std::pair<unsigned, DataSeriesSource *> > opened;
+    PThreadCond open_cond, opened_cond;
 };
 
 #endif
@@ -0,0 +1,193 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    A series over extents of a type whose fixed fields are known when
+    the analysis is compiled
+*/
+
+#ifndef DATASERIES_TYPEDSERIES_HPP
+#define DATASERIES_TYPEDSERIES_HPP
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include <DataSeries/Extent.hpp>
+#include <DataSeries/ExtentType.hpp>
+
+namespace dataseries {
+
+/** One entry in the field list of a schema; see TypedSeries. */
+struct SchemaField {
+    const char *name;
+    ExtentType::fieldType type;
+    bool nullable;
+};
+
+/** Names column I of a schema, which holds values of type T; see
+    TypedSeries. */
+template<unsigned I, typename T, bool Nullable = false> struct SchemaColumn {
+    enum { index = I };
+    typedef T value_type;
+    static const bool nullable = Nullable;
+};
+
+namespace detail {
+    template<typename T> struct SchemaType { };
+    template<> struct SchemaType<bool> {
+        static const ExtentType::fieldType type = ExtentType::ft_bool;
+        static bool load(const uint8_t *pos, uint8_t bit_mask) {
+            return (*pos & bit_mask) != 0;
+        }
+    };
+    template<typename T> struct SchemaLoad {
+        static T load(const uint8_t *pos, uint8_t) {
+            return *reinterpret_cast<const T *>(pos);
+        }
+    };
+    template<> struct SchemaType<uint8_t> : SchemaLoad<uint8_t> {
+        static const ExtentType::fieldType type = ExtentType::ft_byte;
+    };
+    template<> struct SchemaType<int32_t> : SchemaLoad<int32_t> {
+        static const ExtentType::fieldType type = ExtentType::ft_int32;
+    };
+    template<> struct SchemaType<int64_t> : SchemaLoad<int64_t> {
+        static const ExtentType::fieldType type = ExtentType::ft_int64;
+    };
+    template<> struct SchemaType<double> : SchemaLoad<double> {
+        static const ExtentType::fieldType type = ExtentType::ft_double;
+    };
+}
+
+/** \brief Reads the fixed fields of a type that is known at compile time.
+
+    An ExtentSeries with Int32Field and friends looks each field up
+    when the type changes, but every val() still goes through the
+    field's offset and checks whether the field is nullable.  A schema
+    lists the fields an analysis uses, and which columns they are:
+    \code
+    struct NFSCommonSchema {
+        static const char *typeName() { return "NFS trace: common"; }
+        enum { nfields = 2 };
+        static const dataseries::SchemaField &field(unsigned i) {
+            static const dataseries::SchemaField fields[nfields] = {
+                { "packet_at", ExtentType::ft_int64, false },
+                { "payload_length", ExtentType::ft_int32, true },
+            };
+            return fields[i];
+        }
+        typedef dataseries::SchemaColumn<0, int64_t> packet_at;
+        typedef dataseries::SchemaColumn<1, int32_t, true> payload_length;
+    };
+    \endcode
+    dstypes2cxx -o schema writes these from the types in a file.  A
+    TypedSeries<Schema> checks the layout once per ExtentType, when
+    setExtent() is given an extent of a new type: every field has to
+    exist with the schema's type, and may only be nullable if the
+    schema says so.  After that, val<Column>() is an inline load from
+    the current row, with the column and its type resolved by the
+    compiler, and a null check only for columns the schema marks
+    nullable:
+    \code
+    TypedSeries<NFSCommonSchema> s;
+    for (s.setExtent(e); s.more(); s.next()) {
+        total += s.val<NFSCommonSchema::payload_length>();
+    }
+    \endcode
+    The offsets themselves come from the ExtentType, which lays out the
+    fields when the XML is parsed, so the same schema works for any
+    version of a type that has its fields, in whatever order.  variable32
+    fields aren't in schemas; use a Variable32Field on an ExtentSeries
+    for those. */
+template<class Schema> class TypedSeries {
+  public:
+    TypedSeries() : record_size(0), pos(NULL), end(NULL) { }
+
+    /** Checks type against the schema, and remembers where each of the
+        fields is. setExtent() calls this when the type changes. */
+    void bind(const ExtentType::Ptr &type) {
+        for (unsigned i = 0; i < Schema::nfields; ++i) {
+            const SchemaField &f(Schema::field(i));
+            INVARIANT(type->hasColumn(f.name), boost::format("type %s has no field %s")
+                      % type->getName() % f.name);
+            INVARIANT(type->getFieldType(f.name) == f.type,
+                      boost::format("field %s of type %s is %s, not %s as in the schema")
+                      % f.name % type->getName() % type->getFieldTypeStr(f.name)
+                      % ExtentType::fieldTypeToStr(f.type));
+            bool nullable = type->getNullable(f.name);
+            INVARIANT(f.nullable || !nullable,
+                      boost::format("field %s of type %s is nullable, but not in the schema")
+                      % f.name % type->getName());
+            offsets[i] = type->getOffset(f.name);
+            bit_masks[i] = f.type == ExtentType::ft_bool ? 1 << type->getBitPos(f.name) : 0;
+            if (nullable) {
+                std::string null_name(ExtentType::nullableFieldname(f.name));
+                null_offsets[i] = type->getOffset(null_name);
+                null_masks[i] = 1 << type->getBitPos(null_name);
+            } else {
+                null_offsets[i] = 0;
+                null_masks[i] = 0;
+            }
+        }
+        record_size = type->fixedrecordsize();
+        bound_type = type;
+    }
+
+    /** Starts at the first row of e. */
+    void setExtent(const Extent &e) {
+        if (e.getTypePtr() != bound_type) {
+            bind(e.getTypePtr());
+        }
+        pos = e.fixeddata.begin();
+        end = e.fixeddata.end();
+    }
+
+    void setExtent(const Extent::Ptr &e) {
+        setExtent(*e);
+    }
+
+    void clearExtent() {
+        pos = end = NULL;
+    }
+
+    bool more() const {
+        return pos < end;
+    }
+
+    void next() {
+        pos += record_size;
+    }
+
+    /** Returns the value of Column in the current row, or 0 if it's
+        null. */
+    template<class Column> typename Column::value_type val() const {
+        typedef detail::SchemaType<typename Column::value_type> Type;
+        DEBUG_SINVARIANT(more() && Schema::field(Column::index).type == Type::type);
+        if (Column::nullable && isNull<Column>()) {
+            return 0;
+        }
+        return Type::load(pos + offsets[Column::index], bit_masks[Column::index]);
+    }
+
+    /** Always false for columns the schema doesn't mark nullable, or
+        that aren't nullable in the current type. */
+    template<class Column> bool isNull() const {
+        return Column::nullable
+            && (pos[null_offsets[Column::index]] & null_masks[Column::index]) != 0;
+    }
+
+  private:
+    ExtentType::Ptr bound_type;
+    size_t record_size;
+    const uint8_t *pos, *end;
+    int32_t offsets[Schema::nfields], null_offsets[Schema::nfields];
+    uint8_t bit_masks[Schema::nfields], null_masks[Schema::nfields];
+};
+
+} // namespace dataseries
+
+#endif
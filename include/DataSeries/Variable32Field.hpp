@@ -50,6 +50,21 @@ class Variable32Field : public Field {
         return stringval(e, rowPos(e, row_offset));
     }
 
+    /** For a pack_dictionary field, returns the code of the value in
+        the dictionaries of the file the extent was read from (or
+        written to); within one file, equal codes mean equal values, so
+        filters and group-bys can compare codes rather than strings.
+        Returns 0 for the empty string, for values set since the extent
+        was read, which do not have a code yet, and for fields that are
+        not pack_dictionary fields. */
+    int32 code() const {
+        return code(dataseries.getExtentRef(), rowPos());
+    }
+
+    int32 code(const Extent &e, const dataseries::SEP_RowOffset &row_offset) const {
+        return code(e, rowPos(e, row_offset));
+    }
+
     /// Allocate, data_size bytes of space.  The space may not be
     /// initialized.  This function is intended to be used with
     /// partialSet in order to efficiently put together multiple parts
@@ -174,9 +189,17 @@ class Variable32Field : public Field {
         DEBUG_SINVARIANT(e.insideExtentFixed(fixed_data_ptr));
         *reinterpret_cast<int32_t *>(fixed_data_ptr) = 0;
         DEBUG_SINVARIANT(*reinterpret_cast<int32_t *>(e.variabledata.begin()) == 0);
+        if (code_pos >= 0) {
+            *reinterpret_cast<int32_t *>(row_offset + code_pos) = 0;
+        }
         setNull(e, row_offset, false);
     }        
 
+    int32 code(const Extent &e, uint8_t *row_pos) const {
+        DEBUG_SINVARIANT(e.insideExtentFixed(row_pos));
+        return code_pos < 0 ? 0 : *reinterpret_cast<const int32 *>(row_pos + code_pos);
+    }
+
     void set(Extent &e, uint8_t *row_pos, const void *data, uint32_t data_size) {
         allocateSpace(e, row_pos, data_size);
         partialSet(e, row_pos, data, data_size, 0);
@@ -233,6 +256,7 @@ class Variable32Field : public Field {
         return size + (12 - (size % 8)) % 8;
     }
     int offset_pos;
+    int code_pos; // -1 unless this is a pack_dictionary field
     bool unique;
 
   private:
@@ -0,0 +1,88 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Per-extent minimum and maximum values of the numeric fields of a file
+*/
+
+#ifndef DATASERIES_ZONEMAP_HPP
+#define DATASERIES_ZONEMAP_HPP
+
+#include <inttypes.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <DataSeries/Extent.hpp>
+
+class ExtentSeries;
+class GeneralValue;
+
+namespace dataseries {
+
+/** \brief The zone maps of the extents of a file.
+
+    A zone is the range of the values of one byte, int32, int64 or
+    double field in one extent, and the number of records where the
+    field is null.  DataSeriesSink computes the zones of every extent
+    it writes to a DSv2 file, and stores them in one extent of type
+    ExtentType::getDataSeriesZoneMapTypePtr() just before the index at
+    the end of the file; DataSeriesSource reads them back, and
+    TypeIndexModule::addRangeFilter uses them to skip extents. */
+class ZoneMap {
+  public:
+    struct Zone {
+        std::string field;
+        /** false if the field is null (or NaN) in every record, in which
+            case the minimum and maximum are unset. */
+        bool have_values;
+        /** true for a double field, whose range is in min_double and
+            max_double rather than min_int and max_int. */
+        bool is_double;
+        int64_t min_int, max_int;
+        double min_double, max_double;
+        int32_t null_count;
+        Zone() : have_values(false), is_double(false), min_int(0), max_int(0),
+                 min_double(0), max_double(0), null_count(0) { }
+    };
+    typedef std::vector<Zone> ExtentZones;
+
+    /** Computes the zones of the numeric fields of e; the values of
+        double fields are as stored, i.e. without the field's
+        opt_doublebase. */
+    static void computeZones(const Extent &e, ExtentZones &zones);
+
+    /** Appends a record to series, which has to be of the zone map type,
+        for each of the zones of the extent at offset. */
+    static void appendZones(ExtentSeries &series, int64_t offset, const ExtentZones &zones);
+
+    /** Adds the zones stored in an extent of the zone map type. */
+    void add(const Extent::Ptr &e);
+
+    void clear() { extent_zones.clear(); }
+    bool empty() const { return extent_zones.empty(); }
+
+    /** Returns the zone of field in the extent at offset, or NULL if
+        there is none. */
+    const Zone *find(int64_t offset, const std::string &field) const;
+
+    /** Returns false if the zone of field in the extent at offset shows
+        that no value of the field is in [min, max]; returns true if it
+        may be, or there is no zone for the field.  If nulls_match, an
+        extent where the field is null in any record may also match. */
+    bool mayOverlap(int64_t offset, const std::string &field,
+                    const GeneralValue &min, const GeneralValue &max,
+                    bool nulls_match = false) const;
+
+  private:
+    std::map<int64_t, ExtentZones> extent_zones;
+};
+
+} // namespace dataseries
+
+#endif
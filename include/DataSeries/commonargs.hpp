@@ -18,10 +18,12 @@ struct commonPackingArgs {
     int compress_level;
     int compress_modes;
     int extent_size;
+    uint32_t compress_block_size;
+    Extent::CompressionPolicy compress_policy;
     commonPackingArgs() 
             : compress_level(9), 
               compress_modes(Extent::compress_all), 
-              extent_size(-1)
+              extent_size(-1), compress_block_size(0), compress_policy()
     { }
 };
 
@@ -0,0 +1,202 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    BloomFilters implementation
+*/
+
+#include <algorithm>
+
+#include <Lintel/HashFns.hpp>
+
+#include <DataSeries/BloomFilter.hpp>
+#include <DataSeries/ExtentField.hpp>
+
+using namespace std;
+
+namespace dataseries {
+
+uint64_t BloomFilters::Filter::hash(const void *data, uint32_t size) {
+    uint32_t a = lintel::bobJenkinsHash(1972, data, size);
+    uint32_t b = lintel::bobJenkinsHash(a, data, size);
+    return (static_cast<uint64_t>(a) << 32) | b;
+}
+
+uint64_t BloomFilters::Filter::hash(int64_t value) {
+    uint8_t bytes[8];
+    for (unsigned i = 0; i < 8; ++i) {
+        bytes[i] = static_cast<uint8_t>(static_cast<uint64_t>(value) >> (8 * i));
+    }
+    return hash(bytes, 8);
+}
+
+void BloomFilters::Filter::init(size_t ndistinct) {
+    // 7 hashes minimizes the false positives at 10 bits per value; rounding
+    // up to a power of 2 only gives more bits.
+    size_t nwords = 1;
+    while (nwords * 64 < ndistinct * 10) {
+        nwords *= 2;
+    }
+    nhashes = 7;
+    bits.assign(nwords, 0);
+}
+
+// Each probe is a + i * b, the double hashing of Kirsch and Mitzenmacher.
+void BloomFilters::Filter::add(uint64_t hash) {
+    uint32_t a = hash >> 32, b = static_cast<uint32_t>(hash) | 1;
+    uint32_t mask = bits.size() * 64 - 1;
+    for (uint32_t i = 0; i < nhashes; ++i, a += b) {
+        bits[(a & mask) / 64] |= 1ULL << (a % 64);
+    }
+}
+
+bool BloomFilters::Filter::mayContain(uint64_t hash) const {
+    uint32_t a = hash >> 32, b = static_cast<uint32_t>(hash) | 1;
+    uint32_t mask = bits.size() * 64 - 1;
+    for (uint32_t i = 0; i < nhashes; ++i, a += b) {
+        if ((bits[(a & mask) / 64] & (1ULL << (a % 64))) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void BloomFilters::computeFilters(const Extent &e, ExtentFilters &filters) {
+    filters.clear();
+    const ExtentType &type(*e.getTypePtr());
+    uint32_t record_size = type.fixedrecordsize();
+    uint32_t nrecords = record_size == 0 ? 0 : e.fixeddata.size() / record_size;
+    vector<uint64_t> hashes;
+    for (uint32_t i = 0; i < type.getNFields(); ++i) {
+        const string &name(type.getFieldName(i));
+        if (!type.getBloomFilter(name)) {
+            continue;
+        }
+        ExtentType::fieldType field_type = type.getFieldType(name);
+        const Extent::byte *record = e.fixeddata.begin();
+        int32_t offset = type.getOffset(name);
+        const Extent::byte *nulls = NULL;
+        Extent::byte null_mask = 0;
+        if (type.getNullable(name)) {
+            const string null_name(ExtentType::nullableFieldname(name));
+            nulls = e.fixeddata.begin() + type.getOffset(null_name);
+            null_mask = 1 << type.getBitPos(null_name);
+        }
+
+        hashes.clear();
+        hashes.reserve(nrecords);
+        for (uint32_t j = 0; j < nrecords; ++j, record += record_size) {
+            if (nulls != NULL && (nulls[j * record_size] & null_mask)) {
+                continue;
+            }
+            switch (field_type) {
+                case ExtentType::ft_int32:
+                    hashes.push_back(Filter::hash(*reinterpret_cast<const int32_t *>
+                                                  (record + offset)));
+                    break;
+                case ExtentType::ft_int64:
+                    hashes.push_back(Filter::hash(*reinterpret_cast<const int64_t *>
+                                                  (record + offset)));
+                    break;
+                default: {
+                    // a variable32 field is the offset of the value's size,
+                    // which is followed by the value
+                    int32_t varoffset = *reinterpret_cast<const int32_t *>(record + offset);
+                    const Extent::byte *value = e.variabledata.begin() + varoffset;
+                    hashes.push_back(Filter::hash(value + 4,
+                                                  *reinterpret_cast<const int32_t *>(value)));
+                    break;
+                }
+            }
+        }
+        sort(hashes.begin(), hashes.end());
+        hashes.erase(unique(hashes.begin(), hashes.end()), hashes.end());
+
+        filters.push_back(Filter());
+        Filter &filter(filters.back());
+        filter.field = name;
+        filter.init(hashes.size());
+        for (vector<uint64_t>::iterator j = hashes.begin(); j != hashes.end(); ++j) {
+            filter.add(*j);
+        }
+    }
+}
+
+void BloomFilters::appendFilters(ExtentSeries &series, int64_t offset,
+                                 const ExtentFilters &filters) {
+    Int64Field extent_offset(series, "offset");
+    Variable32Field field(series, "field");
+    ByteField nhashes(series, "nhashes");
+    Variable32Field bits(series, "bits");
+
+    string tmp;
+    for (ExtentFilters::const_iterator i = filters.begin(); i != filters.end(); ++i) {
+        series.newRecord();
+        extent_offset.set(offset);
+        field.set(i->field);
+        nhashes.set(i->nhashes);
+        // stored little endian, so files can move between machines
+        tmp.resize(i->bits.size() * 8);
+        for (size_t j = 0; j < tmp.size(); ++j) {
+            tmp[j] = static_cast<char>(i->bits[j / 8] >> (8 * (j % 8)));
+        }
+        bits.set(tmp);
+    }
+}
+
+void BloomFilters::add(const Extent::Ptr &e) {
+    ExtentSeries series(e);
+    Int64Field extent_offset(series, "offset");
+    Variable32Field field(series, "field");
+    ByteField nhashes(series, "nhashes");
+    Variable32Field bits(series, "bits");
+
+    for (; series.morerecords(); ++series) {
+        ExtentFilters &filters(extent_filters[extent_offset.val()]);
+        filters.push_back(Filter());
+        Filter &filter(filters.back());
+        filter.field = field.stringval();
+        filter.nhashes = nhashes.val();
+        const uint8_t *data = bits.val();
+        int32_t size = bits.size();
+        INVARIANT(size > 0 && size % 8 == 0 && ((size / 8) & (size / 8 - 1)) == 0,
+                  boost::format("bad Bloom filter size %d for field %s") % size % filter.field);
+        filter.bits.assign(size / 8, 0);
+        for (int32_t j = 0; j < size; ++j) {
+            filter.bits[j / 8] |= static_cast<uint64_t>(data[j]) << (8 * (j % 8));
+        }
+    }
+}
+
+const BloomFilters::Filter *BloomFilters::find(int64_t offset, const string &field) const {
+    map<int64_t, ExtentFilters>::const_iterator i = extent_filters.find(offset);
+    if (i == extent_filters.end()) {
+        return NULL;
+    }
+    for (ExtentFilters::const_iterator j = i->second.begin(); j != i->second.end(); ++j) {
+        if (j->field == field) {
+            return &*j;
+        }
+    }
+    return NULL;
+}
+
+bool BloomFilters::mayContainAny(int64_t offset, const string &field,
+                                 const vector<uint64_t> &hashes) const {
+    const Filter *filter = find(offset, field);
+    if (filter == NULL) {
+        return true;
+    }
+    for (vector<uint64_t>::const_iterator i = hashes.begin(); i != hashes.end(); ++i) {
+        if (filter->mayContain(*i)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace dataseries
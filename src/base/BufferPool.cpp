@@ -0,0 +1,256 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    BufferPool implementation
+*/
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <Lintel/LintelLog.hpp>
+#include <Lintel/PThread.hpp>
+
+#include <DataSeries/BufferPool.hpp>
+
+using namespace std;
+using boost::format;
+
+namespace dataseries {
+
+namespace {
+
+// Four classes per power of two: b, 5b/4, 6b/4, 7b/4, 2b, ...
+const unsigned nclasses = 4 * 14 + 1;
+const size_t huge_page_size = 2 * 1024 * 1024;
+
+size_t per_thread_limit = 16 * 1024 * 1024;
+size_t shared_limit = 128 * 1024 * 1024;
+bool use_huge_pages = false;
+
+// The limits are set rarely and read often; relaxed atomics keep that
+// from being a race without costing anything.
+template<typename T> T relaxedLoad(const T &from) {
+    return __atomic_load_n(&from, __ATOMIC_RELAXED);
+}
+
+template<typename T> void relaxedStore(T &into, T value) {
+    __atomic_store_n(&into, value, __ATOMIC_RELAXED);
+}
+
+// Only the owning thread updates the counters of a thread cache, but
+// getStats() reads them from other threads.
+void bump(uint64_t &counter) {
+    relaxedStore(counter, relaxedLoad(counter) + 1);
+}
+
+// Returns the index of the smallest class that holds size bytes, and its
+// size in *class_size; size has to be in [min_pooled_size, max_pooled_size].
+unsigned sizeClass(size_t size, size_t *class_size) {
+    size_t base = BufferPool::min_pooled_size;
+    if (size <= base) {
+        *class_size = base;
+        return 0;
+    }
+    unsigned octave = 0;
+    while (base * 2 < size) {
+        base *= 2;
+        ++octave;
+    }
+    size_t step = ((size - base) * 4 + base - 1) / base; // base < size <= 2 * base
+    SINVARIANT(step >= 1 && step <= 4);
+    *class_size = base * (4 + step) / 4;
+    return octave * 4 + step;
+}
+
+size_t classSize(unsigned index) {
+    if (index == 0) {
+        return BufferPool::min_pooled_size;
+    }
+    unsigned octave = (index - 1) / 4;
+    return (BufferPool::min_pooled_size << octave) * (4 + index - octave * 4) / 4;
+}
+
+struct FreeLists {
+    vector<uint8_t *> buffers[nclasses];
+    size_t bytes;
+
+    FreeLists() : bytes(0) { }
+
+    uint8_t *pop(unsigned index, size_t size) {
+        if (buffers[index].empty()) {
+            return NULL;
+        }
+        uint8_t *ret = buffers[index].back();
+        buffers[index].pop_back();
+        relaxedStore(bytes, bytes - size);
+        return ret;
+    }
+
+    bool push(unsigned index, uint8_t *buffer, size_t size, size_t limit) {
+        if (bytes + size > limit) {
+            return false;
+        }
+        buffers[index].push_back(buffer);
+        relaxedStore(bytes, bytes + size);
+        return true;
+    }
+};
+
+struct ThreadCache {
+    FreeLists lists;
+    uint64_t allocations, hits;
+
+    ThreadCache() : allocations(0), hits(0) { }
+};
+
+struct Shared {
+    PThreadMutex mutex;
+    FreeLists lists;
+    // the counters of the thread caches that have gone away are added in
+    BufferPool::Stats stats;
+    vector<ThreadCache *> caches;
+};
+
+pthread_once_t init_once = PTHREAD_ONCE_INIT;
+pthread_key_t cache_key;
+Shared *shared; // never deleted; buffers are freed during exit
+
+void threadExit(void *arg);
+
+void init() {
+    shared = new Shared();
+    INVARIANT(pthread_key_create(&cache_key, threadExit) == 0, "pthread_key_create failed");
+}
+
+uint8_t *systemAllocate(size_t size) {
+    void *ret;
+    if (relaxedLoad(use_huge_pages) && size >= huge_page_size) {
+        INVARIANT(posix_memalign(&ret, huge_page_size, size) == 0,
+                  format("out of memory allocating %d bytes") % size);
+#ifdef MADV_HUGEPAGE
+        madvise(ret, size, MADV_HUGEPAGE); // only advice; fine if it fails
+#endif
+    } else {
+        ret = malloc(size);
+        INVARIANT(ret != NULL, format("out of memory allocating %d bytes") % size);
+    }
+    return static_cast<uint8_t *>(ret);
+}
+
+ThreadCache *threadCache() {
+    pthread_once(&init_once, init);
+    ThreadCache *ret = static_cast<ThreadCache *>(pthread_getspecific(cache_key));
+    if (ret == NULL) {
+        ret = new ThreadCache();
+        pthread_setspecific(cache_key, ret);
+        PThreadScopedLock lock(shared->mutex);
+        shared->caches.push_back(ret);
+    }
+    return ret;
+}
+
+// Moves the buffers of an exiting thread to the shared cache, or frees
+// them if they don't fit.
+void threadExit(void *arg) {
+    ThreadCache *cache = static_cast<ThreadCache *>(arg);
+    PThreadScopedLock lock(shared->mutex);
+    shared->caches.erase(find(shared->caches.begin(), shared->caches.end(), cache));
+    shared->stats.allocations += cache->allocations;
+    shared->stats.thread_hits += cache->hits;
+    size_t limit = relaxedLoad(shared_limit);
+    for (unsigned i = 0; i < nclasses; ++i) {
+        vector<uint8_t *> &buffers(cache->lists.buffers[i]);
+        for (vector<uint8_t *>::iterator j = buffers.begin(); j != buffers.end(); ++j) {
+            if (!shared->lists.push(i, *j, classSize(i), limit)) {
+                ++shared->stats.frees_to_system;
+                ::free(*j);
+            }
+        }
+    }
+    delete cache;
+}
+
+} // anonymous namespace
+
+uint8_t *BufferPool::allocate(size_t *size) {
+    if (*size < min_pooled_size || *size > max_pooled_size
+        || (relaxedLoad(per_thread_limit) == 0 && relaxedLoad(shared_limit) == 0)) {
+        return systemAllocate(*size);
+    }
+    unsigned index = sizeClass(*size, size);
+    ThreadCache *cache = threadCache();
+    bump(cache->allocations);
+    uint8_t *ret = cache->lists.pop(index, *size);
+    if (ret != NULL) {
+        bump(cache->hits);
+        return ret;
+    }
+    {
+        PThreadScopedLock lock(shared->mutex);
+        ret = shared->lists.pop(index, *size);
+        if (ret != NULL) {
+            ++shared->stats.shared_hits;
+            return ret;
+        }
+    }
+    return systemAllocate(*size);
+}
+
+void BufferPool::free(uint8_t *buffer, size_t size) {
+    if (buffer == NULL) {
+        return;
+    }
+    size_t class_size = 0;
+    if (size < min_pooled_size || size > max_pooled_size) {
+        ::free(buffer);
+        return;
+    }
+    unsigned index = sizeClass(size, &class_size);
+    if (class_size != size) { // allocated while pooling was off
+        ::free(buffer);
+        return;
+    }
+    ThreadCache *cache = threadCache();
+    if (cache->lists.push(index, buffer, size, relaxedLoad(per_thread_limit))) {
+        return;
+    }
+    PThreadScopedLock lock(shared->mutex);
+    if (!shared->lists.push(index, buffer, size, relaxedLoad(shared_limit))) {
+        ++shared->stats.frees_to_system;
+        ::free(buffer);
+    }
+}
+
+void BufferPool::setCacheLimits(size_t per_thread_bytes, size_t shared_bytes) {
+    relaxedStore(per_thread_limit, per_thread_bytes);
+    relaxedStore(shared_limit, shared_bytes);
+}
+
+void BufferPool::setUseHugePages(bool huge_pages) {
+    relaxedStore(use_huge_pages, huge_pages);
+}
+
+BufferPool::Stats BufferPool::getStats() {
+    pthread_once(&init_once, init);
+    PThreadScopedLock lock(shared->mutex);
+    Stats ret(shared->stats);
+    ret.cached_bytes = shared->lists.bytes;
+    for (vector<ThreadCache *>::iterator i = shared->caches.begin();
+         i != shared->caches.end(); ++i) {
+        ret.allocations += relaxedLoad((**i).allocations);
+        ret.thread_hits += relaxedLoad((**i).hits);
+        ret.cached_bytes += relaxedLoad((**i).lists.bytes);
+    }
+    return ret;
+}
+
+} // namespace dataseries
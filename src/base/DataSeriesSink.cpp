@@ -1,10 +1,17 @@
 #include <DataSeries/DataSeriesSink.hpp>
 
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <fcntl.h>
 
+#include <boost/bind.hpp>
+
 #include <Lintel/LintelLog.hpp>
 #include <Lintel/HashFns.hpp>
+#include <Lintel/StringUtil.hpp>
+
+#include "OutputFile.hpp"
+#include "SequencedRing.hpp"
 
 dataseries::IExtentSink::~IExtentSink() { }
 
@@ -17,20 +24,6 @@ using boost::format;
 // It is declared in Extent.hpp.
 const int MAX_THREADS = 32;
 
-class DataSeriesSinkPThreadCompressor : public PThread {
-  public:
-    DataSeriesSinkPThreadCompressor(DataSeriesSink *_mine)
-    : mine(_mine) { }
-
-    virtual ~DataSeriesSinkPThreadCompressor() { }
-
-    virtual void *run() {
-        mine->compressorThread();
-        return NULL;
-    }
-    DataSeriesSink *mine;
-};
-
 class DataSeriesSinkPThreadWriter : public PThread {
   public:
     DataSeriesSinkPThreadWriter(DataSeriesSink *_mine)
@@ -47,72 +40,117 @@ class DataSeriesSinkPThreadWriter : public PThread {
 
 int DataSeriesSink::compressor_count = -1;
 
-void DataSeriesSink::WorkerInfo::startThreads(PThreadScopedLock &lock, DataSeriesSink *sink) {
-    int pthread_count = compressor_count;
-    if (pthread_count == -1) {
-        pthread_count = min( PThreadMisc::getNCpus(), MAX_THREADS / 2);
+static uint32_t defaultFormatVersion() {
+    const char *env = getenv("DATASERIES_FORMAT_VERSION");
+    if (env == NULL) {
+        return 1;
     }
-    
-    for (int i=0; i < pthread_count; ++i) {
-        compressors.push_back(new DataSeriesSinkPThreadCompressor(sink));
-        compressors.back()->start();
+    uint32_t ret = stringToInteger<uint32_t>(env);
+    INVARIANT(ret == 1 || ret == 2, format("invalid DATASERIES_FORMAT_VERSION=%s") % env);
+    return ret;
+}
+
+static bool defaultDirectIO() {
+    const char *env = getenv("DATASERIES_DIRECT_IO");
+    if (env == NULL) {
+        return false;
     }
-    if (compressors.empty()) {
+    INVARIANT(strcmp(env, "0") == 0 || strcmp(env, "1") == 0,
+              format("invalid DATASERIES_DIRECT_IO=%s; expected 0 or 1") % env);
+    return strcmp(env, "1") == 0;
+}
+
+void DataSeriesSink::WorkerInfo::startThreads(PThreadScopedLock &lock, DataSeriesSink *sink) {
+    if (compressor_count == 0) {
+        pending_work = new dataseries::SequencedRing<ToCompress>(1);
         writer = NULL;
+        return;
+    }
+    compress_queue = new dataseries::TaskPool::Queue();
+    if (compressor_count == -1) {
+        // leave a thread for the sources and other sinks sharing the pool
+        max_compressing = max(1U, dataseries::TaskPool::shared().nThreads() - 1);
     } else {
-        writer = new DataSeriesSinkPThreadWriter(sink);
-        writer->start();
+        max_compressing = compressor_count;
     }
+    pending_work = new dataseries::SequencedRing<ToCompress>(2 * max_compressing);
+    writer = new DataSeriesSinkPThreadWriter(sink);
+    writer->start();
 }
 
 void DataSeriesSink::WorkerInfo::stopThreads(PThreadScopedLock &lock) {
-    keep_going = false;
+    __atomic_store_n(&keep_going, false, __ATOMIC_SEQ_CST);
     
-    available_work_cond.broadcast();
-    available_write_cond.broadcast();
-
-    PThreadScopedUnlock unlock(lock);
+    if (compress_queue == NULL) {
+        return;
+    }
+    pending_work->wakeConsumer();
+    {
+        PThreadScopedUnlock unlock(lock);
 
-    for (vector<PThread *>::iterator i = compressors.begin();
-         i != compressors.end(); ++i) {
-        (**i).join();
-        delete *i;
+        // A compress task resubmits itself while there is anything left to
+        // claim, so this waits for all of the pending work to be compressed.
+        compress_queue->wait();
+        writer->join();
     }
-    compressors.clear();
-    writer->join();
+    delete compress_queue;
+    compress_queue = NULL;
     delete writer;
     writer = NULL;
 }
 
-void DataSeriesSink::WorkerInfo::setMaxBytesInProgress(PThreadMutex &mutex, size_t nbytes) {
-    PThreadScopedLock lock(mutex);
-    if (nbytes > max_bytes_in_progress) {
-        // May be able to get both more work and more things queued.
-        available_work_cond.broadcast();
-        available_queue_cond.broadcast();
+void DataSeriesSink::WorkerInfo::setMaxBytesInProgress(size_t nbytes) {
+    __atomic_store_n(&max_bytes_in_progress, nbytes, __ATOMIC_SEQ_CST);
+    if (pending_work != NULL) {
+        // May be able to get more things queued.
+        pending_work->popEvent().notifyAll();
     }
-    max_bytes_in_progress = nbytes;
 }    
 
-void DataSeriesSink::WorkerInfo::flushPending(PThreadMutex &mutex) {
-    PThreadScopedLock lock(mutex);
-    while (bytes_in_progress > 0) {
-        available_queue_cond.wait(mutex);
+// Waits until there is room to queue more work, or with flush until all of
+// it has been written; the writer lowers bytes_in_progress before popping.
+void DataSeriesSink::WorkerInfo::waitForProgress(bool flush) {
+    while (flush ? __atomic_load_n(&bytes_in_progress, __ATOMIC_SEQ_CST) > 0 : !canQueueWork()) {
+        SINVARIANT(pending_work != NULL);
+        dataseries::EventCount &popped(pending_work->popEvent());
+        uint32_t key = popped.prepareWait();
+        if (flush ? __atomic_load_n(&bytes_in_progress, __ATOMIC_SEQ_CST) == 0 : canQueueWork()) {
+            popped.cancelWait();
+            break;
+        }
+        popped.wait(key);
     }
 }
 
+// Counts one more running compress task, if there is room for it.
+bool DataSeriesSink::WorkerInfo::reserveCompressor() {
+    unsigned n = __atomic_load_n(&compressing, __ATOMIC_SEQ_CST);
+    while (n < max_compressing) {
+        if (__atomic_compare_exchange_n(&compressing, &n, n + 1, false,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+            return true;
+        }
+    }
+    return false;
+}
 
 DataSeriesSink::DataSeriesSink(int compression_modes, int compression_level)
         : stats(), mutex(), valid_types(), compression_modes(compression_modes),
-          compression_level(compression_level), writer_info(), 
-          worker_info(256*1024*1024), filename()
+          compression_level(compression_level), compression_block_size(0),
+          compression_policy(), policy_choices(), dictionaries(), dictionary_ids(),
+          format_version(defaultFormatVersion()), direct_io(defaultDirectIO()),
+          field_dictionary_mutex(),
+          field_dictionaries(), writer_info(), worker_info(256*1024*1024), filename()
 { }
 
 DataSeriesSink::DataSeriesSink(const string &filename, int compression_modes,
                                int compression_level)
         : stats(), mutex(), valid_types(), compression_modes(compression_modes),
-          compression_level(compression_level), writer_info(),
-          worker_info(256*1024*1024), filename()
+          compression_level(compression_level), compression_block_size(0),
+          compression_policy(), policy_choices(), dictionaries(), dictionary_ids(),
+          format_version(defaultFormatVersion()), direct_io(defaultDirectIO()),
+          field_dictionary_mutex(),
+          field_dictionaries(), writer_info(), worker_info(256*1024*1024), filename()
 {
     open(filename);
 }
@@ -138,11 +176,11 @@ void DataSeriesSink::open(const string &in_filename) {
     stats.packed_size += 2*4 + 4*8;
 
     INVARIANT(filename != "-", "opening stdout as a file isn't expected to work, and '-' as a filename makes little sense");
-    writer_info.fd = ::open(filename.c_str(), O_WRONLY | O_LARGEFILE | O_CREAT | O_TRUNC, 0666);
-    INVARIANT(writer_info.fd >= 0,
-              format("Error opening %s for write: %s") % filename % strerror(errno));
-    const string filetype = "DSv1";
-    checkedWrite(filetype.data(),4);
+    writer_info.file = new dataseries::OutputFile(filename);
+    if (direct_io) {
+        writer_info.file->setDirect();
+    }
+    writeFileType();
     ExtentType::int32 int32check = 0x12345678;
     checkedWrite(&int32check,4);
     ExtentType::int64 int64check = 0x123456789ABCDEF0LL;
@@ -155,7 +193,8 @@ void DataSeriesSink::open(const string &in_filename) {
     checkedWrite(&doublecheck,8);
     writer_info.index_series.newExtent();
     writer_info.cur_offset = 2*4 + 4*8;
-    worker_info.keep_going = true;
+    field_dictionaries.reset(new dataseries::FieldDictionaries());
+    __atomic_store_n(&worker_info.keep_going, true, __ATOMIC_SEQ_CST);
     worker_info.startThreads(lock, this);
 }
 
@@ -169,7 +208,9 @@ void DataSeriesSink::close(bool do_fsync, Stats *to_update) {
     worker_info.stopThreads(lock);
     writer_info.writeOutPending(lock, worker_info);
 
-    SINVARIANT(worker_info.pending_work.empty() && worker_info.bytes_in_progress == 0);
+    SINVARIANT(worker_info.pending_work->empty() && worker_info.bytes_in_progress == 0);
+    lockedWriteSummary(lock, writer_info.zone_series);
+    lockedWriteSummary(lock, writer_info.bloom_filter_series);
     ExtentType::int64 index_offset = writer_info.cur_offset;
     
     // Special case handling of record for index series; this will
@@ -181,22 +222,14 @@ void DataSeriesSink::close(bool do_fsync, Stats *to_update) {
     writer_info.field_extentType.set(writer_info.index_series.getTypePtr()->getName());
 
     worker_info.bytes_in_progress += writer_info.index_series.getExtentRef().size();
-    worker_info.pending_work.push_back
-            (new ToCompress(writer_info.index_series.getSharedExtent(), NULL));
-    worker_info.pending_work.front()->in_progress = true;
-    lockedProcessToCompress(lock, worker_info.pending_work.front());
+    uint32_t packed_size = lockedCompressAndWrite
+        (lock, new ToCompress(writer_info.index_series.getSharedExtent(), NULL));
 
-    SINVARIANT(worker_info.bytes_in_progress 
-               == worker_info.pending_work.front()->compressed.size());
-    SINVARIANT(worker_info.pending_work.size() == 1);
-    SINVARIANT(worker_info.pending_work.front()->readyToWrite());
-    uint32_t packed_size = worker_info.pending_work.front()->compressed.size();
-
-    writer_info.writeOutPending(lock, worker_info);
-
-    INVARIANT(worker_info.pending_work.empty() && worker_info.bytes_in_progress == 0, 
-              format("bad %d %d") % worker_info.pending_work.empty()
+    INVARIANT(worker_info.pending_work->empty() && worker_info.bytes_in_progress == 0, 
+              format("bad %d %d") % worker_info.pending_work->empty()
               % worker_info.bytes_in_progress);
+    delete worker_info.pending_work;
+    worker_info.pending_work = NULL;
 
     char *tail = new char[7*4];
     INVARIANT((reinterpret_cast<unsigned long>(tail) % 8) == 0, 
@@ -212,12 +245,9 @@ void DataSeriesSink::close(bool do_fsync, Stats *to_update) {
     *(int32 *)(tail + 24) = lintel::bobJenkinsHash(1776,tail,6*4);
     checkedWrite(tail,7*4);
     delete [] tail;
-    if (do_fsync) {
-        fsync(writer_info.fd);
-    }
-    int ret = ::close(writer_info.fd);
-    INVARIANT(ret == 0, format("close failed: %s") % strerror(errno));
-    writer_info.fd = -1;
+    writer_info.file->close(do_fsync);
+    delete writer_info.file;
+    writer_info.file = NULL;
     writer_info.wrote_library = false;
     writer_info.cur_offset = -1;
     writer_info.chained_checksum = 0;
@@ -233,11 +263,37 @@ void DataSeriesSink::rotate(const string &new_filename, const ExtentTypeLibrary
     FATAL_ERROR("unimplemented");
 }
 
+void DataSeriesSink::setFormatVersion(uint32_t version) {
+    INVARIANT(version == 1 || version == 2, format("unknown format version %d") % version);
+    PThreadScopedLock lock(mutex);
+    INVARIANT(!writer_info.wrote_library,
+              "the format version has to be set before writing the extent library");
+    format_version = version;
+    if (writer_info.file != NULL) { // rewrite the header open() wrote
+        const string filetype = str(format("DSv%d") % format_version);
+        writer_info.file->rewrite(0, filetype.data(), 4);
+    }
+}
+
+void DataSeriesSink::setDirectIO(bool direct) {
+    PThreadScopedLock lock(mutex);
+    INVARIANT(!writer_info.wrote_library,
+              "direct I/O has to be set before writing the extent library");
+    INVARIANT(direct || writer_info.file == NULL || !writer_info.file->isDirect(),
+              "can't turn off direct I/O once the file is open");
+    direct_io = direct;
+    if (direct && writer_info.file != NULL && !writer_info.file->isDirect()) {
+        writer_info.file->setDirect();
+    }
+}
+
+void DataSeriesSink::writeFileType() {
+    const string filetype = str(format("DSv%d") % format_version);
+    checkedWrite(filetype.data(),4);
+}
+
 void DataSeriesSink::WriterInfo::checkedWrite(const void *buf, int bufsize) {
-    ssize_t ret = write(fd, buf, bufsize);
-    INVARIANT(ret != -1, format("Error on write of %d bytes: %s") % bufsize % strerror(errno));
-    INVARIANT(ret == bufsize, format("Partial write %d bytes out of %d bytes (disk full?): %s")
-              % ret % bufsize % strerror(errno));
+    file->write(buf, bufsize);
 }
 
 void DataSeriesSink::writeExtent(Extent &e, Stats *stats) {
@@ -250,9 +306,45 @@ void DataSeriesSink::writeExtent(Extent &e, Stats *stats) {
     Extent::Ptr we(new Extent(e.getTypePtr()));
     we->swap(e);
     
+    if (we->getTypePtr()->hasDictionaryFields()) {
+        // The new dictionary entries have to be in the file before the
+        // first extent that uses them, so they are queued with the lock
+        // held; the extent itself can follow them without it, so other
+        // producers aren't held up while this one waits for room.
+        PThreadScopedLock lock(field_dictionary_mutex);
+        we->encodeDictionaryFields(field_dictionaries);
+        queueDictionaryEntries();
+    }
     queueWriteExtent(we, stats);
 }
 
+void DataSeriesSink::queueDictionaryEntries() {
+    ExtentSeries series(ExtentType::getDataSeriesStringDictionaryTypePtr());
+    Variable32Field extenttype(series, "extenttype");
+    Variable32Field field(series, "field");
+    Int32Field code(series, "code");
+    Variable32Field value(series, "value");
+    for (dataseries::FieldDictionaries::Map::iterator i = field_dictionaries->begin();
+         i != field_dictionaries->end(); ++i) {
+        dataseries::StringDictionary &dictionary(i->second);
+        for (int32_t j = dictionary.nwritten(); j < dictionary.size(); ++j) {
+            if (!series.hasExtent()) {
+                series.newExtent();
+            }
+            series.newRecord();
+            extenttype.set(i->first.first);
+            field.set(i->first.second);
+            code.set(j);
+            value.set(dictionary.decode(j));
+        }
+        dictionary.setWritten();
+    }
+    if (series.hasExtent()) {
+        // the caller waits for room when it queues its extent
+        queueWriteExtent(series.getSharedExtent(), NULL, false);
+    }
+}
+
 void DataSeriesSink::writeExtentLibrary(const ExtentTypeLibrary &lib) {
     INVARIANT(!writer_info.wrote_library, "Can only write extent library once");
     ExtentSeries type_extent_series(ExtentType::getDataSeriesXMLTypePtr());
@@ -281,20 +373,52 @@ void DataSeriesSink::writeExtentLibrary(const ExtentTypeLibrary &lib) {
     }
     queueWriteExtent(type_extent_series.getSharedExtent(), NULL);
 
+    if (!dictionaries.empty()) {
+        ExtentSeries dictionary_series(ExtentType::getDataSeriesCompressionDictionaryTypePtr());
+        dictionary_series.newExtent();
+        Variable32Field extenttype(dictionary_series, "extenttype");
+        Variable32Field dictionary(dictionary_series, "dictionary");
+        for (map<string, string>::iterator i = dictionaries.begin();
+             i != dictionaries.end(); ++i) {
+            dictionary_series.newRecord();
+            extenttype.set(i->first);
+            dictionary.set(i->second);
+        }
+        queueWriteExtent(dictionary_series.getSharedExtent(), NULL);
+    }
+
     PThreadScopedLock lock(mutex);
     INVARIANT(!writer_info.wrote_library, "bad, two calls to writeExtentLibrary()");
     writer_info.wrote_library = true; 
 }
 
+void DataSeriesSink::setCompressionDictionary(const ExtentType::Ptr type,
+                                              const string &dictionary) {
+    INVARIANT(!writer_info.wrote_library,
+              "compression dictionaries have to be set before writing the extent library");
+    uint32_t id = Extent::registerCompressionDictionary(dictionary);
+    INVARIANT(id != 0, "compression dictionaries need DataSeries built with zstd");
+    dictionaries[type->getName()] = dictionary;
+    dictionary_ids[type->getName()] = id;
+}
+
 void DataSeriesSink::removeStatsUpdate(Stats *would_update) {
     PThreadScopedLock lock(mutex);
 
-    for (Deque<ToCompress *>::iterator i = worker_info.pending_work.begin();
-        i != worker_info.pending_work.end(); ++i) {
-        if ((**i).to_update == would_update) {
-            SINVARIANT(would_update->use_count > 0);
-            --would_update->use_count;
-            (**i).to_update = NULL;
+    if (worker_info.pending_work == NULL) {
+        return;
+    }
+    // The writer pops with the mutex held, so the items between the front
+    // and the back can't be deleted under us; ones that are still being
+    // pushed can't be for would_update, since the caller is here.
+    dataseries::SequencedRing<ToCompress> &pending(*worker_info.pending_work);
+    for (uint64_t ticket = pending.front(); ticket != pending.back(); ++ticket) {
+        ToCompress *work = pending.get(ticket);
+        if (work != NULL && work->to_update == would_update) {
+            uint32_t old_count = __atomic_fetch_sub(&would_update->use_count, 1,
+                                                    __ATOMIC_SEQ_CST);
+            SINVARIANT(old_count > 0);
+            work->to_update = NULL;
         }
     }
 }
@@ -327,38 +451,31 @@ void DataSeriesSink::setCompressorCount(int count) {
     compressor_count = count;
 }
 
-void DataSeriesSink::queueWriteExtent(Extent::Ptr e, Stats *to_update) {
-    PThreadScopedLock lock(mutex);
+void DataSeriesSink::queueWriteExtent(Extent::Ptr e, Stats *to_update, bool wait_for_room) {
     if (to_update) {
-        ++to_update->use_count;
+        __atomic_add_fetch(&to_update->use_count, 1, __ATOMIC_SEQ_CST);
     }
-    INVARIANT(worker_info.keep_going, "got to qWE after call to close()??");
-    INVARIANT(writer_info.cur_offset > 0, "queueWriteExtent on closed file");
+    // the writer moves cur_offset, so keep_going says if the file is open
+    INVARIANT(__atomic_load_n(&worker_info.keep_going, __ATOMIC_SEQ_CST),
+              "got to qWE after call to close()??");
     LintelLogDebug("DataSeriesSink", format("queueWriteExtent(%d bytes)") % e->size());
-    worker_info.bytes_in_progress += e->size(); // putting this into ToCompress erases e
-    worker_info.pending_work.push_back(new ToCompress(e, to_update));
-
-    if (worker_info.compressors.empty()) {
-        SINVARIANT(worker_info.pending_work.size() == 1 && worker_info.bytes_in_progress == 0);
-        worker_info.pending_work.front()->in_progress = true;
-        worker_info.bytes_in_progress += e->size();
-        lockedProcessToCompress(lock, worker_info.pending_work.front());
-        worker_info.pending_work.front()->in_progress = false;
-        writer_info.writeOutPending(lock, worker_info);
+    // putting this into ToCompress erases e
+    __atomic_add_fetch(&worker_info.bytes_in_progress, e->size(), __ATOMIC_SEQ_CST);
+    ToCompress *work = new ToCompress(e, to_update);
+
+    if (worker_info.compress_queue == NULL) {
+        PThreadScopedLock lock(mutex);
+        lockedCompressAndWrite(lock, work);
         SINVARIANT(worker_info.bytes_in_progress == 0);
         return;
     } 
         
-    worker_info.available_work_cond.signal();
-    LintelLogDebug("DataSeriesSink", format("qwe wait? %d %d\n") % worker_info.bytes_in_progress
-                   % worker_info.pending_work.size());
-    while (!worker_info.canQueueWork()) {
-        INVARIANT(worker_info.keep_going, "got to qWE after call to close()??");
-        INVARIANT(writer_info.cur_offset > 0, "queueWriteExtent on closed file");
-        LintelLogDebug("DataSeriesSink", format("after queueWriteExtent %d >= %d || %d >= %d")
-                       % worker_info.bytes_in_progress % worker_info.max_bytes_in_progress 
-                       % worker_info.pending_work.size() % (2 * worker_info.compressors.size()));
-        worker_info.available_queue_cond.wait(mutex);
+    worker_info.pending_work->push(work); // waits if there are too many queued
+    startCompressing();
+    if (wait_for_room) {
+        LintelLogDebug("DataSeriesSink", format("qwe wait? %d\n")
+                       % __atomic_load_n(&worker_info.bytes_in_progress, __ATOMIC_SEQ_CST));
+        worker_info.waitForProgress(false);
     }
 }
 
@@ -372,10 +489,14 @@ DataSeriesSink::Stats DataSeriesSink::getStats(Stats *from) {
 }
 
 void DataSeriesSink::WriterInfo::writeOutPending(PThreadScopedLock &lock, WorkerInfo &worker_info) {
-    Deque<ToCompress *> to_write;
-    while (worker_info.frontReadyToWrite()) {
-        to_write.push_back(worker_info.pending_work.front());
-        worker_info.pending_work.pop_front();
+    dataseries::SequencedRing<ToCompress> &pending(*worker_info.pending_work);
+    vector<ToCompress *> to_write;
+    for (uint64_t ticket = pending.front(); ; ++ticket) {
+        ToCompress *tc = pending.getFinished(ticket);
+        if (tc == NULL) {
+            break;
+        }
+        to_write.push_back(tc);
     }
     
     size_t bytes_written = 0;
@@ -383,12 +504,14 @@ void DataSeriesSink::WriterInfo::writeOutPending(PThreadScopedLock &lock, Worker
         ExtentWriteCallback ewc(extent_write_callback);
         PThreadScopedUnlock unlock(lock);
 
-        while (!to_write.empty()) {
-            ToCompress *tc = to_write.front();
-            to_write.pop_front();
+        // all of the extents go out in one write
+        vector<struct iovec> iov;
+        iov.reserve(to_write.size());
+        for (size_t i = 0; i < to_write.size(); ++i) {
+            ToCompress *tc = to_write[i];
             INVARIANT(cur_offset > 0,"Error: writeoutPending on closed file\n");
             
-            if (ewc) {
+            if (ewc && !tc->summary) {
                 ewc(cur_offset, *tc->extent);
             }
             tc->wipeExtent();
@@ -396,24 +519,43 @@ void DataSeriesSink::WriterInfo::writeOutPending(PThreadScopedLock &lock, Worker
             index_series.newRecord();
             field_extentOffset.set(cur_offset);
             field_extentType.set(tc->extent->getTypePtr()->getName());
+            if (!tc->zones.empty()) {
+                if (!zone_series.hasExtent()) {
+                    zone_series.newExtent();
+                }
+                dataseries::ZoneMap::appendZones(zone_series, cur_offset, tc->zones);
+            }
+            if (!tc->bloom_filters.empty()) {
+                if (!bloom_filter_series.hasExtent()) {
+                    bloom_filter_series.newExtent();
+                }
+                dataseries::BloomFilters::appendFilters(bloom_filter_series, cur_offset,
+                                                        tc->bloom_filters);
+            }
             
-            checkedWrite(tc->compressed.begin(), tc->compressed.size());
+            iov.push_back(iovec());
+            iov.back().iov_base = tc->compressed.begin();
+            iov.back().iov_len = tc->compressed.size();
             cur_offset += tc->compressed.size();
             chained_checksum = lintel::BobJenkinsHashMix3(tc->checksum, chained_checksum, 1972);
             bytes_written += tc->compressed.size();
-            delete tc;
+        }
+        if (!iov.empty()) {
+            file->writev(&iov[0], iov.size());
         }
     }
 
-    INVARIANT(worker_info.bytes_in_progress >= bytes_written, format("internal %d %d") 
-              % worker_info.bytes_in_progress % bytes_written);
-    worker_info.bytes_in_progress -= bytes_written;
-    LintelLogDebug("DataSeriesSink", format("qwe broadcast wop? %d %d")
-                   % worker_info.bytes_in_progress % worker_info.pending_work.size());
-    if (worker_info.canQueueWork()) {
-        // Don't say there is free space until we actually finished writing.
-        worker_info.available_queue_cond.broadcast();
+    // deleted with the lock held for removeStatsUpdate
+    for (size_t i = 0; i < to_write.size(); ++i) {
+        delete to_write[i];
     }
+    size_t old_bytes = __atomic_fetch_sub(&worker_info.bytes_in_progress, bytes_written,
+                                          __ATOMIC_SEQ_CST);
+    INVARIANT(old_bytes >= bytes_written, format("internal %d %d") % old_bytes % bytes_written);
+    LintelLogDebug("DataSeriesSink", format("qwe broadcast wop? %d %d")
+                   % (old_bytes - bytes_written) % to_write.size());
+    // Don't say there is free space until we actually finished writing.
+    pending.pop(to_write.size());
 }
 
 static void get_thread_cputime(struct timespec &ts) {
@@ -451,30 +593,98 @@ static void get_thread_cputime(struct timespec &ts) {
     //    return ts.tv_sec + ts.tv_nsec*1.0e-9;
 }
 
+// The algorithm in a compression mode byte, without the chunked and
+// grouped flags.
+static inline int compressionAlg(Extent::byte mode) {
+    return mode & ~(Extent::compress_mode_chunked | Extent::compress_mode_grouped);
+}
+
+// The summaries of the extents are written just before the index, which
+// lists them like any other extent; the extent write callback only sees
+// the extents the user wrote, and the index.
+void DataSeriesSink::lockedWriteSummary(PThreadScopedLock &lock, ExtentSeries &series) {
+    if (!series.hasExtent()) {
+        return;
+    }
+    worker_info.bytes_in_progress += series.getExtentRef().size();
+    lockedCompressAndWrite(lock, new ToCompress(series.getSharedExtent(), NULL, true));
+    series.clearExtent();
+    SINVARIANT(worker_info.pending_work->empty() && worker_info.bytes_in_progress == 0);
+}
+
+// Without threads, or once they have stopped: passes work through the ring
+// in the calling thread, and returns its compressed size.
+size_t DataSeriesSink::lockedCompressAndWrite(PThreadScopedLock &lock, ToCompress *work) {
+    dataseries::SequencedRing<ToCompress> &pending(*worker_info.pending_work);
+    SINVARIANT(pending.empty());
+    uint64_t ticket = pending.push(work);
+    SINVARIANT(pending.claim(ticket) == work);
+    {
+        PThreadScopedUnlock unlock(lock);
+        processToCompress(work);
+    }
+    pending.finish(ticket);
+    size_t packed_size = work->compressed.size();
+    writer_info.writeOutPending(lock, worker_info);
+    return packed_size;
+}
+
 // This function assumes that bytes_in_progress was updated to the
-// uncompressed size prior to calling the function.
-void DataSeriesSink::lockedProcessToCompress(PThreadScopedLock &lock, ToCompress *work) {
-    SINVARIANT(worker_info.bytes_in_progress >= work->extent->size());
+// uncompressed size prior to calling the function, and that the mutex isn't
+// held; it only takes it to pick the compression and to update the stats.
+void DataSeriesSink::processToCompress(ToCompress *work) {
     size_t uncompressed_size = work->extent->size();
-    worker_info.bytes_in_progress += uncompressed_size; // could temporarily be 2*e.size in worst case if we are trying multiple algorithms
+    // could temporarily be 2*e.size in worst case if we are trying multiple algorithms
+    size_t in_progress = __atomic_add_fetch(&worker_info.bytes_in_progress, uncompressed_size,
+                                            __ATOMIC_SEQ_CST); 
+    SINVARIANT(in_progress >= 2 * uncompressed_size);
     LintelLogDebug("DataSeriesSink", format("compress(%d bytes), in progress %d bytes")
-                   % work->extent->size() % worker_info.bytes_in_progress);
+                   % work->extent->size() % in_progress);
+
+    Extent::CompressionPolicy policy(compression_policy);
+    bool policy_trial = false;
+    if (compression_policy.timed()) {
+        PThreadScopedLock lock(mutex);
+        PolicyChoice &choice = policy_choices[work->extent->getTypePtr()->getName()];
+        if (choice.have_choice && choice.extents_until_trial > 0) {
+            --choice.extents_until_trial;
+            policy.use_section_modes = true;
+            policy.fixed_modes = choice.fixed_modes;
+            policy.variable_modes = choice.variable_modes;
+        } else {
+            policy_trial = true;
+            choice.extents_until_trial = compression_policy.sample_interval - 1;
+        }
+    }
 
-    INVARIANT(work->in_progress, "??");
-    INVARIANT(writer_info.cur_offset > 0,"Error: processToCompress on closed file\n");
+    // fixed once the library is written
+    uint32_t *id = dictionary_ids.lookup(work->extent->getTypePtr()->getName());
+    uint32_t dictionary_id = id == NULL ? 0 : *id;
+    // the types the library writes into every file have no zone maps or
+    // Bloom filters
+    bool zone_map = format_version >= 2
+        && !prefixequal(work->extent->getTypePtr()->getName(), "DataSeries: ");
 
     Stats tmp;
     {
-        PThreadScopedUnlock unlock(lock);
-
         size_t nrecords = work->extent->nRecords();
+        if (zone_map) {
+            dataseries::ZoneMap::computeZones(*work->extent, work->zones);
+            dataseries::BloomFilters::computeFilters(*work->extent, work->bloom_filters);
+        }
         struct timespec pack_start, pack_end;
         get_thread_cputime(pack_start);
 
         uint32_t headersize, fixedsize, variablesize;
-        work->checksum = work->extent->packData(work->compressed, compression_modes,
+        work->checksum = work->extent->packData(work->compressed,
+                                                format_version >= 2 ? compression_modes
+                                                : compression_modes & Extent::compress_v1_modes,
                                                 compression_level, &headersize,
-                                                &fixedsize, &variablesize);
+                                                &fixedsize, &variablesize,
+                                                compression_block_size, &policy,
+                                                dictionary_id,
+                                                format_version >= 2 ? Extent::checksum_crc32c
+                                                                    : Extent::checksum_v1);
         get_thread_cputime(pack_end);
 
         double pack_extent_time = (pack_end.tv_sec - pack_start.tv_sec) 
@@ -489,89 +699,71 @@ void DataSeriesSink::lockedProcessToCompress(PThreadScopedLock &lock, ToCompress
                    work->extent->variabledata.size(), variablesize, 
                    work->compressed.size(), 
                    *reinterpret_cast<uint32_t *>(work->compressed.begin()+4), 
-                   nrecords, pack_extent_time, work->compressed[6*4], 
-                   work->compressed[6*4+1]);
+                   nrecords, pack_extent_time, 
+                   compressionAlg(work->compressed[6*4]),
+                   compressionAlg(work->compressed[6*4+1]));
 
         INVARIANT(work->compressed.size() > 0, "??");
 
         SINVARIANT(work->extent->size() == uncompressed_size);
     }
+    PThreadScopedLock lock(mutex);
+    if (policy_trial) {
+        PolicyChoice &choice = policy_choices[work->extent->getTypePtr()->getName()];
+        choice.have_choice = true;
+        choice.fixed_modes = Extent::compression_algs
+            [compressionAlg(work->compressed[6*4])].compress_flag;
+        choice.variable_modes = Extent::compression_algs
+            [compressionAlg(work->compressed[6*4+1])].compress_flag;
+    }
     // update stats, have to do this before we complete the extent
     // as otherwise the work pointer could vanish under us
 
     stats += tmp;
     if (work->to_update != NULL) {
         *work->to_update += tmp;
-        SINVARIANT(work->to_update->use_count > 0);
-        --work->to_update->use_count;
+        uint32_t old_count = __atomic_fetch_sub(&work->to_update->use_count, 1,
+                                                __ATOMIC_SEQ_CST);
+        SINVARIANT(old_count > 0);
         work->to_update = NULL;
     }
-    work->in_progress = false; 
-    SINVARIANT(!worker_info.pending_work.empty());
     
-    SINVARIANT(worker_info.bytes_in_progress >= 2 * uncompressed_size);
-    // subtract the temporary from above and the cleared extent.
-    worker_info.bytes_in_progress -= 2*uncompressed_size; 
-    worker_info.bytes_in_progress += work->compressed.size(); // add in the compressed bits
+    // subtract the temporary from above and the cleared extent, and add in
+    // the compressed bits.
+    __atomic_add_fetch(&worker_info.bytes_in_progress, work->compressed.size(), __ATOMIC_SEQ_CST);
+    in_progress = __atomic_sub_fetch(&worker_info.bytes_in_progress, 2 * uncompressed_size,
+                                     __ATOMIC_SEQ_CST);
+    LintelLogDebug("DataSeriesSink", format("qwe broadcast compr? %d\n") % in_progress);
 }
 
-void  DataSeriesSink::compressorThread()  {
-#if 0
-    // This didn't seem to have any actual effect; it should have let the
-    // copy thread run at 100%, but it didn't seem to have that effect.
-    int policy = -1;
-    struct sched_param param;
-
-    SINVARIANT(pthread_getschedparam(pthread_self(), &policy, &param) == 0);
-
-    int minprio = sched_get_priority_max(policy);
-    if (param.sched_priority > minprio) {
-        param.sched_priority = minprio;
-        SINVARIANT(pthread_setschedparam(pthread_self(), policy, &param) == 0);
+// Starts another compress task if there is unclaimed work and room for one.
+void DataSeriesSink::startCompressing() {
+    if (worker_info.pending_work->hasUnclaimed() && worker_info.reserveCompressor()) {
+        worker_info.compress_queue->submit(boost::bind(&DataSeriesSink::compressTask, this));
     }
-#endif
-
-    PThreadScopedLock lock(mutex);
-    while (true) {
-        ToCompress *work = NULL;
-        for (Deque<ToCompress *>::iterator i = worker_info.pending_work.begin();
-            i != worker_info.pending_work.end(); ++i) {
-            if ((**i).in_progress == false && (**i).compressed.size() == 0) {
-                work = *i;
-                work->in_progress = true;
-                break;
-            }
-        }
-        if (work == NULL) {
-            if (!worker_info.keep_going) { 
-                break; // only stop if there is no work to do.
-            }
-            worker_info.available_work_cond.wait(mutex);
-        } else {
-            lockedProcessToCompress(lock, work);
+}
 
-            LintelLogDebug("DataSeriesSink", format("qwe broadcast compr? %d %d\n")
-                           % worker_info.bytes_in_progress % worker_info.pending_work.size());
-    
-            if (worker_info.canQueueWork()) { // just freed up space.
-                worker_info.available_queue_cond.broadcast();
-            }
-            SINVARIANT(!worker_info.pending_work.empty());
-            if (worker_info.frontReadyToWrite()) {
-                worker_info.available_write_cond.signal();
-            }
-        }
+// Compresses one extent, and then goes back to the pool, so that a sink
+// that is fed continuously takes turns with the other modules' tasks.
+void DataSeriesSink::compressTask() {
+    dataseries::SequencedRing<ToCompress> &pending(*worker_info.pending_work);
+    uint64_t ticket;
+    ToCompress *work = pending.claim(ticket);
+    if (work != NULL) {
+        processToCompress(work);
+        pending.finish(ticket);
     }
+    __atomic_sub_fetch(&worker_info.compressing, 1, __ATOMIC_SEQ_CST);
+    // for the rest of the work, including any that a producer pushed
+    // while this task was still counted, and so didn't start another for
+    startCompressing();
 }
 
 void DataSeriesSink::writerThread() {
-    PThreadScopedLock lock(mutex);
-    while (worker_info.keep_going) {
-        if (worker_info.frontReadyToWrite()) {
-            writer_info.writeOutPending(lock, worker_info);
-        } else {
-            worker_info.available_write_cond.wait(mutex);
-        }
+    while (__atomic_load_n(&worker_info.keep_going, __ATOMIC_SEQ_CST)) {
+        worker_info.pending_work->waitFront(worker_info.keep_going);
+        PThreadScopedLock lock(mutex);
+        writer_info.writeOutPending(lock, worker_info);
     }
 }
 
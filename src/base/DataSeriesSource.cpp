@@ -17,6 +17,7 @@
 #include <sys/resource.h>
 #include <sys/time.h>
 
+#include <algorithm>
 #include <ostream>
 
 #include <boost/static_assert.hpp>
@@ -35,6 +36,7 @@ using boost::format;
 #if (_FILE_OFFSET_BITS == 64 && !defined(_LARGEFILE64_SOURCE)) || defined(__CYGWIN__)
 #define _LARGEFILE64_SOURCE
 #define lseek64 lseek
+#define pread64 pread
 #endif
 
 #ifndef _LARGEFILE64_SOURCE
@@ -47,8 +49,10 @@ using boost::format;
 
 DataSeriesSource::DataSeriesSource(const string &filename, bool read_index, bool check_tail)
         : index_extent(), filename(filename), fd(-1), cur_offset(0), read_index(read_index),
-          check_tail(check_tail), mtime_nanosec(0)
+          check_tail(check_tail), use_mmap(false), mtime_nanosec(0)
 {
+    const char *read_mmap = getenv("DATASERIES_READ_MMAP");
+    use_mmap = read_mmap != NULL && strcmp(read_mmap, "1") == 0;
     mylibrary.registerType(ExtentType::getDataSeriesXMLTypePtr());
     mylibrary.registerType(ExtentType::getDataSeriesIndexTypeV0Ptr());
     SINVARIANT(mylibrary.getTypeByNamePtr("DataSeries: XmlType")
@@ -77,9 +81,13 @@ void DataSeriesSource::reopenfile() {
     int error = fstat(fd, &stat_buf);
     INVARIANT(error == 0, format("error on file '%s' for stat: %s") % filename % strerror(errno));
     if (lintel::modifyTimeNanoSec(stat_buf) != mtime_nanosec) {
+        field_dictionaries.reset(new dataseries::FieldDictionaries());
         checkHeader();
         readTypeExtent();
+        readCompressionDictionaries();
         readTailIndex();
+        readFieldDictionaries();
+        readSummaries();
         mtime_nanosec = lintel::modifyTimeNanoSec(stat_buf);
     }      
 }
@@ -91,9 +99,10 @@ void DataSeriesSource::checkHeader() {
     data.resize(file_header_size);
     Extent::checkedPread(fd,0,data.begin(),file_header_size);
     cur_offset = file_header_size;
+    // DSv2 only changes the checksums, which each extent records
     INVARIANT(data[0] == 'D' && data[1] == 'S' &&
-              data[2] == 'v' && data[3] == '1',
-              "Invalid data series source, not DSv1");
+              data[2] == 'v' && (data[3] == '1' || data[3] == '2'),
+              "Invalid data series source, not DSv1 or DSv2");
     int32_t check_int = *(int32_t *)(data.begin() + 4);
     if (check_int == 0x12345678) {
         need_bitflip = false;
@@ -137,6 +146,30 @@ void DataSeriesSource::readTypeExtent() {
     }
 }
 
+void DataSeriesSource::readCompressionDictionaries() {
+    // If there are dictionaries, they are in the extent right after the
+    // type extent; peek at the type name in its header so we don't read
+    // a user data extent twice.
+    const string &name = ExtentType::getDataSeriesCompressionDictionaryTypePtr()->getName();
+    const size_t name_offset = 6*4 + 4*1;
+    vector<byte> header(name_offset + name.size());
+    if (pread64(fd, &header[0], header.size(), cur_offset)
+        != static_cast<ssize_t>(header.size())
+        || header[name_offset - 2] != name.size()
+        || memcmp(&header[name_offset], name.data(), name.size()) != 0) {
+        return;
+    }
+
+    off64_t offset = cur_offset;
+    Extent::Ptr e(preadExtent(offset));
+    SINVARIANT(e != NULL);
+    ExtentSeries s(e);
+    Variable32Field dictionary(s, "dictionary");
+    for (; s.morerecords(); ++s) {
+        Extent::registerCompressionDictionary(dictionary.stringval());
+    }
+}
+
 void DataSeriesSource::readTailIndex() {
     if (read_index) {
         check_tail = true;
@@ -164,25 +197,109 @@ void DataSeriesSource::readTailIndex() {
                   % tailoffset % packedsize % indexoffset);
     }
     index_extent.reset();
+    extent_offsets.clear();
     if (read_index) {
         index_extent.reset(preadExtent(indexoffset));
         INVARIANT(index_extent != NULL, "index extent read failed");
+
+        ExtentSeries s(index_extent);
+        Int64Field offset(s, "offset");
+        for (; s.morerecords(); ++s) {
+            extent_offsets.push_back(offset.val());
+        }
+        sort(extent_offsets.begin(), extent_offsets.end());
+        extent_offsets.push_back(indexoffset);
     }
 }    
 
+void DataSeriesSource::readFieldDictionaries() {
+    if (index_extent == NULL) {
+        return;
+    }
+    // The index is in the order the extents were written, which is the
+    // order the entries have to be added in.
+    const string &name = ExtentType::getDataSeriesStringDictionaryTypePtr()->getName();
+    ExtentSeries s(index_extent);
+    Int64Field offset(s, "offset");
+    Variable32Field extenttype(s, "extenttype");
+    for (; s.morerecords(); ++s) {
+        if (extenttype.equal(name)) {
+            off64_t tmp = offset.val();
+            Extent::Ptr e(preadExtent(tmp));
+            SINVARIANT(e != NULL);
+        }
+    }
+}
+
+// Reads the zone maps and Bloom filters stored just before the index.
+void DataSeriesSource::readSummaries() {
+    zone_map.clear();
+    bloom_filters.clear();
+    if (index_extent == NULL) {
+        return;
+    }
+    const string &zone_map_name = ExtentType::getDataSeriesZoneMapTypePtr()->getName();
+    const string &bloom_filter_name = ExtentType::getDataSeriesBloomFilterTypePtr()->getName();
+    ExtentSeries s(index_extent);
+    Int64Field offset(s, "offset");
+    Variable32Field extenttype(s, "extenttype");
+    for (; s.morerecords(); ++s) {
+        if (extenttype.equal(zone_map_name) || extenttype.equal(bloom_filter_name)) {
+            off64_t tmp = offset.val();
+            Extent::Ptr e(preadExtent(tmp));
+            SINVARIANT(e != NULL);
+            if (e->getTypePtr() == ExtentType::getDataSeriesZoneMapTypePtr()) {
+                zone_map.add(e);
+            } else {
+                bloom_filters.add(e);
+            }
+        }
+    }
+}
+
+void DataSeriesSource::addFieldDictionaryEntries(const Extent::Ptr &e) {
+    ExtentSeries s(e);
+    Variable32Field extenttype(s, "extenttype");
+    Variable32Field field(s, "field");
+    Int32Field code(s, "code");
+    Variable32Field value(s, "value");
+    for (; s.morerecords(); ++s) {
+        field_dictionaries->get(extenttype.stringval(), field.stringval())
+                .add(code.val(), value.stringval());
+    }
+}
+
+uint32_t DataSeriesSource::extentSize(off64_t offset) const {
+    vector<off64_t>::const_iterator i
+            = lower_bound(extent_offsets.begin(), extent_offsets.end(), offset);
+    if (i == extent_offsets.end() || *i != offset || i + 1 == extent_offsets.end()) {
+        return 0;
+    }
+    return *(i + 1) - offset;
+}
+
 Extent *DataSeriesSource::preadExtent(off64_t &offset, unsigned *compressedSize) {
     Extent::ByteArray extentdata;
     
     off64_t save_offset = offset;
-    if (Extent::preadExtent(fd, offset, extentdata, need_bitflip) == false) {
+    if (preadCompressed(offset, extentdata) == false) {
         return NULL;
     }
     if (compressedSize) *compressedSize = extentdata.size();
-    Extent *ret = new Extent(mylibrary,extentdata,need_bitflip);
+    Extent *ret = new Extent(mylibrary.getTypeByNamePtr(Extent::getPackedExtentType(extentdata)));
+    ret->dictionaries = field_dictionaries;
+    ret->unpackData(extentdata, need_bitflip);
     ret->extent_source = filename;
     ret->extent_source_offset = save_offset;
     INVARIANT(ret->type != ExtentType::getDataSeriesXMLTypePtr(),
               "Invalid to have a type extent after the first extent.");
+    if (ret->type == ExtentType::getDataSeriesStringDictionaryTypePtr()) {
+        // swapped into a shared extent only so that we can make a series on it
+        Extent::Ptr e(new Extent(ret->type));
+        e->swap(*ret);
+        addFieldDictionaryEntries(e);
+        ret->swap(*e);
+    }
     return ret;
 }
 
@@ -11,17 +11,24 @@
 
 #include <math.h>
 #include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #if defined(__linux__)
 #   include <malloc.h>
 #endif
 
+#include <algorithm>
 #include <iostream>
 
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
 #include <boost/limits.hpp>
 
 #if (_FILE_OFFSET_BITS == 64 && !defined(_LARGEFILE64_SOURCE)) || defined(__CYGWIN__)
 #define pread64 pread
+#define mmap64 mmap
 #endif
 
 #ifndef DATASERIES_ENABLE_BZIP2
@@ -40,6 +47,10 @@
 #define DATASERIES_ENABLE_LZ4 0
 #endif
 
+#ifndef DATASERIES_ENABLE_ZSTD
+#define DATASERIES_ENABLE_ZSTD 0
+#endif
+
 #if DATASERIES_ENABLE_BZIP2
 #include <bzlib.h>
 #endif
@@ -57,12 +68,18 @@
 #include <lz4hc.h>
 #endif
 
+#if DATASERIES_ENABLE_ZSTD
+#include <zstd.h>
+#include <zdict.h>
+#endif
+
 #include <zlib.h>
 extern "C" {
 #include <lzf.h>
 }
 
 #include <Lintel/Clock.hpp>
+#include <Lintel/HashMap.hpp>
 #include <Lintel/HashTable.hpp>
 #include <Lintel/LintelLog.hpp>
 #include <Lintel/PThread.hpp>
@@ -70,11 +87,17 @@ extern "C" {
 
 #define DS_RAW_EXTENT_PTR_DEPRECATED /* allowed */
 
+#include <DataSeries/BufferPool.hpp>
 #include <DataSeries/Extent.hpp>
 #include <DataSeries/ExtentField.hpp>
 #include <DataSeries/DataSeriesFile.hpp>
+#include <DataSeries/TaskPool.hpp>
+
+#include "PackEncoding.hpp"
+#include "PackKernels.hpp"
 
 using namespace std;
+using dataseries::pack_kernels::Kernels;
 using boost::format;
 
 extern "C" {
@@ -94,7 +117,8 @@ Extent::compression_alg Extent::compression_algs[] =
     { "lzf", 8, packLZF, unpackLZF },
     { "snappy", 16, packSnappy, unpackSnappy },
     { "lz4", 32, packLZ4, unpackLZ4 },
-    { "lz4hc", 64, packLZ4HC, unpackLZ4 }
+    { "lz4hc", 64, packLZ4HC, unpackLZ4 },
+    { "zstd", 128, packZstd, unpackZstd }
 };
 
 
@@ -108,15 +132,34 @@ void Extent::ByteArray::initMallocTuning() {
 #endif
 }
 
+Extent::ByteArray::Owner::~Owner() { }
+
 Extent::ByteArray::~ByteArray() {
-    delete [] beginV;
+    release();
+}
+
+void Extent::ByteArray::release() {
+    if (owner == NULL) {
+        dataseries::BufferPool::free(beginV, maxV - beginV);
+    } else {
+        owner.reset();
+    }
 }
 
 void Extent::ByteArray::clear() {
-    delete [] beginV;
+    release();
     beginV = endV = maxV = NULL;
 }
 
+void Extent::ByteArray::borrow(byte *begin, size_t size, const OwnerPtr &with_owner) {
+    SINVARIANT(with_owner != NULL);
+    OwnerPtr keep(with_owner); // with_owner could be our own owner
+    clear();
+    beginV = begin;
+    endV = maxV = begin + size;
+    owner = keep;
+}
+
 void Extent::ByteArray::reserve(size_t reserve_bytes) {
     if (reserve_bytes <= static_cast<size_t>(maxV - beginV)) {
         return; // have enough already;
@@ -125,7 +168,7 @@ void Extent::ByteArray::reserve(size_t reserve_bytes) {
         initMallocTuning();
     }
     size_t oldsize = size();
-    byte *newV = new byte [reserve_bytes];
+    byte *newV = dataseries::BufferPool::allocate(&reserve_bytes); // may round up
 
     size_t expect_align = 8;
     if (reserve_bytes == 4) { expect_align = 4; }
@@ -135,7 +178,7 @@ void Extent::ByteArray::reserve(size_t reserve_bytes) {
               format("internal error, misaligned malloc(%d) return %d mod %d\n")
               % reserve_bytes % actual_align % expect_align);
     memcpy(newV,beginV,oldsize);
-    delete [] beginV;
+    release();
     beginV = newV;
     endV = newV + oldsize;
     maxV = newV + reserve_bytes;    
@@ -281,6 +324,7 @@ void Extent::swap(Extent &with) {
     INVARIANT(with.type == type, "can't swap between incompatible types");
     fixeddata.swap(with.fixeddata);
     variabledata.swap(with.variabledata);
+    dictionaries.swap(with.dictionaries);
 }
 
 void Extent::createRecords(unsigned int nrecords) {
@@ -568,16 +612,383 @@ void Extent::uncompactNulls(Extent::ByteArray &fixed_coded, int32_t &size) {
     }
 }
 
+// Copies one column run between the row-major and columnar layouts;
+// the memcpy with a constant size compiles down to a single move for
+// the common field widths without assuming the columns are aligned.
+template<size_t N>
+static void columnarCopy(ExtentType::byte *to, size_t to_stride,
+                         const ExtentType::byte *from, size_t from_stride,
+                         uint32_t nrecords) {
+    for (uint32_t i = 0; i < nrecords; ++i) {
+        memcpy(to, from, N);
+        to += to_stride;
+        from += from_stride;
+    }
+}
+
+static void columnarCopy(ExtentType::byte *to, size_t to_stride,
+                         const ExtentType::byte *from, size_t from_stride,
+                         uint32_t nrecords, size_t size) {
+    switch(size)
+    {
+        case 1: columnarCopy<1>(to, to_stride, from, from_stride, nrecords); break;
+        case 2: columnarCopy<2>(to, to_stride, from, from_stride, nrecords); break;
+        case 4: columnarCopy<4>(to, to_stride, from, from_stride, nrecords); break;
+        case 8: columnarCopy<8>(to, to_stride, from, from_stride, nrecords); break;
+        default:
+            for (uint32_t i = 0; i < nrecords; ++i) {
+                memcpy(to, from, size);
+                to += to_stride;
+                from += from_stride;
+            }
+    }
+}
+
+void Extent::transposeToColumnar(Extent::ByteArray &fixed_coded) {
+    SINVARIANT(type->getPackLayout() == ExtentType::LayoutColumnar);
+    const size_t record_size = type->rep.fixed_record_size;
+    SINVARIANT(fixed_coded.size() % record_size == 0);
+    const uint32_t nrecords = fixed_coded.size() / record_size;
+    Extent::ByteArray into;
+    into.resize(fixed_coded.size(), false); // every byte is overwritten
+
+    byte *to = into.begin();
+    typedef vector<ExtentType::columnarRun>::const_iterator runiT;
+    for (runiT i = type->rep.columnar_runs.begin(); i != type->rep.columnar_runs.end(); ++i) {
+        columnarCopy(to, i->size, fixed_coded.begin() + i->offset, record_size,
+                     nrecords, i->size);
+        to += static_cast<size_t>(i->size) * nrecords;
+    }
+    SINVARIANT(to == into.end());
+    fixed_coded.swap(into);
+}
+
+void Extent::transposeFromColumnar(Extent::ByteArray &fixed_coded) {
+    SINVARIANT(type->getPackLayout() == ExtentType::LayoutColumnar);
+    const size_t record_size = type->rep.fixed_record_size;
+    SINVARIANT(fixed_coded.size() % record_size == 0);
+    const uint32_t nrecords = fixed_coded.size() / record_size;
+    Extent::ByteArray into;
+    into.resize(fixed_coded.size(), false); // every byte is overwritten
+
+    const byte *from = fixed_coded.begin();
+    typedef vector<ExtentType::columnarRun>::const_iterator runiT;
+    for (runiT i = type->rep.columnar_runs.begin(); i != type->rep.columnar_runs.end(); ++i) {
+        columnarCopy(into.begin() + i->offset, record_size, from, i->size,
+                     nrecords, i->size);
+        from += static_cast<size_t>(i->size) * nrecords;
+    }
+    SINVARIANT(from == fixed_coded.end());
+    fixed_coded.swap(into);
+}
+
+// pack_bitwidth fields are bit-packed in blocks of this many records,
+// each with its own reference and width, so that a few outliers only
+// widen the values near them.
+static const uint32_t bitwidth_block_records = 1024;
+
+static inline uint32_t bitwidthBlocks(uint32_t nrecords) {
+    return (nrecords + bitwidth_block_records - 1) / bitwidth_block_records;
+}
+
+// The largest the fixed data can be with the encoded fields: the
+// blocks can start with up to 7 bytes of padding; each bit-packed
+// block adds a 16 byte header and can round up to a word; and each
+// pack_encoding stream has an 8 byte header.  Empty extents stay empty.
+static inline size_t encodedFixedBound(size_t record_size, size_t nbitwidth,
+                                       size_t nencoding, uint32_t nrecords) {
+    if (nrecords == 0) {
+        return 0;
+    }
+    return nrecords * record_size + 8 + 24 * nbitwidth * bitwidthBlocks(nrecords)
+        + nencoding * (8 + 8 * dataseries::pack_encoding::maxEncodedWords(nrecords));
+}
+
+// The kept runs of every record are stored first (row-major or
+// columnar), then padding to 8 bytes, then for each pack_bitwidth field
+// and each block of records an 8 byte reference, a 1 byte width, 7
+// zero bytes, and the bit-packed words, then for each pack_encoding
+// field a 4 byte encoding, a 4 byte number of words, and the words; see
+// doc/file-format.txt.
+void Extent::packEncodedFields(Extent::ByteArray &fixed_coded) {
+    const ExtentType::ParsedRepresentation &rep(type->rep);
+    const size_t record_size = rep.fixed_record_size;
+    SINVARIANT(fixed_coded.size() % record_size == 0);
+    const uint32_t nrecords = fixed_coded.size() / record_size;
+    const bool columnar = type->getPackLayout() == ExtentType::LayoutColumnar;
+    const Kernels &kernels = dataseries::pack_kernels::kernels();
+    if (nrecords == 0) {
+        return;
+    }
+    Extent::ByteArray into;
+    into.resize(encodedFixedBound(record_size, rep.bitwidth_field_columns.size(),
+                                  rep.pack_encoding.size(), nrecords), false);
+
+    byte *to = into.begin();
+    typedef vector<ExtentType::columnarRun>::const_iterator runiT;
+    for (runiT i = rep.encoded_kept_runs.begin(); i != rep.encoded_kept_runs.end(); ++i) {
+        if (columnar) {
+            columnarCopy(to, i->size, fixed_coded.begin() + i->offset, record_size,
+                         nrecords, i->size);
+            to += static_cast<size_t>(i->size) * nrecords;
+        } else {
+            columnarCopy(to, rep.encoded_kept_size, fixed_coded.begin() + i->offset,
+                         record_size, nrecords, i->size);
+            to += i->size;
+        }
+    }
+    to = into.begin() + static_cast<size_t>(rep.encoded_kept_size) * nrecords;
+    size_t align = (8 - (to - into.begin()) % 8) % 8;
+    memset(to, 0, align);
+    to += align;
+
+    for (unsigned j = 0; j < rep.bitwidth_field_columns.size(); ++j) {
+        const ExtentType::fieldInfo &field(rep.field_info[rep.bitwidth_field_columns[j]]);
+        for (uint32_t first = 0; first < nrecords; first += bitwidth_block_records) {
+            uint32_t count = min(bitwidth_block_records, nrecords - first);
+            const byte *col = fixed_coded.begin() + first * record_size + field.offset;
+            uint64_t *words = reinterpret_cast<uint64_t *>(to + 16);
+            int64_t reference = 0;
+            unsigned width = 0;
+            switch(field.size)
+            {
+                case 1: width = kernels.bitPack1(col, record_size, count, &reference, words); break;
+                case 4: width = kernels.bitPack4(col, record_size, count, &reference, words); break;
+                case 8: width = kernels.bitPack8(col, record_size, count, &reference, words); break;
+                default: FATAL_ERROR("internal error, bad pack_bitwidth field size");
+            }
+            memcpy(to, &reference, 8);
+            memset(to + 8, 0, 8);
+            to[8] = width;
+            to += 16 + 8 * dataseries::pack_kernels::bitPackedWords(count, width);
+        }
+    }
+    for (unsigned j = 0; j < rep.pack_encoding.size(); ++j) {
+        const ExtentType::pack_encodingT &pe(rep.pack_encoding[j]);
+        const byte *col = fixed_coded.begin() + rep.field_info[pe.field_num].offset;
+        uint64_t *words = reinterpret_cast<uint64_t *>(to + 8);
+        size_t nwords = 0;
+        switch(pe.encoding)
+        {
+            case ExtentType::EncodingXor:
+                nwords = dataseries::pack_encoding::encodeXor(col, record_size, nrecords, words);
+                break;
+            case ExtentType::EncodingDelta2:
+                nwords = dataseries::pack_encoding::encodeDelta2(col, record_size, nrecords, words);
+                break;
+            default:
+                FATAL_ERROR("internal error, bad pack_encoding");
+        }
+        *reinterpret_cast<int32 *>(to) = pe.encoding;
+        *reinterpret_cast<int32 *>(to + 4) = nwords;
+        to += 8 + 8 * nwords;
+    }
+    SINVARIANT(to <= into.end());
+    into.resize(to - into.begin());
+    fixed_coded.swap(into);
+}
+
+// Reverses packEncodedFields, leaving the records in the same byte
+// order as they were packed, so the caller can check the hash and then
+// fix the endianness of every field.
+void Extent::unpackEncodedFields(Extent::ByteArray &fixed_coded, int32_t &size,
+                                  uint32_t nrecords, bool fix_endianness) {
+    const ExtentType::ParsedRepresentation &rep(type->rep);
+    const size_t record_size = rep.fixed_record_size;
+    const bool columnar = type->getPackLayout() == ExtentType::LayoutColumnar;
+    const Kernels &kernels = dataseries::pack_kernels::kernels();
+    const size_t kept_size = static_cast<size_t>(rep.encoded_kept_size) * nrecords;
+    INVARIANT(size >= 0 && static_cast<size_t>(size) <= fixed_coded.size()
+              && kept_size <= static_cast<size_t>(size),
+              "Invalid extent data, bad encoded fixed size");
+    Extent::ByteArray into;
+    into.resize(nrecords * record_size, false); // every byte is overwritten
+
+    const byte *from = fixed_coded.begin();
+    typedef vector<ExtentType::columnarRun>::const_iterator runiT;
+    for (runiT i = rep.encoded_kept_runs.begin(); i != rep.encoded_kept_runs.end(); ++i) {
+        if (columnar) {
+            columnarCopy(into.begin() + i->offset, record_size, from, i->size,
+                         nrecords, i->size);
+            from += static_cast<size_t>(i->size) * nrecords;
+        } else {
+            columnarCopy(into.begin() + i->offset, record_size, from,
+                         rep.encoded_kept_size, nrecords, i->size);
+            from += i->size;
+        }
+    }
+    size_t pos = kept_size + (8 - kept_size % 8) % 8;
+
+    for (unsigned j = 0; j < rep.bitwidth_field_columns.size(); ++j) {
+        const ExtentType::fieldInfo &field(rep.field_info[rep.bitwidth_field_columns[j]]);
+        for (uint32_t first = 0; first < nrecords; first += bitwidth_block_records) {
+            uint32_t count = min(bitwidth_block_records, nrecords - first);
+            INVARIANT(pos + 16 <= static_cast<size_t>(size),
+                      "Invalid extent data, bit-packed blocks truncated");
+            byte *block = fixed_coded.begin() + pos;
+            if (fix_endianness) {
+                Extent::flip8bytes(block);
+            }
+            int64_t reference;
+            memcpy(&reference, block, 8);
+            unsigned width = block[8];
+            INVARIANT(width <= 8 * static_cast<unsigned>(field.size),
+                      format("Invalid extent data, bit width %d for field %s")
+                      % width % field.name);
+            size_t nwords = dataseries::pack_kernels::bitPackedWords(count, width);
+            INVARIANT(pos + 16 + 8 * nwords <= static_cast<size_t>(size),
+                      "Invalid extent data, bit-packed blocks truncated");
+            uint64_t *words = reinterpret_cast<uint64_t *>(block + 16);
+            if (fix_endianness) {
+                kernels.flip8(block + 16, 8, nwords);
+            }
+            byte *col = into.begin() + first * record_size + field.offset;
+            switch(field.size)
+            {
+                case 1: kernels.bitUnpack1(words, width, reference, col, record_size, count); break;
+                case 4: kernels.bitUnpack4(words, width, reference, col, record_size, count); break;
+                case 8: kernels.bitUnpack8(words, width, reference, col, record_size, count); break;
+                default: FATAL_ERROR("internal error, bad pack_bitwidth field size");
+            }
+            pos += 16 + 8 * nwords;
+        }
+        if (fix_endianness) {
+            // back to the packed byte order
+            if (field.size == 4) {
+                kernels.flip4(into.begin() + field.offset, record_size, nrecords);
+            } else if (field.size == 8) {
+                kernels.flip8(into.begin() + field.offset, record_size, nrecords);
+            }
+        }
+    }
+    for (unsigned j = 0; j < rep.pack_encoding.size() && nrecords > 0; ++j) {
+        const ExtentType::pack_encodingT &pe(rep.pack_encoding[j]);
+        const ExtentType::fieldInfo &field(rep.field_info[pe.field_num]);
+        INVARIANT(pos + 8 <= static_cast<size_t>(size),
+                  "Invalid extent data, pack_encoding streams truncated");
+        byte *header = fixed_coded.begin() + pos;
+        if (fix_endianness) {
+            Extent::flip4bytes(header);
+            Extent::flip4bytes(header + 4);
+        }
+        int32 encoding = *reinterpret_cast<int32 *>(header);
+        size_t nwords = *reinterpret_cast<uint32_t *>(header + 4);
+        INVARIANT(encoding == pe.encoding,
+                  format("Invalid extent data, pack_encoding %d for field %s")
+                  % encoding % field.name);
+        INVARIANT(pos + 8 + 8 * nwords <= static_cast<size_t>(size),
+                  "Invalid extent data, pack_encoding streams truncated");
+        if (fix_endianness) {
+            kernels.flip8(header + 8, 8, nwords);
+        }
+        const uint64_t *words = reinterpret_cast<const uint64_t *>(header + 8);
+        byte *col = into.begin() + field.offset;
+        if (pe.encoding == ExtentType::EncodingXor) {
+            dataseries::pack_encoding::decodeXor(words, nwords, col, record_size, nrecords);
+        } else {
+            dataseries::pack_encoding::decodeDelta2(words, nwords, col, record_size, nrecords);
+        }
+        if (fix_endianness) {
+            kernels.flip8(col, record_size, nrecords);
+        }
+        pos += 8 + 8 * nwords;
+    }
+    INVARIANT(pos == static_cast<size_t>(size), "Invalid extent data, bad encoded fixed size");
+    fixed_coded.swap(into);
+    size = fixed_coded.size();
+}
+
+// Returns the location of the null bit for field in the first record
+// if the relative packing has to skip nulls, or NULL if it does not.
+static inline const ExtentType::byte *packNulls(const ExtentType::byte *records,
+                                                const ExtentType::fieldInfo &field,
+                                                bool null_compact, int &null_mask) {
+    if (null_compact && field.null_compact_info->null_bitmask != 0) {
+        null_mask = field.null_compact_info->null_bitmask;
+        return records + field.null_compact_info->null_offset;
+    } else {
+        null_mask = 0;
+        return NULL;
+    }
+}
+
 static const uint32_t max_packed_size = 512*1024*1024;
 
 static const unsigned variable_sizes_batch_size = 1024;
 
+void Extent::encodeDictionaryFields(const dataseries::FieldDictionaries::Ptr &with) {
+    SINVARIANT(with != NULL);
+    dictionaries = with;
+    const size_t record_size = type->rep.fixed_record_size;
+    for (unsigned j = 0; j < type->rep.dictionary_field_columns.size(); ++j) {
+        const ExtentType::fieldInfo &field
+                = type->rep.field_info[type->rep.dictionary_field_columns[j]];
+        const int32 code_offset = type->rep.field_info[field.code_fieldnum].offset;
+        dataseries::StringDictionary &dictionary = with->get(type->getName(), field.name);
+        for (byte *record = fixeddata.begin(); record != fixeddata.end();
+             record += record_size) {
+            int32 varoffset = Variable32Field::getVarOffset(record, field.offset);
+            int32 size = Variable32Field::size(variabledata, varoffset);
+            *(int32 *)(record + code_offset) = size == 0 ? 0 
+                    : dictionary.encode(variabledata.begin() + varoffset + 4, size);
+        }
+    }
+}
+
+// Values of the dictionary fields that were packed as just their code
+// are added back to the variable data, once for each distinct code.
+void Extent::decodeDictionaryFields() {
+    const size_t record_size = type->rep.fixed_record_size;
+    for (unsigned j = 0; j < type->rep.dictionary_field_columns.size(); ++j) {
+        const ExtentType::fieldInfo &field
+                = type->rep.field_info[type->rep.dictionary_field_columns[j]];
+        const int32 code_offset = type->rep.field_info[field.code_fieldnum].offset;
+        const dataseries::StringDictionary *dictionary = NULL;
+        HashMap<int32, int32> code_to_varoffset;
+        for (byte *record = fixeddata.begin(); record != fixeddata.end();
+             record += record_size) {
+            int32 code = *(int32 *)(record + code_offset);
+            if (code == 0 || Variable32Field::getVarOffset(record, field.offset) != 0) {
+                continue;
+            }
+            int32 *varoffset = code_to_varoffset.lookup(code);
+            if (varoffset == NULL) {
+                if (dictionary == NULL) {
+                    INVARIANT(dictionaries != NULL, format("field %s of %s is dictionary coded,"
+                                                           " but the extent has no dictionaries")
+                              % field.name % type->getName());
+                    dictionary = dictionaries->find(type->getName(), field.name);
+                    INVARIANT(dictionary != NULL, format("missing dictionary for field %s of %s")
+                              % field.name % type->getName());
+                }
+                const string &value(dictionary->decode(code));
+                int32 size = value.size();
+                int32 roundup = Variable32Field::roundupSize(size);
+                int32 pos = variabledata.size();
+                DEBUG_SINVARIANT((pos + 4) % 8 == 0);
+                variabledata.resize(pos + 4 + roundup, false);
+                *(int32 *)(variabledata.begin() + pos) = size;
+                memcpy(variabledata.begin() + pos + 4, value.data(), size);
+                memset(variabledata.begin() + pos + 4 + size, 0, roundup - size);
+                varoffset = &code_to_varoffset[code];
+                *varoffset = pos;
+            }
+            *(int32 *)(record + field.offset) = *varoffset;
+        }
+    }
+}
+
 // Note: Can't split this into pack fixed and pack variable because 
 // packing the variable data can involve updating the fixed data
 
 uint32_t Extent::packData(Extent::ByteArray &into, uint32_t compression_modes, 
                           uint32_t compression_level, uint32_t *header_packed, 
-                          uint32_t *fixed_packed, uint32_t *variable_packed) {
+                          uint32_t *fixed_packed, uint32_t *variable_packed,
+                          uint32_t compression_block_size,
+                          const CompressionPolicy *policy, uint32_t dictionary_id,
+                          Extent::byte checksum_kind) {
+    INVARIANT(checksum_kind == checksum_v1 || checksum_kind == checksum_crc32c,
+              format("unknown checksum kind %d") % static_cast<int>(checksum_kind));
     // Don't need to zero the coded arrays as we will be filling them
     // all in.
     Extent::ByteArray fixed_coded;
@@ -591,63 +1002,54 @@ uint32_t Extent::packData(Extent::ByteArray &into, uint32_t compression_modes,
             variableDuplicateEliminate_Equal> vardupelim;
 
     memcpy(fixed_coded.begin(), fixeddata.begin(), fixeddata.size());
-    vector<bool> warnings;
-    warnings.resize(type->rep.field_info.size(),false);
-    // copy so that packing is thread safe
-    vector<ExtentType::pack_self_relativeT> psr_copy 
-            = type->rep.pack_self_relative;
-    for (unsigned int j=0; j<type->rep.pack_self_relative.size(); ++j) {
-        INVARIANT(psr_copy[j].field_num < type->rep.field_info.size(), "whoa");
-        psr_copy[j].double_prev_v = 0; // shouldn't be necessary
-        psr_copy[j].int32_prev_v = 0;
-        psr_copy[j].int64_prev_v = 0;
-    }
-    uint32_t nrecords = 0;
+    const size_t record_size = type->rep.fixed_record_size;
+    SINVARIANT(fixed_coded.size() % record_size == 0);
+    const uint32_t nrecords = fixed_coded.size() / record_size;
+    const Kernels &kernels = dataseries::pack_kernels::kernels();
+    byte *records = fixed_coded.begin();
+    bool null_compact = type->getPackNullCompact() != ExtentType::CompactNo;
+    if (null_compact) {
+        // Might want to always do this -- except it seems unlikely people
+        // would commonly fill in a value and then null it.
+        //
+        // Need to zero fill these as when we do null compaction,
+        // we will stuff zeros in to all null fields, and if
+        // someone did relative packing we need it to unpack
+        // properly.
+
+        typedef vector<ExtentType::nullCompactInfo>::const_iterator nciiT;
+        for (nciiT j = type->rep.nonbool_compact_info_size1.begin(); 
+            j != type->rep.nonbool_compact_info_size1.end(); ++j) {
+            if (j->null_bitmask != 0) {
+                kernels.zeroNulls1(records + j->offset, records + j->null_offset,
+                                   j->null_bitmask, record_size, nrecords);
+            }
+        }
+        for (nciiT j = type->rep.nonbool_compact_info_size4.begin(); 
+            j != type->rep.nonbool_compact_info_size4.end(); ++j) {
+            if (j->null_bitmask != 0) {
+                kernels.zeroNulls4(records + j->offset, records + j->null_offset,
+                                   j->null_bitmask, record_size, nrecords);
+            }
+        }
+        for (nciiT j = type->rep.nonbool_compact_info_size8.begin(); 
+            j != type->rep.nonbool_compact_info_size8.end(); ++j) {
+            if (j->null_bitmask != 0) {
+                kernels.zeroNulls8(records + j->offset, records + j->null_offset,
+                                   j->null_bitmask, record_size, nrecords);
+            }
+        }
+    }
+
+    // The variable sized fields are packed a record at a time because
+    // the order the values are appended determines the packed data.
     byte *variable_data_pos = variable_coded.begin();
     *(int32 *)variable_data_pos = 0;
     variable_data_pos += 4;
-    bool null_compact = type->getPackNullCompact() != ExtentType::CompactNo;
     for (Extent::ByteArray::iterator fixed_record = fixed_coded.begin();
         fixed_record != fixed_coded.end(); 
         fixed_record += type->rep.fixed_record_size) {
         INVARIANT(fixed_record < fixed_coded.end(),"internal error");
-        ++nrecords;
-        
-        if (null_compact) {
-            // Might want to always do this -- except it seems unlikely people
-            // would commonly fill in a value and then null it.
-            //
-            // Need to zero fill these as when we do null compaction,
-            // we will stuff zeros in to all null fields, and if
-            // someone did relative packing we need it to unpack
-            // properly.
-
-            typedef vector<ExtentType::nullCompactInfo>::const_iterator nciiT;
-            for (nciiT j = type->rep.nonbool_compact_info_size1.begin(); 
-                j != type->rep.nonbool_compact_info_size1.end(); ++j) {
-                if (!compactIsNull(fixed_record, *j)) 
-                    continue;
-                ExtentType::byte *raw = static_cast<unsigned char *>(fixed_record + j->offset);
-                *raw = 0;
-            }
-
-            for (nciiT j = type->rep.nonbool_compact_info_size4.begin(); 
-                j != type->rep.nonbool_compact_info_size4.end(); ++j) {
-                if (!compactIsNull(fixed_record, *j)) 
-                    continue;
-                ExtentType::byte *raw = static_cast<unsigned char *>(fixed_record + j->offset);
-                *reinterpret_cast<int32_t *>(raw) = 0;
-            }
-
-            for (nciiT j = type->rep.nonbool_compact_info_size8.begin(); 
-                j != type->rep.nonbool_compact_info_size8.end(); ++j) {
-                if (!compactIsNull(fixed_record, *j)) 
-                    continue;
-                ExtentType::byte *raw = static_cast<unsigned char *>(fixed_record + j->offset);
-                *reinterpret_cast<int64_t *>(raw) = 0;
-            }
-        }
-
         // pack variable sized fields ...
         for (unsigned int j=0; j < type->rep.variable32_field_columns.size(); ++j) {
             int field = type->rep.variable32_field_columns[j];
@@ -656,6 +1058,18 @@ uint32_t Extent::packData(Extent::ByteArray &into, uint32_t compression_modes,
             Variable32Field::selfcheck(variabledata, varoffset);
             int32 size = Variable32Field::size(variabledata, varoffset);
             int32 roundup = Variable32Field::roundupSize(size);
+            int code_fieldnum = type->rep.field_info[field].code_fieldnum;
+            if (code_fieldnum > 0) {
+                // a dictionary coded value is stored as just its code
+                int32 *code = reinterpret_cast<int32 *>
+                        (fixed_record + type->rep.field_info[code_fieldnum].offset);
+                if (size == 0 || dictionaries == NULL) {
+                    *code = 0;
+                } else if (*code != 0) {
+                    *(int32 *)(fixed_record + offset) = 0;
+                    continue;
+                }
+            }
             if (size == 0) {
                 SINVARIANT(varoffset == 0);
             } else {
@@ -684,111 +1098,89 @@ uint32_t Extent::packData(Extent::ByteArray &into, uint32_t compression_modes,
                 *(int32 *)(fixed_record + offset) = packed_varoffset;
             } 
         }
-        // pack other relative fields ...  do the packing in reverse
-        // order so that the base field in each packing is still in
-        // unpacked form
-        for (int j=type->rep.pack_other_relative.size()-1;j>=0;--j) {
-            const ExtentType::fieldInfo &field(type->rep.field_info[type->rep.pack_other_relative[j].field_num]);
-            if (null_compact && compactIsNull(fixed_record, 
-                                              *field.null_compact_info)) {
-                // Don't overwrite nulls, must remain 0.
-                continue;
-            }
-            int base_field = type->rep.pack_other_relative[j].base_field_num;
-            int field_offset = field.offset;
-            DEBUG_INVARIANT(field_offset < type->rep.fixed_record_size, "bad");
-            switch(field.type)
-            {
-                case ExtentType::ft_double: {
-                    double v = *(double *)(fixed_record + field_offset);
-                    double base_v = 
-                            *(double *)(fixed_record + 
-                                        type->rep.field_info[base_field].offset);
-                    *(double *)(fixed_record + field_offset) = v - base_v;
-                }
-                    break;
-                case ExtentType::ft_int32: { 
-                    int32 v = *(int32 *)(fixed_record + field_offset);
-                    int32 base_v = 
-                            *(int32 *)(fixed_record + 
-                                       type->rep.field_info[base_field].offset);
-                    *(int32 *)(fixed_record + field_offset) = v - base_v;
-                }
-                    break;
-                case ExtentType::ft_int64: {
-                    int64 v = *(int64 *)(fixed_record + field_offset);
-                    int64 base_v = 
-                            *(int64 *)(fixed_record + 
-                                       type->rep.field_info[base_field].offset);
-                    *(int64 *)(fixed_record + field_offset) = v - base_v;
-                }
-                    break;
+    }
 
-                default:
-                    FATAL_ERROR("Internal error");
-            }
+    // The remaining conversions only touch a single record (or the
+    // same field in earlier records), so they are done a column at a
+    // time; this is the same sequence of operations on each value as
+    // doing them a record at a time.
+
+    // pack other relative fields ...  do the packing in reverse
+    // order so that the base field in each packing is still in
+    // unpacked form
+    for (int j=type->rep.pack_other_relative.size()-1;j>=0;--j) {
+        const ExtentType::fieldInfo &field(type->rep.field_info[type->rep.pack_other_relative[j].field_num]);
+        int null_mask;
+        const byte *nulls = packNulls(records, field, null_compact, null_mask);
+        int base_field = type->rep.pack_other_relative[j].base_field_num;
+        byte *col = records + field.offset;
+        const byte *base_col = records + type->rep.field_info[base_field].offset;
+        DEBUG_INVARIANT(field.offset < type->rep.fixed_record_size, "bad");
+        switch(field.type)
+        {
+            case ExtentType::ft_double:
+                kernels.otherRelativeEncodeDouble(col, base_col, nulls, null_mask,
+                                                  record_size, nrecords);
+                break;
+            case ExtentType::ft_int32:
+                kernels.otherRelativeEncodeInt32(col, base_col, nulls, null_mask,
+                                                 record_size, nrecords);
+                break;
+            case ExtentType::ft_int64:
+                kernels.otherRelativeEncodeInt64(col, base_col, nulls, null_mask,
+                                                 record_size, nrecords);
+                break;
+            default:
+                FATAL_ERROR("Internal error");
         }
-        // pack self relative ...
-        for (unsigned int j=0;j<psr_copy.size();++j) {
-            unsigned field_num = psr_copy[j].field_num;
-            const ExtentType::fieldInfo &field(type->rep.field_info[field_num]);
-            if (null_compact && compactIsNull(fixed_record, 
-                                              *field.null_compact_info)) {
-                // Don't overwrite nulls, must remain 0.
-                continue;
-            }
-            int offset = field.offset;
-            DEBUG_INVARIANT(offset < type->rep.fixed_record_size, "bad");
-            switch(field.type) 
-            {
-                case ExtentType::ft_double: {
-                    double v = *(double *)(fixed_record + offset);
-                    *(double *)(fixed_record + offset) = v - psr_copy[j].double_prev_v;
-                    psr_copy[j].double_prev_v = v;
-                }
-                    break;
-                case ExtentType::ft_int32: {
-                    int32 v = *(int32 *)(fixed_record + offset);
-                    *(int32 *)(fixed_record + offset) = v - psr_copy[j].int32_prev_v;
-                    psr_copy[j].int32_prev_v = v;
-                }
-                    break;
-                case ExtentType::ft_int64: {
-                    int64 v = *(int64 *)(fixed_record + offset);
-                    *(int64 *)(fixed_record + offset) = v - psr_copy[j].int64_prev_v;
-                    psr_copy[j].int64_prev_v = v;
-                }
-                    break;
-                default:
-                    INVARIANT(field_num < type->rep.field_info.size(), 
-                              format("bad field number %d > %d record %d") 
-                              % field_num % type->rep.field_info.size() 
-                              % nrecords);
-
-                    FATAL_ERROR(format("Internal Error: unrecognized field type %d for field %s (#%d) offset %d in type %s")
-                                % field.type % field.name
-                                % field_num % offset % type->rep.name);
-            }
+    }
+    // pack self relative ...
+    for (unsigned int j=0;j<type->rep.pack_self_relative.size();++j) {
+        unsigned field_num = type->rep.pack_self_relative[j].field_num;
+        INVARIANT(field_num < type->rep.field_info.size(), "whoa");
+        const ExtentType::fieldInfo &field(type->rep.field_info[field_num]);
+        int null_mask;
+        const byte *nulls = packNulls(records, field, null_compact, null_mask);
+        byte *col = records + field.offset;
+        DEBUG_INVARIANT(field.offset < type->rep.fixed_record_size, "bad");
+        switch(field.type) 
+        {
+            case ExtentType::ft_double:
+                kernels.selfRelativeEncodeDouble(col, nulls, null_mask, record_size, nrecords);
+                break;
+            case ExtentType::ft_int32:
+                kernels.selfRelativeEncodeInt32(col, nulls, null_mask, record_size, nrecords);
+                break;
+            case ExtentType::ft_int64:
+                kernels.selfRelativeEncodeInt64(col, nulls, null_mask, record_size, nrecords);
+                break;
+            default:
+                FATAL_ERROR(format("Internal Error: unrecognized field type %d for field %s (#%d) offset %d in type %s")
+                            % field.type % field.name
+                            % field_num % field.offset % type->rep.name);
         }
-        // pack scaled fields ...
-        for (unsigned int j=0;j<type->rep.pack_scale.size();++j) {
-            int field = type->rep.pack_scale[j].field_num;
-            INVARIANT(type->rep.field_info[field].type == ExtentType::ft_double,
-                      "internal error, scaled only supported for ft_double");
-            int offset = type->rep.field_info[field].offset;
-            double multiplier = type->rep.pack_scale[j].multiplier;
-            double v = *(double *)(fixed_record + offset);
+    }
+    // pack scaled fields ...
+    vector<bool> warnings;
+    warnings.resize(type->rep.field_info.size(),false);
+    for (unsigned int j=0;j<type->rep.pack_scale.size();++j) {
+        int field = type->rep.pack_scale[j].field_num;
+        INVARIANT(type->rep.field_info[field].type == ExtentType::ft_double,
+                  "internal error, scaled only supported for ft_double");
+        int offset = type->rep.field_info[field].offset;
+        double multiplier = type->rep.pack_scale[j].multiplier;
+        double v = 0;
+        uint32_t bad_record = kernels.scaleEncode(records + offset, record_size, nrecords,
+                                                  multiplier, &v);
+        if (type->rep.pack_scale[j].warn && bad_record < nrecords
+            && warnings[field] == false) {
             double scaled = v * multiplier;
             double rounded = round(scaled);
-            if (type->rep.pack_scale[j].warn && fabs(scaled - rounded) > 0.1 
-                && warnings[field] == false) {
-                LintelLog::warn(format("Warning, while packing field %s of record %d, error was"
-                                       " > 10%%:\n  (%.10g / %.10g = %.2f, round() = %.0f)\n")
-                                % type->rep.field_info[field].name % nrecords
-                                % v % (1.0/multiplier) % scaled % rounded);
-                warnings[field] = true;
-            }
-            *(double *)(fixed_record + offset) = rounded;
+            LintelLog::warn(format("Warning, while packing field %s of record %d, error was"
+                                   " > 10%%:\n  (%.10g / %.10g = %.2f, round() = %.0f)\n")
+                            % type->rep.field_info[field].name % (bad_record + 1)
+                            % v % (1.0/multiplier) % scaled % rounded);
+            warnings[field] = true;
         }
     }
     // unfortunately have to take the hash after we do all of the
@@ -796,8 +1188,13 @@ uint32_t Extent::packData(Extent::ByteArray &into, uint32_t compression_modes,
     // reversable, especially the scaling conversion which is
     // deliberately not precisely reversable
     SINVARIANT(fixed_coded.size() == type->rep.fixed_record_size * nrecords);
-    uint32_t bjhash = lintel::bobJenkinsHash(1972, fixed_coded.begin(),
-                                             type->rep.fixed_record_size * nrecords);
+    uint32_t unpacked_hash;
+    if (checksum_kind == checksum_crc32c) {
+        unpacked_hash = kernels.crc32c(0, fixed_coded.begin(), fixed_coded.size());
+    } else {
+        unpacked_hash = lintel::bobJenkinsHash(1972, fixed_coded.begin(),
+                                               type->rep.fixed_record_size * nrecords);
+    }
 
     if (type->getPackNullCompact() != ExtentType::CompactNo) {
         // do this after we do the fixed hash, so the checksum will
@@ -806,42 +1203,84 @@ uint32_t Extent::packData(Extent::ByteArray &into, uint32_t compression_modes,
         compactNulls(fixed_coded);
     }
 
+    if (type->hasEncodedFields()) {
+        // also after the hash; this stores the other columns in the
+        // columnar layout itself
+        packEncodedFields(fixed_coded);
+    } else if (type->getPackLayout() == ExtentType::LayoutColumnar) {
+        // also after the hash, so the checksum verifies the transpose
+        transposeToColumnar(fixed_coded);
+    }
+
     SINVARIANT(static_cast<size_t>(variable_data_pos - variable_coded.begin()) 
                <= variable_coded.size())
             variable_coded.resize(variable_data_pos - variable_coded.begin());
 
-    bjhash = lintel::bobJenkinsHash(bjhash, variable_coded.begin(), variable_coded.size());
-    vector<int32> variable_sizes;
-    variable_sizes.reserve(variable_sizes_batch_size);
-    byte *endvarpos = variable_coded.begin() + variable_coded.size();
-    for (byte *curvarpos = variable_coded.begin(4);curvarpos != endvarpos;) {
-        int32 size = *(int32 *)curvarpos;
-        variable_sizes.push_back(size);
-        if (variable_sizes.size() == variable_sizes_batch_size) {
-            bjhash = lintel::bobJenkinsHash(bjhash, &(variable_sizes[0]),
-                                            4*variable_sizes_batch_size);
-            variable_sizes.resize(0);
+    if (checksum_kind == checksum_crc32c) {
+        // The sizes are in variable_coded, so unlike v1 they aren't hashed again.
+        unpacked_hash = kernels.crc32c(unpacked_hash, variable_coded.begin(),
+                                       variable_coded.size());
+    } else {
+        uint32_t bjhash = lintel::bobJenkinsHash(unpacked_hash, variable_coded.begin(),
+                                                 variable_coded.size());
+        vector<int32> variable_sizes;
+        variable_sizes.reserve(variable_sizes_batch_size);
+        byte *endvarpos = variable_coded.begin() + variable_coded.size();
+        for (byte *curvarpos = variable_coded.begin(4);curvarpos != endvarpos;) {
+            int32 size = *(int32 *)curvarpos;
+            variable_sizes.push_back(size);
+            if (variable_sizes.size() == variable_sizes_batch_size) {
+                bjhash = lintel::bobJenkinsHash(bjhash, &(variable_sizes[0]),
+                                                4*variable_sizes_batch_size);
+                variable_sizes.resize(0);
+            }
+            curvarpos += 4 + Variable32Field::roundupSize(size);
+            SINVARIANT(curvarpos <= endvarpos);
         }
-        curvarpos += 4 + Variable32Field::roundupSize(size);
-        SINVARIANT(curvarpos <= endvarpos);
+        unpacked_hash = lintel::bobJenkinsHash(bjhash, &(variable_sizes[0]),
+                                               4*variable_sizes.size());
+    }
+
+    uint32_t fixed_modes = compression_modes, variable_modes = compression_modes;
+    if (policy != NULL && policy->use_section_modes) {
+        fixed_modes = policy->fixed_modes;
+        variable_modes = policy->variable_modes;
     }
-    bjhash = lintel::bobJenkinsHash(bjhash, &(variable_sizes[0]), 4*variable_sizes.size());
-    variable_sizes.resize(0);
 
     byte compressed_fixed_mode;
-    Extent::ByteArray *compressed_fixed 
-            = compressBytes(fixed_coded.begin(),fixed_coded.size(),
-                            compression_modes, compression_level,
-                            &compressed_fixed_mode);
+    Extent::ByteArray *compressed_fixed;
+    if (type->hasColumnGroups()) {
+        compressed_fixed = compressColumnGroups(fixed_coded, fixed_modes, compression_level,
+                                                compression_block_size, &compressed_fixed_mode,
+                                                policy, dictionary_id);
+    } else if (compression_block_size > 0 && fixed_coded.size() > compression_block_size) {
+        compressed_fixed = compressBytesChunked(fixed_coded.begin(), fixed_coded.size(),
+                                                fixed_modes, compression_level,
+                                                compression_block_size, &compressed_fixed_mode,
+                                                policy, dictionary_id);
+    } else {
+        compressed_fixed = compressBytes(fixed_coded.begin(),fixed_coded.size(),
+                                         fixed_modes, compression_level,
+                                         &compressed_fixed_mode, policy, dictionary_id);
+    }
     byte compressed_variable_mode;
     Extent::ByteArray *compressed_variable;
     // beginning at 4 bytes into the array avoids packing the 0 bytes at the beginning of the
     // variable coded stuff since that is fixed
-    compressed_variable 
-            = compressBytes(variable_coded.begin() + 4,
-                            variable_coded.size() - 4,
-                            compression_modes, compression_level,
-                            &compressed_variable_mode);
+    if (compression_block_size > 0 && variable_coded.size() - 4 > compression_block_size) {
+        compressed_variable
+                = compressBytesChunked(variable_coded.begin() + 4,
+                                       variable_coded.size() - 4,
+                                       variable_modes, compression_level,
+                                       compression_block_size, &compressed_variable_mode,
+                                       policy, dictionary_id);
+    } else {
+        compressed_variable 
+                = compressBytes(variable_coded.begin() + 4,
+                                variable_coded.size() - 4,
+                                variable_modes, compression_level,
+                                &compressed_variable_mode, policy, dictionary_id);
+    }
 
     int headersize = 6*4+4*1+type->getName().size();
     headersize += (4 - headersize % 4) % 4;
@@ -861,12 +1300,12 @@ uint32_t Extent::packData(Extent::ByteArray &into, uint32_t compression_modes,
     *(int32 *)l = compressed_variable->size(); l += 4;
     *(int32 *)l = nrecords; l += 4;
     *(int32 *)l = variable_coded.size(); l += 4;
-    *(int32 *)l = 0; l += 4; // compressed adler32 digest
-    *(int32 *)l = bjhash; l += 4;
+    *(int32 *)l = 0; l += 4; // compressed digest
+    *(int32 *)l = unpacked_hash; l += 4;
     *l = compressed_fixed_mode; l += 1;
     *l = compressed_variable_mode; l += 1;
     *l = (byte)type->getName().size(); l += 1;
-    *l = 0; l += 1;
+    *l = checksum_kind; l += 1;
     memcpy(l, type->getName().data(), type->getName().size()); l += type->getName().size();
     // TODO: verify that aligning speeds up the copy, I'm 90% sure
     // that's why it was done here since we will always copy out the
@@ -881,18 +1320,25 @@ uint32_t Extent::packData(Extent::ByteArray &into, uint32_t compression_modes,
     memset(l,0,align); l += align;
     SINVARIANT(l - into.begin() == extentsize);
 
-    // adler32 everything but the compressed digest
-    uLong adler32sum = adler32(0L, Z_NULL, 0);
-    adler32sum = adler32(adler32sum, into.begin(), 4*4);
-    adler32sum = adler32(adler32sum, into.begin() + 5*4, into.size()-5*4);
-    *(int32 *)(into.begin() + 4*4) = adler32sum;
+    // digest everything but the compressed digest
+    uint32_t packed_digest;
+    if (checksum_kind == checksum_crc32c) {
+        packed_digest = kernels.crc32c(0, into.begin(), 4*4);
+        packed_digest = kernels.crc32c(packed_digest, into.begin() + 5*4, into.size()-5*4);
+    } else {
+        uLong adler32sum = adler32(0L, Z_NULL, 0);
+        adler32sum = adler32(adler32sum, into.begin(), 4*4);
+        adler32sum = adler32(adler32sum, into.begin() + 5*4, into.size()-5*4);
+        packed_digest = static_cast<uint32_t>(adler32sum);
+    }
+    *(int32 *)(into.begin() + 4*4) = packed_digest;
     if (false) cout << format("final coded size %d bytes\n") % into.size();
     if (header_packed != NULL) *header_packed = headersize;
     if (fixed_packed != NULL) *fixed_packed = fixed_coded.size();
     if (variable_packed != NULL) *variable_packed = variable_coded.size();
     delete compressed_fixed;
     delete compressed_variable;
-    return bjhash ^ static_cast<uint32_t>(adler32sum);
+    return unpacked_hash ^ packed_digest;
 }
 
 bool Extent::packBZ2(byte *input, int32 inputsize,
@@ -1148,20 +1594,291 @@ bool Extent::unpackLZ4(byte* output, byte* input,
 #endif
 }
 
+#if DATASERIES_ENABLE_ZSTD
+// compression_level is 1..9 for all the algorithms, so use zstd's 1..9
+// rather than spreading it over 1..19; the default of 9 would otherwise
+// compress every extent at zstd's slowest level.
+static int zstdLevel(int compression_level) {
+    return max(1, min(compression_level, 9));
+}
+
+// Creating the zstd contexts allocates several hundred KiB, so each
+// thread keeps one of each and frees them when it exits.
+struct ZstdContexts {
+    ZSTD_CCtx *cctx;
+    ZSTD_DCtx *dctx;
+
+    ZstdContexts() : cctx(NULL), dctx(NULL) { }
+};
+
+static pthread_once_t zstd_contexts_once = PTHREAD_ONCE_INIT;
+static pthread_key_t zstd_contexts_key;
+
+static void freeZstdContexts(void *arg) {
+    ZstdContexts *contexts = static_cast<ZstdContexts *>(arg);
+    ZSTD_freeCCtx(contexts->cctx);
+    ZSTD_freeDCtx(contexts->dctx);
+    delete contexts;
+}
+
+static void initZstdContexts() {
+    INVARIANT(pthread_key_create(&zstd_contexts_key, freeZstdContexts) == 0,
+              "pthread_key_create failed");
+}
+
+static ZstdContexts &zstdContexts() {
+    pthread_once(&zstd_contexts_once, initZstdContexts);
+    ZstdContexts *ret = static_cast<ZstdContexts *>(pthread_getspecific(zstd_contexts_key));
+    if (ret == NULL) {
+        ret = new ZstdContexts();
+        pthread_setspecific(zstd_contexts_key, ret);
+    }
+    return *ret;
+}
+
+static ZSTD_CCtx *zstdCCtx() {
+    ZstdContexts &contexts(zstdContexts());
+    if (contexts.cctx == NULL) {
+        contexts.cctx = ZSTD_createCCtx();
+        SINVARIANT(contexts.cctx != NULL);
+    }
+    return contexts.cctx;
+}
+
+static ZSTD_DCtx *zstdDCtx() {
+    ZstdContexts &contexts(zstdContexts());
+    if (contexts.dctx == NULL) {
+        contexts.dctx = ZSTD_createDCtx();
+        SINVARIANT(contexts.dctx != NULL);
+    }
+    return contexts.dctx;
+}
+
+// Registered dictionaries, by the id that zstd stores in the frame
+// header of the data compressed with them.
+struct ZstdDictionary {
+    string data;
+    ZSTD_DDict *ddict;
+    vector<ZSTD_CDict *> cdicts; // by zstd level, made on first use
+};
+
+static PThreadMutex zstd_dictionaries_mutex;
+static HashMap<uint32_t, ZstdDictionary *> zstd_dictionaries;
+
+static ZstdDictionary *getZstdDictionary(uint32_t dictionary_id) {
+    ZstdDictionary **d = zstd_dictionaries.lookup(dictionary_id);
+    INVARIANT(d != NULL, format("zstd dictionary %d was never registered") % dictionary_id);
+    return *d;
+}
+
+static ZSTD_CDict *getZstdCDict(uint32_t dictionary_id, int level) {
+    PThreadScopedLock lock(zstd_dictionaries_mutex);
+    ZstdDictionary *d = getZstdDictionary(dictionary_id);
+    if (d->cdicts.size() <= static_cast<size_t>(level)) {
+        d->cdicts.resize(level + 1, NULL);
+    }
+    if (d->cdicts[level] == NULL) {
+        d->cdicts[level] = ZSTD_createCDict(d->data.data(), d->data.size(), level);
+        SINVARIANT(d->cdicts[level] != NULL);
+    }
+    return d->cdicts[level];
+}
+
+static ZSTD_DDict *getZstdDDict(uint32_t dictionary_id) {
+    PThreadScopedLock lock(zstd_dictionaries_mutex);
+    return getZstdDictionary(dictionary_id)->ddict;
+}
+#endif
+
+uint32_t Extent::registerCompressionDictionary(const string &dictionary) {
+#if DATASERIES_ENABLE_ZSTD
+    uint32_t id = ZDICT_getDictID(dictionary.data(), dictionary.size());
+    INVARIANT(id != 0, "invalid zstd dictionary, it has no dictionary id");
+    PThreadScopedLock lock(zstd_dictionaries_mutex);
+    ZstdDictionary *&d = zstd_dictionaries[id];
+    if (d == NULL) {
+        d = new ZstdDictionary;
+        d->data = dictionary;
+        d->ddict = ZSTD_createDDict(dictionary.data(), dictionary.size());
+        SINVARIANT(d->ddict != NULL);
+    } else {
+        INVARIANT(d->data == dictionary,
+                  format("two different zstd dictionaries have the same id %d") % id);
+    }
+    return id;
+#else
+    return 0;
+#endif
+}
+
+string Extent::trainCompressionDictionary(const vector<Extent::Ptr> &samples, size_t max_size) {
+#if DATASERIES_ENABLE_ZSTD
+    // Train on what compressBytes sees: the fixed and variable data
+    // after packing, which an uncompressed packData leaves in place.
+    string sample_data;
+    vector<size_t> sample_sizes;
+    for (vector<Extent::Ptr>::const_iterator i = samples.begin(); i != samples.end(); ++i) {
+        Extent::ByteArray packed;
+        (**i).packData(packed, 0, 1);
+        int32 fixed_size = *reinterpret_cast<int32 *>(packed.begin());
+        int32 variable_size = *reinterpret_cast<int32 *>(packed.begin() + 4);
+        int32 headersize = 6*4 + 4*1 + (**i).type->getName().size();
+        headersize += (4 - headersize % 4) % 4;
+        byte *fixed = packed.begin() + headersize;
+        byte *variable = fixed + fixed_size + (4 - fixed_size % 4) % 4;
+        if (fixed_size > 0) {
+            sample_data.append(reinterpret_cast<char *>(fixed), fixed_size);
+            sample_sizes.push_back(fixed_size);
+        }
+        if (variable_size > 0) {
+            sample_data.append(reinterpret_cast<char *>(variable), variable_size);
+            sample_sizes.push_back(variable_size);
+        }
+    }
+    if (sample_sizes.empty()) {
+        return string();
+    }
+    string dictionary(max_size, '\0');
+    size_t size = ZDICT_trainFromBuffer(&dictionary[0], max_size, sample_data.data(),
+                                        &sample_sizes[0], sample_sizes.size());
+    if (ZDICT_isError(size)) {
+        LintelLogDebug("Extent", format("training zstd dictionary failed: %s")
+                       % ZDICT_getErrorName(size));
+        return string();
+    }
+    dictionary.resize(size);
+    return dictionary;
+#else
+    return string();
+#endif
+}
+
+bool Extent::packZstd(byte* input, int32 inputsize,
+                      Extent::ByteArray &into, int compression_level) {
+    return packZstdDictionary(input, inputsize, into, compression_level, 0);
+}
+
+bool Extent::packZstdDictionary(byte* input, int32 inputsize, Extent::ByteArray &into,
+                                int compression_level, uint32_t dictionary_id) {
+#if DATASERIES_ENABLE_ZSTD
+
+    size_t output_length = ZSTD_compressBound(inputsize);
+    into.resize(output_length, false);
+
+    size_t ret;
+    if (dictionary_id == 0) {
+        ret = ZSTD_compressCCtx(zstdCCtx(), into.begin(), output_length, input, inputsize,
+                                zstdLevel(compression_level));
+    } else {
+        ret = ZSTD_compress_usingCDict(zstdCCtx(), into.begin(), output_length, input,
+                                       inputsize, getZstdCDict(dictionary_id,
+                                                               zstdLevel(compression_level)));
+    }
+
+    if (!ZSTD_isError(ret) && ret < static_cast<size_t>(inputsize)) {
+        into.resize(ret);
+        return true;
+    }
+
+    return false;
+
+#else
+    return false;
+#endif
+}
+
+bool Extent::unpackZstd(byte* output, byte* input,
+                        int32 input_size, int32 &output_size) {
+#if DATASERIES_ENABLE_ZSTD
+
+    uint32_t dictionary_id = ZSTD_getDictID_fromFrame(input, input_size);
+    size_t ret;
+    if (dictionary_id == 0) {
+        ret = ZSTD_decompressDCtx(zstdDCtx(), output, output_size, input, input_size);
+    } else {
+        ret = ZSTD_decompress_usingDDict(zstdDCtx(), output, output_size, input, input_size,
+                                         getZstdDDict(dictionary_id));
+    }
+
+    INVARIANT(!ZSTD_isError(ret), format("Error decompressing extent: %s")
+              % ZSTD_getErrorName(ret));
+    output_size = static_cast<int32>(ret);
+    return true;
+#else
+    return false;
+#endif
+}
+
 // TODO: test that this works, but I believe that if we do a resize on
 // the extent that is about to be used when we pass it in to the sub
 // pack functions then the compression algorithms will stop early if
 // they can't compress into the smaller amount of space.
 
-Extent::ByteArray *Extent::compressBytes(byte *input, int32 input_size,
+Extent::CompressionPolicy Extent::CompressionPolicy::fromName(const string &name) {
+    // The weights are relative to one byte; read-optimized treats a
+    // second of decompression as costing as much as reading 200MB,
+    // roughly a fast disk, and balanced as much as 20MB.
+    if (name == "smallest") {
+        return CompressionPolicy();
+    } else if (name == "balanced") {
+        return CompressionPolicy(20.0e6, 1);
+    } else if (name == "read-optimized") {
+        return CompressionPolicy(200.0e6, 1);
+    } else if (prefixequal(name, "cost:")) {
+        vector<string> weights;
+        split(name.substr(5), ",", weights);
+        INVARIANT(weights.size() == 2, format("expected cost:F1,F2, not '%s'") % name);
+        CompressionPolicy ret(stringToDouble(weights[0]), stringToDouble(weights[1]));
+        INVARIANT(ret.decompress_weight >= 0 && ret.size_weight >= 0,
+                  format("compression policy weights in '%s' must not be negative") % name);
+        return ret;
+    } else {
+        FATAL_ERROR(format("unknown compression policy '%s', expected smallest, balanced,"
+                           " read-optimized or cost:F1,F2") % name);
+    }
+}
+
+// Returns the seconds taken to uncompress packed, which was compressed
+// with mode from size bytes, into scratch.
+static double timeUncompress(int mode, Extent::ByteArray &packed, Extent::ByteArray &scratch,
+                             int32_t size) {
+    Clock::Tdbl start = Clock::tod();
+    int32_t outsize = size;
+    bool success = Extent::compression_algs[mode].unpackFunc(scratch.begin(), packed.begin(),
+                                                             packed.size(), outsize);
+    Clock::Tdbl end = Clock::tod();
+    INVARIANT(success && outsize == size,
+              format("%s failed to uncompress its own output") 
+              % Extent::compression_algs[mode].name);
+    return end - start;
+}
+
+Extent::ByteArray *Extent::compressBytes(byte *input, int32_t input_size,
                                          int compression_modes,
-                                         int compression_level, byte *mode) {
+                                         int compression_level, byte *mode,
+                                         const CompressionPolicy *policy,
+                                         uint32_t dictionary_id) {
+    *mode = 0;
     if (input_size == 0) {
         return new Extent::ByteArray;
     }
 
     Extent::ByteArray *best_packed = NULL;
-    *mode = 0;
+
+    // With a timed policy, leaving the data uncompressed is a candidate
+    // like any other, costing the time to copy it.  Section modes are the
+    // choice of an earlier trial, so they are used without timing them
+    // again; that is what bounds the cost of a timed policy.
+    bool timed = policy != NULL && policy->timed() && !policy->use_section_modes;
+    Extent::ByteArray scratch;
+    double best_cost = 0;
+    if (timed) {
+        scratch.resize(input_size, false);
+        Clock::Tdbl start = Clock::tod();
+        memcpy(scratch.begin(), input, input_size);
+        best_cost = policy->size_weight * input_size
+            + policy->decompress_weight * (Clock::tod() - start);
+    }
 
     // Notes on the order of attempted compression algorithms:
     // On reasonably powerful machines today in 2013, this should not be of
@@ -1193,12 +1910,29 @@ Extent::ByteArray *Extent::compressBytes(byte *input, int32 input_size,
 
         Extent::ByteArray* next_pack = new Extent::ByteArray;
         
-        bool packResult = compression_algs[i].packFunc(input, input_size,
-                                                       *next_pack, 
-                                                       compression_level);
+        bool packResult;
+        if (i == compress_mode_zstd && dictionary_id != 0) {
+            packResult = packZstdDictionary(input, input_size, *next_pack,
+                                            compression_level, dictionary_id);
+        } else {
+            packResult = compression_algs[i].packFunc(input, input_size,
+                                                      *next_pack, 
+                                                      compression_level);
+        }
         
 
-        if ( (packResult && next_pack->size() < (size_t)input_size) &&
+        if (timed && packResult && next_pack->size() < (size_t)input_size) {
+            double cost = policy->size_weight * next_pack->size() + policy->decompress_weight
+                * timeUncompress(i, *next_pack, scratch, input_size);
+            if (cost < best_cost) {
+                delete best_packed;
+                best_packed = next_pack;
+                best_cost = cost;
+                *mode = i;
+            } else {
+                delete next_pack;
+            }
+        } else if ( (packResult && next_pack->size() < (size_t)input_size) &&
              (best_packed == NULL || next_pack->size() < best_packed->size()) ) { 
                 delete best_packed;
                 best_packed = next_pack;
@@ -1252,6 +1986,285 @@ int32_t Extent::uncompressBytes(byte *into, byte *from, byte compression_mode,
     return outsize;
 }
 
+void Extent::compressBlock(byte *input, int32 input_size, int compression_modes,
+                           int compression_level, const CompressionPolicy *policy,
+                           uint32_t dictionary_id, Extent::ByteArray **into, byte *mode) {
+    *into = compressBytes(input, input_size, compression_modes, compression_level, mode, policy,
+                          dictionary_id);
+}
+
+void Extent::uncompressBlock(byte *into, byte *from, byte compression_mode,
+                             int32 intosize, int32 fromsize, int32 *outsize) {
+    *outsize = uncompressBytes(into, from, compression_mode, intosize, fromsize);
+}
+
+// Chunked data is a table followed by the independently compressed
+// blocks; see doc/file-format.txt.  Every block except the last one
+// uncompresses to exactly block_size bytes.
+Extent::ByteArray *Extent::compressBytesChunked(byte *input, int32 input_size,
+                                                int compression_modes,
+                                                int compression_level,
+                                                uint32_t block_size, byte *mode,
+                                                const CompressionPolicy *policy,
+                                                uint32_t dictionary_id) {
+    SINVARIANT(block_size > 0 && input_size > 0);
+    uint32_t nblocks = (static_cast<uint32_t>(input_size) + block_size - 1) / block_size;
+    vector<Extent::ByteArray *> blocks(nblocks, static_cast<Extent::ByteArray *>(NULL));
+    vector<byte> modes(nblocks, 0);
+
+    vector<boost::function<void ()> > tasks;
+    tasks.reserve(nblocks);
+    for (uint32_t i = 0; i < nblocks; ++i) {
+        int32 size = min(block_size, static_cast<uint32_t>(input_size) - i * block_size);
+        tasks.push_back(boost::bind(&Extent::compressBlock, input + i * block_size, size,
+                                    compression_modes, compression_level, policy,
+                                    dictionary_id, &blocks[i], &modes[i]));
+    }
+    dataseries::TaskPool::shared().runAll(tasks);
+
+    uint32_t table_size = 4 + 4 + 4 * nblocks + nblocks;
+    table_size += (4 - table_size % 4) % 4;
+    size_t total_size = table_size;
+    vector<uint32_t> mode_counts(num_comp_algs, 0);
+    for (uint32_t i = 0; i < nblocks; ++i) {
+        total_size += blocks[i]->size();
+        ++mode_counts[modes[i]];
+    }
+
+    Extent::ByteArray *ret = new Extent::ByteArray;
+    ret->resize(total_size, false);
+    byte *l = ret->begin();
+    *reinterpret_cast<int32 *>(l) = block_size; l += 4;
+    *reinterpret_cast<int32 *>(l) = nblocks; l += 4;
+    for (uint32_t i = 0; i < nblocks; ++i) {
+        *reinterpret_cast<int32 *>(l) = blocks[i]->size(); l += 4;
+    }
+    memcpy(l, &modes[0], nblocks); l += nblocks;
+    memset(l, 0, ret->begin() + table_size - l); l = ret->begin() + table_size;
+    for (uint32_t i = 0; i < nblocks; ++i) {
+        memcpy(l, blocks[i]->begin(), blocks[i]->size()); l += blocks[i]->size();
+        delete blocks[i];
+    }
+    SINVARIANT(l == ret->end());
+
+    *mode = compress_mode_chunked 
+        | (max_element(mode_counts.begin(), mode_counts.end()) - mode_counts.begin());
+    return ret;
+}
+
+int32_t Extent::uncompressBytesChunked(byte *into, byte *from, int32 intosize,
+                                       int32 fromsize, bool fix_endianness) {
+    INVARIANT(fromsize >= 8, "Invalid extent data, chunked data too small");
+    int32 *table = reinterpret_cast<int32 *>(from);
+    if (fix_endianness) {
+        Extent::flip4bytes(from);
+        Extent::flip4bytes(from + 4);
+    }
+    uint32_t block_size = table[0];
+    uint32_t nblocks = table[1];
+    uint32_t table_size = 4 + 4 + 4 * nblocks + nblocks;
+    table_size += (4 - table_size % 4) % 4;
+    INVARIANT(block_size > 0 && nblocks > 0 && nblocks <= static_cast<uint32_t>(fromsize)
+              && table_size <= static_cast<uint32_t>(fromsize)
+              && (nblocks - 1) * static_cast<uint64_t>(block_size) < static_cast<uint32_t>(intosize),
+              format("Invalid extent data, bad chunk table %d blocks of %d bytes for %d bytes")
+              % nblocks % block_size % intosize);
+    if (fix_endianness) {
+        run_flip4bytes(reinterpret_cast<uint32_t *>(table + 2), nblocks);
+    }
+    const byte *modes = from + 8 + 4 * nblocks;
+
+    vector<int32> outsizes(nblocks, -1);
+    vector<boost::function<void ()> > tasks;
+    tasks.reserve(nblocks);
+    byte *block = from + table_size;
+    for (uint32_t i = 0; i < nblocks; ++i) {
+        int32 compressed_size = table[2 + i];
+        INVARIANT(compressed_size >= 0 && block + compressed_size <= from + fromsize,
+                  "Invalid extent data, chunk overruns the compressed data");
+        int32 size = min(block_size, static_cast<uint32_t>(intosize) - i * block_size);
+        INVARIANT(modes[i] < num_comp_algs, "Invalid extent data, bad chunk compression mode");
+        tasks.push_back(boost::bind(&Extent::uncompressBlock, into + i * block_size, block,
+                                    modes[i], size, compressed_size, &outsizes[i]));
+        block += compressed_size;
+    }
+    INVARIANT(block == from + fromsize, "Invalid extent data, chunk sizes do not add up");
+    dataseries::TaskPool::shared().runAll(tasks);
+
+    int32 outsize = 0;
+    for (uint32_t i = 0; i < nblocks; ++i) {
+        // only the last block can be short, otherwise the output has holes.
+        INVARIANT(i + 1 == nblocks || outsizes[i] == static_cast<int32>(block_size),
+                  "Invalid extent data, short chunk");
+        outsize += outsizes[i];
+    }
+    return outsize;
+}
+
+void Extent::compressColumnGroup(byte *input, int32 input_size, int compression_modes,
+                                 int compression_level, uint32_t block_size,
+                                 const CompressionPolicy *policy, uint32_t dictionary_id,
+                                 Extent::ByteArray **into, byte *mode) {
+    if (block_size > 0 && static_cast<uint32_t>(input_size) > block_size) {
+        *into = compressBytesChunked(input, input_size, compression_modes, compression_level,
+                                     block_size, mode, policy, dictionary_id);
+    } else {
+        *into = compressBytes(input, input_size, compression_modes, compression_level, mode,
+                              policy, dictionary_id);
+    }
+}
+
+// Each column group is copied out column by column and compressed on
+// its own (chunked if it is large), in parallel; the groups follow a
+// table of their compressed sizes and modes, see doc/file-format.txt.
+Extent::ByteArray *Extent::compressColumnGroups(const Extent::ByteArray &fixed_coded,
+                                                int compression_modes, int compression_level,
+                                                uint32_t block_size, byte *mode,
+                                                const CompressionPolicy *policy,
+                                                uint32_t dictionary_id) {
+    const vector<vector<ExtentType::columnarRun> > &groups(type->rep.column_groups);
+    const size_t record_size = type->rep.fixed_record_size;
+    SINVARIANT(fixed_coded.size() % record_size == 0);
+    const uint32_t nrecords = fixed_coded.size() / record_size;
+    const uint32_t ngroups = groups.size();
+
+    Extent::ByteArray columns;
+    columns.resize(fixed_coded.size(), false); // every byte is overwritten
+    vector<Extent::ByteArray *> packed(ngroups, static_cast<Extent::ByteArray *>(NULL));
+    vector<byte> modes(ngroups, 0);
+    vector<boost::function<void ()> > tasks;
+    tasks.reserve(ngroups);
+    byte *to = columns.begin();
+    typedef vector<ExtentType::columnarRun>::const_iterator runiT;
+    for (uint32_t g = 0; g < ngroups; ++g) {
+        byte *group_begin = to;
+        for (runiT i = groups[g].begin(); i != groups[g].end(); ++i) {
+            columnarCopy(to, i->size, fixed_coded.begin() + i->offset, record_size,
+                         nrecords, i->size);
+            to += static_cast<size_t>(i->size) * nrecords;
+        }
+        tasks.push_back(boost::bind(&Extent::compressColumnGroup, group_begin,
+                                    static_cast<int32>(to - group_begin), compression_modes,
+                                    compression_level, block_size, policy, dictionary_id,
+                                    &packed[g], &modes[g]));
+    }
+    SINVARIANT(to == columns.end());
+    dataseries::TaskPool::shared().runAll(tasks);
+
+    uint32_t table_size = 4 + 4 * ngroups + ngroups;
+    table_size += (4 - table_size % 4) % 4;
+    size_t total_size = table_size;
+    vector<uint32_t> mode_counts(num_comp_algs, 0);
+    for (uint32_t g = 0; g < ngroups; ++g) {
+        total_size += packed[g]->size() + (4 - packed[g]->size() % 4) % 4;
+        ++mode_counts[modes[g] & ~compress_mode_chunked];
+    }
+
+    Extent::ByteArray *ret = new Extent::ByteArray;
+    ret->resize(total_size, false);
+    byte *l = ret->begin();
+    *reinterpret_cast<int32 *>(l) = ngroups; l += 4;
+    for (uint32_t g = 0; g < ngroups; ++g) {
+        *reinterpret_cast<int32 *>(l) = packed[g]->size(); l += 4;
+    }
+    memcpy(l, &modes[0], ngroups); l += ngroups;
+    memset(l, 0, ret->begin() + table_size - l); l = ret->begin() + table_size;
+    for (uint32_t g = 0; g < ngroups; ++g) {
+        memcpy(l, packed[g]->begin(), packed[g]->size()); l += packed[g]->size();
+        size_t align = (4 - packed[g]->size() % 4) % 4;
+        memset(l, 0, align); l += align;
+        delete packed[g];
+    }
+    SINVARIANT(l == ret->end());
+
+    *mode = compress_mode_grouped
+        | (max_element(mode_counts.begin(), mode_counts.end()) - mode_counts.begin());
+    return ret;
+}
+
+// Uncompresses the selected column groups into the fixed data in
+// parallel, and zeros the others; *partial is set if any were skipped.
+int32_t Extent::uncompressColumnGroups(byte *from, int32 fromsize, uint32_t nrecords,
+                                     bool fix_endianness,
+                                     const ExtentType::ColumnSelection *columns,
+                                     bool *partial) {
+    const vector<vector<ExtentType::columnarRun> > &groups(type->rep.column_groups);
+    const size_t record_size = type->rep.fixed_record_size;
+    INVARIANT(fromsize >= 4, "Invalid extent data, column group table too small");
+    int32 *table = reinterpret_cast<int32 *>(from);
+    if (fix_endianness) {
+        Extent::flip4bytes(from);
+    }
+    uint32_t ngroups = table[0];
+    INVARIANT(ngroups == groups.size(), format("Invalid extent data, %d column groups, expected %d")
+              % ngroups % groups.size());
+    uint32_t table_size = 4 + 4 * ngroups + ngroups;
+    table_size += (4 - table_size % 4) % 4;
+    INVARIANT(table_size <= static_cast<uint32_t>(fromsize),
+              "Invalid extent data, column group table too small");
+    if (fix_endianness) {
+        run_flip4bytes(reinterpret_cast<uint32_t *>(table + 1), ngroups);
+    }
+    const byte *modes = from + 4 + 4 * ngroups;
+
+    *partial = false;
+    vector<boost::function<void ()> > tasks;
+    tasks.reserve(ngroups);
+    byte *group = from + table_size;
+    for (uint32_t g = 0; g < ngroups; ++g) {
+        int32 compressed_size = table[1 + g];
+        INVARIANT(compressed_size >= 0 && group + compressed_size <= from + fromsize,
+                  "Invalid extent data, column group overruns the compressed data");
+        if (columns == NULL || columns->groups.empty() || columns->groups[g]) {
+            tasks.push_back(boost::bind(&Extent::uncompressColumnGroup, this, g, group,
+                                        compressed_size, modes[g], nrecords, fix_endianness));
+        } else {
+            *partial = true;
+            typedef vector<ExtentType::columnarRun>::const_iterator runiT;
+            for (runiT i = groups[g].begin(); i != groups[g].end(); ++i) {
+                byte *to = fixeddata.begin() + i->offset;
+                for (uint32_t r = 0; r < nrecords; ++r, to += record_size) {
+                    memset(to, 0, i->size);
+                }
+            }
+        }
+        group += compressed_size + (4 - compressed_size % 4) % 4;
+    }
+    INVARIANT(group == from + fromsize, "Invalid extent data, column group sizes do not add up");
+    dataseries::TaskPool::shared().runAll(tasks);
+    return nrecords * record_size;
+}
+
+void Extent::uncompressColumnGroup(uint32_t group, byte *from, int32 fromsize, byte mode,
+                                   uint32_t nrecords, bool fix_endianness) {
+    const vector<ExtentType::columnarRun> &runs(type->rep.column_groups[group]);
+    const size_t record_size = type->rep.fixed_record_size;
+    typedef vector<ExtentType::columnarRun>::const_iterator runiT;
+    size_t group_size = 0;
+    for (runiT i = runs.begin(); i != runs.end(); ++i) {
+        group_size += i->size;
+    }
+    INVARIANT((mode & ~compress_mode_chunked) < num_comp_algs,
+              "Invalid extent data, bad column group compression mode");
+    Extent::ByteArray columns;
+    columns.resize(group_size * nrecords, false);
+    int32 outsize;
+    if (mode & compress_mode_chunked) {
+        outsize = uncompressBytesChunked(columns.begin(), from, columns.size(), fromsize,
+                                         fix_endianness);
+    } else {
+        outsize = uncompressBytes(columns.begin(), from, mode, columns.size(), fromsize);
+    }
+    INVARIANT(outsize == static_cast<int32>(columns.size()),
+              "Invalid extent data, bad column group size");
+
+    const byte *l = columns.begin();
+    for (runiT i = runs.begin(); i != runs.end(); ++i) {
+        columnarCopy(fixeddata.begin() + i->offset, record_size, l, i->size, nrecords, i->size);
+        l += static_cast<size_t>(i->size) * nrecords;
+    }
+}
+
 #define TIME_UNPACKING(x)
 
 const string Extent::getPackedExtentType(const Extent::ByteArray &from) {
@@ -1267,7 +2280,51 @@ const string Extent::getPackedExtentType(const Extent::ByteArray &from) {
     return type_name;
 }
 
-void Extent::unpackData(Extent::ByteArray &from, bool fix_endianness) {
+// The private mappings of an extent made by mmapExtent.  The variable
+// data is mapped a second time, starting 4 bytes early, so that unpacking
+// can zero those bytes to make the empty string at the start of the
+// variable data without changing the end of the fixed data, which is what
+// is there in the first mapping.
+class MappedExtent : public Extent::ByteArray::Owner {
+  public:
+    typedef Extent::byte byte;
+
+    MappedExtent(int fd, off64_t offset, uint64_t size, uint64_t variable_offset) {
+        extent = map(fd, offset, size, extent_mapping, extent_mapping_size);
+        variable = map(fd, offset + variable_offset - 4, size - variable_offset + 4,
+                       variable_mapping, variable_mapping_size);
+    }
+
+    virtual ~MappedExtent() {
+        unmap(extent_mapping, extent_mapping_size);
+        unmap(variable_mapping, variable_mapping_size);
+    }
+
+    byte *extent, *variable;
+  private:
+    static byte *map(int fd, off64_t offset, uint64_t size, void *&mapping,
+                     size_t &mapping_size) {
+        static const off64_t page_size = sysconf(_SC_PAGESIZE);
+        off64_t page_offset = offset % page_size;
+        mapping_size = size + page_offset;
+        mapping = mmap64(NULL, mapping_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                         fd, offset - page_offset);
+        INVARIANT(mapping != MAP_FAILED, format("mmap of %d bytes at %d failed: %s")
+                  % mapping_size % (offset - page_offset) % strerror(errno));
+        return static_cast<byte *>(mapping) + page_offset;
+    }
+
+    static void unmap(void *mapping, size_t mapping_size) {
+        CHECKED(munmap(mapping, mapping_size) == 0,
+                format("munmap failed: %s") % strerror(errno));
+    }
+
+    void *extent_mapping, *variable_mapping;
+    size_t extent_mapping_size, variable_mapping_size;
+};
+
+void Extent::unpackData(Extent::ByteArray &from, bool fix_endianness,
+                        const ExtentType::ColumnSelection *columns) {
     if (!did_checks_init) {
         setReadChecksFromEnv();
     }
@@ -1275,12 +2332,22 @@ void Extent::unpackData(Extent::ByteArray &from, bool fix_endianness) {
               "Internal: type mismatch") ;
 
     TIME_UNPACKING(Clock::Tdbl time_start = Clock::tod());
-    INVARIANT(from.size() > (6*4+2), "Invalid extent data, too small.");
-
-    uLong adler32sum = adler32(0L, Z_NULL, 0);
-    if (preuncompress_check) {
+    INVARIANT(from.size() > (6*4+4), "Invalid extent data, too small.");
+
+    const Kernels &kernels = dataseries::pack_kernels::kernels();
+    const byte checksum_kind = from[6*4+3];
+    INVARIANT(checksum_kind == checksum_v1 || checksum_kind == checksum_crc32c,
+              format("Invalid extent data, unknown checksum kind %d")
+              % static_cast<int>(checksum_kind));
+    uint32_t packed_digest = 0;
+    if (preuncompress_check && checksum_kind == checksum_crc32c) {
+        packed_digest = kernels.crc32c(0, from.begin(), 4*4);
+        packed_digest = kernels.crc32c(packed_digest, from.begin() + 5*4, from.size()-5*4);
+    } else if (preuncompress_check) {
+        uLong adler32sum = adler32(0L, Z_NULL, 0);
         adler32sum = adler32(adler32sum, from.begin(), 4*4);
         adler32sum = adler32(adler32sum, from.begin() + 5*4, from.size()-5*4);
+        packed_digest = static_cast<uint32_t>(adler32sum);
     }
     if (fix_endianness) {
         for (int i=0 ; i < 6*4 ; i += 4) {
@@ -1288,10 +2355,11 @@ void Extent::unpackData(Extent::ByteArray &from, bool fix_endianness) {
         }
     }
     if (preuncompress_check) {
-        INVARIANT(*(int32 *)(from.begin() + 4*4) == (int32)adler32sum,
-                  format("Invalid extent data, adler32 digest"
+        INVARIANT(*(int32 *)(from.begin() + 4*4) == (int32)packed_digest,
+                  format("Invalid extent data, %s digest"
                          " mismatch on compressed data %x != %x")
-                  % *(int32 *)(from.begin() + 4*4) % (int32)adler32sum);
+                  % (checksum_kind == checksum_crc32c ? "crc32c" : "adler32")
+                  % *(int32 *)(from.begin() + 4*4) % (int32)packed_digest);
     }
     TIME_UNPACKING(Clock::Tdbl time_upc = Clock::tod());
     int32 compressed_fixed_size = *(int32 *)from.begin();
@@ -1316,42 +2384,113 @@ void Extent::unpackData(Extent::ByteArray &from, bool fix_endianness) {
     INVARIANT(header_len + rounded_fixed + rounded_variable == from.size(),
               "Invalid extent data");
 
-    fixeddata.resize(nrecords * type->rep.fixed_record_size, false);
-
-    int32 fixed_uncompressed_size
-            = uncompressBytes(fixeddata.begin(),compressed_fixed_begin,
-                              compressed_fixed_mode,
-                              nrecords * type->rep.fixed_record_size,
-                              compressed_fixed_size);
+    // Uncompressed data mapped by mmapExtent is used where it is; any
+    // decoding below then modifies private copies of the mapped pages.
+    MappedExtent *mapped = dynamic_cast<MappedExtent *>(from.getOwner().get());
+    // The encoded fields are variable sized, so they are uncompressed
+    // into space for the largest they could be.
+    const bool encoded = type->hasEncodedFields();
+    const int32 fixed_size = encoded
+        ? encodedFixedBound(type->rep.fixed_record_size, type->rep.bitwidth_field_columns.size(),
+                            type->rep.pack_encoding.size(), nrecords)
+        : nrecords * type->rep.fixed_record_size;
+    INVARIANT(((compressed_fixed_mode & compress_mode_grouped) != 0) == type->hasColumnGroups(),
+              "Invalid extent data, column groups do not match the type");
+    // partial if some of the columns are left out, so the unpacked hash
+    // can't be checked
+    bool partial = false;
+    int32 fixed_uncompressed_size;
+    if (compressed_fixed_mode & compress_mode_grouped) {
+        fixeddata.resize(fixed_size, false);
+        fixed_uncompressed_size
+                = uncompressColumnGroups(compressed_fixed_begin, compressed_fixed_size, nrecords,
+                                         fix_endianness, columns, &partial);
+    } else if (mapped != NULL && compressed_fixed_mode == compress_mode_none
+        && compressed_fixed_size == fixed_size && !encoded) {
+        fixeddata.borrow(compressed_fixed_begin, fixed_size, from.getOwner());
+        fixed_uncompressed_size = fixed_size;
+    } else if (compressed_fixed_mode & compress_mode_chunked) {
+        fixeddata.resize(fixed_size, false);
+        fixed_uncompressed_size
+                = uncompressBytesChunked(fixeddata.begin(), compressed_fixed_begin,
+                                         fixed_size, compressed_fixed_size, fix_endianness);
+    } else {
+        fixeddata.resize(fixed_size, false);
+        fixed_uncompressed_size
+                = uncompressBytes(fixeddata.begin(),compressed_fixed_begin,
+                                  compressed_fixed_mode, fixed_size,
+                                  compressed_fixed_size);
+    }
+    if (encoded) {
+        unpackEncodedFields(fixeddata, fixed_uncompressed_size, nrecords, fix_endianness);
+    } else if (type->getPackLayout() == ExtentType::LayoutColumnar) {
+        INVARIANT(fixed_uncompressed_size == nrecords * type->rep.fixed_record_size,
+                  "Invalid extent data, bad columnar fixed size");
+        transposeFromColumnar(fixeddata);
+    }
     if (type->getPackNullCompact() != ExtentType::CompactNo) {
         uncompactNulls(fixeddata, fixed_uncompressed_size);
     }
     INVARIANT(fixed_uncompressed_size == nrecords * type->rep.fixed_record_size, "internal");
     
-    variabledata.resize(variable_size, false);
     INVARIANT(variable_size >= 4, "error unpacking, invalid variable size");
+    // Without the variable data every variable32 value is empty.
+    const bool skip_variable = columns != NULL && !columns->variable;
+    bool borrow_variable = mapped != NULL && compressed_variable_mode == compress_mode_none
+        && compressed_variable_size == variable_size - 4;
+    if (skip_variable) {
+        variabledata.resize(4, false);
+        partial = true;
+    } else if (borrow_variable) {
+        variabledata.borrow(mapped->variable, variable_size, from.getOwner());
+    } else {
+        variabledata.resize(variable_size, false);
+    }
     *(int32 *)variabledata.begin() = 0;
-    int32 variable_uncompressed_size
-            = uncompressBytes(variabledata.begin()+4, compressed_variable_begin,
-                              compressed_variable_mode,
-                              variable_size-4, compressed_variable_size);
-    INVARIANT(variable_uncompressed_size == variable_size - 4, "internal");
-    uint32_t bjhash = 0;
-    if (postuncompress_check) {
-        bjhash = lintel::bobJenkinsHash(1972, fixeddata.begin(), fixeddata.size());
-        bjhash = lintel::bobJenkinsHash(bjhash, variabledata.begin(), variabledata.size());
+    int32 variable_uncompressed_size;
+    if (skip_variable) {
+        variable_uncompressed_size = 0;
+    } else if (borrow_variable) {
+        variable_uncompressed_size = variable_size - 4;
+    } else if (compressed_variable_mode & compress_mode_chunked) {
+        variable_uncompressed_size
+                = uncompressBytesChunked(variabledata.begin()+4, compressed_variable_begin,
+                                         variable_size-4, compressed_variable_size,
+                                         fix_endianness);
+    } else {
+        variable_uncompressed_size
+                = uncompressBytes(variabledata.begin()+4, compressed_variable_begin,
+                                  compressed_variable_mode,
+                                  variable_size-4, compressed_variable_size);
+    }
+    INVARIANT(variable_uncompressed_size == static_cast<int32>(variabledata.size()) - 4,
+              "internal");
+    uint32_t unpacked_hash = 0;
+    const bool check_hash = postuncompress_check && !partial;
+    // v1 also hashes the variable sizes separately
+    const bool hash_sizes = check_hash && checksum_kind == checksum_v1;
+    if (check_hash && checksum_kind == checksum_crc32c) {
+        unpacked_hash = kernels.crc32c(0, fixeddata.begin(), fixeddata.size());
+        unpacked_hash = kernels.crc32c(unpacked_hash, variabledata.begin(),
+                                       variabledata.size());
+    } else if (check_hash) {
+        unpacked_hash = lintel::bobJenkinsHash(1972, fixeddata.begin(), fixeddata.size());
+        unpacked_hash = lintel::bobJenkinsHash(unpacked_hash, variabledata.begin(),
+                                               variabledata.size());
     }
     vector<int32> variable_sizes;
-    variable_sizes.reserve(variable_sizes_batch_size);
+    if (hash_sizes) {
+        variable_sizes.reserve(variable_sizes_batch_size);
+    }
     byte *endvarpos = variabledata.begin() + variabledata.size();
     for (byte *curvarpos = &variabledata[4];curvarpos != endvarpos;) {
         int32 size = *(int32 *)curvarpos;
-        if (postuncompress_check) {
+        if (hash_sizes) {
             variable_sizes.push_back(size);
 
             if (variable_sizes.size() == variable_sizes_batch_size) {
-                bjhash = lintel::bobJenkinsHash(bjhash, &(variable_sizes[0]),
-                                                4*variable_sizes_batch_size);
+                unpacked_hash = lintel::bobJenkinsHash(unpacked_hash, &(variable_sizes[0]),
+                                                       4*variable_sizes_batch_size);
                 variable_sizes.resize(0);
             }
         }
@@ -1362,173 +2501,140 @@ void Extent::unpackData(Extent::ByteArray &from, bool fix_endianness) {
         curvarpos += 4 + Variable32Field::roundupSize(size);
         INVARIANT(curvarpos <= endvarpos,"internal error on variable data");
     }
-    if (postuncompress_check) {
-        bjhash = lintel::bobJenkinsHash(bjhash,&(variable_sizes[0]),4*variable_sizes.size());
+    if (hash_sizes) {
+        unpacked_hash = lintel::bobJenkinsHash(unpacked_hash, &(variable_sizes[0]),
+                                               4*variable_sizes.size());
     }
    
     variable_sizes.resize(0);
 
-    INVARIANT(postuncompress_check == false 
-              || *(int32 *)(from.begin() + 5*4) == (int32)bjhash,
+    INVARIANT(check_hash == false
+              || *(int32 *)(from.begin() + 5*4) == (int32)unpacked_hash,
               "final partially unpacked hash check failed");
     
-    vector<ExtentType::pack_self_relativeT> psr_copy 
-            = type->rep.pack_self_relative;
-    for (unsigned int j=0;j<type->rep.pack_self_relative.size();++j) {
-        SINVARIANT(psr_copy[j].field_num < type->rep.field_info.size());
-        
-        SINVARIANT(psr_copy[j].double_prev_v == 0 &&
-                   psr_copy[j].int32_prev_v == 0 &&
-                   psr_copy[j].int64_prev_v == 0);
-    }
     TIME_UNPACKING(Clock::Tdbl time_postuc = Clock::tod());
-    int record_count = 0;
-    // 2004-09-26: each one of these is worth a small speedup, 0.5-1%
-    // or so I'd guess, while not inherently worth it, the fix was
-    // made when profiling accidentally with the debugging library, 
-    // and there is no point in removing the fix.
-    const size_t type_variable32_field_columns_size 
-            = type->rep.variable32_field_columns.size();
-    const size_t type_pack_scale_size = type->rep.pack_scale.size();
-    const size_t type_pack_self_relative_size = psr_copy.size();
-    const size_t type_pack_other_relative_size 
-            = type->rep.pack_other_relative.size();
+    // Each of the conversions is done a column at a time; unpacking is
+    // done in the reverse order as packing.
+    const size_t record_size = type->rep.fixed_record_size;
+    byte *records = fixeddata.begin();
     const bool null_compact = type->getPackNullCompact() != ExtentType::CompactNo;
-    for (ExtentSeries::iterator pos(this); pos.morerecords(); ++pos) {
-        ++record_count;
-        if (fix_endianness) {
-            for (unsigned int j=0; j<type->rep.field_info.size(); j++) {
-                switch(type->rep.field_info[j].type)
-                {
-                    case ExtentType::ft_bool: 
-                    case ExtentType::ft_byte:
-                        break;
-                    case ExtentType::ft_int32:
-                    case ExtentType::ft_variable32:
-                        Extent::flip4bytes(pos.record_start() 
-                                           + type->rep.field_info[j].offset);
-                        break;
-                    case ExtentType::ft_int64:
-                    case ExtentType::ft_double:
-                        Extent::flip8bytes(pos.record_start() 
-                                           + type->rep.field_info[j].offset);
-                        break;
-                    default:
-                        FATAL_ERROR(format("unknown field type %d for fix_endianness") % type->rep.field_info[j].type);
-                        break;
+    if (fix_endianness) {
+        for (unsigned int j=0; j<type->rep.field_info.size(); j++) {
+            const ExtentType::fieldInfo &field(type->rep.field_info[j]);
+            switch(field.type)
+            {
+                case ExtentType::ft_bool: 
+                case ExtentType::ft_byte:
+                    break;
+                case ExtentType::ft_int32:
+                case ExtentType::ft_variable32:
+                    kernels.flip4(records + field.offset, record_size, nrecords);
+                    break;
+                case ExtentType::ft_int64:
+                case ExtentType::ft_double:
+                    kernels.flip8(records + field.offset, record_size, nrecords);
+                    break;
+                default:
+                    FATAL_ERROR(format("unknown field type %d for fix_endianness") % field.type);
+                    break;
+            }
+        }
+    }
+    if (skip_variable) {
+        // the offsets (and dictionary codes) point at the missing data
+        for (unsigned int j = 0; j < type->rep.variable32_field_columns.size(); ++j) {
+            const ExtentType::fieldInfo &field
+                    = type->rep.field_info[type->rep.variable32_field_columns[j]];
+            for (byte *record = records; record != fixeddata.end(); record += record_size) {
+                *(int32 *)(record + field.offset) = 0;
+                if (field.code_fieldnum > 0) {
+                    *(int32 *)(record + type->rep.field_info[field.code_fieldnum].offset) = 0;
                 }
             }
         }
-        // check variable sized fields ...
-        if (unpack_variable32_check) {
+    }
+    // check variable sized fields ...
+    if (unpack_variable32_check) {
+        const size_t type_variable32_field_columns_size 
+                = type->rep.variable32_field_columns.size();
+        for (byte *record = records; record != fixeddata.end(); record += record_size) {
             for (unsigned int j=0;j<type_variable32_field_columns_size;j++) {
                 int field = type->rep.variable32_field_columns[j];
                 int32 offset = type->rep.field_info[field].offset;
-                int32 varoffset 
-                        = Variable32Field::getVarOffset(pos.record_start(), 
-                                                        offset);
+                int32 varoffset = Variable32Field::getVarOffset(record, offset);
                 // now check with the standard verification routine
                 Variable32Field::selfcheck(variabledata,varoffset);
             }
-        }     
-        // Unpacking is done in the reverse order as packing.
-
-        // unpack scaled fields ...
-        for (unsigned int j=0;j<type_pack_scale_size;++j) {
-            int field = type->rep.pack_scale[j].field_num;
-            INVARIANT(type->rep.field_info[field].type == ExtentType::ft_double,
-                      "internal error, scaled only supported for ft_double");
-            int offset = type->rep.field_info[field].offset;
-            double scale = type->rep.pack_scale[j].scale;
-            double v = *(double *)(pos.record_start() + offset);
-            *(double *)(pos.record_start() + offset) = v * scale;
         }
+    }     
 
-        // unpack self-relative fields ...
-        for (unsigned int j=0;j<type_pack_self_relative_size;++j) {
-            unsigned field_num = psr_copy[j].field_num;
-            const ExtentType::fieldInfo &field(type->rep.field_info[field_num]);
-            if (null_compact && compactIsNull(pos.record_start(),
-                                              *field.null_compact_info)) {
-                // Don't overwrite nulls, must remain 0 to unpack properly.
-                continue;
-            }
-            int offset = field.offset;
-            switch(field.type) 
-            {
-                case ExtentType::ft_double: {
-                    double v = *(double *)(pos.record_start() + offset) + psr_copy[j].double_prev_v;
-                    double multiplier = psr_copy[j].multiplier;
-                    double scale = psr_copy[j].scale;
-                    v = round(v * multiplier) * scale;
-                    *(double *)(pos.record_start() + offset) = v;
-                    psr_copy[j].double_prev_v = v;
-                }
-                    break;
-                case ExtentType::ft_int32: {
-                    int32 v = *(int32 *)(pos.record_start() + offset) + psr_copy[j].int32_prev_v;
-                    *(int32 *)(pos.record_start() + offset) = v;
-                    psr_copy[j].int32_prev_v = v;
-                }                   
-                    break;
-                case ExtentType::ft_int64: {
-                    int64 v = *(int64 *)(pos.record_start() + offset) + psr_copy[j].int64_prev_v;
-                    *(int64 *)(pos.record_start() + offset) = v;
-                    psr_copy[j].int64_prev_v = v;
-                }                   
-                    break;
-                default:
-                    INVARIANT(field_num < type->rep.field_info.size(), 
-                              format("bad field number %d > %d") 
-                              % field_num % type->rep.field_info.size());
+    if (!type->rep.dictionary_field_columns.empty()) {
+        decodeDictionaryFields();
+    }
 
-                    FATAL_ERROR(format("Internal Error: unrecognized field type %d for field %s (#%d) offset %d in type %s")
-                                % field.type % field.name
-                                % field_num % offset % type->rep.name);
-            }
+    // unpack scaled fields ...
+    for (unsigned int j=0;j<type->rep.pack_scale.size();++j) {
+        int field = type->rep.pack_scale[j].field_num;
+        INVARIANT(type->rep.field_info[field].type == ExtentType::ft_double,
+                  "internal error, scaled only supported for ft_double");
+        kernels.scaleDecode(records + type->rep.field_info[field].offset, record_size,
+                            nrecords, type->rep.pack_scale[j].scale);
+    }
+
+    // unpack self-relative fields ...
+    for (unsigned int j=0;j<type->rep.pack_self_relative.size();++j) {
+        const ExtentType::pack_self_relativeT &psr(type->rep.pack_self_relative[j]);
+        SINVARIANT(psr.field_num < type->rep.field_info.size());
+        const ExtentType::fieldInfo &field(type->rep.field_info[psr.field_num]);
+        // Don't overwrite nulls, must remain 0 to unpack properly.
+        int null_mask;
+        const byte *nulls = packNulls(records, field, null_compact, null_mask);
+        byte *col = records + field.offset;
+        switch(field.type) 
+        {
+            case ExtentType::ft_double:
+                kernels.selfRelativeDecodeDouble(col, nulls, null_mask, record_size, nrecords,
+                                                 psr.multiplier, psr.scale);
+                break;
+            case ExtentType::ft_int32:
+                kernels.selfRelativeDecodeInt32(col, nulls, null_mask, record_size, nrecords);
+                break;
+            case ExtentType::ft_int64:
+                kernels.selfRelativeDecodeInt64(col, nulls, null_mask, record_size, nrecords);
+                break;
+            default:
+                FATAL_ERROR(format("Internal Error: unrecognized field type %d for field %s (#%d) offset %d in type %s")
+                            % field.type % field.name
+                            % psr.field_num % field.offset % type->rep.name);
         }
-        // unpack other-relative fields ...
-        for (unsigned int j=0;j<type_pack_other_relative_size;++j) {
-            // 2004-09-26 I cannot believe this is worth a 1% speedup (pulling out v).
-            const ExtentType::pack_other_relativeT &v 
-                    = type->rep.pack_other_relative[j];
-            int field_num = v.field_num;
-            const ExtentType::fieldInfo &field(type->rep.field_info[field_num]);
-            if (null_compact && compactIsNull(pos.record_start(), 
-                                              *field.null_compact_info)) {
-                // Don't overwrite nulls, must remain 0 to unpack properly.
-                continue;
-            }
-            int base_field = v.base_field_num;
-            int field_offset = field.offset;
-            byte *base_ptr = pos.record_start()
-                             + type->rep.field_info[base_field].offset;
-            switch(field.type)
-            {
-                case ExtentType::ft_double: {
-                    double v = *(double *)(pos.record_start() + field_offset);
-                    double base_v = *reinterpret_cast<double *>(base_ptr);
-                    *(double *)(pos.record_start() + field_offset) = v + base_v;
-                }
-                    break;
-                case ExtentType::ft_int32: {
-                    int32 v = *(int32 *)(pos.record_start() + field_offset);
-                    int32 base_v = *reinterpret_cast<int32 *>(base_ptr);
-                    *(int32 *)(pos.record_start() + field_offset) = v + base_v;
-                }
-                    break;
-                case ExtentType::ft_int64: {
-                    int64 v = *(int64 *)(pos.record_start() + field_offset);
-                    int64 base_v = *reinterpret_cast<int64 *>(base_ptr);
-                    *(int64 *)(pos.record_start() + field_offset) = v + base_v;
-                }
-                    break;
-                default:
-                    FATAL_ERROR("Internal error");
-            }
+    }
+    // unpack other-relative fields ...
+    for (unsigned int j=0;j<type->rep.pack_other_relative.size();++j) {
+        const ExtentType::pack_other_relativeT &v = type->rep.pack_other_relative[j];
+        const ExtentType::fieldInfo &field(type->rep.field_info[v.field_num]);
+        // Don't overwrite nulls, must remain 0 to unpack properly.
+        int null_mask;
+        const byte *nulls = packNulls(records, field, null_compact, null_mask);
+        byte *col = records + field.offset;
+        const byte *base_col = records + type->rep.field_info[v.base_field_num].offset;
+        switch(field.type)
+        {
+            case ExtentType::ft_double:
+                kernels.otherRelativeDecodeDouble(col, base_col, nulls, null_mask,
+                                                  record_size, nrecords);
+                break;
+            case ExtentType::ft_int32:
+                kernels.otherRelativeDecodeInt32(col, base_col, nulls, null_mask,
+                                                 record_size, nrecords);
+                break;
+            case ExtentType::ft_int64:
+                kernels.otherRelativeDecodeInt64(col, base_col, nulls, null_mask,
+                                                 record_size, nrecords);
+                break;
+            default:
+                FATAL_ERROR("Internal error");
         }
-    }   
-    INVARIANT(record_count == nrecords,"internal error");
+    }
     TIME_UNPACKING(Clock::Tdbl time_done = Clock::tod();
                    printf("%d records, unpackcheck %.6g; uncompress %.6g; unpack %.6g\n",
                           nrecords,
@@ -1561,25 +2667,26 @@ bool Extent::checkedPread(int fd, off64_t offset, byte *into, int amount, bool e
     return true;
 }
 
-bool Extent::preadExtent(int fd, off64_t &offset, Extent::ByteArray &into, bool need_bitflip) {
-    int prefix_size = 6*4 + 4*1;
-    into.resize(prefix_size, false);
-    if (checkedPread(fd,offset,into.begin(),prefix_size, true) == false) {
-        into.resize(0);
-        return false;
+static const int extent_prefix_size = 6*4 + 4*1;
+
+// Reads the fixed size start of the extent header at offset into prefix;
+// returns the size of the whole extent, or 0 at the end of the file.  Sets
+// variable_offset to the offset of the variable data within the extent.
+static uint64_t preadExtentSize(int fd, off64_t offset, Extent::byte *prefix,
+                                bool need_bitflip, uint64_t &variable_offset) {
+    if (Extent::checkedPread(fd, offset, prefix, extent_prefix_size, true) == false) {
+        return 0;
     }
-    offset += prefix_size;
-    byte *l = into.begin();
-    int32_t compressed_fixed = *(int32_t *)l; l += 4;
-    int32_t compressed_variable = *(int32_t *)l; l += 4;
-    int32 typenamelen = into[6*4+2];
+    int32_t compressed_fixed = *(int32_t *)prefix;
+    int32_t compressed_variable = *(int32_t *)(prefix + 4);
+    int32_t typenamelen = prefix[6*4+2];
     if (need_bitflip) {
-        compressed_fixed = flip4bytes(compressed_fixed);
-        compressed_variable = flip4bytes(compressed_variable);
+        compressed_fixed = Extent::flip4bytes(compressed_fixed);
+        compressed_variable = Extent::flip4bytes(compressed_variable);
     }
     if (compressed_fixed == -1) {
-        DataSeriesSink::verifyTail(into.begin(), need_bitflip,"*unknown*");
-        return false;
+        DataSeriesSink::verifyTail(prefix, need_bitflip,"*unknown*");
+        return 0;
     }
     INVARIANT(compressed_fixed >= 0 && compressed_variable >= 0
               && typenamelen >= 0, "Error reading extent");
@@ -1587,23 +2694,59 @@ bool Extent::preadExtent(int fd, off64_t &offset, Extent::ByteArray &into, bool
               && static_cast<uint32_t>(compressed_variable) < max_packed_size,
               format("Excessively large extent is almost definitely corruption sizes=%d/%d")
               % compressed_fixed % compressed_variable);
-    uint64_t extentsize = prefix_size+typenamelen;
+    uint64_t extentsize = extent_prefix_size+typenamelen;
     extentsize += (4 - extentsize % 4) % 4;
     extentsize += compressed_fixed;
     extentsize += (4 - extentsize % 4) % 4;
+    variable_offset = extentsize;
     extentsize += compressed_variable;
     extentsize += (4 - extentsize % 4) % 4;
-    LintelLogDebug("Extent/size", format("%d %d %d %d ~= %d") % prefix_size % typenamelen
-                   % compressed_fixed % compressed_variable % extentsize);
+    LintelLogDebug("Extent/size", format("%d %d %d %d ~= %d") % extent_prefix_size
+                   % typenamelen % compressed_fixed % compressed_variable % extentsize);
+    return extentsize;
+}
+
+// Reads the rest of the extent whose prefix preadExtentSize read
+static void preadExtentRest(int fd, off64_t offset, const Extent::byte *prefix,
+                            uint64_t extentsize, Extent::ByteArray &into) {
     into.resize(extentsize, false);
-    checkedPread(fd, offset, into.begin() + prefix_size, 
-                 extentsize - prefix_size);
-    offset += extentsize - prefix_size;
+    memcpy(into.begin(), prefix, extent_prefix_size);
+    Extent::checkedPread(fd, offset + extent_prefix_size, into.begin() + extent_prefix_size,
+                         extentsize - extent_prefix_size);
+}
+
+bool Extent::preadExtent(int fd, off64_t &offset, Extent::ByteArray &into, bool need_bitflip) {
+    byte prefix[extent_prefix_size];
+    uint64_t variable_offset;
+    uint64_t extentsize = preadExtentSize(fd, offset, prefix, need_bitflip, variable_offset);
+    if (extentsize == 0) {
+        into.resize(0);
+        return false;
+    }
+    preadExtentRest(fd, offset, prefix, extentsize, into);
+    offset += extentsize;
     return true;
 }
 
-void Extent::run_flip4bytes(uint32_t *buf, unsigned buflen) {
-    for (unsigned i=0;i<buflen;++i) {
-        buf[i] = Extent::flip4bytes(buf[i]);
+bool Extent::mmapExtent(int fd, off64_t &offset, Extent::ByteArray &into, bool need_bitflip) {
+    byte prefix[extent_prefix_size];
+    uint64_t variable_offset;
+    uint64_t extentsize = preadExtentSize(fd, offset, prefix, need_bitflip, variable_offset);
+    if (extentsize == 0) {
+        into.resize(0);
+        return false;
     }
+    if (prefix[6*4] == compress_mode_none && prefix[6*4+1] == compress_mode_none) {
+        MappedExtent *mapped = new MappedExtent(fd, offset, extentsize, variable_offset);
+        into.borrow(mapped->extent, extentsize, ByteArray::OwnerPtr(mapped));
+    } else {
+        // compressed data has to be copied when it is uncompressed anyway
+        preadExtentRest(fd, offset, prefix, extentsize, into);
+    }
+    offset += extentsize;
+    return true;
+}
+
+void Extent::run_flip4bytes(uint32_t *buf, unsigned buflen) {
+    dataseries::pack_kernels::kernels().flip4Contiguous(buf, buflen);
 }
@@ -112,7 +112,7 @@ Variable32Field::Variable32Field(ExtentSeries &_dataseries,
                                  const std::string &_default_value,
                                  bool auto_add) 
 : Field(_dataseries,field,flags), default_value(_default_value), 
-    offset_pos(-1), unique(false)
+    offset_pos(-1), code_pos(-1), unique(false)
 { 
     if (auto_add) {
         dataseries.addField(*this);
@@ -123,6 +123,11 @@ void Variable32Field::newExtentType() {
     Field::newExtentType();
     offset_pos = dataseries.getTypePtr()->getOffset(getName());
     unique = dataseries.getTypePtr()->getUnique(getName());
+    if (dataseries.getTypePtr()->getDictionary(getName())) {
+        code_pos = dataseries.getTypePtr()->getOffset(ExtentType::dictionaryCodeFieldname(getName()));
+    } else {
+        code_pos = -1;
+    }
     INVARIANT(dataseries.getTypePtr()->getFieldType(getName()) 
               == ExtentType::ft_variable32,
               format("mismatch on field types for field named %s in type %s")
@@ -153,6 +158,9 @@ void Variable32Field::allocateSpace(Extent &e, uint8_t *row_pos, uint32_t data_s
     int32_t varoffset = e.variabledata.size();
     e.variabledata.resize(varoffset + 4 + roundup);
     *reinterpret_cast<int32_t *>(fixed_data_ptr) = varoffset;
+    if (code_pos >= 0) {
+        *reinterpret_cast<int32_t *>(row_pos + code_pos) = 0;
+    }
 
     int32_t *var_data = reinterpret_cast<int32_t *>(vardata(e.variabledata, varoffset));
                                               
@@ -10,6 +10,7 @@
 */
 #include <boost/assign/list_of.hpp>
 
+#include <algorithm>
 #include <vector>
 
 #include <libxml/parser.h>
@@ -36,6 +37,39 @@ const string dataseries_index_type_v0_xml =
         "  <field type=\"variable32\" name=\"extenttype\" />\n"
         "</ExtentType>\n";
 
+static const string dataseries_compression_dictionary_type_xml =
+        "<ExtentType name=\"DataSeries: CompressionDictionary\">\n"
+        "  <field type=\"variable32\" name=\"extenttype\" />\n"
+        "  <field type=\"variable32\" name=\"dictionary\" />\n"
+        "</ExtentType>\n";
+
+static const string dataseries_string_dictionary_type_xml =
+        "<ExtentType name=\"DataSeries: StringDictionary\">\n"
+        "  <field type=\"variable32\" name=\"extenttype\" pack_unique=\"yes\" />\n"
+        "  <field type=\"variable32\" name=\"field\" pack_unique=\"yes\" />\n"
+        "  <field type=\"int32\" name=\"code\" pack_relative=\"code\" />\n"
+        "  <field type=\"variable32\" name=\"value\" />\n"
+        "</ExtentType>\n";
+
+static const string dataseries_zone_map_type_xml =
+        "<ExtentType name=\"DataSeries: ZoneMap\">\n"
+        "  <field type=\"int64\" name=\"offset\" pack_relative=\"offset\" />\n"
+        "  <field type=\"variable32\" name=\"field\" pack_unique=\"yes\" />\n"
+        "  <field type=\"int64\" name=\"min_int\" opt_nullable=\"yes\" />\n"
+        "  <field type=\"int64\" name=\"max_int\" opt_nullable=\"yes\" />\n"
+        "  <field type=\"double\" name=\"min_double\" opt_nullable=\"yes\" />\n"
+        "  <field type=\"double\" name=\"max_double\" opt_nullable=\"yes\" />\n"
+        "  <field type=\"int32\" name=\"null_count\" />\n"
+        "</ExtentType>\n";
+
+static const string dataseries_bloom_filter_type_xml =
+        "<ExtentType name=\"DataSeries: BloomFilter\">\n"
+        "  <field type=\"int64\" name=\"offset\" pack_relative=\"offset\" />\n"
+        "  <field type=\"variable32\" name=\"field\" pack_unique=\"yes\" />\n"
+        "  <field type=\"byte\" name=\"nhashes\" />\n"
+        "  <field type=\"variable32\" name=\"bits\" />\n"
+        "</ExtentType>\n";
+
 // The following is here as we are working out what the next version
 // of the extent index should look like; I think we will be able to
 // get away with putting it into the xmltype index and hence be able 
@@ -68,6 +102,10 @@ const string dataseries_index_type_v1_xml =
 
 const ExtentType::Ptr ExtentType::dataseries_xml_type(ExtentTypeLibrary::sharedExtentTypePtr(dataseries_xml_type_xml));
 const ExtentType::Ptr ExtentType::dataseries_index_type_v0(ExtentTypeLibrary::sharedExtentTypePtr(dataseries_index_type_v0_xml));
+const ExtentType::Ptr ExtentType::dataseries_compression_dictionary_type(ExtentTypeLibrary::sharedExtentTypePtr(dataseries_compression_dictionary_type_xml));
+const ExtentType::Ptr ExtentType::dataseries_string_dictionary_type(ExtentTypeLibrary::sharedExtentTypePtr(dataseries_string_dictionary_type_xml));
+const ExtentType::Ptr ExtentType::dataseries_zone_map_type(ExtentTypeLibrary::sharedExtentTypePtr(dataseries_zone_map_type_xml));
+const ExtentType::Ptr ExtentType::dataseries_bloom_filter_type(ExtentTypeLibrary::sharedExtentTypePtr(dataseries_bloom_filter_type_xml));
 
 string ExtentType::strGetXMLProp(xmlNodePtr cur, const string &option_name, bool empty_ok) {
     xmlChar *option = xmlGetProp(cur, reinterpret_cast<const xmlChar *>(option_name.c_str()));
@@ -290,10 +328,44 @@ ExtentType::ParsedRepresentation ExtentType::parseXML(const string &xmldesc) {
         }
     }
 
+    ret.pack_layout = LayoutRowMajor;
+    {
+        string layout_opt = strGetXMLProp(cur, "pack_layout");
+        if (!layout_opt.empty()) {
+            LintelLog::warn("Warning, pack_layout under testing, may not be safe for use.\n");
+            if (layout_opt == "row_major") {
+                ret.pack_layout = LayoutRowMajor;
+            } else if (layout_opt == "columnar") {
+                ret.pack_layout = LayoutColumnar;
+            } else {
+                FATAL_ERROR(format("Unknown pack_layout value '%s', expect row_major or columnar") % layout_opt);
+            }
+        }
+    }
+    // Null compaction makes the packed records variable sized, so there
+    // are no columns left to transpose.
+    INVARIANT(ret.pack_layout == LayoutRowMajor || ret.pack_null_compact == CompactNo,
+              "pack_layout=\"columnar\" can not be combined with pack_null_compact");
+
+    bool auto_column_groups = false;
+    {
+        string groups_opt = strGetXMLProp(cur, "pack_column_groups");
+        if (!groups_opt.empty()) {
+            if (groups_opt == "auto") {
+                auto_column_groups = true;
+            } else {
+                INVARIANT(groups_opt == "none",
+                          format("Unknown pack_column_groups value '%s', expect auto or none")
+                          % groups_opt);
+            }
+        }
+    }
+
     for (xmlAttr *prop = cur->properties; prop != NULL; prop = prop->next) {
         string opt(reinterpret_cast<const char *>(prop->name));
         if (opt == "pack_null_compact" || opt == "pack_pad_record"
-            || opt == "pack_field_ordering") {
+            || opt == "pack_field_ordering" || opt == "pack_layout"
+            || opt == "pack_column_groups") {
             // ok
         } else {
             INVARIANT(!prefixequal(opt, "pack_"),
@@ -323,6 +395,8 @@ ExtentType::ParsedRepresentation ExtentType::parseXML(const string &xmldesc) {
     cur = cur->xmlChildrenNode;
     unsigned bool_fields = 0, byte_fields = 0, int32_fields = 0, 
             eight_fields = 0, variable_fields = 0;
+    map<string, int> column_group_numbers;
+    int ncolumn_groups = 1;
     while (true) {
         if (cur == NULL) 
             break;
@@ -341,10 +415,20 @@ ExtentType::ParsedRepresentation ExtentType::parseXML(const string &xmldesc) {
                 // ok
             } else if (xmlStrcmp(prop->name,(const xmlChar *)"pack_unique") == 0) {
                 // ok
+            } else if (xmlStrcmp(prop->name,(const xmlChar *)"pack_dictionary") == 0) {
+                // ok
+            } else if (xmlStrcmp(prop->name,(const xmlChar *)"pack_bitwidth") == 0) {
+                // ok
+            } else if (xmlStrcmp(prop->name,(const xmlChar *)"pack_encoding") == 0) {
+                // ok
+            } else if (xmlStrcmp(prop->name,(const xmlChar *)"pack_group") == 0) {
+                // ok
             } else if (xmlStrcmp(prop->name,(const xmlChar *)"opt_doublebase") == 0) {
                 // ok
             } else if (xmlStrcmp(prop->name,(const xmlChar *)"opt_nullable") == 0) {
                 // ok
+            } else if (xmlStrcmp(prop->name,(const xmlChar *)"opt_bloom_filter") == 0) {
+                // ok
             } else {
                 INVARIANT(xmlStrncmp(prop->name,(const xmlChar *)"pack_",5)!=0,
                           boost::format("Unrecognized local packing"
@@ -404,18 +488,34 @@ ExtentType::ParsedRepresentation ExtentType::parseXML(const string &xmldesc) {
         LintelLogDebug("ExtentType::XMLDecode", boost::format("  field type='%s', name='%s'\n") % type_str % info.name);
 
         string pack_unique = strGetXMLProp(cur, "pack_unique");
+        string pack_dictionary = strGetXMLProp(cur, "pack_dictionary");
+        bool dictionary = false;
         if (info.type == ft_variable32) {
             ret.variable32_field_columns.push_back(ret.field_info.size());
             info.unique = parseYesNo(cur, "pack_unique", false);
+            dictionary = parseYesNo(cur, "pack_dictionary", false);
         } else {
             INVARIANT(pack_unique.empty(),
                       "pack_unique only allowed for variable32 fields");
+            INVARIANT(pack_dictionary.empty(),
+                      "pack_dictionary only allowed for variable32 fields");
         }
         
         bool nullable = parseYesNo(cur, "opt_nullable", false);
-        // Real field will go into size, so null field into size+1.
+        // Real field will go into size, so null field into size+1, and
+        // the dictionary code after that.
         info.null_fieldnum 
                 = nullable ? static_cast<int>(ret.field_info.size()) + 1 : -1;
+        if (dictionary) {
+            info.code_fieldnum = ret.field_info.size() + (nullable ? 2 : 1);
+            ret.dictionary_field_columns.push_back(ret.field_info.size());
+            ++int32_fields;
+        }
+
+        info.bloom_filter = parseYesNo(cur, "opt_bloom_filter", false);
+        INVARIANT(!info.bloom_filter || info.type == ft_variable32 || info.type == ft_int32
+                  || info.type == ft_int64,
+                  "opt_bloom_filter only allowed for variable32, int32 and int64 fields");
 
         string opt_doublebase = strGetXMLProp(cur, "opt_doublebase");
         if (!opt_doublebase.empty()) {
@@ -452,6 +552,48 @@ ExtentType::ParsedRepresentation ExtentType::parseXML(const string &xmldesc) {
             INVARIANT(pack_scale_warn_v.empty(),
                       "Invalid to specify pack_scale_warn without pack_scale");
         }
+        string pack_bitwidth = strGetXMLProp(cur, "pack_bitwidth");
+        if (!pack_bitwidth.empty()) {
+            INVARIANT(info.type == ft_byte || info.type == ft_int32 || info.type == ft_int64,
+                      "pack_bitwidth only allowed for byte, int32 and int64 fields");
+            if (pack_bitwidth == "auto") {
+                ret.bitwidth_field_columns.push_back(ret.field_info.size());
+            } else {
+                INVARIANT(pack_bitwidth == "none",
+                          boost::format("Unknown pack_bitwidth value '%s', expect auto or none")
+                          % pack_bitwidth);
+            }
+        }
+        string pack_encoding = strGetXMLProp(cur, "pack_encoding");
+        if (!pack_encoding.empty() && pack_encoding != "none") {
+            INVARIANT(info.type == ft_double || info.type == ft_int64,
+                      "pack_encoding only allowed for double and int64 fields");
+            INVARIANT(pack_bitwidth.empty() || pack_bitwidth == "none",
+                      "pack_encoding can not be combined with pack_bitwidth");
+            if (pack_encoding == "xor") {
+                ret.pack_encoding.push_back(pack_encodingT(ret.field_info.size(), EncodingXor));
+            } else if (pack_encoding == "delta2") {
+                ret.pack_encoding.push_back(pack_encodingT(ret.field_info.size(),
+                                                           EncodingDelta2));
+            } else {
+                FATAL_ERROR(boost::format("Unknown pack_encoding value '%s', expect xor, delta2"
+                                          " or none") % pack_encoding);
+            }
+        }
+        // The booleans share bytes, so they stay in group 0; the other
+        // fields get a group per pack_group name, in the order the names
+        // first appear, or with pack_column_groups="auto" one each.
+        string pack_group = strGetXMLProp(cur, "pack_group");
+        if (!pack_group.empty()) {
+            INVARIANT(info.type != ft_bool, "pack_group not allowed for bool fields");
+            int &group = column_group_numbers[pack_group];
+            if (group == 0) {
+                group = ncolumn_groups++;
+            }
+            info.column_group = group;
+        } else if (auto_column_groups && info.type != ft_bool) {
+            info.column_group = ncolumn_groups++;
+        }
         string pack_relative = strGetXMLProp(cur, "pack_relative");
         if (!pack_relative.empty()) {
             INVARIANT(info.type == ft_double || info.type == ft_int64 || info.type == ft_int32,
@@ -496,12 +638,42 @@ ExtentType::ParsedRepresentation ExtentType::parseXML(const string &xmldesc) {
             info.offset = -1;
             info.bitpos = -1;
             info.unique = false;
+            info.bloom_filter = false;
             info.null_fieldnum = -1;
+            info.column_group = 0;
             info.null_compact_info = NULL;
             info.doublebase = 0;
             info.xmldesc = NULL;
             ret.field_info.push_back(info);
         }
+        if (dictionary) {
+            fieldInfo code;
+            
+            // auto-generate the int32 dictionary code field
+            code.name = dictionaryCodeFieldname(ret.field_info[ret.visible_fields.back()].name);
+            code.type = ft_int32;
+            code.size = 4;
+            code.column_group = ret.field_info[ret.visible_fields.back()].column_group;
+            DEBUG_SINVARIANT(info.code_fieldnum == static_cast<int>(ret.field_info.size()));
+            ret.field_info.push_back(code);
+        }
+    }
+
+    // Null compaction removes the null fields from the records, so the
+    // bit-packed columns would no longer have a value per record.
+    INVARIANT(ret.bitwidth_field_columns.empty() || ret.pack_null_compact == CompactNo,
+              "pack_bitwidth can not be combined with pack_null_compact");
+    INVARIANT(ret.pack_encoding.empty() || ret.pack_null_compact == CompactNo,
+              "pack_encoding can not be combined with pack_null_compact");
+    // Each column group is stored column by column already, and the
+    // groups are cut from the unpacked records.
+    if (ncolumn_groups > 1) {
+        INVARIANT(ret.pack_null_compact == CompactNo,
+                  "column groups can not be combined with pack_null_compact");
+        INVARIANT(ret.pack_layout == LayoutRowMajor,
+                  "column groups can not be combined with pack_layout=\"columnar\"");
+        INVARIANT(ret.bitwidth_field_columns.empty() && ret.pack_encoding.empty(),
+                  "column groups can not be combined with pack_bitwidth or pack_encoding");
     }
 
     // need to put in the variable sized special fields here!
@@ -599,6 +771,102 @@ ExtentType::ParsedRepresentation ExtentType::parseXML(const string &xmldesc) {
     ret.sortAssignNCI(ret.nonbool_compact_info_size4);
     ret.sortAssignNCI(ret.nonbool_compact_info_size8);
 
+    if (ret.pack_layout == LayoutColumnar) {
+        // Each non-bool field becomes a run; the bytes between them
+        // (booleans and padding) become runs of their own so that the
+        // runs exactly tile the record.
+        vector<pair<int32, int32> > fields;
+        for (unsigned i = 0; i < ret.field_info.size(); ++i) {
+            const fieldInfo &field(ret.field_info[i]);
+            if (field.type != ft_bool) {
+                fields.push_back(make_pair(field.offset, field.size));
+            }
+        }
+        sort(fields.begin(), fields.end());
+        int32 pos = 0;
+        for (vector<pair<int32, int32> >::iterator i = fields.begin(); i != fields.end(); ++i) {
+            SINVARIANT(i->first >= pos);
+            if (i->first > pos) {
+                ret.columnar_runs.push_back(columnarRun(pos, i->first - pos));
+            }
+            ret.columnar_runs.push_back(columnarRun(i->first, i->second));
+            pos = i->first + i->second;
+        }
+        SINVARIANT(pos <= ret.fixed_record_size);
+        if (pos < ret.fixed_record_size) {
+            ret.columnar_runs.push_back(columnarRun(pos, ret.fixed_record_size - pos));
+        }
+    }
+
+    if (ncolumn_groups > 1) {
+        // As for the columnar runs, but each run goes to the group of
+        // its field; the bytes between the fields go to group 0.
+        vector<pair<int32, int32> > fields;
+        for (unsigned i = 0; i < ret.field_info.size(); ++i) {
+            const fieldInfo &field(ret.field_info[i]);
+            if (field.type != ft_bool) {
+                fields.push_back(make_pair(field.offset, i));
+            }
+        }
+        sort(fields.begin(), fields.end());
+        ret.column_groups.resize(ncolumn_groups);
+        int32 pos = 0;
+        for (vector<pair<int32, int32> >::iterator i = fields.begin(); i != fields.end(); ++i) {
+            const fieldInfo &field(ret.field_info[i->second]);
+            SINVARIANT(field.offset >= pos);
+            if (field.offset > pos) {
+                ret.column_groups[0].push_back(columnarRun(pos, field.offset - pos));
+            }
+            ret.column_groups[field.column_group].push_back(columnarRun(field.offset, field.size));
+            pos = field.offset + field.size;
+        }
+        SINVARIANT(pos <= ret.fixed_record_size);
+        if (pos < ret.fixed_record_size) {
+            ret.column_groups[0].push_back(columnarRun(pos, ret.fixed_record_size - pos));
+        }
+    }
+
+    ret.encoded_kept_size = ret.fixed_record_size;
+    if (!ret.bitwidth_field_columns.empty() || !ret.pack_encoding.empty()) {
+        // Row-major keeps the bytes between the encoded fields;
+        // columnar keeps all the other columns.
+        vector<pair<int32, int32> > packed;
+        for (unsigned i = 0; i < ret.bitwidth_field_columns.size(); ++i) {
+            const fieldInfo &field(ret.field_info[ret.bitwidth_field_columns[i]]);
+            packed.push_back(make_pair(field.offset, field.size));
+        }
+        for (unsigned i = 0; i < ret.pack_encoding.size(); ++i) {
+            const fieldInfo &field(ret.field_info[ret.pack_encoding[i].field_num]);
+            packed.push_back(make_pair(field.offset, field.size));
+        }
+        sort(packed.begin(), packed.end());
+        if (ret.pack_layout == LayoutColumnar) {
+            for (vector<columnarRun>::iterator i = ret.columnar_runs.begin();
+                 i != ret.columnar_runs.end(); ++i) {
+                if (!binary_search(packed.begin(), packed.end(), make_pair(i->offset, i->size))) {
+                    ret.encoded_kept_runs.push_back(*i);
+                }
+            }
+        } else {
+            int32 pos = 0;
+            for (vector<pair<int32, int32> >::iterator i = packed.begin();
+                 i != packed.end(); ++i) {
+                if (i->first > pos) {
+                    ret.encoded_kept_runs.push_back(columnarRun(pos, i->first - pos));
+                }
+                pos = i->first + i->second;
+            }
+            if (pos < ret.fixed_record_size) {
+                ret.encoded_kept_runs.push_back(columnarRun(pos, ret.fixed_record_size - pos));
+            }
+        }
+        ret.encoded_kept_size = 0;
+        for (vector<columnarRun>::iterator i = ret.encoded_kept_runs.begin();
+             i != ret.encoded_kept_runs.end(); ++i) {
+            ret.encoded_kept_size += i->size;
+        }
+    }
+
     return ret;
 }
 
@@ -675,6 +943,13 @@ bool ExtentType::getUnique(int column) const {
     return rep.field_info[column].unique;
 }
 
+bool ExtentType::getBloomFilter(int column) const {
+    INVARIANT(column >= 0 && column < (int)rep.field_info.size(),
+              boost::format("internal error, column %d out of range [0..%d]\n")
+              % column % (rep.field_info.size()-1));
+    return rep.field_info[column].bloom_filter;
+}
+
 bool ExtentType::getNullable(int column) const {
     INVARIANT(column >= 0 && column < (int)rep.field_info.size(),
               boost::format("internal error, column %d out of range [0..%d]\n")
@@ -689,6 +964,65 @@ double ExtentType::getDoubleBase(int column) const {
     return rep.field_info[column].doublebase;
 }
 
+double ExtentType::getPackScale(int column) const {
+    INVARIANT(column >= 0 && column < (int)rep.field_info.size(),
+              boost::format("internal error, column %d out of range [0..%d]\n")
+              % column % (rep.field_info.size()-1));
+    for (vector<pack_scaleT>::const_iterator i = rep.pack_scale.begin();
+         i != rep.pack_scale.end(); ++i) {
+        if (i->field_num == column) {
+            return i->scale;
+        }
+    }
+    return 0;
+}
+
+bool ExtentType::getDictionary(int column) const {
+    INVARIANT(column >= 0 && column < (int)rep.field_info.size(),
+              boost::format("internal error, column %d out of range [0..%d]\n")
+              % column % (rep.field_info.size()-1));
+    return rep.field_info[column].code_fieldnum > 0;
+}
+
+ExtentType::ColumnSelection ExtentType::selectColumns(const vector<string> &columns) const {
+    ColumnSelection ret;
+    ret.groups.resize(rep.column_groups.size(), false);
+    if (!ret.groups.empty()) {
+        ret.groups[0] = true;
+    }
+    vector<int> todo;
+    for (vector<string>::const_iterator i = columns.begin(); i != columns.end(); ++i) {
+        int field_num = getColumnNumber(rep, *i);
+        if (field_num != -1) {
+            todo.push_back(field_num);
+        }
+    }
+    // unpacking a pack_relative field needs its base field
+    vector<bool> selected(rep.field_info.size(), false);
+    while (!todo.empty()) {
+        int field_num = todo.back();
+        todo.pop_back();
+        if (selected[field_num]) {
+            continue;
+        }
+        selected[field_num] = true;
+        const fieldInfo &field(rep.field_info[field_num]);
+        if (field.type == ft_variable32) {
+            ret.variable = true;
+        }
+        if (!ret.groups.empty()) {
+            ret.groups[field.column_group] = true;
+        }
+        for (vector<pack_other_relativeT>::const_iterator i = rep.pack_other_relative.begin();
+             i != rep.pack_other_relative.end(); ++i) {
+            if (i->field_num == field_num) {
+                todo.push_back(i->base_field_num);
+            }
+        }
+    }
+    return ret;
+}
+
 string ExtentType::nullableFieldname(const string &fieldname) {
     string ret(" ");
 
@@ -696,6 +1030,14 @@ string ExtentType::nullableFieldname(const string &fieldname) {
     return ret;
 }
 
+string ExtentType::dictionaryCodeFieldname(const string &fieldname) {
+    // two spaces so it can not collide with a nullable field name
+    string ret("  ");
+
+    ret += fieldname;
+    return ret;
+}
+
 string ExtentType::xmlFieldDesc(int field_num) const {
     INVARIANT(field_num >= 0 && field_num < (int)rep.field_info.size(),
               "bad field num");
@@ -756,6 +1098,14 @@ const ExtentType::Ptr ExtentTypeLibrary::getTypeByNamePtr(const string &name, bo
         return ExtentType::getDataSeriesXMLTypePtr();
     } else if (name == ExtentType::getDataSeriesIndexTypeV0Ptr()->getName()) {
         return ExtentType::getDataSeriesIndexTypeV0Ptr();
+    } else if (name == ExtentType::getDataSeriesCompressionDictionaryTypePtr()->getName()) {
+        return ExtentType::getDataSeriesCompressionDictionaryTypePtr();
+    } else if (name == ExtentType::getDataSeriesStringDictionaryTypePtr()->getName()) {
+        return ExtentType::getDataSeriesStringDictionaryTypePtr();
+    } else if (name == ExtentType::getDataSeriesZoneMapTypePtr()->getName()) {
+        return ExtentType::getDataSeriesZoneMapTypePtr();
+    } else if (name == ExtentType::getDataSeriesBloomFilterTypePtr()->getName()) {
+        return ExtentType::getDataSeriesBloomFilterTypePtr();
     }
     NameToType::const_iterator i = name_to_type.find(name);
     if (i == name_to_type.end()) {
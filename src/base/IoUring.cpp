@@ -0,0 +1,155 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    IoUring implementation
+*/
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <Lintel/LintelLog.hpp>
+
+#include "IoUring.hpp"
+
+#ifndef DATASERIES_ENABLE_IO_URING
+#define DATASERIES_ENABLE_IO_URING 0
+#endif
+
+#if DATASERIES_ENABLE_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+using namespace std;
+using boost::format;
+
+namespace dataseries {
+
+#if DATASERIES_ENABLE_IO_URING
+
+IoUring *IoUring::make(unsigned entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int ring_fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring_fd < 0) {
+        LintelLogDebug("IoUring", format("io_uring_setup failed: %s") % strerror(errno));
+        return NULL;
+    }
+    // the kernel rounds the number of entries up to a power of 2
+    SINVARIANT(params.sq_entries >= entries && params.cq_entries >= entries);
+    return new IoUring(ring_fd, params);
+}
+
+IoUring::IoUring(int ring_fd, const struct io_uring_params &params) : ring_fd(ring_fd) {
+    sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap) {
+        sq_ring_size = cq_ring_size = max(sq_ring_size, cq_ring_size);
+    }
+    sq_ring = map(sq_ring_size, IORING_OFF_SQ_RING);
+    cq_ring = single_mmap ? sq_ring : map(cq_ring_size, IORING_OFF_CQ_RING);
+    sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    sqes = reinterpret_cast<struct io_uring_sqe *>(map(sqes_size, IORING_OFF_SQES));
+
+    sq_tail = reinterpret_cast<unsigned *>(sq_ring + params.sq_off.tail);
+    sq_mask = reinterpret_cast<unsigned *>(sq_ring + params.sq_off.ring_mask);
+    sq_array = reinterpret_cast<unsigned *>(sq_ring + params.sq_off.array);
+    cq_head = reinterpret_cast<unsigned *>(cq_ring + params.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned *>(cq_ring + params.cq_off.tail);
+    cq_mask = reinterpret_cast<unsigned *>(cq_ring + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<struct io_uring_cqe *>(cq_ring + params.cq_off.cqes);
+}
+
+IoUring::~IoUring() {
+    unmap(sqes, sqes_size);
+    if (cq_ring != sq_ring) {
+        unmap(cq_ring, cq_ring_size);
+    }
+    unmap(sq_ring, sq_ring_size);
+    CHECKED(close(ring_fd) == 0, format("close failed: %s") % strerror(errno));
+}
+
+uint8_t *IoUring::map(size_t size, off_t offset) {
+    void *ret = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     ring_fd, offset);
+    INVARIANT(ret != MAP_FAILED, format("mmap of io_uring failed: %s") % strerror(errno));
+    return static_cast<uint8_t *>(ret);
+}
+
+void IoUring::unmap(void *addr, size_t size) {
+    CHECKED(munmap(addr, size) == 0, format("munmap failed: %s") % strerror(errno));
+}
+
+void IoUring::submit(Op op, int fd, const struct iovec *iov, unsigned niov, off64_t offset,
+                     void *user_data) {
+    unsigned tail = *sq_tail; // we are the only producer
+    unsigned index = tail & *sq_mask;
+    struct io_uring_sqe *sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = op == op_readv ? IORING_OP_READV : IORING_OP_WRITEV;
+    sqe->fd = fd;
+    sqe->off = offset;
+    sqe->addr = reinterpret_cast<uint64_t>(iov);
+    sqe->len = niov;
+    sqe->user_data = reinterpret_cast<uint64_t>(user_data);
+    sq_array[index] = index;
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    while (true) {
+        int ret = syscall(__NR_io_uring_enter, ring_fd, 1, 0, 0, NULL, 0);
+        if (ret == 1) {
+            break;
+        }
+        INVARIANT(ret < 0 && (errno == EINTR || errno == EAGAIN),
+                  format("io_uring_enter failed to submit: %s") % strerror(errno));
+    }
+}
+
+void *IoUring::wait(int &result) {
+    while (true) {
+        unsigned head = *cq_head; // we are the only consumer
+        if (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+            int ret = syscall(__NR_io_uring_enter, ring_fd, 0, 1, IORING_ENTER_GETEVENTS,
+                              NULL, 0);
+            INVARIANT(ret >= 0 || errno == EINTR,
+                      format("io_uring_enter failed: %s") % strerror(errno));
+            continue;
+        }
+        struct io_uring_cqe *cqe = &cqes[head & *cq_mask];
+        void *ret = reinterpret_cast<void *>(cqe->user_data);
+        result = cqe->res;
+        __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+        return ret;
+    }
+}
+
+#else
+
+IoUring *IoUring::make(unsigned entries) {
+    return NULL;
+}
+
+IoUring::~IoUring() { }
+
+void IoUring::submit(Op op, int fd, const struct iovec *iov, unsigned niov, off64_t offset,
+                     void *user_data) {
+    FATAL_ERROR("built without io_uring");
+}
+
+void *IoUring::wait(int &result) {
+    FATAL_ERROR("built without io_uring");
+}
+
+#endif
+
+} // namespace dataseries
@@ -0,0 +1,67 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    A minimal io_uring, talking to the kernel directly rather than
+    through liburing; used by AsyncReader and OutputFile.
+*/
+
+#ifndef DATASERIES_IO_URING_HPP
+#define DATASERIES_IO_URING_HPP
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <inttypes.h>
+
+#include <boost/utility.hpp>
+
+struct io_uring_params;
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace dataseries {
+
+/** An io_uring that can only readv and writev.  Not thread safe; one
+    thread has to do all of the submits and waits. */
+class IoUring : boost::noncopyable {
+  public:
+    enum Op { op_readv, op_writev };
+
+    /** Returns a ring for up to entries operations in flight, or NULL if
+        the kernel won't give us one or DataSeries was built without
+        io_uring support. */
+    static IoUring *make(unsigned entries);
+
+    ~IoUring();
+
+    /** Hands the kernel a readv or writev of the iovecs at offset in fd;
+        the iovecs have to stay valid until wait() returns user_data.
+        There has to be room: at most entries operations are in flight. */
+    void submit(Op op, int fd, const struct iovec *iov, unsigned niov, off64_t offset,
+                void *user_data);
+
+    /** Waits for one of the operations to finish; returns its user_data
+        and sets result to the bytes transferred or -errno. */
+    void *wait(int &result);
+
+  private:
+    IoUring(int ring_fd, const struct io_uring_params &params);
+    uint8_t *map(size_t size, off_t offset);
+    static void unmap(void *addr, size_t size);
+
+    int ring_fd;
+    uint8_t *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+    struct io_uring_sqe *sqes;
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+};
+
+} // namespace dataseries
+
+#endif
@@ -0,0 +1,272 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    OutputFile implementation
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <Lintel/LintelLog.hpp>
+
+#include "IoUring.hpp"
+#include "OutputFile.hpp"
+
+#if (_FILE_OFFSET_BITS == 64 && !defined(_LARGEFILE64_SOURCE)) || defined(__CYGWIN__)
+#define pread64 pread
+#define pwrite64 pwrite
+#endif
+
+#ifndef O_LARGEFILE
+#define O_LARGEFILE 0
+#endif
+
+using namespace std;
+using boost::format;
+
+namespace dataseries {
+
+const size_t OutputFile::direct_alignment;
+const size_t OutputFile::staging_size;
+const unsigned OutputFile::nstaging;
+
+OutputFile::OutputFile(const string &filename)
+    : filename(filename), fd(-1), offset(0), cur(0), ring(NULL), in_flight(0)
+{
+    fd = ::open(filename.c_str(), O_RDWR | O_LARGEFILE | O_CREAT | O_TRUNC, 0666);
+    INVARIANT(fd >= 0, format("Error opening %s for write: %s") % filename % strerror(errno));
+}
+
+OutputFile::~OutputFile() {
+    INVARIANT(fd == -1, format("%s was not closed") % filename);
+}
+
+void OutputFile::setDirect() {
+    INVARIANT(!isDirect(), "already using direct I/O");
+    INVARIANT(offset <= static_cast<off64_t>(staging_size),
+              "too late to switch to direct I/O");
+    buffers.resize(nstaging);
+    for (vector<Staging>::iterator i = buffers.begin(); i != buffers.end(); ++i) {
+        void *data;
+        INVARIANT(posix_memalign(&data, direct_alignment, staging_size) == 0,
+                  "out of memory for the direct I/O buffers");
+        i->data = static_cast<uint8_t *>(data);
+    }
+    // what was already written is rewritten with the first buffer
+    cur = 0;
+    Staging &first(buffers[0]);
+    while (first.size < static_cast<size_t>(offset)) {
+        ssize_t ret = pread64(fd, first.data + first.size, offset - first.size, first.size);
+        INVARIANT(ret > 0 || (ret < 0 && errno == EINTR),
+                  format("error rereading %s: %s") % filename % strerror(errno));
+        first.size += max(ret, static_cast<ssize_t>(0));
+    }
+
+#ifdef O_DIRECT
+    int flags = fcntl(fd, F_GETFL);
+    INVARIANT(flags != -1, format("fcntl failed: %s") % strerror(errno));
+    if (fcntl(fd, F_SETFL, flags | O_DIRECT) != 0) {
+        LintelLog::warn(format("can't use O_DIRECT for %s (%s); writing it through the"
+                               " page cache") % filename % strerror(errno));
+    }
+#else
+    LintelLog::warn(format("no O_DIRECT; writing %s through the page cache") % filename);
+#endif
+
+    string engine(getenv("DATASERIES_WRITE_ENGINE") == NULL
+                  ? "" : getenv("DATASERIES_WRITE_ENGINE"));
+    INVARIANT(engine.empty() || engine == "pwrite" || engine == "io_uring",
+              format("unrecognized DATASERIES_WRITE_ENGINE %s; expected pwrite or io_uring")
+              % engine);
+    if (engine != "pwrite") {
+        ring = IoUring::make(nstaging);
+    }
+    INVARIANT(engine != "io_uring" || ring != NULL,
+              "DATASERIES_WRITE_ENGINE=io_uring, but io_uring is unavailable");
+}
+
+void OutputFile::writev(const struct iovec *iov, unsigned niov) {
+    if (isDirect()) {
+        for (unsigned i = 0; i < niov; ++i) {
+            stage(static_cast<const uint8_t *>(iov[i].iov_base), iov[i].iov_len);
+        }
+        return;
+    }
+
+    vector<struct iovec> todo;
+    todo.reserve(niov);
+    for (unsigned i = 0; i < niov; ++i) {
+        if (iov[i].iov_len > 0) {
+            todo.push_back(iov[i]);
+        }
+    }
+    for (size_t first = 0; first < todo.size(); ) {
+        size_t n = min(todo.size() - first, static_cast<size_t>(IOV_MAX));
+        ssize_t ret = pwritev(fd, &todo[first], n, offset);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        INVARIANT(ret > 0, format("Error on write at %d of %s: %s") % offset % filename
+                  % (ret == 0 ? "no progress (disk full?)" : strerror(errno)));
+        offset += ret;
+        // skip what was written, which may end part way through an iovec
+        size_t done = ret;
+        while (first < todo.size() && done >= todo[first].iov_len) {
+            done -= todo[first].iov_len;
+            ++first;
+        }
+        if (done > 0) {
+            todo[first].iov_base = static_cast<uint8_t *>(todo[first].iov_base) + done;
+            todo[first].iov_len -= done;
+        }
+    }
+}
+
+void OutputFile::write(const void *buf, size_t size) {
+    struct iovec iov;
+    iov.iov_base = const_cast<void *>(buf);
+    iov.iov_len = size;
+    writev(&iov, 1);
+}
+
+void OutputFile::rewrite(off64_t at, const void *buf, size_t size) {
+    INVARIANT(at >= 0 && at + static_cast<off64_t>(size) <= offset,
+              format("can only rewrite what was written, not %d bytes at %d")
+              % size % at);
+    if (isDirect()) {
+        Staging &staging(buffers[cur]);
+        INVARIANT(at >= staging.offset,
+                  format("%d bytes at %d were already written with direct I/O") % size % at);
+        memcpy(staging.data + (at - staging.offset), buf, size);
+        return;
+    }
+    for (size_t done = 0; done < size; ) {
+        ssize_t ret = pwrite64(fd, static_cast<const uint8_t *>(buf) + done, size - done,
+                               at + done);
+        INVARIANT(ret > 0 || (ret < 0 && errno == EINTR),
+                  format("Error on rewrite of %s: %s") % filename % strerror(errno));
+        done += max(ret, static_cast<ssize_t>(0));
+    }
+}
+
+void OutputFile::stage(const uint8_t *data, size_t size) {
+    while (size > 0) {
+        Staging &staging(buffers[cur]);
+        size_t n = min(size, staging_size - staging.size);
+        memcpy(staging.data + staging.size, data, n);
+        staging.size += n;
+        offset += n;
+        data += n;
+        size -= n;
+        if (staging.size < staging_size) {
+            break;
+        }
+
+        // full, so write it and start on the next one
+        if (ring != NULL) {
+            submitStaging(staging);
+        } else {
+            pwriteStaging(staging);
+        }
+        cur = (cur + 1) % nstaging;
+        while (buffers[cur].in_flight) {
+            waitStaging();
+        }
+        buffers[cur].offset = staging.offset + staging_size;
+        buffers[cur].size = 0;
+    }
+}
+
+void OutputFile::pwriteStaging(Staging &staging) {
+    for (staging.written = 0; staging.written < staging.size; ) {
+        ssize_t ret = pwrite64(fd, staging.data + staging.written,
+                               staging.size - staging.written, staging.offset + staging.written);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        INVARIANT(ret > 0, format("Error on write at %d of %s: %s")
+                  % (staging.offset + staging.written) % filename
+                  % (ret == 0 ? "no progress (disk full?)" : strerror(errno)));
+        staging.written += ret;
+    }
+}
+
+// Hands the kernel a write of the part of staging that isn't written; there
+// is always room, since at most nstaging writes are in flight.
+void OutputFile::submitStaging(Staging &staging) {
+    if (!staging.in_flight) {
+        staging.written = 0;
+        staging.in_flight = true;
+        ++in_flight;
+    }
+    staging.iov.iov_base = staging.data + staging.written;
+    staging.iov.iov_len = staging.size - staging.written;
+    ring->submit(IoUring::op_writev, fd, &staging.iov, 1, staging.offset + staging.written,
+                 &staging);
+}
+
+void OutputFile::waitStaging() {
+    SINVARIANT(in_flight > 0);
+    int res;
+    Staging &staging(*static_cast<Staging *>(ring->wait(res)));
+    if (res == -EINTR || res == -EAGAIN) {
+        submitStaging(staging);
+        return;
+    }
+    INVARIANT(res > 0, format("Error on write at %d of %s: %s")
+              % (staging.offset + staging.written) % filename
+              % (res == 0 ? "no progress (disk full?)" : strerror(-res)));
+    staging.written += res;
+    if (staging.written < staging.size) {
+        submitStaging(staging); // short write, send the rest
+    } else {
+        staging.in_flight = false;
+        --in_flight;
+    }
+}
+
+void OutputFile::close(bool do_fsync) {
+    SINVARIANT(fd >= 0);
+    if (isDirect()) {
+        while (in_flight > 0) {
+            waitStaging();
+        }
+        // O_DIRECT writes whole blocks, so pad the last one and then cut
+        // the file back to its real size
+        Staging &staging(buffers[cur]);
+        if (staging.size > 0) {
+            size_t padded = (staging.size + direct_alignment - 1) / direct_alignment
+                * direct_alignment;
+            memset(staging.data + staging.size, 0, padded - staging.size);
+            staging.size = padded;
+            pwriteStaging(staging);
+            CHECKED(ftruncate(fd, offset) == 0,
+                    format("ftruncate of %s failed: %s") % filename % strerror(errno));
+        }
+        for (vector<Staging>::iterator i = buffers.begin(); i != buffers.end(); ++i) {
+            free(i->data);
+        }
+        buffers.clear();
+        delete ring;
+        ring = NULL;
+    }
+    if (do_fsync) {
+        fsync(fd);
+    }
+    int ret = ::close(fd);
+    INVARIANT(ret == 0, format("close failed: %s") % strerror(errno));
+    fd = -1;
+}
+
+} // namespace dataseries
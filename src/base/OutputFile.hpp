@@ -0,0 +1,97 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Writes a file sequentially; used by DataSeriesSink.
+*/
+
+#ifndef DATASERIES_OUTPUT_FILE_HPP
+#define DATASERIES_OUTPUT_FILE_HPP
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <inttypes.h>
+
+#include <string>
+#include <vector>
+
+#include <boost/utility.hpp>
+
+namespace dataseries {
+
+class IoUring;
+
+/** Writes a file from start to end.  Normally each writev() is one
+    pwritev of the caller's buffers.  With direct I/O the data is copied
+    into aligned staging buffers that are written with O_DIRECT, so
+    it doesn't fill the page cache; while one buffer fills, the ones
+    before it are written with io_uring, or with a blocking pwrite if
+    io_uring is unavailable.  The last buffer is padded to the block
+    size and the file truncated to its real size when it is closed, so
+    the contents are the same either way.  Not thread safe. */
+class OutputFile : boost::noncopyable {
+  public:
+    /** Creates (or truncates) filename. */
+    OutputFile(const std::string &filename);
+    ~OutputFile();
+
+    /** Switches to direct I/O; only the first staging buffer's worth of
+        data may have been written.  If the file system refuses O_DIRECT,
+        the staging buffers are still used, but go through the page
+        cache.  Setting the environment variable DATASERIES_WRITE_ENGINE
+        to pwrite or io_uring chooses how the buffers are written;
+        io_uring is the default when it is available. */
+    void setDirect();
+    bool isDirect() const { return !buffers.empty(); }
+
+    /** Appends the iovecs to the file. */
+    void writev(const struct iovec *iov, unsigned niov);
+    void write(const void *buf, size_t size);
+
+    /** Overwrites size bytes at offset, which have already been
+        written; with direct I/O, they have to be in the buffer being
+        filled. */
+    void rewrite(off64_t offset, const void *buf, size_t size);
+
+    /** Writes out everything, and closes the file. */
+    void close(bool do_fsync);
+
+    /** Returns the number of bytes written so far. */
+    off64_t size() const { return offset; }
+
+    static const size_t direct_alignment = 4096;
+    static const size_t staging_size = 4 * 1024 * 1024;
+    static const unsigned nstaging = 4;
+
+  private:
+    struct Staging {
+        uint8_t *data;
+        off64_t offset; // in the file
+        size_t size, written;
+        bool in_flight;
+        struct iovec iov;
+        Staging() : data(NULL), offset(0), size(0), written(0), in_flight(false) { }
+    };
+
+    void stage(const uint8_t *data, size_t size);
+    void pwriteStaging(Staging &staging);
+    void submitStaging(Staging &staging);
+    void waitStaging();
+
+    const std::string filename;
+    int fd;
+    off64_t offset;
+    // for direct I/O; the one being filled is buffers[cur]
+    std::vector<Staging> buffers;
+    unsigned cur;
+    IoUring *ring;
+    unsigned in_flight;
+};
+
+} // namespace dataseries
+
+#endif
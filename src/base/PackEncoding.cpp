@@ -0,0 +1,224 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    pack_encoding="xor" and "delta2" bit stream encodings.
+*/
+
+#include <string.h>
+
+#include <Lintel/AssertBoost.hpp>
+
+#include "PackEncoding.hpp"
+
+namespace dataseries { namespace pack_encoding {
+
+namespace {
+
+inline uint64_t load(const byte *col, size_t stride, uint32_t i) {
+    uint64_t v;
+    memcpy(&v, col + i * stride, 8);
+    return v;
+}
+
+inline void store(byte *col, size_t stride, uint32_t i, uint64_t v) {
+    memcpy(col + i * stride, &v, 8);
+}
+
+class BitWriter {
+  public:
+    BitWriter(uint64_t *out) : out(out), nwords(0), cur(0), used(0) { }
+
+    // v must fit in nbits, which is 1..64
+    void put(uint64_t v, unsigned nbits) {
+        cur |= v << used;
+        if (used + nbits >= 64) {
+            out[nwords++] = cur;
+            cur = used == 0 ? 0 : v >> (64 - used);
+            used = used + nbits - 64;
+        } else {
+            used += nbits;
+        }
+    }
+
+    size_t finish() {
+        if (used > 0) {
+            out[nwords++] = cur;
+        }
+        return nwords;
+    }
+
+  private:
+    uint64_t *out;
+    size_t nwords;
+    uint64_t cur;
+    unsigned used;
+};
+
+class BitReader {
+  public:
+    BitReader(const uint64_t *in, size_t nwords) : in(in), nwords(nwords), word(0), used(0) { }
+
+    // nbits is 1..64
+    uint64_t get(unsigned nbits) {
+        INVARIANT(word < nwords, "Invalid extent data, pack_encoding stream truncated");
+        uint64_t v = in[word] >> used;
+        if (used + nbits >= 64) {
+            ++word;
+            if (used + nbits > 64) {
+                INVARIANT(word < nwords, "Invalid extent data, pack_encoding stream truncated");
+                v |= in[word] << (64 - used);
+            }
+            used = used + nbits - 64;
+        } else {
+            used += nbits;
+        }
+        return nbits == 64 ? v : v & ((static_cast<uint64_t>(1) << nbits) - 1);
+    }
+
+    bool getBit() {
+        return get(1) != 0;
+    }
+
+    void finish() {
+        INVARIANT(word + (used > 0 ? 1 : 0) == nwords,
+                  "Invalid extent data, pack_encoding stream too long");
+    }
+
+  private:
+    const uint64_t *in;
+    size_t nwords, word;
+    unsigned used;
+};
+
+// The delta2 buckets after the 0 bucket, by the number of 1 bits in
+// their prefix.
+const unsigned delta2_bits[] = { 7, 9, 12, 32, 64 };
+const unsigned delta2_buckets = sizeof(delta2_bits) / sizeof(delta2_bits[0]);
+
+}
+
+size_t encodeXor(const byte *col, size_t stride, uint32_t nrecords, uint64_t *out) {
+    BitWriter w(out);
+    if (nrecords == 0) {
+        return w.finish();
+    }
+    uint64_t prev = load(col, stride, 0);
+    w.put(prev, 64);
+    unsigned prev_lead = 64, prev_trail = 64; // no window yet
+    for (uint32_t i = 1; i < nrecords; ++i) {
+        uint64_t v = load(col, stride, i);
+        uint64_t x = v ^ prev;
+        prev = v;
+        if (x == 0) {
+            w.put(0, 1);
+            continue;
+        }
+        unsigned lead = __builtin_clzll(x), trail = __builtin_ctzll(x);
+        if (lead > 31) {
+            lead = 31;
+        }
+        if (prev_lead + prev_trail < 64 && lead >= prev_lead && trail >= prev_trail) {
+            w.put(1, 2);
+            w.put(x >> prev_trail, 64 - prev_lead - prev_trail);
+        } else {
+            unsigned len = 64 - lead - trail;
+            w.put(3, 2);
+            w.put(lead, 5);
+            w.put(len - 1, 6);
+            w.put(x >> trail, len);
+            prev_lead = lead;
+            prev_trail = trail;
+        }
+    }
+    return w.finish();
+}
+
+void decodeXor(const uint64_t *in, size_t nwords, byte *col, size_t stride, uint32_t nrecords) {
+    BitReader r(in, nwords);
+    if (nrecords == 0) {
+        r.finish();
+        return;
+    }
+    uint64_t prev = r.get(64);
+    store(col, stride, 0, prev);
+    unsigned prev_lead = 64, prev_trail = 64;
+    for (uint32_t i = 1; i < nrecords; ++i) {
+        if (r.getBit()) {
+            if (r.getBit()) {
+                prev_lead = r.get(5);
+                unsigned len = r.get(6) + 1;
+                INVARIANT(prev_lead + len <= 64, "Invalid extent data, bad xor window");
+                prev_trail = 64 - prev_lead - len;
+            } else {
+                INVARIANT(prev_lead + prev_trail < 64, "Invalid extent data, xor without window");
+            }
+            prev ^= r.get(64 - prev_lead - prev_trail) << prev_trail;
+        }
+        store(col, stride, i, prev);
+    }
+    r.finish();
+}
+
+size_t encodeDelta2(const byte *col, size_t stride, uint32_t nrecords, uint64_t *out) {
+    BitWriter w(out);
+    if (nrecords == 0) {
+        return w.finish();
+    }
+    uint64_t prev = load(col, stride, 0), prev_delta = 0;
+    w.put(prev, 64);
+    for (uint32_t i = 1; i < nrecords; ++i) {
+        uint64_t v = load(col, stride, i);
+        uint64_t delta = v - prev;
+        int64_t dd = static_cast<int64_t>(delta - prev_delta);
+        uint64_t zigzag = (static_cast<uint64_t>(dd) << 1) ^ static_cast<uint64_t>(dd >> 63);
+        prev = v;
+        prev_delta = delta;
+        if (zigzag == 0) {
+            w.put(0, 1);
+            continue;
+        }
+        unsigned bucket = 0;
+        while (bucket + 1 < delta2_buckets && (zigzag >> delta2_bits[bucket]) != 0) {
+            ++bucket;
+        }
+        // bucket + 1 one bits, then a zero unless it is the last bucket
+        if (bucket + 1 < delta2_buckets) {
+            w.put((static_cast<uint64_t>(1) << (bucket + 1)) - 1, bucket + 2);
+        } else {
+            w.put((static_cast<uint64_t>(1) << delta2_buckets) - 1, delta2_buckets);
+        }
+        w.put(zigzag, delta2_bits[bucket]);
+    }
+    return w.finish();
+}
+
+void decodeDelta2(const uint64_t *in, size_t nwords, byte *col, size_t stride,
+                  uint32_t nrecords) {
+    BitReader r(in, nwords);
+    if (nrecords == 0) {
+        r.finish();
+        return;
+    }
+    uint64_t prev = r.get(64), prev_delta = 0;
+    store(col, stride, 0, prev);
+    for (uint32_t i = 1; i < nrecords; ++i) {
+        unsigned ones = 0;
+        while (ones < delta2_buckets && r.getBit()) {
+            ++ones;
+        }
+        if (ones > 0) {
+            uint64_t zigzag = r.get(delta2_bits[ones - 1]);
+            prev_delta += (zigzag >> 1) ^ (~(zigzag & 1) + 1);
+        }
+        prev += prev_delta;
+        store(col, stride, i, prev);
+    }
+    r.finish();
+}
+
+} }
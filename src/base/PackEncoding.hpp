@@ -0,0 +1,61 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    The pack_encoding="xor" and "delta2" encodings used by
+    Extent::packData and Extent::unpackData.
+
+    Both take a column of 64-bit values (int64, or the bits of a
+    double) and write a bit stream, filling 64-bit words from the low
+    bit up.  The first value is stored as is; each later value is
+    stored as:
+
+    - xor: the value xor the previous one, as in Gorilla.  A 0 bit if
+      they are equal; otherwise 1 then 0 and the bits of the xor inside
+      the previous window of significant bits, if they fit, or 1 then 1,
+      5 bits of leading zeros (at most 31), 6 bits of the number of
+      significant bits less one, and the significant bits.
+
+    - delta2: the difference between this delta and the previous one
+      (the first delta is from 0), zig-zag encoded so small negative
+      values are small, then stored in the first of 0, 7, 9, 12, 32 or
+      64 bits that fits, preceded by 0, 10, 110, 1110, 11110 or 11111.
+
+    Both are lossless; the differences wrap around as uint64_t.
+*/
+
+#ifndef DATASERIES_PACK_ENCODING_HPP
+#define DATASERIES_PACK_ENCODING_HPP
+
+#include <stddef.h>
+#include <inttypes.h>
+
+namespace dataseries { namespace pack_encoding {
+
+typedef uint8_t byte;
+
+/// The most words either encoding can need for nrecords values; the
+/// worst case is 77 bits per value for xor.
+inline size_t maxEncodedWords(uint32_t nrecords) {
+    return (static_cast<uint64_t>(nrecords) * 77 + 63) / 64;
+}
+
+/// The encoders read the 8 byte values at col, stride bytes apart, and
+/// return the number of words they filled in out, which needs
+/// maxEncodedWords(nrecords) words.  The decoders write the values
+/// back; they fail with an invariant if the nwords words of in run
+/// out first.
+size_t encodeXor(const byte *col, size_t stride, uint32_t nrecords, uint64_t *out);
+void decodeXor(const uint64_t *in, size_t nwords, byte *col, size_t stride, uint32_t nrecords);
+
+size_t encodeDelta2(const byte *col, size_t stride, uint32_t nrecords, uint64_t *out);
+void decodeDelta2(const uint64_t *in, size_t nwords, byte *col, size_t stride,
+                  uint32_t nrecords);
+
+} }
+
+#endif
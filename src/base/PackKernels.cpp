@@ -0,0 +1,643 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Column-at-a-time pack/unpack kernels with run-time cpu dispatch.
+*/
+
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+
+#include <Lintel/AssertBoost.hpp>
+
+#include "PackKernels.hpp"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) \
+    && (defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define DATASERIES_PACK_KERNELS_X86 1
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+namespace dataseries { namespace pack_kernels {
+
+// The kernel bodies are written once and forced inline.  Only the
+// contiguous byte swap, the bit unpacking and the CRC32C have
+// hand-written variants for sse4.2 and avx2, which use these bodies for
+// the values they don't cover.  The strided column kernels (null
+// zeroing, the relative encodings and prefix sums, and scaling) step
+// through whole records and the delta and prefix-sum chains are serial,
+// so every level shares their one scalar version.
+#define KERNEL_BODY static inline __attribute__((always_inline))
+
+template<typename T> KERNEL_BODY T &at(byte *col, size_t stride, uint32_t i) {
+    return *reinterpret_cast<T *>(col + i * stride);
+}
+
+template<typename T> KERNEL_BODY const T &at(const byte *col, size_t stride, uint32_t i) {
+    return *reinterpret_cast<const T *>(col + i * stride);
+}
+
+KERNEL_BODY bool isNull(const byte *nulls, int null_mask, size_t stride, uint32_t i) {
+    return nulls != NULL && (nulls[i * stride] & null_mask) != 0;
+}
+
+KERNEL_BODY uint32_t flip32(uint32_t v) {
+    return ((v >> 24) & 0xFF) | ((v >> 8) & 0xFF00) | ((v & 0xFF00) << 8) | ((v & 0xFF) << 24);
+}
+
+KERNEL_BODY uint64_t flip64(uint64_t v) {
+    return (static_cast<uint64_t>(flip32(static_cast<uint32_t>(v))) << 32)
+        | flip32(static_cast<uint32_t>(v >> 32));
+}
+
+KERNEL_BODY void flip4Body(byte *col, size_t stride, uint32_t nrecords) {
+    for (uint32_t i = 0; i < nrecords; ++i) {
+        at<uint32_t>(col, stride, i) = flip32(at<uint32_t>(col, stride, i));
+    }
+}
+
+KERNEL_BODY void flip8Body(byte *col, size_t stride, uint32_t nrecords) {
+    for (uint32_t i = 0; i < nrecords; ++i) {
+        at<uint64_t>(col, stride, i) = flip64(at<uint64_t>(col, stride, i));
+    }
+}
+
+KERNEL_BODY void flip4ContiguousBody(uint32_t *buf, size_t buflen) {
+    for (size_t i = 0; i < buflen; ++i) {
+        buf[i] = flip32(buf[i]);
+    }
+}
+
+template<typename T>
+KERNEL_BODY void zeroNullsBody(byte *col, const byte *nulls, int null_mask,
+                               size_t stride, uint32_t nrecords) {
+    for (uint32_t i = 0; i < nrecords; ++i) {
+        if (nulls[i * stride] & null_mask) {
+            at<T>(col, stride, i) = 0;
+        }
+    }
+}
+
+template<typename T>
+KERNEL_BODY void selfRelativeEncodeBody(byte *col, const byte *nulls, int null_mask,
+                                        size_t stride, uint32_t nrecords) {
+    T prev = 0;
+    for (uint32_t i = 0; i < nrecords; ++i) {
+        if (isNull(nulls, null_mask, stride, i)) {
+            continue; // Don't overwrite nulls, must remain 0.
+        }
+        T v = at<T>(col, stride, i);
+        at<T>(col, stride, i) = v - prev;
+        prev = v;
+    }
+}
+
+template<typename T>
+KERNEL_BODY void selfRelativeDecodeBody(byte *col, const byte *nulls, int null_mask,
+                                        size_t stride, uint32_t nrecords) {
+    T prev = 0;
+    for (uint32_t i = 0; i < nrecords; ++i) {
+        if (isNull(nulls, null_mask, stride, i)) {
+            continue;
+        }
+        prev = at<T>(col, stride, i) + prev;
+        at<T>(col, stride, i) = prev;
+    }
+}
+
+KERNEL_BODY void selfRelativeDecodeDoubleBody(byte *col, const byte *nulls, int null_mask,
+                                              size_t stride, uint32_t nrecords,
+                                              double multiplier, double scale) {
+    double prev = 0;
+    for (uint32_t i = 0; i < nrecords; ++i) {
+        if (isNull(nulls, null_mask, stride, i)) {
+            continue;
+        }
+        double v = at<double>(col, stride, i) + prev;
+        v = round(v * multiplier) * scale;
+        at<double>(col, stride, i) = v;
+        prev = v;
+    }
+}
+
+template<typename T>
+KERNEL_BODY void otherRelativeEncodeBody(byte *col, const byte *base_col, const byte *nulls,
+                                         int null_mask, size_t stride, uint32_t nrecords) {
+    for (uint32_t i = 0; i < nrecords; ++i) {
+        if (isNull(nulls, null_mask, stride, i)) {
+            continue;
+        }
+        at<T>(col, stride, i) = at<T>(col, stride, i) - at<T>(base_col, stride, i);
+    }
+}
+
+template<typename T>
+KERNEL_BODY void otherRelativeDecodeBody(byte *col, const byte *base_col, const byte *nulls,
+                                         int null_mask, size_t stride, uint32_t nrecords) {
+    for (uint32_t i = 0; i < nrecords; ++i) {
+        if (isNull(nulls, null_mask, stride, i)) {
+            continue;
+        }
+        at<T>(col, stride, i) = at<T>(col, stride, i) + at<T>(base_col, stride, i);
+    }
+}
+
+KERNEL_BODY uint32_t scaleEncodeBody(byte *col, size_t stride, uint32_t nrecords,
+                                     double multiplier, double *bad_value) {
+    uint32_t first_bad = nrecords;
+    for (uint32_t i = 0; i < nrecords; ++i) {
+        double v = at<double>(col, stride, i);
+        double scaled = v * multiplier;
+        double rounded = round(scaled);
+        if (first_bad == nrecords && fabs(scaled - rounded) > 0.1) {
+            first_bad = i;
+            *bad_value = v;
+        }
+        at<double>(col, stride, i) = rounded;
+    }
+    return first_bad;
+}
+
+KERNEL_BODY void scaleDecodeBody(byte *col, size_t stride, uint32_t nrecords, double scale) {
+    for (uint32_t i = 0; i < nrecords; ++i) {
+        at<double>(col, stride, i) = at<double>(col, stride, i) * scale;
+    }
+}
+
+// The bit-packed values are widened to 64 bits so that value -
+// reference wraps the same way for every column type; bytes are
+// unsigned.
+template<typename T> KERNEL_BODY uint64_t widen(T v) {
+    return static_cast<uint64_t>(static_cast<int64_t>(v));
+}
+
+template<typename T>
+KERNEL_BODY unsigned bitPackBody(const byte *col, size_t stride, uint32_t nrecords,
+                                 int64_t *reference, uint64_t *out) {
+    if (nrecords == 0) {
+        *reference = 0;
+        return 0;
+    }
+    T lo = at<T>(col, stride, 0), hi = lo;
+    for (uint32_t i = 1; i < nrecords; ++i) {
+        T v = at<T>(col, stride, i);
+        lo = v < lo ? v : lo;
+        hi = v > hi ? v : hi;
+    }
+    *reference = static_cast<int64_t>(lo);
+    const uint64_t base = widen(lo), range = widen(hi) - base;
+    const unsigned width = range == 0 ? 0 : 64 - __builtin_clzll(range);
+    memset(out, 0, bitPackedWords(nrecords, width) * 8);
+    uint64_t bitpos = 0;
+    for (uint32_t i = 0; i < nrecords; ++i, bitpos += width) {
+        uint64_t v = widen(at<T>(col, stride, i)) - base;
+        size_t word = bitpos >> 6;
+        unsigned shift = bitpos & 63;
+        out[word] |= v << shift;
+        if (shift + width > 64) {
+            out[word + 1] |= v >> (64 - shift);
+        }
+    }
+    return width;
+}
+
+// Unpacks the values from first on, so the vectorized variants can
+// finish with it.
+template<typename T>
+KERNEL_BODY void bitUnpackBody(const uint64_t *in, unsigned width, int64_t reference,
+                               byte *col, size_t stride, uint32_t first, uint32_t nrecords) {
+    const uint64_t base = reference;
+    if (width == 0) {
+        for (uint32_t i = first; i < nrecords; ++i) {
+            at<T>(col, stride, i) = static_cast<T>(base);
+        }
+        return;
+    }
+    const uint64_t mask = width == 64 ? ~static_cast<uint64_t>(0)
+        : (static_cast<uint64_t>(1) << width) - 1;
+    for (uint32_t i = first; i < nrecords; ++i) {
+        uint64_t bitpos = static_cast<uint64_t>(i) * width;
+        size_t word = bitpos >> 6;
+        unsigned shift = bitpos & 63;
+        uint64_t v = in[word] >> shift;
+        if (shift + width > 64) {
+            v |= in[word + 1] << (64 - shift);
+        }
+        at<T>(col, stride, i) = static_cast<T>((v & mask) + base);
+    }
+}
+
+#define DEFINE_FLIP4(suffix, attr) \
+static attr void flip4_##suffix(byte *col, size_t stride, uint32_t nrecords) { \
+    if (stride == 4) { \
+        flip4Contiguous_##suffix(reinterpret_cast<uint32_t *>(col), nrecords); \
+    } else { \
+        flip4Body(col, stride, nrecords); \
+    } \
+}
+
+// The kernels every level shares.
+#define DEFINE_KERNEL_SET(suffix, attr) \
+static attr void flip8_##suffix(byte *col, size_t stride, uint32_t nrecords) { \
+    flip8Body(col, stride, nrecords); \
+} \
+static attr void zeroNulls1_##suffix(byte *col, const byte *nulls, int null_mask, \
+                                     size_t stride, uint32_t nrecords) { \
+    zeroNullsBody<uint8_t>(col, nulls, null_mask, stride, nrecords); \
+} \
+static attr void zeroNulls4_##suffix(byte *col, const byte *nulls, int null_mask, \
+                                     size_t stride, uint32_t nrecords) { \
+    zeroNullsBody<uint32_t>(col, nulls, null_mask, stride, nrecords); \
+} \
+static attr void zeroNulls8_##suffix(byte *col, const byte *nulls, int null_mask, \
+                                     size_t stride, uint32_t nrecords) { \
+    zeroNullsBody<uint64_t>(col, nulls, null_mask, stride, nrecords); \
+} \
+static attr void sREInt32_##suffix(byte *col, const byte *nulls, int null_mask, \
+                                   size_t stride, uint32_t nrecords) { \
+    selfRelativeEncodeBody<int32_t>(col, nulls, null_mask, stride, nrecords); \
+} \
+static attr void sREInt64_##suffix(byte *col, const byte *nulls, int null_mask, \
+                                   size_t stride, uint32_t nrecords) { \
+    selfRelativeEncodeBody<int64_t>(col, nulls, null_mask, stride, nrecords); \
+} \
+static attr void sREDouble_##suffix(byte *col, const byte *nulls, int null_mask, \
+                                    size_t stride, uint32_t nrecords) { \
+    selfRelativeEncodeBody<double>(col, nulls, null_mask, stride, nrecords); \
+} \
+static attr void sRDInt32_##suffix(byte *col, const byte *nulls, int null_mask, \
+                                   size_t stride, uint32_t nrecords) { \
+    selfRelativeDecodeBody<int32_t>(col, nulls, null_mask, stride, nrecords); \
+} \
+static attr void sRDInt64_##suffix(byte *col, const byte *nulls, int null_mask, \
+                                   size_t stride, uint32_t nrecords) { \
+    selfRelativeDecodeBody<int64_t>(col, nulls, null_mask, stride, nrecords); \
+} \
+static attr void sRDDouble_##suffix(byte *col, const byte *nulls, int null_mask, \
+                                    size_t stride, uint32_t nrecords, \
+                                    double multiplier, double scale) { \
+    selfRelativeDecodeDoubleBody(col, nulls, null_mask, stride, nrecords, multiplier, scale); \
+} \
+static attr void oREInt32_##suffix(byte *col, const byte *base_col, const byte *nulls, \
+                                   int null_mask, size_t stride, uint32_t nrecords) { \
+    otherRelativeEncodeBody<int32_t>(col, base_col, nulls, null_mask, stride, nrecords); \
+} \
+static attr void oREInt64_##suffix(byte *col, const byte *base_col, const byte *nulls, \
+                                   int null_mask, size_t stride, uint32_t nrecords) { \
+    otherRelativeEncodeBody<int64_t>(col, base_col, nulls, null_mask, stride, nrecords); \
+} \
+static attr void oREDouble_##suffix(byte *col, const byte *base_col, const byte *nulls, \
+                                    int null_mask, size_t stride, uint32_t nrecords) { \
+    otherRelativeEncodeBody<double>(col, base_col, nulls, null_mask, stride, nrecords); \
+} \
+static attr void oRDInt32_##suffix(byte *col, const byte *base_col, const byte *nulls, \
+                                   int null_mask, size_t stride, uint32_t nrecords) { \
+    otherRelativeDecodeBody<int32_t>(col, base_col, nulls, null_mask, stride, nrecords); \
+} \
+static attr void oRDInt64_##suffix(byte *col, const byte *base_col, const byte *nulls, \
+                                   int null_mask, size_t stride, uint32_t nrecords) { \
+    otherRelativeDecodeBody<int64_t>(col, base_col, nulls, null_mask, stride, nrecords); \
+} \
+static attr void oRDDouble_##suffix(byte *col, const byte *base_col, const byte *nulls, \
+                                    int null_mask, size_t stride, uint32_t nrecords) { \
+    otherRelativeDecodeBody<double>(col, base_col, nulls, null_mask, stride, nrecords); \
+} \
+static attr uint32_t scaleEncode_##suffix(byte *col, size_t stride, uint32_t nrecords, \
+                                          double multiplier, double *bad_value) { \
+    return scaleEncodeBody(col, stride, nrecords, multiplier, bad_value); \
+} \
+static attr void scaleDecode_##suffix(byte *col, size_t stride, uint32_t nrecords, \
+                                      double scale) { \
+    scaleDecodeBody(col, stride, nrecords, scale); \
+} \
+static attr unsigned bitPack1_##suffix(const byte *col, size_t stride, uint32_t nrecords, \
+                                       int64_t *reference, uint64_t *out) { \
+    return bitPackBody<uint8_t>(col, stride, nrecords, reference, out); \
+} \
+static attr unsigned bitPack4_##suffix(const byte *col, size_t stride, uint32_t nrecords, \
+                                       int64_t *reference, uint64_t *out) { \
+    return bitPackBody<int32_t>(col, stride, nrecords, reference, out); \
+} \
+static attr unsigned bitPack8_##suffix(const byte *col, size_t stride, uint32_t nrecords, \
+                                       int64_t *reference, uint64_t *out) { \
+    return bitPackBody<int64_t>(col, stride, nrecords, reference, out); \
+}
+
+// The unpacking kernels are written separately for each level, as are
+// flip4Contiguous and crc32c.
+#define DEFINE_BIT_UNPACK(suffix, attr, body) \
+static attr void bitUnpack1_##suffix(const uint64_t *in, unsigned width, int64_t reference, \
+                                     byte *col, size_t stride, uint32_t nrecords) { \
+    body<uint8_t>(in, width, reference, col, stride, 0, nrecords); \
+} \
+static attr void bitUnpack4_##suffix(const uint64_t *in, unsigned width, int64_t reference, \
+                                     byte *col, size_t stride, uint32_t nrecords) { \
+    body<int32_t>(in, width, reference, col, stride, 0, nrecords); \
+} \
+static attr void bitUnpack8_##suffix(const uint64_t *in, unsigned width, int64_t reference, \
+                                     byte *col, size_t stride, uint32_t nrecords) { \
+    body<int64_t>(in, width, reference, col, stride, 0, nrecords); \
+}
+
+#define KERNEL_SET_TABLE(level, name, suffix) \
+    { level, name, flip4_##suffix, flip8_scalar, flip4Contiguous_##suffix, \
+      zeroNulls1_scalar, zeroNulls4_scalar, zeroNulls8_scalar, \
+      sREInt32_scalar, sREInt64_scalar, sREDouble_scalar, \
+      sRDInt32_scalar, sRDInt64_scalar, sRDDouble_scalar, \
+      oREInt32_scalar, oREInt64_scalar, oREDouble_scalar, \
+      oRDInt32_scalar, oRDInt64_scalar, oRDDouble_scalar, \
+      scaleEncode_scalar, scaleDecode_scalar, \
+      bitPack1_scalar, bitPack4_scalar, bitPack8_scalar, \
+      bitUnpack1_##suffix, bitUnpack4_##suffix, bitUnpack8_##suffix, crc32c_##suffix }
+
+static void flip4Contiguous_scalar(uint32_t *buf, size_t buflen) {
+    flip4ContiguousBody(buf, buflen);
+}
+
+// Slicing-by-8 tables for the reflected CRC32C polynomial; table[k][b]
+// is the crc of byte b followed by k zero bytes.
+struct Crc32cTables {
+    uint32_t table[8][256];
+
+    Crc32cTables() {
+        for (uint32_t b = 0; b < 256; ++b) {
+            uint32_t crc = b;
+            for (int bit = 0; bit < 8; ++bit) {
+                crc = (crc >> 1) ^ ((crc & 1) ? 0x82F63B78 : 0);
+            }
+            table[0][b] = crc;
+        }
+        for (uint32_t b = 0; b < 256; ++b) {
+            for (int k = 1; k < 8; ++k) {
+                table[k][b] = (table[k-1][b] >> 8) ^ table[0][table[k-1][b] & 0xFF];
+            }
+        }
+    }
+};
+
+// Reads the input a byte at a time, so it works on either endianness.
+static uint32_t crc32c_scalar(uint32_t crc, const byte *buf, size_t len) {
+    static const Crc32cTables tables;
+    const uint32_t (&t)[8][256] = tables.table;
+    crc = ~crc;
+    for (; len >= 8; len -= 8, buf += 8) {
+        uint32_t low = crc ^ (buf[0] | (buf[1] << 8) | (buf[2] << 16)
+                              | (static_cast<uint32_t>(buf[3]) << 24));
+        crc = t[7][low & 0xFF] ^ t[6][(low >> 8) & 0xFF] ^ t[5][(low >> 16) & 0xFF]
+            ^ t[4][low >> 24] ^ t[3][buf[4]] ^ t[2][buf[5]] ^ t[1][buf[6]] ^ t[0][buf[7]];
+    }
+    for (; len > 0; --len, ++buf) {
+        crc = (crc >> 8) ^ t[0][(crc ^ *buf) & 0xFF];
+    }
+    return ~crc;
+}
+
+DEFINE_FLIP4(scalar, )
+DEFINE_KERNEL_SET(scalar, )
+DEFINE_BIT_UNPACK(scalar, , bitUnpackBody)
+
+static const Kernels scalar_kernels = KERNEL_SET_TABLE(LevelScalar, "scalar", scalar);
+
+#if DATASERIES_PACK_KERNELS_X86
+// The byte swap of a contiguous buffer maps directly onto pshufb.
+
+static __attribute__((target("sse4.2"))) void flip4Contiguous_sse42(uint32_t *buf, size_t buflen) {
+    const __m128i shuffle = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+    size_t i = 0;
+    for (; i + 4 <= buflen; i += 4) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<__m128i *>(buf + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(buf + i), _mm_shuffle_epi8(v, shuffle));
+    }
+    flip4ContiguousBody(buf + i, buflen - i);
+}
+
+static __attribute__((target("avx2"))) void flip4Contiguous_avx2(uint32_t *buf, size_t buflen) {
+    const __m256i shuffle = _mm256_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3,
+                                            12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+    size_t i = 0;
+    for (; i + 8 <= buflen; i += 8) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<__m256i *>(buf + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(buf + i), _mm256_shuffle_epi8(v, shuffle));
+    }
+    flip4ContiguousBody(buf + i, buflen - i);
+}
+
+// The crc32 instruction takes 3 cycles but can start every cycle, so
+// long buffers are done as three interleaved stripes whose crcs are
+// then combined.  The crc of a stripe followed by n bytes is the crc of
+// the stripe multiplied by x^(8n), plus the crc of the n bytes.
+static const size_t crc32c_stripe = 4096;
+
+// Returns a * b modulo the CRC32C polynomial, in the bit-reflected
+// representation the crcs use (x^0 is the top bit); as in zlib.
+static uint32_t crc32cMultiply(uint32_t a, uint32_t b) {
+    uint32_t product = 0;
+    for (uint32_t bit = 1U << 31; bit != 0; bit >>= 1) {
+        if (a & bit) {
+            product ^= b;
+        }
+        b = (b & 1) ? (b >> 1) ^ 0x82F63B78 : b >> 1;
+    }
+    return product;
+}
+
+struct Crc32cShifts {
+    uint32_t one_stripe, two_stripes; // x^(8 * stripe), x^(16 * stripe)
+
+    Crc32cShifts() {
+        uint32_t x_power = 1U << 31;
+        for (size_t i = 0; i < 16 * crc32c_stripe; ++i) {
+            x_power = (x_power & 1) ? (x_power >> 1) ^ 0x82F63B78 : x_power >> 1;
+            if (i + 1 == 8 * crc32c_stripe) {
+                one_stripe = x_power;
+            }
+        }
+        two_stripes = x_power;
+    }
+};
+
+// The crc32 instruction was added with sse4.2, and is all that either
+// variant uses.
+static inline __attribute__((always_inline, target("sse4.2")))
+uint32_t crc32cBody(uint32_t crc, const byte *buf, size_t len) {
+    crc = ~crc;
+    for (; len > 0 && (reinterpret_cast<uintptr_t>(buf) & 7) != 0; --len, ++buf) {
+        crc = _mm_crc32_u8(crc, *buf);
+    }
+#ifdef __x86_64__
+    if (len >= 3 * crc32c_stripe) {
+        static const Crc32cShifts shifts;
+        for (; len >= 3 * crc32c_stripe; len -= 3 * crc32c_stripe, buf += 3 * crc32c_stripe) {
+            const uint64_t *words = reinterpret_cast<const uint64_t *>(buf);
+            const size_t nwords = crc32c_stripe / 8;
+            uint64_t a = crc, b = 0, c = 0;
+            for (size_t i = 0; i < nwords; ++i) {
+                a = _mm_crc32_u64(a, words[i]);
+                b = _mm_crc32_u64(b, words[i + nwords]);
+                c = _mm_crc32_u64(c, words[i + 2 * nwords]);
+            }
+            crc = crc32cMultiply(shifts.two_stripes, static_cast<uint32_t>(a))
+                ^ crc32cMultiply(shifts.one_stripe, static_cast<uint32_t>(b))
+                ^ static_cast<uint32_t>(c);
+        }
+    }
+    uint64_t crc64 = crc;
+    for (; len >= 8; len -= 8, buf += 8) {
+        crc64 = _mm_crc32_u64(crc64, *reinterpret_cast<const uint64_t *>(buf));
+    }
+    crc = static_cast<uint32_t>(crc64);
+#endif
+    for (; len >= 4; len -= 4, buf += 4) {
+        crc = _mm_crc32_u32(crc, *reinterpret_cast<const uint32_t *>(buf));
+    }
+    for (; len > 0; --len, ++buf) {
+        crc = _mm_crc32_u8(crc, *buf);
+    }
+    return ~crc;
+}
+
+static __attribute__((target("sse4.2"))) uint32_t crc32c_sse42(uint32_t crc, const byte *buf,
+                                                               size_t len) {
+    return crc32cBody(crc, buf, len);
+}
+
+static __attribute__((target("avx2"))) uint32_t crc32c_avx2(uint32_t crc, const byte *buf,
+                                                            size_t len) {
+    return crc32cBody(crc, buf, len);
+}
+
+// Unpacks four values at a time: each lane gathers the word holding
+// the start of its value and the word after it, and shifts the two
+// together.  A shift by 64 gives 0 for the values that don't cross a
+// word.  The loop stops while the last lane's next word is still in
+// the packed data, and the scalar code does the rest.
+template<typename T>
+static inline __attribute__((always_inline, target("avx2")))
+void bitUnpackAvx2Body(const uint64_t *in, unsigned width, int64_t reference,
+                       byte *col, size_t stride, uint32_t first, uint32_t nrecords) {
+    uint32_t i = first;
+    if (width > 0) {
+        const size_t nwords = bitPackedWords(nrecords, width);
+        const __m256i mask = _mm256_set1_epi64x(width == 64 ? -1LL
+                                                : static_cast<long long>((1ULL << width) - 1));
+        const __m256i base = _mm256_set1_epi64x(reference);
+        const __m256i low_six = _mm256_set1_epi64x(63);
+        const __m256i sixty_four = _mm256_set1_epi64x(64);
+        const __m256i step = _mm256_set1_epi64x(4 * width);
+        __m256i bitpos = _mm256_add_epi64(_mm256_set1_epi64x(static_cast<uint64_t>(i) * width),
+                                          _mm256_set_epi64x(3 * width, 2 * width, width, 0));
+        const long long *words = reinterpret_cast<const long long *>(in);
+        for (; i + 4 <= nrecords
+                 && ((static_cast<uint64_t>(i + 3) * width) >> 6) + 1 < nwords; i += 4) {
+            __m256i word = _mm256_srli_epi64(bitpos, 6);
+            __m256i shift = _mm256_and_si256(bitpos, low_six);
+            __m256i lo = _mm256_i64gather_epi64(words, word, 8);
+            __m256i hi = _mm256_i64gather_epi64(words + 1, word, 8);
+            __m256i v = _mm256_or_si256(_mm256_srlv_epi64(lo, shift),
+                                        _mm256_sllv_epi64(hi, _mm256_sub_epi64(sixty_four, shift)));
+            v = _mm256_add_epi64(_mm256_and_si256(v, mask), base);
+            uint64_t out[4];
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(out), v);
+            at<T>(col, stride, i) = static_cast<T>(out[0]);
+            at<T>(col, stride, i + 1) = static_cast<T>(out[1]);
+            at<T>(col, stride, i + 2) = static_cast<T>(out[2]);
+            at<T>(col, stride, i + 3) = static_cast<T>(out[3]);
+            bitpos = _mm256_add_epi64(bitpos, step);
+        }
+    }
+    bitUnpackBody<T>(in, width, reference, col, stride, i, nrecords);
+}
+
+DEFINE_FLIP4(sse42, __attribute__((target("sse4.2"))))
+DEFINE_FLIP4(avx2, __attribute__((target("avx2"))))
+DEFINE_BIT_UNPACK(sse42, __attribute__((target("sse4.2"))), bitUnpackBody)
+DEFINE_BIT_UNPACK(avx2, __attribute__((target("avx2"))), bitUnpackAvx2Body)
+
+static const Kernels sse42_kernels = KERNEL_SET_TABLE(LevelSSE42, "sse4.2", sse42);
+static const Kernels avx2_kernels = KERNEL_SET_TABLE(LevelAVX2, "avx2", avx2);
+#endif
+
+const Kernels *kernels(Level level) {
+    switch(level)
+    {
+        case LevelScalar: return &scalar_kernels;
+#if DATASERIES_PACK_KERNELS_X86
+        case LevelSSE42:
+            return __builtin_cpu_supports("sse4.2") ? &sse42_kernels : NULL;
+        case LevelAVX2:
+            return __builtin_cpu_supports("avx2") ? &avx2_kernels : NULL;
+#endif
+        default: return NULL;
+    }
+}
+
+static const Kernels *chooseKernels() {
+#if DATASERIES_PACK_KERNELS_X86
+    __builtin_cpu_init();
+#endif
+    Level max_level = LevelAVX2;
+    if (getenv("DATASERIES_PACK_KERNELS") != NULL) {
+        string level(getenv("DATASERIES_PACK_KERNELS"));
+        if (level == "scalar") {
+            max_level = LevelScalar;
+        } else if (level == "sse4.2") {
+            max_level = LevelSSE42;
+        } else if (level == "avx2") {
+            max_level = LevelAVX2;
+        } else {
+            FATAL_ERROR(boost::format("unrecognized DATASERIES_PACK_KERNELS %s;"
+                                      " expected {scalar,sse4.2,avx2}") % level);
+        }
+    }
+    for (int l = max_level; l > LevelScalar; --l) {
+        const Kernels *ret = kernels(static_cast<Level>(l));
+        if (ret != NULL) {
+            return ret;
+        }
+    }
+    return &scalar_kernels;
+}
+
+// Chosen lazily rather than during static initialization so that
+// extents packed from other static constructors still work.  Compress
+// tasks, unpack tasks and opener threads all call kernels(), so the
+// choice is made once under pthread_once and setLevel() replaces it
+// with an atomic store; the kernel tables themselves are immutable.
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+static const Kernels *current_kernels = NULL;
+
+static void initKernels() {
+    __atomic_store_n(&current_kernels, chooseKernels(), __ATOMIC_RELEASE);
+}
+
+const Kernels &kernels() {
+    const Kernels *ret = __atomic_load_n(&current_kernels, __ATOMIC_ACQUIRE);
+    if (ret == NULL) {
+        pthread_once(&kernels_once, initKernels);
+        ret = __atomic_load_n(&current_kernels, __ATOMIC_ACQUIRE);
+    }
+    return *ret;
+}
+
+bool setLevel(Level level) {
+    const Kernels *k = kernels(level);
+    if (k == NULL) {
+        return false;
+    }
+    // Finish any lazy choice first so it can not overwrite this one.
+    pthread_once(&kernels_once, initKernels);
+    __atomic_store_n(&current_kernels, k, __ATOMIC_RELEASE);
+    return true;
+}
+
+} }
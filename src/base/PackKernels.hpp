@@ -0,0 +1,130 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Column-at-a-time kernels used by Extent::packData and Extent::unpackData.
+
+    Each kernel walks one field of every record in a fixed data buffer
+    (records are @c stride bytes apart), replacing the per-record
+    switch on the field type.  The byte swap of contiguous buffers, the
+    pack_bitwidth unpacking and the CRC32C used for the DSv2 extent
+    checksums have sse4.2 and avx2 variants, and the best one supported
+    by the cpu is chosen at run time; the other kernels are scalar at
+    every level.  Every variant produces byte-identical results.
+*/
+
+#ifndef DATASERIES_PACK_KERNELS_HPP
+#define DATASERIES_PACK_KERNELS_HPP
+
+#include <stddef.h>
+#include <inttypes.h>
+
+namespace dataseries { namespace pack_kernels {
+
+typedef uint8_t byte;
+
+enum Level { LevelScalar, LevelSSE42, LevelAVX2 };
+
+// For all of the kernels, col points at the field in the first record;
+// nulls, if not NULL, points at the byte holding the field's null bit
+// in the first record, and null_mask selects the bit.  Null fields
+// are skipped by the relative packing kernels.
+struct Kernels {
+    Level level;
+    const char *name;
+
+    void (*flip4)(byte *col, size_t stride, uint32_t nrecords);
+    void (*flip8)(byte *col, size_t stride, uint32_t nrecords);
+    void (*flip4Contiguous)(uint32_t *buf, size_t buflen);
+
+    void (*zeroNulls1)(byte *col, const byte *nulls, int null_mask,
+                       size_t stride, uint32_t nrecords);
+    void (*zeroNulls4)(byte *col, const byte *nulls, int null_mask,
+                       size_t stride, uint32_t nrecords);
+    void (*zeroNulls8)(byte *col, const byte *nulls, int null_mask,
+                       size_t stride, uint32_t nrecords);
+
+    void (*selfRelativeEncodeInt32)(byte *col, const byte *nulls, int null_mask,
+                                    size_t stride, uint32_t nrecords);
+    void (*selfRelativeEncodeInt64)(byte *col, const byte *nulls, int null_mask,
+                                    size_t stride, uint32_t nrecords);
+    void (*selfRelativeEncodeDouble)(byte *col, const byte *nulls, int null_mask,
+                                     size_t stride, uint32_t nrecords);
+    void (*selfRelativeDecodeInt32)(byte *col, const byte *nulls, int null_mask,
+                                    size_t stride, uint32_t nrecords);
+    void (*selfRelativeDecodeInt64)(byte *col, const byte *nulls, int null_mask,
+                                    size_t stride, uint32_t nrecords);
+    void (*selfRelativeDecodeDouble)(byte *col, const byte *nulls, int null_mask,
+                                     size_t stride, uint32_t nrecords,
+                                     double multiplier, double scale);
+
+    void (*otherRelativeEncodeInt32)(byte *col, const byte *base_col, const byte *nulls,
+                                     int null_mask, size_t stride, uint32_t nrecords);
+    void (*otherRelativeEncodeInt64)(byte *col, const byte *base_col, const byte *nulls,
+                                     int null_mask, size_t stride, uint32_t nrecords);
+    void (*otherRelativeEncodeDouble)(byte *col, const byte *base_col, const byte *nulls,
+                                      int null_mask, size_t stride, uint32_t nrecords);
+    void (*otherRelativeDecodeInt32)(byte *col, const byte *base_col, const byte *nulls,
+                                     int null_mask, size_t stride, uint32_t nrecords);
+    void (*otherRelativeDecodeInt64)(byte *col, const byte *base_col, const byte *nulls,
+                                     int null_mask, size_t stride, uint32_t nrecords);
+    void (*otherRelativeDecodeDouble)(byte *col, const byte *base_col, const byte *nulls,
+                                      int null_mask, size_t stride, uint32_t nrecords);
+
+    /// Replaces each value with round(value * multiplier); returns the
+    /// index of the first record whose rounding error exceeded 10%
+    /// (storing its original value in *bad_value), or nrecords if none did.
+    uint32_t (*scaleEncode)(byte *col, size_t stride, uint32_t nrecords,
+                            double multiplier, double *bad_value);
+    void (*scaleDecode)(byte *col, size_t stride, uint32_t nrecords, double scale);
+
+    /// Frame-of-reference bit-packing of a byte, int32 or int64 column:
+    /// each value is stored as value - reference in width bits, packed
+    /// from the low bit up into consecutive 64-bit words.  bitPack uses
+    /// the smallest value as the reference, fills in
+    /// bitPackedWords(nrecords, width) words of out and returns the
+    /// width, which is 0 if all the values are the same.
+    unsigned (*bitPack1)(const byte *col, size_t stride, uint32_t nrecords,
+                         int64_t *reference, uint64_t *out);
+    unsigned (*bitPack4)(const byte *col, size_t stride, uint32_t nrecords,
+                         int64_t *reference, uint64_t *out);
+    unsigned (*bitPack8)(const byte *col, size_t stride, uint32_t nrecords,
+                         int64_t *reference, uint64_t *out);
+    void (*bitUnpack1)(const uint64_t *in, unsigned width, int64_t reference,
+                       byte *col, size_t stride, uint32_t nrecords);
+    void (*bitUnpack4)(const uint64_t *in, unsigned width, int64_t reference,
+                       byte *col, size_t stride, uint32_t nrecords);
+    void (*bitUnpack8)(const uint64_t *in, unsigned width, int64_t reference,
+                       byte *col, size_t stride, uint32_t nrecords);
+
+    /// Returns the CRC32C (Castagnoli) of buf continuing from crc, which
+    /// is 0 to start or the result of a previous call, as for zlib's crc32().
+    uint32_t (*crc32c)(uint32_t crc, const byte *buf, size_t len);
+};
+
+/// Returns the number of 64-bit words bitPack uses for nrecords values
+/// of width bits.
+inline size_t bitPackedWords(uint32_t nrecords, unsigned width) {
+    return (static_cast<uint64_t>(nrecords) * width + 63) / 64;
+}
+
+/// Returns the kernels for the current level; the first call picks the
+/// best level supported by the cpu, which can be lowered by setting
+/// DATASERIES_PACK_KERNELS to scalar, sse4.2 or avx2.
+const Kernels &kernels();
+
+/// Returns the kernels for a specific level, or NULL if the level was
+/// not compiled in or is not supported by the cpu.
+const Kernels *kernels(Level level);
+
+/// Switches the level used by kernels(); mostly useful for testing.
+/// Returns false, leaving the level alone, if it is unavailable.
+bool setLevel(Level level);
+
+} }
+
+#endif
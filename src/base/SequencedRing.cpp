@@ -0,0 +1,64 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    EventCount implementation
+*/
+
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+#include "SequencedRing.hpp"
+
+using boost::format;
+
+namespace dataseries {
+
+#ifdef __linux__
+
+void EventCount::wait(uint32_t key) {
+    // returns at once if a notify already moved epoch on
+    int ret = syscall(SYS_futex, &epoch, FUTEX_WAIT_PRIVATE, key, NULL, NULL, 0);
+    INVARIANT(ret == 0 || errno == EAGAIN || errno == EINTR,
+              format("futex wait failed: %s") % strerror(errno));
+    cancelWait();
+}
+
+void EventCount::wakeAll() {
+    __atomic_add_fetch(&epoch, 1, __ATOMIC_SEQ_CST);
+    int ret = syscall(SYS_futex, &epoch, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+    INVARIANT(ret >= 0, format("futex wake failed: %s") % strerror(errno));
+}
+
+#else
+
+void EventCount::wait(uint32_t key) {
+    {
+        PThreadScopedLock lock(mutex);
+        while (__atomic_load_n(&epoch, __ATOMIC_SEQ_CST) == key) {
+            cond.wait(mutex);
+        }
+    }
+    cancelWait();
+}
+
+void EventCount::wakeAll() {
+    __atomic_add_fetch(&epoch, 1, __ATOMIC_SEQ_CST);
+    PThreadScopedLock lock(mutex);
+    cond.broadcast();
+}
+
+#endif
+
+} // namespace dataseries
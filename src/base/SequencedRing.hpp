@@ -0,0 +1,236 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    A bounded lock-free ring that hands work from producers to workers
+    and on to a consumer in order; used by DataSeriesSink.
+*/
+
+#ifndef DATASERIES_SEQUENCED_RING_HPP
+#define DATASERIES_SEQUENCED_RING_HPP
+
+#include <inttypes.h>
+
+#include <boost/utility.hpp>
+
+#include <Lintel/LintelLog.hpp>
+#include <Lintel/PThread.hpp>
+
+namespace dataseries {
+
+/** Lets threads sleep until some condition, kept by the caller in atomic
+    variables, changes.  Waiting is a futex on linux, so notifying costs
+    nothing unless someone is asleep.  A waiter calls prepareWait(),
+    checks its condition, and then calls either cancelWait() or
+    wait(key); a notifier changes the condition and then calls
+    notifyAll(), so the wakeup can't be lost between the check and the
+    sleep. */
+class EventCount : boost::noncopyable {
+  public:
+    EventCount() : epoch(0), waiters(0) { }
+
+    uint32_t prepareWait() {
+        __atomic_add_fetch(&waiters, 1, __ATOMIC_SEQ_CST);
+        return __atomic_load_n(&epoch, __ATOMIC_SEQ_CST);
+    }
+    void cancelWait() {
+        __atomic_sub_fetch(&waiters, 1, __ATOMIC_SEQ_CST);
+    }
+    void wait(uint32_t key);
+    void notifyAll() {
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&waiters, __ATOMIC_SEQ_CST) != 0) {
+            wakeAll();
+        }
+    }
+
+  private:
+    void wakeAll();
+
+    uint32_t epoch, waiters;
+#ifndef __linux__
+    PThreadMutex mutex;
+    PThreadCond cond;
+#endif
+};
+
+/** \brief A bounded ring of work, kept in the order it was pushed.
+
+    Any number of threads push() items, each getting the next ticket,
+    and waiting while the ring is full.  Any number of workers claim()
+    the pushed items, in ticket order, and finish() them in any order.
+    One consumer takes the finished items off the front in ticket
+    order, so it sees them in the order they were pushed no matter
+    which worker finished first.
+
+    Each slot has a sequence number that says which ticket it holds
+    and how far along it is, as in Vyukov's bounded queue; the only
+    shared counters are the ticket, claim and front positions, so
+    there are no locks, and threads only sleep when the ring is full
+    or the front isn't finished. */
+template<typename T> class SequencedRing : boost::noncopyable {
+  public:
+    /** capacity is rounded up to a power of 2 */
+    explicit SequencedRing(unsigned capacity)
+        : mask(0), slots(NULL), back_pos(0), claim_pos(0), front_pos(0)
+    {
+        unsigned n = 1;
+        while (n < capacity) {
+            n *= 2;
+        }
+        mask = n - 1;
+        slots = new Slot[n];
+        for (unsigned i = 0; i < n; ++i) {
+            slots[i].seq = seq(i, st_empty);
+            slots[i].item = NULL;
+        }
+    }
+    ~SequencedRing() {
+        SINVARIANT(empty());
+        delete [] slots;
+    }
+
+    unsigned capacity() const { return mask + 1; }
+
+    /** Adds item at the back, waiting while the ring is full; returns
+        its ticket. */
+    uint64_t push(T *item) {
+        uint64_t ticket = __atomic_fetch_add(&back_pos, 1, __ATOMIC_SEQ_CST);
+        Slot &slot(slots[ticket & mask]);
+        while (load(slot) != seq(ticket, st_empty)) {
+            uint32_t key = space.prepareWait();
+            if (load(slot) == seq(ticket, st_empty)) {
+                space.cancelWait();
+                break;
+            }
+            space.wait(key);
+        }
+        slot.item = item;
+        __atomic_store_n(&slot.seq, seq(ticket, st_pushed), __ATOMIC_SEQ_CST);
+        return ticket;
+    }
+
+    /** Returns the oldest item nobody has claimed, or NULL if it hasn't
+        been pushed yet. */
+    T *claim(uint64_t &ticket) {
+        while (true) {
+            uint64_t next = __atomic_load_n(&claim_pos, __ATOMIC_SEQ_CST);
+            Slot &slot(slots[next & mask]);
+            if (load(slot) != seq(next, st_pushed)) {
+                return NULL;
+            }
+            if (__atomic_compare_exchange_n(&claim_pos, &next, next + 1, false,
+                                            __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+                ticket = next;
+                return slot.item;
+            }
+        }
+    }
+
+    bool hasUnclaimed() const {
+        uint64_t next = __atomic_load_n(&claim_pos, __ATOMIC_SEQ_CST);
+        return load(slots[next & mask]) == seq(next, st_pushed);
+    }
+
+    /** Marks a claimed item as done, so the consumer can take it. */
+    void finish(uint64_t ticket) {
+        Slot &slot(slots[ticket & mask]);
+        SINVARIANT(load(slot) == seq(ticket, st_pushed));
+        __atomic_store_n(&slot.seq, seq(ticket, st_finished), __ATOMIC_SEQ_CST);
+        if (ticket == front()) {
+            front_ready.notifyAll();
+        }
+    }
+
+    /** Returns the item with ticket if it has been pushed, finished or
+        not, and hasn't been popped, otherwise NULL.  The caller has to
+        keep the consumer from popping it while looking at it. */
+    T *get(uint64_t ticket) const {
+        const Slot &slot(slots[ticket & mask]);
+        uint64_t s = load(slot);
+        return s == seq(ticket, st_pushed) || s == seq(ticket, st_finished) ? slot.item : NULL;
+    }
+
+    /** Returns the item with ticket if it is finished, otherwise NULL. */
+    T *getFinished(uint64_t ticket) const {
+        const Slot &slot(slots[ticket & mask]);
+        return load(slot) == seq(ticket, st_finished) ? slot.item : NULL;
+    }
+
+    /** The consumer's position, and the ticket the next push will get. */
+    uint64_t front() const { return __atomic_load_n(&front_pos, __ATOMIC_SEQ_CST); }
+    uint64_t back() const { return __atomic_load_n(&back_pos, __ATOMIC_SEQ_CST); }
+    bool empty() const { return front() == back(); }
+
+    /** Consumer only: frees the n items at the front, which have to be
+        finished. */
+    void pop(unsigned n) {
+        uint64_t ticket = front();
+        for (unsigned i = 0; i < n; ++i, ++ticket) {
+            Slot &slot(slots[ticket & mask]);
+            SINVARIANT(load(slot) == seq(ticket, st_finished));
+            __atomic_store_n(&slot.seq, seq(ticket + capacity(), st_empty), __ATOMIC_SEQ_CST);
+        }
+        __atomic_store_n(&front_pos, ticket, __ATOMIC_SEQ_CST);
+        space.notifyAll();
+    }
+
+    /** Notified whenever items are popped, for waiting on something the
+        consumer does as it pops, like freeing memory. */
+    EventCount &popEvent() { return space; }
+
+    /** Consumer only: waits until the front item is finished or
+        keep_going, set with an atomic store, is false. */
+    void waitFront(const bool &keep_going) {
+        while (getFinished(front()) == NULL
+               && __atomic_load_n(&keep_going, __ATOMIC_SEQ_CST)) {
+            uint32_t key = front_ready.prepareWait();
+            if (getFinished(front()) != NULL
+                || !__atomic_load_n(&keep_going, __ATOMIC_SEQ_CST)) {
+                front_ready.cancelWait();
+                break;
+            }
+            front_ready.wait(key);
+        }
+    }
+
+    /** Wakes the consumer from waitFront(), e.g. after clearing
+        keep_going. */
+    void wakeConsumer() {
+        front_ready.notifyAll();
+    }
+
+  private:
+    enum State { st_empty = 0, st_pushed = 1, st_finished = 2 };
+
+    struct Slot {
+        uint64_t seq;
+        T *item;
+    };
+
+    static uint64_t seq(uint64_t ticket, State state) {
+        return ticket * 4 + state;
+    }
+    static uint64_t load(const Slot &slot) {
+        return __atomic_load_n(&slot.seq, __ATOMIC_SEQ_CST);
+    }
+
+    uint64_t mask;
+    Slot *slots;
+    // each on its own cache line, as different threads update them
+    char pad0[64];
+    uint64_t back_pos;
+    char pad1[64];
+    uint64_t claim_pos;
+    char pad2[64];
+    uint64_t front_pos;
+    EventCount space, front_ready;
+};
+
+} // namespace dataseries
+
+#endif
@@ -0,0 +1,52 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    StringDictionary implementation
+*/
+
+#include <limits>
+
+#include <DataSeries/StringDictionary.hpp>
+
+using namespace std;
+using boost::format;
+
+namespace dataseries {
+
+StringDictionary::StringDictionary() : written(1) {
+    values.push_back(string());
+    codes[string()] = 0;
+}
+
+int32_t StringDictionary::encode(const void *value, int32_t size) {
+    string v(static_cast<const char *>(value), size);
+    int32_t *code = codes.lookup(v);
+    if (code != NULL) {
+        return *code;
+    }
+    INVARIANT(values.size() < static_cast<size_t>(numeric_limits<int32_t>::max()),
+              "too many distinct values for a pack_dictionary field");
+    int32_t ret = values.size();
+    values.push_back(v);
+    codes[v] = ret;
+    return ret;
+}
+
+void StringDictionary::add(int32_t code, const string &value) {
+    INVARIANT(code > 0 && code <= size(),
+              format("dictionary entry %d is not the next one (%d)") % code % size());
+    if (code < size()) {
+        INVARIANT(values[code] == value, format("dictionary entry %d changed") % code);
+        return;
+    }
+    values.push_back(value);
+    codes[value] = code;
+    written = values.size();
+}
+
+} // namespace dataseries
@@ -0,0 +1,190 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    TaskPool implementation
+*/
+
+#include <stdlib.h>
+
+#include <algorithm>
+
+#include <boost/bind.hpp>
+#include <boost/format.hpp>
+
+#include <Lintel/StringUtil.hpp>
+
+#include <DataSeries/Extent.hpp>
+#include <DataSeries/TaskPool.hpp>
+
+using namespace std;
+using boost::format;
+
+namespace dataseries {
+
+int TaskPool::shared_threads = -1;
+TaskPool *TaskPool::shared_pool = NULL;
+static PThreadMutex shared_mutex;
+
+TaskPool::Queue::Queue(TaskPool &pool) : pool(pool), running(0), listed(false) { }
+
+TaskPool::Queue::~Queue() {
+    wait();
+    PThreadScopedLock lock(pool.mutex);
+    if (listed) { // runOne() emptied us before a worker got to us
+        pool.ready.erase(find(pool.ready.begin(), pool.ready.end(), this));
+    }
+}
+
+void TaskPool::Queue::submit(const Task &task) {
+    PThreadScopedLock lock(pool.mutex);
+    tasks.push_back(task);
+    if (!listed) {
+        listed = true;
+        pool.ready.push_back(this);
+    }
+    pool.ready_cond.signal();
+}
+
+bool TaskPool::Queue::runOne() {
+    PThreadScopedLock lock(pool.mutex);
+    if (tasks.empty()) {
+        return false;
+    }
+    Task task(tasks.front());
+    tasks.pop_front();
+    ++running;
+    {
+        PThreadScopedUnlock unlock(lock);
+        task();
+    }
+    --running;
+    if (tasks.empty() && running == 0) {
+        idle_cond.broadcast();
+    }
+    return true;
+}
+
+void TaskPool::Queue::wait() {
+    PThreadScopedLock lock(pool.mutex);
+    while (!tasks.empty() || running > 0) {
+        idle_cond.wait(pool.mutex);
+    }
+}
+
+TaskPool &TaskPool::shared() {
+    PThreadScopedLock lock(shared_mutex);
+    if (shared_pool == NULL) {
+        // Never deleted; sources and sinks in static objects may still be
+        // using it during exit.
+        shared_pool = new TaskPool(getSharedThreads());
+    }
+    return *shared_pool;
+}
+
+// The number of threads that setSharedThreads(nthreads) asks for, with
+// -1 meaning DATASERIES_THREADS or the number of cpus.
+static unsigned resolveThreads(int nthreads) {
+    if (nthreads > 0) {
+        return nthreads;
+    }
+    const char *env = getenv("DATASERIES_THREADS");
+    if (env != NULL) {
+        int ret = stringToInteger<int32_t>(env);
+        INVARIANT(ret > 0, format("invalid DATASERIES_THREADS=%s") % env);
+        return ret;
+    }
+    return min(PThreadMisc::getNCpus(), MAX_THREADS);
+}
+
+void TaskPool::setSharedThreads(int nthreads) {
+    INVARIANT(nthreads == -1 || nthreads > 0, format("invalid thread count %d") % nthreads);
+    PThreadScopedLock lock(shared_mutex);
+    if (shared_pool != NULL) {
+        unsigned requested = resolveThreads(nthreads);
+        INVARIANT(shared_pool->nThreads() == requested,
+                  format("can't change the shared pool from %d threads to %d once it has"
+                         " started") % shared_pool->nThreads() % requested);
+    }
+    shared_threads = nthreads;
+}
+
+unsigned TaskPool::getSharedThreads() {
+    return resolveThreads(shared_threads);
+}
+
+TaskPool::TaskPool(unsigned nthreads) : stopping(false) {
+    SINVARIANT(nthreads > 0);
+    for (unsigned i = 0; i < nthreads; ++i) {
+        threads.push_back(new PThreadFunction(boost::bind(&TaskPool::workerThread, this)));
+        threads.back()->start();
+    }
+}
+
+TaskPool::~TaskPool() {
+    mutex.lock();
+    INVARIANT(ready.empty(), "deleting a task pool with queued tasks");
+    stopping = true;
+    ready_cond.broadcast();
+    mutex.unlock();
+    for (vector<PThread *>::iterator i = threads.begin(); i != threads.end(); ++i) {
+        (**i).join();
+        delete *i;
+    }
+}
+
+void TaskPool::runAll(const vector<Task> &tasks) {
+    if (tasks.size() == 1) {
+        tasks[0]();
+        return;
+    }
+    Queue queue(*this);
+    for (vector<Task>::const_iterator i = tasks.begin(); i != tasks.end(); ++i) {
+        queue.submit(*i);
+    }
+    while (queue.runOne()) {
+        // help out rather than wait; tasks calling us then can't deadlock
+    }
+    queue.wait();
+}
+
+void TaskPool::workerThread() {
+    PThreadScopedLock lock(mutex);
+    while (true) {
+        if (ready.empty()) {
+            if (stopping) {
+                break;
+            }
+            ready_cond.wait(mutex);
+            continue;
+        }
+        Queue *queue = ready.front();
+        ready.pop_front();
+        queue->listed = false;
+        if (queue->tasks.empty()) {
+            continue; // runOne() got them
+        }
+        Task task(queue->tasks.front());
+        queue->tasks.pop_front();
+        ++queue->running;
+        if (!queue->tasks.empty()) {
+            // to the back, so the other queues get a turn first
+            queue->listed = true;
+            ready.push_back(queue);
+        }
+        {
+            PThreadScopedUnlock unlock(lock);
+            task();
+        }
+        --queue->running;
+        if (queue->tasks.empty() && queue->running == 0) {
+            queue->idle_cond.broadcast();
+        }
+    }
+}
+
+} // namespace dataseries
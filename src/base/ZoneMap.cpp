@@ -0,0 +1,211 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    ZoneMap implementation
+*/
+
+#include <DataSeries/DoubleField.hpp>
+#include <DataSeries/GeneralField.hpp>
+#include <DataSeries/Int32Field.hpp>
+#include <DataSeries/Int64Field.hpp>
+#include <DataSeries/Variable32Field.hpp>
+#include <DataSeries/ZoneMap.hpp>
+
+using namespace std;
+
+namespace dataseries {
+
+namespace {
+    template<typename T> void intRange(const Extent::byte *data, uint32_t record_size,
+                                       uint32_t nrecords, const Extent::byte *nulls,
+                                       Extent::byte null_mask, ZoneMap::Zone &zone) {
+        for (uint32_t i = 0; i < nrecords; ++i, data += record_size) {
+            if (nulls != NULL && (nulls[i * record_size] & null_mask)) {
+                ++zone.null_count;
+                continue;
+            }
+            int64_t v = *reinterpret_cast<const T *>(data);
+            if (!zone.have_values) {
+                zone.have_values = true;
+                zone.min_int = zone.max_int = v;
+            } else if (v < zone.min_int) {
+                zone.min_int = v;
+            } else if (v > zone.max_int) {
+                zone.max_int = v;
+            }
+        }
+    }
+
+    void doubleRange(const Extent::byte *data, uint32_t record_size, uint32_t nrecords,
+                     const Extent::byte *nulls, Extent::byte null_mask, ZoneMap::Zone &zone) {
+        for (uint32_t i = 0; i < nrecords; ++i, data += record_size) {
+            if (nulls != NULL && (nulls[i * record_size] & null_mask)) {
+                ++zone.null_count;
+                continue;
+            }
+            double v = *reinterpret_cast<const double *>(data);
+            if (v != v) {
+                continue; // NaN is in no range
+            }
+            if (!zone.have_values) {
+                zone.have_values = true;
+                zone.min_double = zone.max_double = v;
+            } else if (v < zone.min_double) {
+                zone.min_double = v;
+            } else if (v > zone.max_double) {
+                zone.max_double = v;
+            }
+        }
+    }
+}
+
+void ZoneMap::computeZones(const Extent &e, ExtentZones &zones) {
+    zones.clear();
+    const ExtentType &type(*e.getTypePtr());
+    uint32_t record_size = type.fixedrecordsize();
+    uint32_t nrecords = record_size == 0 ? 0 : e.fixeddata.size() / record_size;
+    for (uint32_t i = 0; i < type.getNFields(); ++i) {
+        const string &name(type.getFieldName(i));
+        ExtentType::fieldType field_type = type.getFieldType(name);
+        if (field_type != ExtentType::ft_byte && field_type != ExtentType::ft_int32
+            && field_type != ExtentType::ft_int64 && field_type != ExtentType::ft_double) {
+            continue;
+        }
+        const Extent::byte *data = e.fixeddata.begin() + type.getOffset(name);
+        const Extent::byte *nulls = NULL;
+        Extent::byte null_mask = 0;
+        if (type.getNullable(name)) {
+            const string null_name(ExtentType::nullableFieldname(name));
+            nulls = e.fixeddata.begin() + type.getOffset(null_name);
+            null_mask = 1 << type.getBitPos(null_name);
+        }
+
+        zones.push_back(Zone());
+        Zone &zone(zones.back());
+        zone.field = name;
+        switch (field_type) {
+            case ExtentType::ft_byte:
+                intRange<uint8_t>(data, record_size, nrecords, nulls, null_mask, zone);
+                break;
+            case ExtentType::ft_int32:
+                intRange<int32_t>(data, record_size, nrecords, nulls, null_mask, zone);
+                break;
+            case ExtentType::ft_int64:
+                intRange<int64_t>(data, record_size, nrecords, nulls, null_mask, zone);
+                break;
+            default:
+                zone.is_double = true;
+                doubleRange(data, record_size, nrecords, nulls, null_mask, zone);
+                // The zones are taken before packing, which rounds
+                // pack_scale fields to multiples of the scale, so a value
+                // can read back up to half a step outside of them.
+                if (zone.have_values && type.getPackScale(name) > 0) {
+                    zone.min_double -= type.getPackScale(name);
+                    zone.max_double += type.getPackScale(name);
+                }
+                break;
+        }
+    }
+}
+
+void ZoneMap::appendZones(ExtentSeries &series, int64_t offset, const ExtentZones &zones) {
+    Int64Field extent_offset(series, "offset");
+    Variable32Field field(series, "field");
+    Int64Field min_int(series, "min_int", Field::flag_nullable);
+    Int64Field max_int(series, "max_int", Field::flag_nullable);
+    DoubleField min_double(series, "min_double", Field::flag_nullable);
+    DoubleField max_double(series, "max_double", Field::flag_nullable);
+    Int32Field null_count(series, "null_count");
+
+    for (ExtentZones::const_iterator i = zones.begin(); i != zones.end(); ++i) {
+        series.newRecord();
+        extent_offset.set(offset);
+        field.set(i->field);
+        min_int.setNull();
+        max_int.setNull();
+        min_double.setNull();
+        max_double.setNull();
+        if (i->have_values && i->is_double) {
+            min_double.set(i->min_double);
+            max_double.set(i->max_double);
+        } else if (i->have_values) {
+            min_int.set(i->min_int);
+            max_int.set(i->max_int);
+        }
+        null_count.set(i->null_count);
+    }
+}
+
+void ZoneMap::add(const Extent::Ptr &e) {
+    ExtentSeries series(e);
+    Int64Field extent_offset(series, "offset");
+    Variable32Field field(series, "field");
+    Int64Field min_int(series, "min_int", Field::flag_nullable);
+    Int64Field max_int(series, "max_int", Field::flag_nullable);
+    DoubleField min_double(series, "min_double", Field::flag_nullable);
+    DoubleField max_double(series, "max_double", Field::flag_nullable);
+    Int32Field null_count(series, "null_count");
+
+    for (; series.morerecords(); ++series) {
+        ExtentZones &zones(extent_zones[extent_offset.val()]);
+        zones.push_back(Zone());
+        Zone &zone(zones.back());
+        zone.field = field.stringval();
+        if (!min_double.isNull()) {
+            zone.have_values = zone.is_double = true;
+            zone.min_double = min_double.val();
+            zone.max_double = max_double.val();
+        } else if (!min_int.isNull()) {
+            zone.have_values = true;
+            zone.min_int = min_int.val();
+            zone.max_int = max_int.val();
+        }
+        zone.null_count = null_count.val();
+    }
+}
+
+const ZoneMap::Zone *ZoneMap::find(int64_t offset, const string &field) const {
+    map<int64_t, ExtentZones>::const_iterator i = extent_zones.find(offset);
+    if (i == extent_zones.end()) {
+        return NULL;
+    }
+    for (ExtentZones::const_iterator j = i->second.begin(); j != i->second.end(); ++j) {
+        if (j->field == field) {
+            return &*j;
+        }
+    }
+    return NULL;
+}
+
+namespace {
+    bool isInteger(const GeneralValue &v) {
+        return v.getType() == ExtentType::ft_byte || v.getType() == ExtentType::ft_int32
+            || v.getType() == ExtentType::ft_int64;
+    }
+}
+
+bool ZoneMap::mayOverlap(int64_t offset, const string &field,
+                         const GeneralValue &min, const GeneralValue &max,
+                         bool nulls_match) const {
+    const Zone *zone = find(offset, field);
+    if (zone == NULL || (nulls_match && zone->null_count > 0)) {
+        return true;
+    } else if (!zone->have_values) {
+        return false;
+    } else if (!zone->is_double && isInteger(min) && isInteger(max)) {
+        return zone->min_int <= max.valInt64() && min.valInt64() <= zone->max_int;
+    } else if (!zone->is_double) {
+        // compared as doubles, which rounds int64 values beyond 2^53
+        return static_cast<double>(zone->min_int) <= max.valDouble()
+            && min.valDouble() <= static_cast<double>(zone->max_int);
+    } else {
+        return zone->min_double <= max.valDouble() && min.valDouble() <= zone->max_double;
+    }
+}
+
+} // namespace dataseries
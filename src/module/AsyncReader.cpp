@@ -0,0 +1,208 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    AsyncReader implementations
+*/
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <boost/bind.hpp>
+
+#include <Lintel/Deque.hpp>
+#include <Lintel/LintelLog.hpp>
+#include <Lintel/PThread.hpp>
+
+#include <DataSeries/Extent.hpp>
+
+#include "AsyncReader.hpp"
+#include "base/IoUring.hpp"
+
+#if (_FILE_OFFSET_BITS == 64 && !defined(_LARGEFILE64_SOURCE)) || defined(__CYGWIN__)
+#define pread64 pread
+#endif
+
+using namespace std;
+using boost::format;
+
+namespace dataseries {
+
+AsyncReader::AsyncReader(unsigned max_in_flight)
+    : max_in_flight(max_in_flight), in_flight(0)
+{
+    SINVARIANT(max_in_flight > 0);
+}
+
+AsyncReader::~AsyncReader() { }
+
+// Reads with a thread per read in flight, each doing a blocking pread.
+class PReadPool : public AsyncReader {
+  public:
+    PReadPool(unsigned max_in_flight) : AsyncReader(max_in_flight), stopping(false) {
+        for (unsigned i = 0; i < max_in_flight; ++i) {
+            threads.push_back(new PThreadFunction(boost::bind(&PReadPool::readThread, this)));
+            threads.back()->setStackSize(64*1024); // only calls pread
+            threads.back()->start();
+        }
+    }
+
+    virtual ~PReadPool() {
+        mutex.lock();
+        stopping = true;
+        todo_cond.broadcast();
+        mutex.unlock();
+        for (vector<PThread *>::iterator i = threads.begin(); i != threads.end(); ++i) {
+            (**i).join();
+            delete *i;
+        }
+    }
+
+    virtual void submit(Read *read) {
+        SINVARIANT(!full());
+        ++in_flight;
+        PThreadScopedLock lock(mutex);
+        todo.push_back(read);
+        todo_cond.signal();
+    }
+
+    virtual Read *wait() {
+        SINVARIANT(in_flight > 0);
+        PThreadScopedLock lock(mutex);
+        while (done.empty()) {
+            done_cond.wait(mutex);
+        }
+        Read *ret = done.front();
+        done.pop_front();
+        --in_flight;
+        return ret;
+    }
+
+    virtual const char *name() const { return "pread"; }
+
+  private:
+    void readThread() {
+        mutex.lock();
+        while (true) {
+            if (todo.empty()) {
+                if (stopping) {
+                    break;
+                }
+                todo_cond.wait(mutex);
+                continue;
+            }
+            Read *read = todo.front();
+            todo.pop_front();
+            mutex.unlock();
+            while (read->done < read->size) {
+                ssize_t ret = pread64(read->fd, read->into + read->done, read->size - read->done,
+                                      read->offset + read->done);
+                if (ret < 0 && errno == EINTR) {
+                    continue;
+                }
+                INVARIANT(ret > 0, format("error reading %d bytes at %d: %s")
+                          % (read->size - read->done) % (read->offset + read->done)
+                          % (ret == 0 ? "unexpected end of file" : strerror(errno)));
+                read->done += ret;
+            }
+            mutex.lock();
+            done.push_back(read);
+            done_cond.signal();
+        }
+        mutex.unlock();
+    }
+
+    PThreadMutex mutex;
+    PThreadCond todo_cond, done_cond;
+    Deque<Read *> todo, done;
+    vector<PThread *> threads;
+    bool stopping;
+};
+
+// Reads with io_uring; we only need readv.
+class IoUringReader : public AsyncReader {
+  public:
+    // returns NULL if the kernel won't give us a ring
+    static IoUringReader *make(unsigned max_in_flight) {
+        IoUring *ring = IoUring::make(max_in_flight);
+        return ring == NULL ? NULL : new IoUringReader(max_in_flight, ring);
+    }
+
+    virtual ~IoUringReader() {
+        SINVARIANT(in_flight == 0);
+        delete ring;
+    }
+
+    virtual void submit(Read *read) {
+        SINVARIANT(!full());
+        ++in_flight;
+        queue(read);
+    }
+
+    virtual Read *wait() {
+        SINVARIANT(in_flight > 0);
+        while (true) {
+            int res;
+            Read *read = static_cast<Read *>(ring->wait(res));
+            if (res == -EINTR || res == -EAGAIN) {
+                queue(read);
+                continue;
+            }
+            INVARIANT(res > 0, format("error reading %d bytes at %d: %s")
+                      % (read->size - read->done) % (read->offset + read->done)
+                      % (res == 0 ? "unexpected end of file" : strerror(-res)));
+            read->done += res;
+            if (read->done < read->size) {
+                queue(read); // short read, get the rest
+                continue;
+            }
+            --in_flight;
+            return read;
+        }
+    }
+
+    virtual const char *name() const { return "io_uring"; }
+
+  private:
+    IoUringReader(unsigned max_in_flight, IoUring *ring)
+        : AsyncReader(max_in_flight), ring(ring) { }
+
+    // Hands the kernel a readv of the part of read that isn't done.  There
+    // is always room: at most max_in_flight reads are ever queued.
+    void queue(Read *read) {
+        read->iov.iov_base = read->into + read->done;
+        read->iov.iov_len = read->size - read->done;
+        ring->submit(IoUring::op_readv, read->fd, &read->iov, 1, read->offset + read->done, read);
+    }
+
+    IoUring *ring;
+};
+
+
+AsyncReader *AsyncReader::make(unsigned max_in_flight) {
+    string engine(getenv("DATASERIES_READ_ENGINE") == NULL
+                  ? "" : getenv("DATASERIES_READ_ENGINE"));
+    INVARIANT(engine.empty() || engine == "pread" || engine == "io_uring",
+              format("unrecognized DATASERIES_READ_ENGINE %s; expected pread or io_uring")
+              % engine);
+    if (engine != "pread") {
+        AsyncReader *ret = IoUringReader::make(max_in_flight);
+        if (ret != NULL) {
+            return ret;
+        }
+    }
+    INVARIANT(engine != "io_uring", "DATASERIES_READ_ENGINE=io_uring, but io_uring is unavailable");
+    return new PReadPool(max_in_flight);
+}
+
+} // namespace dataseries
@@ -0,0 +1,75 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Reads byte ranges of files with many reads in flight; used by
+    IndexSourceModule to read compressed extents.
+*/
+
+#ifndef DATASERIES_ASYNC_READER_HPP
+#define DATASERIES_ASYNC_READER_HPP
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <inttypes.h>
+
+#include <boost/utility.hpp>
+
+namespace dataseries {
+
+/** Reads ranges of files asynchronously, with io_uring if the kernel
+    supports it, and with a pool of threads calling pread otherwise.  A
+    reader is not thread safe; submit() and wait() have to be called from
+    the same thread. */
+class AsyncReader : boost::noncopyable {
+  public:
+    struct Read {
+        int fd;
+        off64_t offset;
+        size_t size;
+        uint8_t *into;
+        void *arg; // for the caller
+
+        // used by the reader
+        size_t done;
+        struct iovec iov;
+
+        Read() : fd(-1), offset(0), size(0), into(NULL), arg(NULL), done(0) { }
+    };
+
+    /** Returns a reader that can have max_in_flight reads in flight.  Setting
+        the environment variable DATASERIES_READ_ENGINE to pread or io_uring
+        chooses the engine; io_uring is the default when it is available. */
+    static AsyncReader *make(unsigned max_in_flight);
+
+    virtual ~AsyncReader();
+
+    /** Starts reading read->size bytes at read->offset in read->fd into
+        read->into.  Invalid if full(). */
+    virtual void submit(Read *read) = 0;
+
+    /** Waits for one of the submitted reads to finish and returns it; aborts
+        if a read fails or hits the end of the file.  Invalid if
+        inFlight() == 0. */
+    virtual Read *wait() = 0;
+
+    /** "io_uring" or "pread" */
+    virtual const char *name() const = 0;
+
+    unsigned inFlight() const { return in_flight; }
+    bool full() const { return in_flight == max_in_flight; }
+
+  protected:
+    AsyncReader(unsigned max_in_flight);
+
+    const unsigned max_in_flight;
+    unsigned in_flight;
+};
+
+} // namespace dataseries
+
+#endif
@@ -43,6 +43,17 @@ class DefaultParser : public DSExprParser {
 
 //////////////////////////////////////////////////////////////////////
 
+DSExpr::FieldRanges DSExpr::impliedRanges(const string &expr_string) {
+    DSExprImpl::Driver driver;
+    driver.doit(expr_string);
+    boost::scoped_ptr<DSExpr> expr(driver.expr);
+    FieldRanges ret;
+    expr->getImpliedRanges(ret);
+    return ret;
+}
+
+//////////////////////////////////////////////////////////////////////
+
 class DefaultParserFactory : public DSExprParserFactory {
     DSExprParser *make() {
         return new DefaultParser();
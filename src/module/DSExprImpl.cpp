@@ -7,6 +7,7 @@
 #include "DSExprImpl.hpp"
 
 #include <ios>
+#include <math.h>
 
 #include <boost/format.hpp>
 
@@ -39,27 +40,35 @@ void DSExprImpl::ExprNumericConstant::dump(ostream &out) {
 
 //////////////////////////////////////////////////////////////////////
 
-DSExprImpl::ExprField::ExprField(ExtentSeries &series, const string &fieldname_)
-{ 
+namespace {
     // Allow for almost arbitrary fieldnames through escaping...
-    if (fieldname_.find('\\', 0) != string::npos) {
+    string unescapeFieldName(const string &fieldname) {
+        if (fieldname.find('\\', 0) == string::npos) {
+            return fieldname;
+        }
         string fixup;
-        fixup.reserve(fieldname_.size());
-        for (unsigned i=0; i<fieldname_.size(); ++i) {
-            if (fieldname_[i] == '\\') {
+        fixup.reserve(fieldname.size());
+        for (unsigned i=0; i<fieldname.size(); ++i) {
+            if (fieldname[i] == '\\') {
                 ++i;
-                INVARIANT(i < fieldname_.size(), "missing escaped value");
+                INVARIANT(i < fieldname.size(), "missing escaped value");
             }
-            fixup.push_back(fieldname_[i]);
+            fixup.push_back(fieldname[i]);
         }
-        field = GeneralField::create(NULL, series, fixup);
-        fieldname = fixup;
-    } else {
-        field = GeneralField::create(NULL, series, fieldname_);
-        fieldname = fieldname_;
+        return fixup;
     }
 }
 
+DSExprImpl::ExprField::ExprField(ExtentSeries &series, const string &fieldname_)
+        : fieldname(unescapeFieldName(fieldname_))
+{ 
+    field = GeneralField::create(NULL, series, fieldname);
+}
+
+DSExprImpl::ExprField::ExprField(const string &fieldname_)
+        : field(NULL), fieldname(unescapeFieldName(fieldname_))
+{ }
+
 void DSExprImpl::ExprField::dump(ostream &out) {
     out << format("{Field: %1%}") % fieldname;
 }
@@ -92,6 +101,61 @@ void DSExprImpl::ExprBinary::dump(ostream &out)
 
 //////////////////////////////////////////////////////////////////////
 
+namespace {
+    bool numericConstant(DSExpr *expr, double &val) {
+        DSExprImpl::ExprNumericConstant *constant 
+            = dynamic_cast<DSExprImpl::ExprNumericConstant *>(expr);
+        if (constant != NULL) {
+            val = constant->value();
+            return true;
+        }
+        DSExprImpl::ExprMinus *minus = dynamic_cast<DSExprImpl::ExprMinus *>(expr);
+        if (minus != NULL && numericConstant(minus->getSubexpr(), val)) {
+            val = -val;
+            return true;
+        }
+        return false;
+    }
+}
+
+void DSExprImpl::impliedRange(DSExpr *left, comparison_t cmp, DSExpr *right,
+                              DSExpr::FieldRanges &ranges) {
+    ExprField *field = dynamic_cast<ExprField *>(left);
+    double val;
+    if (field != NULL && numericConstant(right, val)) {
+        // field <cmp> val
+    } else if ((field = dynamic_cast<ExprField *>(right)) != NULL
+               && numericConstant(left, val)) {
+        // val <cmp> field, so flip the comparison
+        switch (cmp) {
+            case cmp_lt: cmp = cmp_gt; break;
+            case cmp_gt: cmp = cmp_lt; break;
+            case cmp_leq: cmp = cmp_geq; break;
+            case cmp_geq: cmp = cmp_leq; break;
+            default: break;
+        }
+    } else {
+        return;
+    }
+    if (field->getType() == DSExpr::t_String) {
+        return; // compared as strings
+    }
+
+    // Double::eq and friends may compare with a tolerance, so the ranges
+    // are inclusive and a little wider; they only have to contain every
+    // value for which the comparison is true.
+    double slack = (fabs(val) + 1) * 1.0e-9;
+    double min = -Double::Inf, max = Double::Inf;
+    switch (cmp) {
+        case cmp_eq: min = val - slack; max = val + slack; break;
+        case cmp_lt: case cmp_leq: max = val + slack; break;
+        case cmp_gt: case cmp_geq: min = val - slack; break;
+    }
+    ranges.push_back(DSExpr::FieldRange(field->getFieldName(), min, max));
+}
+
+//////////////////////////////////////////////////////////////////////
+
 DSExprImpl::ExprStrLiteral::ExprStrLiteral(const string &l)
 {
     string fixup;
@@ -32,6 +32,8 @@ namespace DSExprImpl {
             return t_Numeric;
         }
 
+        double value() const { return val; }
+
         virtual double valDouble() { return val; }
         virtual int64_t valInt64() { return static_cast<int64_t>(val); }
         virtual bool valBool() { return val ? true : false; }
@@ -50,13 +52,21 @@ namespace DSExprImpl {
     class ExprField : public DSExpr {
       public:
         ExprField(ExtentSeries &series, const string &fieldname);
+
+        /// A field that isn't bound to a series, for expressions that are only analyzed; the
+        /// values can not be evaluated.
+        explicit ExprField(const string &fieldname);
         
         virtual ~ExprField() { 
             delete field;
         };
 
+        const string &getFieldName() const { return fieldname; }
+
         virtual expr_type_t getType() {
-            if (field->getType() == ExtentType::ft_variable32) {
+            if (field == NULL) {
+                return t_Unknown;
+            } else if (field->getType() == ExtentType::ft_variable32) {
                 return t_String;
             } else {
                 return t_Numeric;
@@ -126,6 +136,8 @@ namespace DSExprImpl {
             delete subexpr;
         }
 
+        DSExpr *getSubexpr() { return subexpr; }
+
         virtual void dump(ostream &out);
 
         virtual string opname() const {
@@ -167,6 +179,13 @@ namespace DSExprImpl {
         DSExpr *left, *right;
     };
 
+    typedef enum { cmp_eq, cmp_lt, cmp_gt, cmp_leq, cmp_geq } comparison_t;
+
+    /// Appends the range implied by left <cmp> right, if one side is a field and the other a
+    /// numeric constant.
+    void impliedRange(DSExpr *left, comparison_t cmp, DSExpr *right,
+                      DSExpr::FieldRanges &ranges);
+
     class ExprMinus : public ExprUnary {
       public:
         ExprMinus(DSExpr *subexpr)
@@ -317,6 +336,10 @@ namespace DSExprImpl {
             FATAL_ERROR("evaluating == as a string is not well defined");
         }
 
+        virtual void getImpliedRanges(FieldRanges &ranges) {
+            impliedRange(left, cmp_eq, right, ranges);
+        }
+
         virtual string opname() const { return string("=="); }
     };
 
@@ -375,6 +398,10 @@ namespace DSExprImpl {
             FATAL_ERROR("evaluating > as a string is not well defined");
         }
 
+        virtual void getImpliedRanges(FieldRanges &ranges) {
+            impliedRange(left, cmp_gt, right, ranges);
+        }
+
         virtual string opname() const { return string(">"); }
     };
 
@@ -402,6 +429,10 @@ namespace DSExprImpl {
             FATAL_ERROR("evaluating < as a string is not well defined");
         }
 
+        virtual void getImpliedRanges(FieldRanges &ranges) {
+            impliedRange(left, cmp_lt, right, ranges);
+        }
+
         virtual string opname() const { return string("<"); }
     };
 
@@ -431,6 +462,10 @@ namespace DSExprImpl {
             FATAL_ERROR("evaluating >= as a string is not well defined");
         }
 
+        virtual void getImpliedRanges(FieldRanges &ranges) {
+            impliedRange(left, cmp_geq, right, ranges);
+        }
+
         virtual string opname() const { return string(">="); }
     };
 
@@ -460,6 +495,10 @@ namespace DSExprImpl {
             FATAL_ERROR("evaluating <= as a string is not well defined");
         }
 
+        virtual void getImpliedRanges(FieldRanges &ranges) {
+            impliedRange(left, cmp_leq, right, ranges);
+        }
+
         virtual string opname() const { return string("<="); }
     };
 
@@ -508,6 +547,11 @@ namespace DSExprImpl {
             FATAL_ERROR("evaluating && as a string is not well defined");
         }
 
+        virtual void getImpliedRanges(FieldRanges &ranges) {
+            left->getImpliedRanges(ranges);
+            right->getImpliedRanges(ranges);
+        }
+
         virtual string opname() const { return string("&&"); }
     };
 
@@ -611,6 +655,12 @@ namespace DSExprImpl {
           current_fnargs() 
         { }
 
+        /// For expressions that are only analyzed; see ExprField(const string &).
+        Driver()
+        : expr(NULL), series(NULL), field_name_to_selector(), scanner_state(NULL),
+          current_fnargs()
+        { }
+
         Driver(const FieldNameToSelector &field_name_to_selector)
         : expr(NULL), series(NULL), field_name_to_selector(field_name_to_selector), 
           scanner_state(NULL), current_fnargs() 
@@ -619,7 +669,9 @@ namespace DSExprImpl {
         }
 
         ExprField *makeExprField(const string &field_name) {
-            if (series == NULL) {
+            if (series == NULL && !field_name_to_selector) {
+                return new ExprField(field_name);
+            } else if (series == NULL) {
                 Selector tmp = field_name_to_selector(field_name);
                 INVARIANT(tmp.first != NULL, format("field_name '%s' is not defined") % field_name);
                 return new ExprField(*tmp.first, tmp.second);
@@ -302,6 +302,19 @@ Extent::Ptr DStoTextModule::getSharedExtent() {
         return e;
     }
 
+    if (print_index == false && (e->type == ExtentType::getDataSeriesZoneMapTypePtr()
+                                 || e->type == ExtentType::getDataSeriesBloomFilterTypePtr())) {
+        return e;
+    }
+
+    if (e->type == ExtentType::getDataSeriesCompressionDictionaryTypePtr()) {
+        return e; // binary, no point in printing it
+    }
+
+    if (e->type == ExtentType::getDataSeriesStringDictionaryTypePtr()) {
+        return e; // the values are printed in the extents that use them
+    }
+
     PerTypeState &state = type_to_state[e->type->getName()];
 
     state.series.setExtent(e);
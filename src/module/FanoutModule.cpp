@@ -0,0 +1,154 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    implementation
+*/
+
+#include <limits>
+
+#include <DataSeries/FanoutModule.hpp>
+
+using namespace std;
+
+// The head of a branch.
+class FanoutModule::BranchSource : public DataSeriesModule {
+  public:
+    BranchSource(FanoutModule &fanout, unsigned branch) : fanout(fanout), branch(branch) { }
+    virtual ~BranchSource() { }
+
+    virtual Extent::Ptr getSharedExtent() {
+        return fanout.nextExtent(branch);
+    }
+
+  private:
+    FanoutModule &fanout;
+    const unsigned branch;
+};
+
+class FanoutModule::BranchThread : public PThread {
+  public:
+    BranchThread(FanoutModule &fanout, unsigned branch) : fanout(fanout), branch(branch) { }
+
+    virtual void *run() {
+        fanout.branches[branch]->getAndDeleteShared();
+        fanout.finishBranch(branch);
+        return NULL;
+    }
+
+  private:
+    FanoutModule &fanout;
+    const unsigned branch;
+};
+
+FanoutModule::FanoutModule(DataSeriesModule &source, unsigned max_lag)
+    : source(source), max_lag(max_lag), first_seq(0), source_done(false)
+{
+    INVARIANT(max_lag > 0, "max_lag has to be at least 1");
+}
+
+FanoutModule::~FanoutModule() {
+    finishBranches();
+    for (vector<SequenceModule *>::reverse_iterator i = branches.rbegin();
+         i != branches.rend(); ++i) {
+        delete *i;
+    }
+}
+
+SequenceModule &FanoutModule::addBranch() {
+    INVARIANT(threads.empty() && !source_done, "can't add a branch once the fanout has started");
+    SequenceModule *branch = new SequenceModule(new BranchSource(*this, branches.size()));
+    branches.push_back(branch);
+    next.push_back(first_seq);
+    return *branch;
+}
+
+Extent::Ptr FanoutModule::getSharedExtent() {
+    if (threads.empty() && !source_done) {
+        for (unsigned i = 0; i < branches.size(); ++i) {
+            threads.push_back(new BranchThread(*this, i));
+            threads.back()->start();
+        }
+    }
+    Extent::Ptr e = source.getSharedExtent();
+    if (e == NULL) {
+        finishBranches();
+        return e;
+    }
+    if (!branches.empty()) {
+        PThreadScopedLock lock(mutex);
+        // window starts at the slowest branch, so its size is the lag
+        while (window.size() >= max_lag) {
+            cond.wait(mutex);
+        }
+        window.push_back(e);
+        trimWindow(); // nothing is left to read it if all the branches stopped early
+        cond.broadcast();
+    }
+    return e;
+}
+
+Extent::Ptr FanoutModule::nextExtent(unsigned branch) {
+    PThreadScopedLock lock(mutex);
+    while (next[branch] == first_seq + window.size() && !source_done) {
+        cond.wait(mutex);
+    }
+    if (next[branch] == first_seq + window.size()) {
+        return Extent::Ptr();
+    }
+    Extent::Ptr ret = window[next[branch] - first_seq];
+    ++next[branch];
+    if (next[branch] == first_seq + 1) { // may have been the slowest
+        trimWindow();
+    }
+    return ret;
+}
+
+// A branch can stop before the end of the source, e.g. one that only
+// looks at the first few extents; it is then past every extent, so it
+// no longer holds back the window.
+void FanoutModule::finishBranch(unsigned branch) {
+    PThreadScopedLock lock(mutex);
+    next[branch] = numeric_limits<uint64_t>::max();
+    trimWindow();
+    cond.broadcast();
+}
+
+uint64_t FanoutModule::slowestBranch() const {
+    uint64_t ret = first_seq + window.size();
+    for (vector<uint64_t>::const_iterator i = next.begin(); i != next.end(); ++i) {
+        ret = min(ret, *i);
+    }
+    return ret;
+}
+
+// Drops the extents every branch has read; called with mutex held.
+void FanoutModule::trimWindow() {
+    uint64_t slowest = slowestBranch();
+    if (slowest == first_seq) {
+        return;
+    }
+    while (first_seq < slowest) {
+        window.pop_front();
+        ++first_seq;
+    }
+    cond.broadcast();
+}
+
+void FanoutModule::finishBranches() {
+    {
+        PThreadScopedLock lock(mutex);
+        source_done = true;
+        cond.broadcast();
+    }
+    for (vector<BranchThread *>::iterator i = threads.begin(); i != threads.end(); ++i) {
+        (**i).join();
+        delete *i;
+    }
+    threads.clear();
+    SINVARIANT(window.empty());
+}
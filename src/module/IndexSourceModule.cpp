@@ -11,53 +11,111 @@
 
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 
+#include <boost/bind.hpp>
+
 #include <Lintel/LintelLog.hpp>
 #include <Lintel/PThread.hpp>
 
 #include <DataSeries/IndexSourceModule.hpp>
 
+#include "AsyncReader.hpp"
+
+#ifdef __CYGWIN__
+#define O_LARGEFILE 0
+#endif
+
 using namespace std;
 using boost::format;
+using dataseries::AsyncReader;
+
+// The file the compressed prefetch thread reads from; the reads have their
+// own descriptor since the sub-classes delete their DataSeriesSource as soon
+// as they are done getting extents from it.
+struct IndexSourceModule::ReadFile : boost::noncopyable {
+    const string filename;
+    int fd;
+
+    ReadFile(const string &filename) : filename(filename) {
+        fd = open(filename.c_str(), O_RDONLY | O_LARGEFILE);
+        INVARIANT(fd >= 0, format("error opening file '%s' for read: %s")
+                  % filename % strerror(errno));
+    }
 
-class IndexSourceModuleCompressedPrefetchThread : public PThread {
-  public:
-    IndexSourceModuleCompressedPrefetchThread(IndexSourceModule &_ism)
-    : ism(_ism) { 
-        setStackSize(256*1024); // shouldn't need much
+    ~ReadFile() {
+        CHECKED(::close(fd) == 0, format("close failed: %s") % strerror(errno));
     }
+};
 
-    virtual ~IndexSourceModuleCompressedPrefetchThread() { }
+// One asynchronous read of one or more adjacent compressed extents.  The
+// extents' bytes borrow their parts of the buffer, which is freed once
+// they have all been unpacked; self keeps us around while the read is in
+// flight.
+struct IndexSourceModule::CompressedRead : public Extent::ByteArray::Owner {
+    AsyncReader::Read read;
+    boost::shared_ptr<ReadFile> file;
+    vector<PrefetchExtent *> extents;
+    Extent::byte *buffer;
+    Extent::ByteArray::OwnerPtr self;
+
+    CompressedRead(const boost::shared_ptr<ReadFile> &file, off64_t offset)
+        : file(file), buffer(NULL) {
+        read.fd = file->fd;
+        read.offset = offset;
+        read.arg = this;
+    }
 
-    virtual void *run() {
-        ism.compressedPrefetchThread();
-        return NULL;
+    virtual ~CompressedRead() {
+        delete [] buffer;
+    }
+
+    bool adjacent(const PrefetchExtent *p) const {
+        return p->extent_source == file->filename
+            && p->extent_source_offset == static_cast<int64_t>(read.offset + read.size);
     }
-    IndexSourceModule &ism;
 };
 
-class IndexSourceModuleUnpackThread : public PThread {
+class IndexSourceModuleCompressedPrefetchThread : public PThread {
   public:
-    IndexSourceModuleUnpackThread(IndexSourceModule &_ism)
+    IndexSourceModuleCompressedPrefetchThread(IndexSourceModule &_ism)
     : ism(_ism) { 
         setStackSize(256*1024); // shouldn't need much
     }
 
-    virtual ~IndexSourceModuleUnpackThread() { }
+    virtual ~IndexSourceModuleCompressedPrefetchThread() { }
 
     virtual void *run() {
-        ism.unpackThread();
+        ism.compressedPrefetchThread();
         return NULL;
     }
     IndexSourceModule &ism;
 };
 
 IndexSourceModule::IndexSourceModule()
-        : getting_extent(false), prefetch(NULL)
+        : getting_extent(false), max_reads_in_flight(8), prefetch(NULL)
 {
 }
 
+IndexSourceModule::PrefetchInfo::~PrefetchInfo() {
+    SINVARIANT(next_read == NULL && unpacking == 0);
+    delete reader;
+    delete unpack_queue; // waits for the last unpack task to return
+}
+
+void IndexSourceModule::setMaxReadsInFlight(unsigned max_reads) {
+    INVARIANT(prefetch == NULL, "can't change reads in flight after prefetching starts");
+    SINVARIANT(max_reads > 0);
+    max_reads_in_flight = max_reads;
+}
+
+void IndexSourceModule::setColumns(const vector<string> &new_columns) {
+    INVARIANT(prefetch == NULL, "can't change the columns after prefetching starts");
+    columns = new_columns;
+}
+
 IndexSourceModule::~IndexSourceModule() {
     INVARIANT(prefetch == NULL || isClosed(),
               "Must either have never read data or be done reading data");
@@ -79,18 +137,18 @@ IndexSourceModule::startPrefetching(unsigned prefetch_max_compressed,
     tmp->mutex.lock();
     prefetch = tmp;
 
-    unsigned unpack_count;
+    tmp->unpack_queue = new dataseries::TaskPool::Queue();
     if (n_unpack_threads == -1) {
-        unpack_count = min(PThreadMisc::getNCpus(), MAX_THREADS/2);
+        tmp->max_unpacking = dataseries::TaskPool::shared().nThreads();
     } else {
         // TODO: Add support (and test) for 0 unpack threads which should
         // disable all of the prefetching.
         SINVARIANT(n_unpack_threads > 0);
-        unpack_count = static_cast<unsigned>(n_unpack_threads);
+        tmp->max_unpacking = static_cast<unsigned>(n_unpack_threads);
     } 
-
-    INVARIANT(unpack_count > 0, "?");
-    tmp->unpack_threads.resize(unpack_count);
+    tmp->reader = AsyncReader::make(max_reads_in_flight);
+    // Spread the compressed budget over the reads in flight
+    tmp->max_read_size = max(prefetch_max_compressed / max_reads_in_flight, 64U * 1024);
     INVARIANT(prefetch == tmp, "two simulataneous calls to startPrefetching??");
     lockedStartThreads();
     tmp->mutex.unlock();
@@ -101,10 +159,6 @@ void IndexSourceModule::lockedStartThreads() {
     prefetch->compressed_prefetch_thread = 
             new IndexSourceModuleCompressedPrefetchThread(*this);
     prefetch->compressed_prefetch_thread->start();
-    for (unsigned i = 0; i < prefetch->unpack_threads.size(); ++i) {
-        prefetch->unpack_threads[i] = new IndexSourceModuleUnpackThread(*this);
-        prefetch->unpack_threads[i]->start();
-    }
 }
 
 static inline double 
@@ -125,7 +179,6 @@ Extent::Ptr IndexSourceModule::getSharedExtent() {
     while (!prefetch->allDone() &&
           !prefetch->unpackedReady()) {
         ++prefetch->stats.consumer;
-        prefetch->unpack_cond.broadcast();
         prefetch->ready_cond.wait(prefetch->mutex);
     }
     if (prefetch->allDone()) {
@@ -139,12 +192,7 @@ Extent::Ptr IndexSourceModule::getSharedExtent() {
     PrefetchExtent *buf = prefetch->unpacked.getFront();
     SINVARIANT(buf->bytes.empty() && buf->unpacked != NULL);
     prefetch->unpacked.subtract(buf->unpacked->size());
-    if (!prefetch->compressed.empty() &&
-        prefetch->unpacked.can_add(prefetch->compressed.front())) {
-        prefetch->unpack_cond.signal();
-    } else {
-        ++prefetch->stats.skip_unpack_signal;
-    }
+    lockedStartUnpacks();
     prefetch->mutex.unlock();
 
     Extent::Ptr ret = buf->unpacked;
@@ -168,6 +216,7 @@ void IndexSourceModule::resetPos() {
     prefetch->source_done = false;
     SINVARIANT(prefetch->abort_prefetching == 0);
     lockedStartThreads();
+    prefetch->mutex.unlock();
 }
 
 void IndexSourceModule::close() {
@@ -180,10 +229,9 @@ void IndexSourceModule::close() {
         return;
     }
     if (prefetch->abort_prefetching == 0) {
-        //                          me + compressed_prefetch + unpackers
-        prefetch->abort_prefetching = 2 + prefetch->unpack_threads.size();
+        //                          me + compressed_prefetch
+        prefetch->abort_prefetching = 2;
         prefetch->compressed_cond.broadcast();
-        prefetch->unpack_cond.broadcast();
         prefetch->ready_cond.broadcast();
 
         while (prefetch->abort_prefetching > 1) {
@@ -193,11 +241,9 @@ void IndexSourceModule::close() {
         prefetch->compressed_prefetch_thread->join();
         delete prefetch->compressed_prefetch_thread;
         prefetch->compressed_prefetch_thread = NULL;
-        for (vector<PThread *>::iterator i = prefetch->unpack_threads.begin();
-            i != prefetch->unpack_threads.end(); ++i) {
-            (**i).join();
-            delete *i;
-            *i = NULL;
+        // no more unpacks start once we are aborting
+        while (prefetch->unpacking > 0) {
+            prefetch->compressed_cond.wait(prefetch->mutex);
         }
         while (prefetch->compressed.empty() == false) {
             delete prefetch->compressed.getFront();
@@ -205,6 +251,7 @@ void IndexSourceModule::close() {
         while (prefetch->unpacked.empty() == false) {
             delete prefetch->unpacked.getFront();
         }
+        prefetch->read_file.reset();
         SINVARIANT(prefetch->abort_prefetching == 1);
         prefetch->abort_prefetching = 0;
         prefetch->compressed_cond.broadcast();
@@ -226,17 +273,7 @@ bool IndexSourceModule::isClosed() {
 }
 
 bool IndexSourceModule::lockedIsClosed() {
-    if (prefetch->compressed_prefetch_thread != NULL) {
-        return false;
-    } 
-
-    for (vector<PThread *>::iterator i = prefetch->unpack_threads.begin(); 
-         i != prefetch->unpack_threads.end(); ++i) {
-        if (*i != NULL) {
-            return false;
-        }
-    }
-    return true;
+    return prefetch->compressed_prefetch_thread == NULL && prefetch->unpacking == 0;
 }
 
 double 
@@ -270,10 +307,44 @@ IndexSourceModule::getWaitStats(WaitStats &stats)
     return true;
 }
 
+// Moves as many of the compressed extents as there is room for to the
+// unpacked queue, and hands them to the task pool to unpack.
+void IndexSourceModule::lockedStartUnpacks() {
+    bool started = false;
+    while (prefetch->abort_prefetching == 0 && prefetch->unpacking < prefetch->max_unpacking) {
+        if (!prefetch->compressedReady()) {
+            ++prefetch->stats.unpack_no_upstream;
+            break;
+        }
+        if (!prefetch->unpacked.can_add(prefetch->compressed.front())) {
+            ++prefetch->stats.unpack_downstream_full;
+            break;
+        }
+        PrefetchExtent *pe = prefetch->compressed.getFront();
+        prefetch->compressed.subtract(pe->bytes.size());
+        uint32_t unpacked_size = Extent::unpackedSize(pe->bytes, pe->need_bitflip, pe->type);
+        prefetch->unpacked.add(pe, unpacked_size);
+        ++prefetch->unpacking;
+        prefetch->stats.active_unpackers = prefetch->unpacking;
+        prefetch->stats.lockedUpdateActive();
+        prefetch->unpack_queue->submit(boost::bind(&IndexSourceModule::unpackTask, this,
+                                                   pe, unpacked_size));
+        started = true;
+    }
+    if (started) {
+        prefetch->compressed_cond.signal();
+    } else {
+        ++prefetch->stats.skip_unpack_signal;
+    }
+}
+
 void IndexSourceModule::compressedPrefetchThread() {
     prefetch->mutex.lock();
     while (prefetch->abort_prefetching == 0) {
-        if (!prefetch->source_done && prefetch->compressed.can_add(0)) {
+        // Each lockedGetCompressedExtent() submits at most one read, so
+        // checking for room first keeps us within max_reads_in_flight.
+        if (!prefetch->source_done && prefetch->compressed.can_add(0)
+            && !prefetch->reader->full()) {
             PrefetchExtent *p = lockedGetCompressedExtent();
             if (p == NULL) {
                 prefetch->source_done = true;
@@ -281,97 +352,122 @@ void IndexSourceModule::compressedPrefetchThread() {
             } else {
                 SINVARIANT(p->extent_source != Extent::in_memory_str &&
                            p->extent_source_offset > 0);
-                prefetch->compressed.add(p, p->bytes.size());
-                if (prefetch->unpacked.can_add(prefetch->compressed.front())) {
-                    prefetch->unpack_cond.signal();
-                } else {
-                    ++prefetch->stats.skip_unpack_signal;
-                }
+                prefetch->compressed.add(p, p->reading ? p->read_size : p->bytes.size());
+                lockedStartUnpacks();
             }
+        } else if (prefetch->next_read != NULL && !prefetch->reader->full()) {
+            lockedSubmitRead();
+        } else if (prefetch->reader->inFlight() > 0) {
+            lockedWaitForRead();
         } else {
             prefetch->compressed_cond.wait(prefetch->mutex);
         }
     }
+    // The extents of the unsubmitted read are in the compressed queue, which
+    // close() empties; the buffers of reads in flight have to stay until
+    // the reads finish.
+    delete prefetch->next_read;
+    prefetch->next_read = NULL;
+    while (prefetch->reader->inFlight() > 0) {
+        lockedWaitForRead();
+    }
     SINVARIANT(prefetch->abort_prefetching > 0);
     --prefetch->abort_prefetching;
     prefetch->compressed_cond.broadcast();
     prefetch->mutex.unlock();
 }
 
-void IndexSourceModule::unpackThread() {
-    prefetch->mutex.lock();
-    ++prefetch->stats.active_unpackers;
-    while (prefetch->abort_prefetching == 0) {
-        if (prefetch->compressed.data.empty() || 
-            !prefetch->unpacked.can_add(prefetch->compressed.front())) {
-            --prefetch->stats.active_unpackers;
-            if (prefetch->compressed.data.empty()) {
-                ++prefetch->stats.unpack_no_upstream;
-            } else {
-                ++prefetch->stats.unpack_downstream_full;
-            }
-            prefetch->unpack_cond.wait(prefetch->mutex);
-            ++prefetch->stats.active_unpackers;
-        }
-        
-        if (prefetch->abort_prefetching > 0) {
-            break;
+void IndexSourceModule::lockedAddToRead(PrefetchExtent *p) {
+    CompressedRead *read = prefetch->next_read;
+    if (read != NULL && (!read->adjacent(p) 
+                         || read->read.size + p->read_size > prefetch->max_read_size)) {
+        lockedSubmitRead();
+        read = NULL;
+    }
+    if (read == NULL) {
+        if (prefetch->read_file == NULL || prefetch->read_file->filename != p->extent_source) {
+            prefetch->read_file.reset(new ReadFile(p->extent_source));
         }
+        read = prefetch->next_read
+             = new CompressedRead(prefetch->read_file, p->extent_source_offset);
+    }
+    read->extents.push_back(p);
+    read->read.size += p->read_size;
+}
 
-        prefetch->stats.lockedUpdateActive();
-        if (!prefetch->compressed.data.empty() &&
-            prefetch->unpacked.can_add(prefetch->compressed.front())) {
-            PrefetchExtent *pe = prefetch->compressed.getFront();
-            prefetch->compressed.subtract(pe->bytes.size());
-            uint32_t unpacked_size 
-                    = Extent::unpackedSize(pe->bytes, pe->need_bitflip,pe->type);
-            prefetch->unpacked.add(pe, unpacked_size);
-            prefetch->compressed_cond.signal();
-            bool should_yield; 
-            if (prefetch->unpackedReady()) {
-                // For small extents, almost equivalent to just having the
-                // next condition, but not equivalent with large extents.
-                // really want a directed yield here to the consumer.
-                ++prefetch->stats.unpack_yield_ready;
-                should_yield = true;
-            } else if (prefetch->unpacked.data.size() > 2*prefetch->unpack_threads.size()) {
-                ++prefetch->stats.unpack_yield_front;
-                // The front of the queue isn't done, but we have a lot of 
-                // things in the queue, this means whatever thread is working
-                // on that element has been preempted.
-                // really want a directed yield to the thread processing the
-                // first extent.
-                should_yield = true;
-            } else {
-                should_yield = false;
-            }
-            prefetch->mutex.unlock();
-            if (should_yield) {
-                sched_yield();
-            }
-            Extent::Ptr e(new Extent(pe->type));
-            e->unpackData(pe->bytes, pe->need_bitflip);
-            e->extent_source = pe->extent_source;
-            e->extent_source_offset = pe->extent_source_offset;
-            SINVARIANT(e->type->getName() == pe->uncompressed_type);
-            SINVARIANT(e->size() == unpacked_size);
-            prefetch->mutex.lock();
-            SINVARIANT(pe->unpacked == NULL && pe->bytes.size() > 0);
-            total_compressed_bytes += pe->bytes.size();
-            total_uncompressed_bytes += e->size();
-            pe->bytes.clear();
-            pe->unpacked = e;
-            SINVARIANT(!prefetch->unpacked.empty());
-            if (prefetch->unpackedReady()) {
-                prefetch->ready_cond.signal();
-            }
-        }
+void IndexSourceModule::lockedSubmitRead() {
+    CompressedRead *read = prefetch->next_read;
+    prefetch->next_read = NULL;
+    SINVARIANT(read != NULL && read->buffer == NULL);
+    read->buffer = new Extent::byte[read->read.size];
+    read->read.into = read->buffer;
+    read->self.reset(read);
+    Extent::byte *pos = read->buffer;
+    for (vector<PrefetchExtent *>::iterator i = read->extents.begin();
+         i != read->extents.end(); ++i) {
+        (**i).bytes.borrow(pos, (**i).read_size, read->self);
+        pos += (**i).read_size;
     }
-    --prefetch->stats.active_unpackers;
-    SINVARIANT(prefetch->abort_prefetching > 0);
-    --prefetch->abort_prefetching;
-    prefetch->compressed_cond.broadcast();
+    ++prefetch->stats.async_reads;
+    prefetch->stats.async_read_extents += read->extents.size();
+    prefetch->reader->submit(&read->read);
+}
+
+void IndexSourceModule::lockedWaitForRead() {
     prefetch->mutex.unlock();
+    AsyncReader::Read *done = prefetch->reader->wait();
+    prefetch->mutex.lock();
+
+    CompressedRead *read = static_cast<CompressedRead *>(done->arg);
+    for (vector<PrefetchExtent *>::iterator i = read->extents.begin();
+         i != read->extents.end(); ++i) {
+        SINVARIANT((**i).reading);
+        (**i).reading = false;
+    }
+    read->extents.clear();
+    Extent::ByteArray::OwnerPtr keep;
+    keep.swap(read->self); // the extents' bytes keep the buffer until they are unpacked
+    lockedStartUnpacks(); // may have finished several extents
+}
+
+void IndexSourceModule::unpackTask(PrefetchExtent *pe, uint32_t unpacked_size) {
+    Extent::Ptr e(new Extent(pe->type));
+    e->dictionaries = pe->dictionaries;
+    if (columns.empty()) {
+        e->unpackData(pe->bytes, pe->need_bitflip);
+    } else {
+        ExtentType::ColumnSelection selection(pe->type->selectColumns(columns));
+        e->unpackData(pe->bytes, pe->need_bitflip, &selection);
+    }
+    e->extent_source = pe->extent_source;
+    e->extent_source_offset = pe->extent_source_offset;
+    SINVARIANT(e->type->getName() == pe->uncompressed_type);
+
+    PThreadScopedLock lock(prefetch->mutex);
+    if (e->size() > unpacked_size) {
+        // the values of dictionary coded fields were added back
+        SINVARIANT(e->type->hasDictionaryFields());
+        prefetch->unpacked.cur += e->size() - unpacked_size;
+    } else if (e->size() < unpacked_size) {
+        // the variable data was left out
+        SINVARIANT(!columns.empty());
+        prefetch->unpacked.subtract(unpacked_size - e->size());
+    }
+    SINVARIANT(pe->unpacked == NULL && pe->bytes.size() > 0);
+    total_compressed_bytes += pe->bytes.size();
+    total_uncompressed_bytes += e->size();
+    pe->bytes.clear();
+    pe->unpacked = e;
+    SINVARIANT(prefetch->unpacking > 0);
+    --prefetch->unpacking;
+    if (prefetch->unpackedReady()) {
+        prefetch->ready_cond.signal();
+    }
+    if (prefetch->abort_prefetching > 0) {
+        prefetch->compressed_cond.broadcast(); // close() waits for us
+    } else {
+        lockedStartUnpacks();
+    }
 }
 
 IndexSourceModule::PrefetchExtent *
@@ -379,15 +475,28 @@ IndexSourceModule::readCompressed(DataSeriesSource *dss,
                                   off64_t offset,
                                   const string &uncompressed_type)
 {
-    prefetch->mutex.unlock();
     PrefetchExtent *p = new PrefetchExtent;
     p->extent_source = dss->getFilename();
     p->extent_source_offset = offset;
+    p->need_bitflip = dss->needBitflip();
+    p->dictionaries = dss->getFieldDictionaries();
+    p->uncompressed_type = uncompressed_type;
+    // With the size from the index we can read the whole extent at once;
+    // mapped extents are only read when they are unpacked.
+    p->read_size = dss->extentSize(offset);
+    if (p->read_size > 0 && !dss->getUseMmap()) {
+        p->type = dss->getLibrary().getTypeByNamePtr(uncompressed_type, true);
+    }
+    if (p->type != NULL) {
+        p->reading = true;
+        lockedAddToRead(p);
+        return p;
+    }
+
+    prefetch->mutex.unlock();
     bool ok = dss->preadCompressed(offset,p->bytes);
     INVARIANT(ok,"whoa, shouldn't have hit eof!");
     p->type = dss->getLibrary().getTypeByNamePtr(Extent::getPackedExtentType(p->bytes));
-    p->need_bitflip = dss->needBitflip();
-    p->uncompressed_type = uncompressed_type;
     prefetch->mutex.lock();
     return p;
 }
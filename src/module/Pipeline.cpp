@@ -0,0 +1,417 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    implementation
+*/
+
+#include <boost/bind.hpp>
+#include <boost/format.hpp>
+
+#include <DataSeries/DSExpr.hpp>
+#include <DataSeries/GeneralField.hpp>
+#include <DataSeries/Pipeline.hpp>
+
+using namespace std;
+using boost::format;
+
+namespace dataseries {
+
+MorselSink::~MorselSink() { }
+
+PipelineOperator::Local::~Local() { }
+
+PipelineOperator::~PipelineOperator() { }
+
+PipelineOperator::Local *PipelineOperator::newLocal() {
+    return NULL;
+}
+
+void PipelineOperator::finishLocal(Local *local) { }
+
+void BreakerOperator::finishInput() { }
+
+// The operators from the input (the source or a breaker) up to the next
+// breaker, if any.
+struct Pipeline::Stage {
+    Stage(const BreakerOperator::Ptr &input) : input(input), started(false), input_done(false),
+                                               next_seq(0) { }
+
+    BreakerOperator::Ptr input, breaker;
+    vector<StreamOperator::Ptr> ops;
+    vector<Slot *> slots;
+    bool started, input_done;
+    uint64_t next_seq;
+};
+
+// A running morsel's Locals, one for each operator in the stage and then
+// one for the breaker.
+struct Pipeline::Slot {
+    vector<PipelineOperator::Local *> locals;
+};
+
+struct Pipeline::Result {
+    Result() : done(false) { }
+    vector<Extent::Ptr> out;
+    bool done;
+};
+
+// Pushes a morsel into operator pos of the stage, or past the last one.
+class Pipeline::StageSink : public MorselSink {
+  public:
+    StageSink(Stage &stage, Slot &slot, size_t pos, uint64_t seq, Result *result)
+        : stage(stage), slot(slot), pos(pos), seq(seq), result(result) { }
+
+    virtual void push(const Extent::Ptr &morsel) {
+        if (pos < stage.ops.size()) {
+            StageSink next(stage, slot, pos + 1, seq, result);
+            stage.ops[pos]->process(slot.locals[pos], morsel, next);
+        } else if (stage.breaker != NULL) {
+            stage.breaker->consume(slot.locals[pos], seq, morsel);
+        } else {
+            result->out.push_back(morsel);
+        }
+    }
+
+  private:
+    Stage &stage;
+    Slot &slot;
+    const size_t pos;
+    const uint64_t seq;
+    Result *result;
+};
+
+Pipeline::Pipeline(DataSeriesModule &source)
+    : source(source), cur_stage(0), max_in_flight(0), started(false), running(0)
+{
+    stages.push_back(new Stage(BreakerOperator::Ptr()));
+}
+
+Pipeline::~Pipeline() {
+    queue.wait();
+    for (deque<Result *>::iterator i = results.begin(); i != results.end(); ++i) {
+        delete *i;
+    }
+    for (vector<Stage *>::iterator i = stages.begin(); i != stages.end(); ++i) {
+        for (vector<Slot *>::iterator j = (**i).slots.begin(); j != (**i).slots.end(); ++j) {
+            for (vector<PipelineOperator::Local *>::iterator k = (**j).locals.begin();
+                 k != (**j).locals.end(); ++k) {
+                delete *k;
+            }
+            delete *j;
+        }
+        delete *i;
+    }
+}
+
+Pipeline &Pipeline::add(const StreamOperator::Ptr &op) {
+    INVARIANT(!started, "can't add operators to a running pipeline");
+    SINVARIANT(op != NULL);
+    stages.back()->ops.push_back(op);
+    return *this;
+}
+
+Pipeline &Pipeline::add(const BreakerOperator::Ptr &op) {
+    INVARIANT(!started, "can't add operators to a running pipeline");
+    SINVARIANT(op != NULL);
+    stages.back()->breaker = op;
+    stages.push_back(new Stage(op));
+    return *this;
+}
+
+void Pipeline::setMaxInFlight(unsigned max) {
+    INVARIANT(!started, "can't change a running pipeline");
+    max_in_flight = max;
+}
+
+// The last stage has no breaker, so its output goes into results, in the
+// order the morsels were read; every morsel in flight has a result, so
+// results also bounds the morsels in flight.
+Extent::Ptr Pipeline::getSharedExtent() {
+    if (!started) {
+        started = true;
+        if (max_in_flight == 0) {
+            max_in_flight = TaskPool::getSharedThreads();
+        }
+    }
+    while (true) {
+        if (!output.empty()) {
+            Extent::Ptr ret = output.front();
+            output.pop_front();
+            return ret;
+        }
+        if (cur_stage == stages.size()) {
+            return Extent::Ptr();
+        }
+        Stage &stage(*stages[cur_stage]);
+        if (!stage.started) {
+            startStage(stage);
+        }
+
+        bool front_done;
+        unsigned now_running;
+        {
+            PThreadScopedLock lock(mutex);
+            front_done = !results.empty() && results.front()->done;
+            now_running = running;
+        }
+        if (front_done) {
+            Result *result = results.front();
+            results.pop_front();
+            output.insert(output.end(), result->out.begin(), result->out.end());
+            delete result;
+            continue;
+        }
+
+        unsigned in_flight = stage.breaker == NULL ? results.size() : now_running;
+        if (!stage.input_done && in_flight < max_in_flight) {
+            Extent::Ptr in = stageInput(stage);
+            if (in == NULL) {
+                stage.input_done = true;
+                continue;
+            }
+            Result *result = NULL;
+            if (stage.breaker == NULL) {
+                result = new Result();
+                results.push_back(result);
+            }
+            {
+                PThreadScopedLock lock(mutex);
+                ++running;
+            }
+            queue.submit(boost::bind(&Pipeline::runMorsel, this, &stage, stage.next_seq,
+                                     in, result));
+            ++stage.next_seq;
+        } else if (stage.input_done && now_running == 0 && results.empty()) {
+            finishStage(stage);
+            ++cur_stage;
+        } else {
+            waitForMorsel(now_running);
+        }
+    }
+}
+
+void Pipeline::startStage(Stage &stage) {
+    for (unsigned i = 0; i < max_in_flight; ++i) {
+        Slot *slot = new Slot();
+        for (vector<StreamOperator::Ptr>::iterator j = stage.ops.begin();
+             j != stage.ops.end(); ++j) {
+            slot->locals.push_back((**j).newLocal());
+        }
+        if (stage.breaker != NULL) {
+            slot->locals.push_back(stage.breaker->newLocal());
+        }
+        stage.slots.push_back(slot);
+    }
+    PThreadScopedLock lock(mutex);
+    idle = stage.slots;
+    stage.started = true;
+}
+
+void Pipeline::finishStage(Stage &stage) {
+    {
+        PThreadScopedLock lock(mutex);
+        SINVARIANT(running == 0 && idle.size() == stage.slots.size());
+        idle.clear();
+    }
+    for (vector<Slot *>::iterator i = stage.slots.begin(); i != stage.slots.end(); ++i) {
+        for (size_t j = 0; j < (**i).locals.size(); ++j) {
+            PipelineOperator *op = j < stage.ops.size()
+                ? static_cast<PipelineOperator *>(stage.ops[j].get()) : stage.breaker.get();
+            op->finishLocal((**i).locals[j]);
+            delete (**i).locals[j];
+        }
+        delete *i;
+    }
+    stage.slots.clear();
+    if (stage.breaker != NULL) {
+        stage.breaker->finishInput();
+    }
+}
+
+Extent::Ptr Pipeline::stageInput(Stage &stage) {
+    return stage.input == NULL ? source.getSharedExtent() : stage.input->produce();
+}
+
+void Pipeline::runMorsel(Stage *stage, uint64_t seq, Extent::Ptr in, Result *result) {
+    Slot *slot;
+    {
+        PThreadScopedLock lock(mutex);
+        SINVARIANT(!idle.empty());
+        slot = idle.back();
+        idle.pop_back();
+    }
+    StageSink(*stage, *slot, 0, seq, result).push(in);
+
+    PThreadScopedLock lock(mutex);
+    idle.push_back(slot);
+    if (result != NULL) {
+        result->done = true;
+    }
+    --running;
+    done_cond.signal();
+}
+
+// Runs a morsel in this thread if one is waiting, so a busy pool can't
+// stall us; otherwise waits until one of the seen_running finishes.
+void Pipeline::waitForMorsel(unsigned seen_running) {
+    if (queue.runOne()) {
+        return;
+    }
+    PThreadScopedLock lock(mutex);
+    SINVARIANT(seen_running > 0);
+    while (running == seen_running) {
+        done_cond.wait(mutex);
+    }
+}
+
+// The source of the module in a ModuleOperator; returns the morsels in seq order.
+class ModuleOperator::Buffered : public DataSeriesModule {
+  public:
+    Buffered(map<uint64_t, vector<Extent::Ptr> > &input) : input(input), pos(0) { }
+
+    virtual Extent::Ptr getSharedExtent() {
+        while (!input.empty() && pos == input.begin()->second.size()) {
+            input.erase(input.begin());
+            pos = 0;
+        }
+        if (input.empty()) {
+            return Extent::Ptr();
+        }
+        Extent::Ptr ret;
+        ret.swap(input.begin()->second[pos]); // so it is freed once the module is done with it
+        ++pos;
+        return ret;
+    }
+
+  private:
+    map<uint64_t, vector<Extent::Ptr> > &input;
+    size_t pos;
+};
+
+ModuleOperator::ModuleOperator(const Factory &factory)
+    : factory(factory), buffered(NULL) { }
+
+ModuleOperator::~ModuleOperator() {
+    module.reset();
+    delete buffered;
+}
+
+void ModuleOperator::consume(Local *local, uint64_t seq, const Extent::Ptr &in) {
+    PThreadScopedLock lock(mutex);
+    input[seq].push_back(in);
+}
+
+void ModuleOperator::finishInput() {
+    SINVARIANT(buffered == NULL);
+    buffered = new Buffered(input);
+    module = factory(*buffered);
+    SINVARIANT(module != NULL);
+}
+
+Extent::Ptr ModuleOperator::produce() {
+    SINVARIANT(module != NULL);
+    return module->getSharedExtent();
+}
+
+struct SelectOperator::SelectLocal : public PipelineOperator::Local {
+    SelectLocal() : copier(in, out), where_expr(NULL) { }
+    virtual ~SelectLocal() {
+        delete where_expr;
+    }
+
+    ExtentSeries in, out;
+    ExtentRecordCopy copier;
+    DSExpr *where_expr;
+};
+
+SelectOperator::SelectOperator(const string &where_expr_str)
+    : where_expr_str(where_expr_str) { }
+
+SelectOperator::~SelectOperator() { }
+
+PipelineOperator::Local *SelectOperator::newLocal() {
+    return new SelectLocal();
+}
+
+void SelectOperator::process(Local *local, const Extent::Ptr &e, MorselSink &sink) {
+    SelectLocal &l(*static_cast<SelectLocal *>(local));
+    if (l.where_expr == NULL) {
+        l.in.setType(e->getTypePtr());
+        l.out.setType(e->getTypePtr());
+        l.copier.prep();
+        l.where_expr = DSExpr::make(l.in, where_expr_str);
+    }
+    l.out.newExtent();
+    for (l.in.setExtent(e); l.in.more(); l.in.next()) {
+        if (l.where_expr->valBool()) {
+            l.out.newRecord();
+            l.copier.copyRecord();
+        }
+    }
+    l.in.clearExtent();
+    Extent::Ptr selected = l.out.getSharedExtent();
+    l.out.clearExtent();
+    sink.push(selected);
+}
+
+ExtentMergeModule::ExtentMergeModule(DataSeriesModule &source, size_t target_size)
+    : source(source), target_size(target_size), copier(input, output), seen_rows(false) { }
+
+ExtentMergeModule::~ExtentMergeModule() { }
+
+Extent::Ptr ExtentMergeModule::takeOutput() {
+    Extent::Ptr ret = output.getSharedExtent();
+    output.clearExtent();
+    return ret;
+}
+
+Extent::Ptr ExtentMergeModule::getSharedExtent() {
+    while (true) {
+        Extent::Ptr in = source.getSharedExtent();
+        if (in == NULL) {
+            if (output.hasExtent()) {
+                return takeOutput();
+            }
+            Extent::Ptr ret;
+            ret.swap(empty); // set only if there were no rows at all
+            return ret;
+        }
+        if (in->nRecords() == 0) {
+            if (!seen_rows && empty == NULL) {
+                empty = in;
+            }
+            continue;
+        }
+        seen_rows = true;
+        empty.reset();
+        if (output.getTypePtr() == NULL) {
+            input.setType(in->getTypePtr());
+            output.setType(in->getTypePtr());
+            copier.prep();
+        }
+        INVARIANT(in->getTypePtr() == output.getTypePtr(),
+                  format("ExtentMergeModule got extents of types %s and %s")
+                  % output.getTypePtr()->getName() % in->getTypePtr()->getName());
+        if (!output.hasExtent() && in->size() >= target_size) {
+            return in; // big enough already, no need to copy it
+        }
+        if (!output.hasExtent()) {
+            output.newExtent();
+        }
+        for (input.setExtent(in); input.more(); input.next()) {
+            output.newRecord();
+            copier.copyRecord();
+        }
+        input.clearExtent();
+        if (output.getExtentRef().size() >= target_size) {
+            return takeOutput();
+        }
+    }
+}
+
+} // namespace dataseries
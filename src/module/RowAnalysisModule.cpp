@@ -9,19 +9,45 @@
     implementation
 */
 
+#include <boost/bind.hpp>
+
 #include <DataSeries/DSExpr.hpp>
 #include <DataSeries/RowAnalysisModule.hpp>
 #include <DataSeries/SequenceModule.hpp>
+#include <DataSeries/TaskPool.hpp>
+#include <DataSeries/TypeIndexModule.hpp>
+
+using namespace std;
+
+// The workers that aren't processing an extent are in idle; there are
+// never more extents in progress than workers, so a task always finds one.
+struct RowAnalysisModule::Parallel {
+    vector<RowAnalysisModule *> workers, idle;
+    unsigned in_progress;
+    PThreadMutex mutex;
+    PThreadCond done_cond;
+    dataseries::TaskPool::Queue queue;
+    Parallel() : in_progress(0) { }
+};
 
 RowAnalysisModule::RowAnalysisModule(DataSeriesModule &_source,
                                      ExtentSeries::typeCompatibilityT _tc)
         : processed_rows(0), ignored_rows(0), 
-          series(_tc), source(_source), prepared(false), where_expr(NULL)
+          series(_tc), source(_source), prepared(false), where_expr(NULL), parallel(NULL)
 {
     SINVARIANT(&source != NULL);
 }
 
 RowAnalysisModule::~RowAnalysisModule() {
+    if (parallel != NULL) {
+        waitForWorkers(0);
+        for (vector<RowAnalysisModule *>::iterator i = parallel->workers.begin();
+             i != parallel->workers.end(); ++i) {
+            delete *i;
+        }
+        delete parallel;
+        parallel = NULL;
+    }
     delete where_expr;
     where_expr = NULL;
 }
@@ -35,9 +61,21 @@ void RowAnalysisModule::prepareForProcessing() { }
 Extent::Ptr RowAnalysisModule::getSharedExtent() {
     Extent::Ptr e = source.getSharedExtent();
     if (e == NULL) {
+        if (parallel != NULL) {
+            finishParallel();
+        }
         completeProcessing();
         return e;
     }
+    if (parallel != NULL) {
+        parallelExtent(e);
+    } else {
+        analyzeExtent(e);
+    }
+    return e;
+}
+
+void RowAnalysisModule::analyzeExtent(const Extent::Ptr &e) {
     if (!prepared) {
         firstExtent(*e);
     }
@@ -50,6 +88,15 @@ Extent::Ptr RowAnalysisModule::getSharedExtent() {
             where_expr = DSExpr::make(series, where_expr_str);
         }
     }
+    processExtent(*e);
+    series.clearExtent();
+}
+
+void RowAnalysisModule::processRow() {
+    FATAL_ERROR("a RowAnalysisModule has to override processRow() or processExtent()");
+}
+
+void RowAnalysisModule::processExtent(const Extent &e) {
     for (;series.morerecords();++series) {
         if (!where_expr || where_expr->valBool()) {
             ++processed_rows;
@@ -58,17 +105,106 @@ Extent::Ptr RowAnalysisModule::getSharedExtent() {
             ++ignored_rows;
         }
     }
-    series.clearExtent();
-    return e;
+}
+
+RowAnalysisModule *RowAnalysisModule::newWorker() {
+    return NULL;
+}
+
+void RowAnalysisModule::mergeWorker(RowAnalysisModule &worker) {
+    FATAL_ERROR("a module with a newWorker() needs a mergeWorker()");
+}
+
+void RowAnalysisModule::setParallel(unsigned nworkers) {
+    INVARIANT(!prepared && parallel == NULL, "can't set parallel after prepare");
+    if (nworkers == 0) {
+        nworkers = dataseries::TaskPool::getSharedThreads();
+    }
+    parallel = new Parallel();
+    for (unsigned i = 0; i < nworkers; ++i) {
+        RowAnalysisModule *worker = newWorker();
+        INVARIANT(worker != NULL, "this module can't run in parallel; it has no newWorker()");
+        parallel->workers.push_back(worker);
+    }
+    parallel->idle = parallel->workers;
+}
+
+void RowAnalysisModule::parallelExtent(const Extent::Ptr &e) {
+    if (!prepared) {
+        // set up for the merge, as the workers will set themselves up
+        firstExtent(*e);
+        series.setExtent(e);
+        prepareForProcessing();
+        series.clearExtent();
+        prepared = true;
+        for (vector<RowAnalysisModule *>::iterator i = parallel->workers.begin();
+             i != parallel->workers.end(); ++i) {
+            (**i).where_expr_str = where_expr_str;
+        }
+    }
+    waitForWorkers(parallel->workers.size() - 1);
+    PThreadScopedLock lock(parallel->mutex);
+    ++parallel->in_progress;
+    parallel->queue.submit(boost::bind(&RowAnalysisModule::workerTask, this, e));
+}
+
+void RowAnalysisModule::workerTask(Extent::Ptr e) {
+    RowAnalysisModule *worker;
+    {
+        PThreadScopedLock lock(parallel->mutex);
+        SINVARIANT(!parallel->idle.empty());
+        worker = parallel->idle.back();
+        parallel->idle.pop_back();
+    }
+    worker->analyzeExtent(e);
+    PThreadScopedLock lock(parallel->mutex);
+    parallel->idle.push_back(worker);
+    --parallel->in_progress;
+    parallel->done_cond.signal();
+}
+
+// Helps with the queued extents rather than just waiting, in case the pool's
+// threads are busy with other work.
+void RowAnalysisModule::waitForWorkers(unsigned max_in_progress) {
+    PThreadScopedLock lock(parallel->mutex);
+    while (parallel->in_progress > max_in_progress) {
+        bool ran;
+        {
+            PThreadScopedUnlock unlock(lock);
+            ran = parallel->queue.runOne();
+        }
+        if (!ran && parallel->in_progress > max_in_progress) {
+            parallel->done_cond.wait(parallel->mutex);
+        }
+    }
+}
+
+void RowAnalysisModule::finishParallel() {
+    waitForWorkers(0);
+    for (vector<RowAnalysisModule *>::iterator i = parallel->workers.begin();
+         i != parallel->workers.end(); ++i) {
+        if ((**i).prepared) { // otherwise it never saw an extent
+            mergeWorker(**i);
+            processed_rows += (**i).processed_rows;
+            ignored_rows += (**i).ignored_rows;
+        }
+        delete *i;
+    }
+    parallel->workers.clear();
+    parallel->idle.clear();
 }
 
 void RowAnalysisModule::completeProcessing() { }
 
 void RowAnalysisModule::printResult() { }
 
-void RowAnalysisModule::setWhereExpr(const std::string &expr) {
+void RowAnalysisModule::setWhereExpr(const std::string &expr, bool skip_extents) {
     where_expr_str = expr;
     INVARIANT(!prepared, "can't set where expr after prepare");
+    TypeIndexModule *index_source = dynamic_cast<TypeIndexModule *>(&source);
+    if (skip_extents && index_source != NULL && !expr.empty()) {
+        index_source->addWhereFilter(expr);
+    }
 }
 
 int RowAnalysisModule::printAllResults(SequenceModule &sequence, int expected_nonprintable) {
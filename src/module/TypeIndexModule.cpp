@@ -5,6 +5,9 @@
   See the file named COPYING for license details
 */
 
+#include <boost/bind.hpp>
+
+#include <DataSeries/DSExpr.hpp>
 #include <DataSeries/TypeIndexModule.hpp>
 
 using namespace std;
@@ -17,11 +20,86 @@ TypeIndexModule::TypeIndexModule(const string &_type_match)
           extentOffset(indexSeries,"offset"), 
           extentType(indexSeries,"extenttype"),
           cur_file(0), cur_source(NULL),
-          my_type()
+          my_type(), parallel_files(1), keep_file_order(true), running_openers(0),
+          next_to_open(0), open_files(0), stop_opening(false)
 { }
 
-TypeIndexModule::~TypeIndexModule()
-{ }
+TypeIndexModule::~TypeIndexModule() {
+    if (!openers.empty()) {
+        PThreadScopedLock lock(prefetchMutex());
+        lockedStopOpeners();
+    }
+}
+
+void TypeIndexModule::setParallelFiles(unsigned nfiles, bool _keep_file_order) {
+    INVARIANT(startedPrefetching() == false,
+              "can't change the number of parallel files after prefetching starts");
+    SINVARIANT(nfiles > 0);
+    parallel_files = nfiles;
+    keep_file_order = _keep_file_order;
+}
+
+void TypeIndexModule::addRangeFilter(const string &field, const GeneralValue &min,
+                                     const GeneralValue &max) {
+    INVARIANT(startedPrefetching() == false,
+              "can't add a range filter after prefetching starts");
+    range_filters.push_back(RangeFilter(field, min, max, false));
+}
+
+unsigned TypeIndexModule::addWhereFilter(const string &where_expression) {
+    INVARIANT(startedPrefetching() == false,
+              "can't add a where filter after prefetching starts");
+    DSExpr::FieldRanges ranges(DSExpr::impliedRanges(where_expression));
+    for (DSExpr::FieldRanges::iterator i = ranges.begin(); i != ranges.end(); ++i) {
+        GeneralValue min, max;
+        min.setDouble(i->min);
+        max.setDouble(i->max);
+        // the expression compares a null as its field's default value
+        range_filters.push_back(RangeFilter(i->field, min, max, true));
+    }
+    return ranges.size();
+}
+
+bool TypeIndexModule::mayMatchRanges(off64_t offset) const {
+    const dataseries::ZoneMap &zone_map(cur_source->getZoneMap());
+    for (vector<RangeFilter>::const_iterator i = range_filters.begin();
+         i != range_filters.end(); ++i) {
+        if (!zone_map.mayOverlap(offset, i->field, i->min, i->max, i->nulls_match)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void TypeIndexModule::addKeyFilter(const string &field, const vector<string> &keys) {
+    INVARIANT(startedPrefetching() == false,
+              "can't add a key filter after prefetching starts");
+    key_filters.push_back(KeyFilter(field));
+    for (vector<string>::const_iterator i = keys.begin(); i != keys.end(); ++i) {
+        key_filters.back().hashes.push_back
+                (dataseries::BloomFilters::Filter::hash(i->data(), i->size()));
+    }
+}
+
+void TypeIndexModule::addKeyFilter(const string &field, const vector<int64_t> &keys) {
+    INVARIANT(startedPrefetching() == false,
+              "can't add a key filter after prefetching starts");
+    key_filters.push_back(KeyFilter(field));
+    for (vector<int64_t>::const_iterator i = keys.begin(); i != keys.end(); ++i) {
+        key_filters.back().hashes.push_back(dataseries::BloomFilters::Filter::hash(*i));
+    }
+}
+
+bool TypeIndexModule::mayMatchKeys(off64_t offset) const {
+    const dataseries::BloomFilters &bloom_filters(cur_source->getBloomFilters());
+    for (vector<KeyFilter>::const_iterator i = key_filters.begin();
+         i != key_filters.end(); ++i) {
+        if (!bloom_filters.mayContainAny(offset, i->field, i->hashes)) {
+            return false;
+        }
+    }
+    return true;
+}
 
 void TypeIndexModule::setMatch(const string &_type_match) {
     INVARIANT(startedPrefetching() == false,
@@ -44,9 +122,89 @@ void TypeIndexModule::addSource(const std::string &filename) {
 
 void TypeIndexModule::lockedResetModule() {
     indexSeries.clearExtent();
+    if (cur_source != NULL) {
+        lockedCloseSource();
+    }
+    lockedStopOpeners();
     cur_file = 0;
 }
 
+DataSeriesSource *TypeIndexModule::lockedOpenSource() {
+    if (parallel_files == 1) {
+        return new DataSeriesSource(inputFiles[cur_file]);
+    }
+    if (openers.empty()) {
+        running_openers = parallel_files;
+        for (unsigned i = 0; i < parallel_files; ++i) {
+            openers.push_back(new PThreadFunction(boost::bind(&TypeIndexModule::openerThread,
+                                                              this)));
+            openers.back()->start();
+        }
+    }
+    while (true) {
+        for (vector<pair<unsigned, DataSeriesSource *> >::iterator i = opened.begin();
+             i != opened.end(); ++i) {
+            if (!keep_file_order || i->first == cur_file) {
+                DataSeriesSource *ret = i->second;
+                opened.erase(i);
+                return ret;
+            }
+        }
+        opened_cond.wait(prefetchMutex());
+    }
+}
+
+void TypeIndexModule::lockedCloseSource() {
+    delete cur_source;
+    cur_source = NULL;
+    if (parallel_files > 1) {
+        SINVARIANT(open_files > 0);
+        --open_files;
+        open_cond.signal();
+    }
+}
+
+void TypeIndexModule::openerThread() {
+    PThreadMutex &mutex = prefetchMutex();
+    mutex.lock();
+    while (!stop_opening && next_to_open < inputFiles.size()) {
+        if (open_files == parallel_files) {
+            open_cond.wait(mutex);
+            continue;
+        }
+        unsigned file = next_to_open++;
+        ++open_files;
+        mutex.unlock();
+        DataSeriesSource *source = new DataSeriesSource(inputFiles[file]);
+        mutex.lock();
+        opened.push_back(make_pair(file, source));
+        opened_cond.broadcast();
+    }
+    --running_openers;
+    opened_cond.broadcast();
+    mutex.unlock();
+}
+
+void TypeIndexModule::lockedStopOpeners() {
+    stop_opening = true;
+    open_cond.broadcast();
+    while (running_openers > 0) {
+        opened_cond.wait(prefetchMutex());
+    }
+    for (vector<PThread *>::iterator i = openers.begin(); i != openers.end(); ++i) {
+        (**i).join();
+        delete *i;
+    }
+    openers.clear();
+    for (vector<pair<unsigned, DataSeriesSource *> >::iterator i = opened.begin();
+         i != opened.end(); ++i) {
+        delete i->second;
+    }
+    opened.clear();
+    next_to_open = open_files = 0;
+    stop_opening = false;
+}
+
 TypeIndexModule::PrefetchExtent *TypeIndexModule::lockedGetCompressedExtent() {
     while (true) {
         if (!indexSeries.hasExtent()) {
@@ -54,7 +212,7 @@ TypeIndexModule::PrefetchExtent *TypeIndexModule::lockedGetCompressedExtent() {
                 INVARIANT(!inputFiles.empty(), "type index module had no input files??");
                 return NULL;
             }
-            cur_source = new DataSeriesSource(inputFiles[cur_file]);
+            cur_source = lockedOpenSource();
             INVARIANT(cur_source->index_extent != NULL,
                       "can't handle source with null index extent\n");
             if (type_match.empty()) {
@@ -66,7 +224,7 @@ TypeIndexModule::PrefetchExtent *TypeIndexModule::lockedGetCompressedExtent() {
                 // TODO: figure out what we should allow, should the series typematching rules be imported here?
                 INVARIANT(my_type == tmp, 
                           boost::format("two different types were matched; this is currently invalid\nFile with mismatch was %s\nType 1:\n%s\nType 2:\n%s\n")
-                          % inputFiles[cur_file]
+                          % cur_source->getFilename()
                           % my_type->getXmlDescriptionString()
                           % tmp->getXmlDescriptionString()); 
             }
@@ -78,6 +236,10 @@ TypeIndexModule::PrefetchExtent *TypeIndexModule::lockedGetCompressedExtent() {
                 (my_type != NULL &&
                  extentType.stringval() == my_type->getName())) {
                 off64_t v = extentOffset.val();
+                if ((!range_filters.empty() && !mayMatchRanges(v))
+                    || (!key_filters.empty() && !mayMatchKeys(v))) {
+                    continue;
+                }
                 PrefetchExtent *ret 
                         = readCompressed(cur_source, v, extentType.stringval());
                 ++indexSeries;
@@ -86,8 +248,7 @@ TypeIndexModule::PrefetchExtent *TypeIndexModule::lockedGetCompressedExtent() {
         }
         if (indexSeries.morerecords() == false) {
             indexSeries.clearExtent();
-            delete cur_source;
-            cur_source = NULL;
+            lockedCloseSource();
             ++cur_file;
         }
     }
@@ -124,6 +124,22 @@ void getPackingArgs(int *argc, char *argv[], commonPackingArgs *commonArgs) {
             INVARIANT(commonArgs->extent_size >= 1024,
                       format("extent size %d (%s), < 1024 doesn't make sense")
                       % commonArgs->extent_size % argv[cur_arg]);
+        } else if (strncmp(argv[cur_arg],"--compress-block-size=",22) == 0) {
+            int block_size = atoi(argv[cur_arg]+22);
+            INVARIANT(block_size == 0 || block_size >= 64*1024,
+                      format("compress block size %d (%s), < 64k doesn't make sense")
+                      % block_size % argv[cur_arg]);
+            commonArgs->compress_block_size = block_size;
+        } else if (strncmp(argv[cur_arg],"--compress-policy=",18) == 0) {
+            uint32_t sample_interval = commonArgs->compress_policy.sample_interval;
+            commonArgs->compress_policy = Extent::CompressionPolicy::fromName(argv[cur_arg]+18);
+            commonArgs->compress_policy.sample_interval = sample_interval;
+        } else if (strncmp(argv[cur_arg],"--compress-policy-sample=",25) == 0) {
+            int sample_interval = atoi(argv[cur_arg]+25);
+            INVARIANT(sample_interval > 0,
+                      format("compress policy sample interval %d (%s), should be > 0")
+                      % sample_interval % argv[cur_arg]);
+            commonArgs->compress_policy.sample_interval = sample_interval;
             // Check for arguments in the old format -- provided for backwards
             // compatability.
         } else if (oldStyle(argv, cur_arg, num_munged_args, commonArgs)) {
@@ -176,10 +192,16 @@ const std::string packingOptions() {
         returnStr += Extent::compression_algs[i].name;
     }
     returnStr += 
-            "} (default enables all --- enable does little on its own)\n"
+            "} (default enables all but zstd --- enable does little on its own)\n"
             "    --compress-level=[0-9] (default 9)\n"
             "    --extent-size=[>=1024] (default 16*1024*1024 if bz2 is "
-            "enabled, 64*1024 otherwise)\n";
+            "enabled, 64*1024 otherwise)\n"
+            "    --compress-block-size=[0 or >=65536] (default 0; split larger extents into\n"
+            "      blocks of this size that are compressed in parallel)\n"
+            "    --compress-policy={smallest,balanced,read-optimized,cost:F1,F2} (default\n"
+            "      smallest; the others trade size against decompression time)\n"
+            "    --compress-policy-sample=[>0] (default 16; try all the algorithms on one\n"
+            "      out of this many extents of each type)\n";
 
     return returnStr;
 }
@@ -19,7 +19,7 @@
    =head1 SYNOPSIS
 
    dsrepack [common-options] [--verbose] [--target-file-size=MiB] [--no-info] 
-   input-filename... output-filename
+   [--zstd-dictionary=KiB] input-filename... output-filename
 
    =head1 DESCRIPTION
 
@@ -61,6 +61,15 @@
    This cannot be used when repacking a trace that already contains the 
    Info::DSRepack extent, as dsrepack does not support removing trace data.
 
+   =item B<--zstd-dictionary=KiB>
+
+   Train a zstd dictionary of at most this size for each extent type on a
+   sample of its extents, store the dictionaries in the output files, and
+   use them when compressing with zstd.  Dictionaries help most with small
+   extents.  Requires zstd to be one of the enabled compression algorithms,
+   which it is not by default; use --enable zstd.  zstd is only used in
+   DSv2 files, so this also needs DATASERIES_FORMAT_VERSION=2.
+
    =item B<--verbose, -v>
 
    Outputs progress reports as it processes the extents.
@@ -273,17 +282,66 @@ void writeRepackInfo(DataSeriesSink &sink, const commonPackingArgs &cpa, int fil
 bool skipType(const ExtentType::Ptr type) {
     return type->getName() == "DataSeries: ExtentIndex"
             || type->getName() == "DataSeries: XmlType"
+            || type == ExtentType::getDataSeriesCompressionDictionaryTypePtr()
+            || type == ExtentType::getDataSeriesStringDictionaryTypePtr()
+            || type == ExtentType::getDataSeriesZoneMapTypePtr()
+            || type == ExtentType::getDataSeriesBloomFilterTypePtr()
             || (type->getName() == "Info::DSRepack"
                 && type->getNamespace() == "ssd.hpl.hp.com");
 }
 
+// Trains a zstd dictionary for each of the types on about 100 times
+// the dictionary size worth of its extents, as zstd recommends.
+map<string, string> trainDictionaries(const vector<string> &input_files,
+                                      const map<string, PerTypeWork *> &per_type_work,
+                                      size_t dictionary_bytes) {
+    map<string, string> ret;
+    for (map<string, PerTypeWork *>::const_iterator i = per_type_work.begin();
+         i != per_type_work.end(); ++i) {
+        TypeIndexModule sample_source(i->first);
+        for (vector<string>::const_iterator j = input_files.begin();
+             j != input_files.end(); ++j) {
+            sample_source.addSource(*j);
+        }
+        vector<Extent::Ptr> samples;
+        size_t sample_bytes = 0;
+        while (sample_bytes < 100 * dictionary_bytes) {
+            Extent::Ptr e = sample_source.getSharedExtent();
+            if (e == NULL) {
+                break;
+            }
+            sample_bytes += e->size();
+            samples.push_back(e);
+        }
+        string dictionary = Extent::trainCompressionDictionary(samples, dictionary_bytes);
+        if (dictionary.empty()) {
+            cerr << boost::format("Warning: unable to train a dictionary for type '%s'"
+                                  " from %d bytes of samples\n") % i->first % sample_bytes;
+        } else {
+            ret[i->first] = dictionary;
+        }
+    }
+    return ret;
+}
+
+void setDictionaries(DataSeriesSink &sink, const ExtentTypeLibrary &library,
+                     const map<string, string> &dictionaries) {
+    INVARIANT(dictionaries.empty() || sink.getFormatVersion() >= 2,
+              "--zstd-dictionary needs DATASERIES_FORMAT_VERSION=2, as DSv1 files never use zstd");
+    for (map<string, string>::const_iterator i = dictionaries.begin();
+         i != dictionaries.end(); ++i) {
+        sink.setCompressionDictionary(library.getTypeByNamePtr(i->first), i->second);
+    }
+}
+
 void usage(const string argv0, const string &error) {
-    FATAL_ERROR(boost::format("Error:%s\nUsage: %s [common-args] [--target-file-size=MiB] input-filename... output-filename\nCommon args:\n%s") 
+    FATAL_ERROR(boost::format("Error:%s\nUsage: %s [common-args] [--target-file-size=MiB] [--zstd-dictionary=KiB] input-filename... output-filename\nCommon args:\n%s") 
                 % error % argv0 % packingOptions());
 }
 
 // TODO: Split up main(), it's getting a bit large
 const string target_file_size_arg("--target-file-size=");
+const string zstd_dictionary_arg("--zstd-dictionary=");
 
 int main(int argc, char *argv[]) {
     
@@ -297,6 +355,7 @@ int main(int argc, char *argv[]) {
 
     LintelLog::parseEnv();
     uint64_t target_file_bytes = 0;
+    size_t dictionary_bytes = 0;
     commonPackingArgs packing_args;
     getPackingArgs(&argc,argv,&packing_args);
 
@@ -305,6 +364,14 @@ int main(int argc, char *argv[]) {
             double mib = stringToDouble(string(argv[1]).substr(target_file_size_arg.size()));
             INVARIANT(mib > 0, "max file size MiB must be > 0");
             target_file_bytes = static_cast<uint64_t>(mib * 1024.0 * 1024.0);
+        } else if (prefixequal(argv[1], zstd_dictionary_arg)) {
+            string kib_str(string(argv[1]).substr(zstd_dictionary_arg.size()));
+            int kib = stringToInteger<int32_t>(kib_str);
+            INVARIANT(kib > 0, "zstd dictionary KiB must be > 0");
+            INVARIANT(packing_args.compress_modes
+                      & Extent::compression_algs[Extent::compress_mode_zstd].compress_flag,
+                      "--zstd-dictionary needs zstd compression enabled");
+            dictionary_bytes = kib * 1024;
         } else if (string(argv[1]) == "--no-info") {
             generate_info_extent = false;
         } else if (string(argv[1]) == "--verbose" || string(argv[1]) == "-v") {
@@ -359,6 +426,8 @@ int main(int argc, char *argv[]) {
     DataSeriesSink *output = 
             new DataSeriesSink(output_path, packing_args.compress_modes,
                                packing_args.compress_level);
+    output->setCompressionBlockSize(packing_args.compress_block_size);
+    output->setCompressionPolicy(packing_args.compress_policy);
 
     uint32_t extent_count = 0;
     for (int i = 1; i < (argc-1); ++i) {
@@ -418,6 +487,12 @@ int main(int argc, char *argv[]) {
     // want a fair bit here in case we are writing big extents since 
     // during compression they use 2x the size.
     output->setMaxBytesInProgress(512*1024*1024); 
+    map<string, string> dictionaries;
+    if (dictionary_bytes > 0) {
+        dictionaries = trainDictionaries(vector<string>(argv + 1, argv + argc - 1),
+                                         per_type_work, dictionary_bytes);
+        setDictionaries(*output, library, dictionaries);
+    }
     output->writeExtentLibrary(library);
 
     DataSeriesSink::Stats all_stats;
@@ -479,6 +554,9 @@ int main(int argc, char *argv[]) {
                             new DataSeriesSink(output_path, 
                                                packing_args.compress_modes,
                                                packing_args.compress_level);
+                    new_output->setCompressionBlockSize(packing_args.compress_block_size);
+                    new_output->setCompressionPolicy(packing_args.compress_policy);
+                    setDictionaries(*new_output, library, dictionaries);
                     new_output->writeExtentLibrary(library);
                    
                     for (map<string, PerTypeWork *>::iterator i = per_type_work.begin();
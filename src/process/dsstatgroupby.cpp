@@ -22,8 +22,9 @@
   Two types of statistic types are currently implemented basic (mean, stddev, min, max), and quantile
   (percentile/100).  The expression implements the standard + - * / () and constants.  Two optional
   arguments can be added.  where I<expr> adds in a conditional expression so you could calculate 
-  separate statistics over large and small files.  group by <field> specifies a column that should be
-  used for grouping the statistics.
+  separate statistics over large and small files.  If there is only one statistic, its where
+  expression is also used to skip the extents whose zone maps show that they have no matching rows.
+  group by <field> specifies a column that should be used for grouping the statistics.
 
   =head1 DESCRIPTION
 
@@ -77,6 +78,7 @@ main(int argc, char *_argv[])
     SequenceModule seq(prefetch);
 
     uint32_t argpos;
+    vector<string> where_exprs;
     for (argpos = 2; argpos < argv.size();) {
         if (argv[argpos] == "from") 
             break;
@@ -108,6 +110,11 @@ main(int argc, char *_argv[])
 
         seq.addModule(new DSStatGroupByModule(seq.tail(), expr, group_by, 
                                               stat_type, where_expr));
+        where_exprs.push_back(where_expr);
+    }
+    if (where_exprs.size() == 1 && !where_exprs[0].empty()) {
+        // otherwise the other statistics would miss the skipped extents
+        source.addWhereFilter(where_exprs[0]);
     }
 
     if (argpos >= argv.size() || argv[argpos] != "from") {
@@ -26,6 +26,7 @@
 
 #include <DataSeries/DSExpr.hpp>
 #include <DataSeries/GeneralField.hpp>
+#include <DataSeries/Pipeline.hpp>
 #include <DataSeries/RowAnalysisModule.hpp>
 #include <DataSeries/SequenceModule.hpp>
 #include <DataSeries/TFixedField.hpp>
@@ -257,14 +258,13 @@ class DataSeriesServerHandler : public DataSeriesServerIf, public ThrowError {
 
         TypeIndexModule input(i->second.extent_type->getName());
         input.addSource(tableToPath(source_table));
-        DataSeriesModule *mod = &input;
-        DataSeriesModule::Ptr select_module;
+        Pipeline select(input);
         if (!where_expr.empty()) {
-            select_module = makeSelectModule(input, where_expr);
-            mod = select_module.get();
+            select.add(StreamOperator::Ptr(new SelectOperator(where_expr)));
         }
+        ExtentMergeModule merge(select);
 
-        DataSeriesModule::Ptr sink(makeTableDataModule(*mod, ret, max_rows));
+        DataSeriesModule::Ptr sink(makeTableDataModule(merge, ret, max_rows));
 
         sink->getAndDeleteShared();
     }
@@ -330,8 +330,10 @@ class DataSeriesServerHandler : public DataSeriesServerIf, public ThrowError {
         NameToInfo::iterator info = getTableInfo(in_table);
         TypeIndexModule input(info->second.extent_type->getName());
         input.addSource(tableToPath(in_table));
-        DataSeriesModule::Ptr select(makeSelectModule(input, where_expr));
-        DataSeriesModule::Ptr output_module = makeTeeModule(*select, tableToPath(out_table));
+        Pipeline select(input);
+        select.add(StreamOperator::Ptr(new SelectOperator(where_expr)));
+        ExtentMergeModule merge(select);
+        DataSeriesModule::Ptr output_module = makeTeeModule(merge, tableToPath(out_table));
 
         output_module->getAndDeleteShared();
         updateTableInfo(out_table, info->second.extent_type);
@@ -0,0 +1,109 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Test the asynchronous reads of compressed extents in IndexSourceModule.
+*/
+
+#include <stdlib.h>
+
+#include <iostream>
+
+#include <DataSeries/DataSeriesFile.hpp>
+#include <DataSeries/DataSeriesModule.hpp>
+#include <DataSeries/TypeIndexModule.hpp>
+
+using namespace std;
+using boost::format;
+
+const string type_xml =
+        "<ExtentType namespace=\"ssd.hpl.hp.com\" name=\"Test::AsyncRead%s\" version=\"1.0\">\n"
+        "  <field type=\"int64\" name=\"i64\" pack_relative=\"i64\" />\n"
+        "  <field type=\"variable32\" name=\"v32\" />\n"
+        "</ExtentType>\n";
+
+const unsigned nextents = 100;
+const unsigned nrecords = 1000;
+
+string v32Val(unsigned i) { return str(format("record %d") % (i % 100)); }
+
+// Writes nextents extents of type A; if interleave, each one is followed by
+// an extent of type B, so no two extents of type A are adjacent.
+void writeFile(const string &filename, bool interleave) {
+    ExtentTypeLibrary library;
+    const ExtentType::Ptr type_a = library.registerTypePtr(str(format(type_xml) % "A"));
+    const ExtentType::Ptr type_b = library.registerTypePtr(str(format(type_xml) % "B"));
+    DataSeriesSink sink(filename, Extent::compression_algs[Extent::compress_mode_lzf].compress_flag);
+    sink.writeExtentLibrary(library);
+    for (unsigned e = 0; e < nextents; ++e) {
+        for (unsigned t = 0; t < (interleave ? 2 : 1); ++t) {
+            ExtentSeries s(t == 0 ? type_a : type_b);
+            Extent::Ptr extent(new Extent(s.getTypePtr()));
+            s.setExtent(extent);
+            Int64Field i64(s, "i64");
+            Variable32Field v32(s, "v32");
+            for (unsigned i = e * nrecords; i < (e + 1) * nrecords; ++i) {
+                s.newRecord();
+                i64.set(t == 0 ? i : -1);
+                v32.set(v32Val(i));
+            }
+            sink.writeExtent(*extent, NULL);
+        }
+    }
+    sink.close();
+}
+
+void readFiles(const string &filename, unsigned nfiles, const string &engine,
+               unsigned max_reads, unsigned max_compressed) {
+    setenv("DATASERIES_READ_ENGINE", engine.c_str(), 1);
+    TypeIndexModule source("Test::AsyncReadA");
+    for (unsigned f = 0; f < nfiles; ++f) {
+        source.addSource(filename);
+    }
+    source.setMaxReadsInFlight(max_reads);
+    source.startPrefetching(max_compressed);
+
+    ExtentSeries s;
+    Int64Field i64(s, "i64");
+    Variable32Field v32(s, "v32");
+    unsigned i = 0;
+    while (Extent::Ptr e = source.getSharedExtent()) {
+        for (s.setExtent(e); s.more(); s.next(), ++i) {
+            unsigned expect = i % (nextents * nrecords);
+            SINVARIANT(i64.val() == expect && v32.stringval() == v32Val(expect));
+        }
+    }
+    SINVARIANT(i == nfiles * nextents * nrecords);
+
+    IndexSourceModule::WaitStats stats;
+    SINVARIANT(source.getWaitStats(stats));
+    SINVARIANT(stats.async_read_extents == nfiles * nextents);
+    cout << format("%s '%s' reads=%d compressed=%d: %d extents in %d reads\n")
+        % filename % engine % max_reads % max_compressed % stats.async_read_extents
+        % stats.async_reads;
+    if (filename == "async-read-interleaved.ds") {
+        SINVARIANT(stats.async_reads == stats.async_read_extents);
+    } else if (max_compressed >= 1024 * 1024) {
+        SINVARIANT(stats.async_reads < stats.async_read_extents);
+    }
+}
+
+int main() {
+    writeFile("async-read.ds", false);
+    writeFile("async-read-interleaved.ds", true);
+
+    // The default is io_uring if the kernel supports it
+    const char *engines[] = { "pread", "" };
+    for (unsigned e = 0; e < 2; ++e) {
+        readFiles("async-read.ds", 3, engines[e], 8, 8 * 1024 * 1024);
+        readFiles("async-read.ds", 1, engines[e], 1, 8 * 1024 * 1024);
+        readFiles("async-read.ds", 2, engines[e], 4, 16 * 1024);
+        readFiles("async-read-interleaved.ds", 2, engines[e], 8, 8 * 1024 * 1024);
+    }
+    cout << "Passed async read tests\n";
+    return 0;
+}
@@ -0,0 +1,223 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Test Bloom filters: DSv2 files carry a filter of the values of each
+    opt_bloom_filter field of each extent, and TypeIndexModule::addKeyFilter
+    skips the extents that can't have the keys.
+*/
+
+#include <algorithm>
+#include <iostream>
+
+#include <boost/assign/list_of.hpp>
+
+#include <DataSeries/DataSeriesFile.hpp>
+#include <DataSeries/DataSeriesModule.hpp>
+#include <DataSeries/TypeIndexModule.hpp>
+
+using namespace std;
+using boost::format;
+using boost::assign::list_of;
+using dataseries::BloomFilters;
+
+const string type_xml(
+        "<ExtentType namespace=\"ssd.hpl.hp.com\" name=\"Test::BloomFilters\" version=\"1.0\">\n"
+        "  <field type=\"int32\" name=\"extent\" />\n"
+        "  <field type=\"variable32\" name=\"handle\" opt_bloom_filter=\"yes\" />\n"
+        "  <field type=\"int64\" name=\"id\" opt_bloom_filter=\"yes\" />\n"
+        "  <field type=\"int32\" name=\"small\" opt_nullable=\"yes\" opt_bloom_filter=\"yes\" />\n"
+        "  <field type=\"variable32\" name=\"name\" />\n"
+        "</ExtentType>\n");
+
+const unsigned nextents = 20, nrecords = 500;
+
+string handle(unsigned i, unsigned j) {
+    return str(format("fh-%d-%d") % i % j);
+}
+
+int64_t id(unsigned i, unsigned j) {
+    return (static_cast<int64_t>(i) << 40) + j * 7919;
+}
+
+// small is null in the odd extents.
+void fill(ExtentSeries &s, unsigned i) {
+    Int32Field extent(s, "extent");
+    Variable32Field handle_field(s, "handle");
+    Int64Field id_field(s, "id");
+    Int32Field small(s, "small", Field::flag_nullable);
+    Variable32Field name(s, "name");
+    for (unsigned j = 0; j < nrecords; ++j) {
+        s.newRecord();
+        extent.set(i);
+        handle_field.set(handle(i, j));
+        id_field.set(id(i, j));
+        if (i % 2 == 1) {
+            small.setNull();
+        } else {
+            small.set(i);
+        }
+        name.set("x");
+    }
+}
+
+unsigned nwritten;
+
+// Neither of the summary extents is one of the extents the callback sees.
+void countWrite(off64_t offset, Extent &e) {
+    SINVARIANT(e.getTypePtr() != ExtentType::getDataSeriesBloomFilterTypePtr()
+               && e.getTypePtr() != ExtentType::getDataSeriesZoneMapTypePtr());
+    ++nwritten;
+}
+
+void writeFile(const string &filename, const ExtentTypeLibrary &library,
+               const ExtentType::Ptr type, uint32_t format_version) {
+    DataSeriesSink sink(filename, Extent::compression_algs[Extent::compress_mode_lzf].compress_flag);
+    sink.setFormatVersion(format_version);
+    nwritten = 0;
+    sink.setExtentWriteCallback(&countWrite);
+    sink.writeExtentLibrary(library);
+    for (unsigned i = 0; i < nextents; ++i) {
+        Extent::Ptr extent(new Extent(type));
+        ExtentSeries s(extent);
+        fill(s, i);
+        sink.writeExtent(*extent, NULL);
+    }
+    sink.close();
+    SINVARIANT(nwritten == 1 + nextents + 1); // the type library and the index
+}
+
+void testFalsePositives() {
+    BloomFilters::Filter filter;
+    filter.init(10000);
+    for (int64_t i = 0; i < 10000; ++i) {
+        filter.add(BloomFilters::Filter::hash(i));
+    }
+    unsigned false_positives = 0;
+    for (int64_t i = 0; i < 10000; ++i) {
+        SINVARIANT(filter.mayContain(BloomFilters::Filter::hash(i)));
+        if (filter.mayContain(BloomFilters::Filter::hash(i + 10000))) {
+            ++false_positives;
+        }
+    }
+    INVARIANT(false_positives < 200, format("%d false positives") % false_positives);
+
+    BloomFilters::Filter empty;
+    empty.init(0);
+    SINVARIANT(empty.bits.size() == 1 && !empty.mayContain(BloomFilters::Filter::hash(0)));
+}
+
+void checkFilters(const string &filename) {
+    DataSeriesSource source(filename);
+    const BloomFilters &filters(source.getBloomFilters());
+    SINVARIANT(!filters.empty());
+    ExtentSeries s(source.index_extent);
+    Int64Field offset(s, "offset");
+    Variable32Field extenttype(s, "extenttype");
+    unsigned i = 0;
+    for (; s.morerecords(); ++s) {
+        if (extenttype.stringval() != "Test::BloomFilters") {
+            SINVARIANT(filters.find(offset.val(), "handle") == NULL);
+            continue;
+        }
+        const BloomFilters::Filter *handles = filters.find(offset.val(), "handle");
+        const BloomFilters::Filter *ids = filters.find(offset.val(), "id");
+        const BloomFilters::Filter *small = filters.find(offset.val(), "small");
+        SINVARIANT(handles != NULL && ids != NULL && small != NULL);
+        SINVARIANT(filters.find(offset.val(), "extent") == NULL);
+        SINVARIANT(filters.find(offset.val(), "name") == NULL);
+        for (unsigned j = 0; j < nrecords; ++j) {
+            string h(handle(i, j));
+            SINVARIANT(handles->mayContain(BloomFilters::Filter::hash(h.data(), h.size())));
+            SINVARIANT(ids->mayContain(BloomFilters::Filter::hash(id(i, j))));
+        }
+        // an int32 is hashed as the int64 with the same value, and the
+        // nulls aren't in the filter
+        SINVARIANT(small->mayContain(BloomFilters::Filter::hash(i)) == (i % 2 == 0));
+        ++i;
+    }
+    SINVARIANT(i == nextents);
+}
+
+// Returns the extents returned with the filters.
+vector<int32_t> readFiltered(const string &filename, const vector<string> &handles,
+                             const vector<int64_t> &ids) {
+    TypeIndexModule module("Test::BloomFilters");
+    module.addSource(filename);
+    if (!handles.empty()) {
+        module.addKeyFilter("handle", handles);
+    }
+    if (!ids.empty()) {
+        module.addKeyFilter("id", ids);
+    }
+    vector<int32_t> ret;
+    while (Extent::Ptr e = module.getSharedExtent()) {
+        ExtentSeries s(e);
+        Int32Field extent(s, "extent");
+        ret.push_back(extent.val());
+    }
+    return ret;
+}
+
+bool contains(const vector<int32_t> &extents, int32_t extent) {
+    return find(extents.begin(), extents.end(), extent) != extents.end();
+}
+
+void testKeyFilter(const string &filename, bool have_filters) {
+    vector<string> no_handles;
+    vector<int64_t> no_ids;
+    // no extent is ever wrongly skipped; there may be a rare false positive
+    unsigned most = have_filters ? 2 : nextents, most_false = have_filters ? 1 : nextents;
+    vector<int32_t> got(readFiltered(filename, list_of(handle(7, 3)), no_ids));
+    SINVARIANT(contains(got, 7) && got.size() <= most);
+
+    got = readFiltered(filename, no_handles, list_of(id(12, 499)));
+    SINVARIANT(contains(got, 12) && got.size() <= most);
+
+    got = readFiltered(filename, list_of(handle(3, 0))(handle(15, 100))(handle(99, 1)), no_ids);
+    SINVARIANT(contains(got, 3) && contains(got, 15) && got.size() <= most + most_false);
+
+    // both filters have to match
+    got = readFiltered(filename, list_of(handle(3, 0))(handle(15, 100)), list_of(id(15, 0)));
+    SINVARIANT(contains(got, 15) && got.size() <= most);
+
+    got = readFiltered(filename, list_of(string("not-a-handle"))(handle(nextents, 0)), no_ids);
+    SINVARIANT(got.size() <= most_false);
+
+    TypeIndexModule module("Test::BloomFilters");
+    module.addSource(filename);
+    vector<int64_t> smalls(list_of(5)(6));
+    module.addKeyFilter("small", smalls);
+    unsigned n = 0;
+    while (Extent::Ptr e = module.getSharedExtent()) {
+        ExtentSeries s(e);
+        Int32Field extent(s, "extent");
+        SINVARIANT(!have_filters || extent.val() % 2 == 0);
+        ++n;
+    }
+    SINVARIANT(n >= 1 && n <= most);
+}
+
+int main() {
+    testFalsePositives();
+
+    ExtentTypeLibrary library;
+    const ExtentType::Ptr type = library.registerTypePtr(type_xml);
+    SINVARIANT(type->getBloomFilter("handle") && type->getBloomFilter("id")
+               && !type->getBloomFilter("name"));
+
+    writeFile("bloom-filters.ds", library, type, 2);
+    checkFilters("bloom-filters.ds");
+    testKeyFilter("bloom-filters.ds", true);
+
+    writeFile("bloom-filters-v1.ds", library, type, 1);
+    SINVARIANT(DataSeriesSource("bloom-filters-v1.ds").getBloomFilters().empty());
+    testKeyFilter("bloom-filters-v1.ds", false);
+
+    cout << "Passed Bloom filter tests\n";
+    return 0;
+}
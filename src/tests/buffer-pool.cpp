@@ -0,0 +1,132 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Test the pool that Extent::ByteArray allocates from.
+*/
+
+#include <iostream>
+
+#include <boost/bind.hpp>
+
+#include <Lintel/PThread.hpp>
+
+#include <DataSeries/BufferPool.hpp>
+#include <DataSeries/Extent.hpp>
+
+using namespace std;
+using dataseries::BufferPool;
+
+void checkSize(size_t request, size_t expect) {
+    size_t size = request;
+    uint8_t *buffer = BufferPool::allocate(&size);
+    INVARIANT(size == expect, boost::format("%d -> %d, not %d") % request % size % expect);
+    BufferPool::free(buffer, size);
+}
+
+void testSizeClasses() {
+    checkSize(100, 100);
+    checkSize(4096, 4096);
+    checkSize(4097, 5120);
+    checkSize(6000, 6144);
+    checkSize(8192, 8192);
+    checkSize(1000 * 1000, 1024 * 1024);
+    checkSize(BufferPool::max_pooled_size, BufferPool::max_pooled_size);
+    checkSize(BufferPool::max_pooled_size + 1, BufferPool::max_pooled_size + 1);
+    cout << "size classes ok\n";
+}
+
+void testReuse() {
+    BufferPool::Stats before = BufferPool::getStats();
+    size_t size = 300 * 1000;
+    uint8_t *a = BufferPool::allocate(&size);
+    BufferPool::free(a, size);
+    uint8_t *b = BufferPool::allocate(&size);
+    SINVARIANT(a == b);
+    BufferPool::free(b, size);
+
+    // ByteArrays reuse each other's memory
+    Extent::ByteArray x;
+    x.resize(200 * 1000);
+    Extent::byte *x_begin = x.begin();
+    x.clear();
+    Extent::ByteArray y;
+    y.resize(200 * 1000);
+    SINVARIANT(y.begin() == x_begin);
+
+    BufferPool::Stats after = BufferPool::getStats();
+    SINVARIANT(after.thread_hits >= before.thread_hits + 2);
+    cout << "reuse ok\n";
+}
+
+void freeBuffers(vector<uint8_t *> *buffers, size_t size) {
+    for (vector<uint8_t *>::iterator i = buffers->begin(); i != buffers->end(); ++i) {
+        BufferPool::free(*i, size);
+    }
+}
+
+// Buffers freed by one thread beyond its cache end up in the shared cache,
+// and get used by other threads; so do the ones it had when it exits.
+void testSpill() {
+    BufferPool::setCacheLimits(1024 * 1024, 128 * 1024 * 1024);
+    const size_t size = 256 * 1024;
+    vector<uint8_t *> buffers;
+    for (unsigned i = 0; i < 16; ++i) {
+        size_t tmp = size;
+        buffers.push_back(BufferPool::allocate(&tmp));
+        SINVARIANT(tmp == size);
+    }
+    BufferPool::Stats before = BufferPool::getStats();
+    PThreadFunction thread(boost::bind(freeBuffers, &buffers, size));
+    thread.start();
+    thread.join();
+
+    BufferPool::Stats after = BufferPool::getStats();
+    SINVARIANT(after.cached_bytes == before.cached_bytes + 16 * size);
+    vector<uint8_t *> reused;
+    for (unsigned i = 0; i < 16; ++i) {
+        size_t tmp = size;
+        reused.push_back(BufferPool::allocate(&tmp));
+        SINVARIANT(find(buffers.begin(), buffers.end(), reused.back()) != buffers.end());
+    }
+    SINVARIANT(BufferPool::getStats().shared_hits == after.shared_hits + 16);
+    freeBuffers(&reused, size);
+    cout << "spill ok\n";
+}
+
+void testDisabled() {
+    BufferPool::setCacheLimits(0, 0);
+    size_t size = 5000;
+    uint8_t *buffer = BufferPool::allocate(&size);
+    SINVARIANT(size == 5000);
+    Extent::ByteArray x;
+    x.resize(100 * 1000);
+    BufferPool::setCacheLimits(16 * 1024 * 1024, 128 * 1024 * 1024);
+    BufferPool::free(buffer, size); // not a class size, so not cached
+    cout << "disabled ok\n";
+}
+
+void testHugePages() {
+    BufferPool::setUseHugePages(true);
+    size_t size = BufferPool::max_pooled_size + 1; // can't be a cached buffer
+    uint8_t *buffer = BufferPool::allocate(&size);
+    SINVARIANT(reinterpret_cast<size_t>(buffer) % (2 * 1024 * 1024) == 0);
+    memset(buffer, 1, size);
+    BufferPool::free(buffer, size);
+    BufferPool::setUseHugePages(false);
+    cout << "huge pages ok\n";
+}
+
+int main() {
+    testSizeClasses();
+    testReuse();
+    testSpill();
+    testDisabled();
+    testHugePages();
+    cout << "Passed buffer pool tests\n";
+    return 0;
+}
@@ -0,0 +1,202 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Test the column() spans of the fixed fields, and RowAnalysisModules
+    that override processExtent() to use them.
+*/
+
+#include <sys/time.h>
+
+#include <iostream>
+
+#include <DataSeries/ByteField.hpp>
+#include <DataSeries/DataSeriesFile.hpp>
+#include <DataSeries/DoubleField.hpp>
+#include <DataSeries/Int32Field.hpp>
+#include <DataSeries/Int64Field.hpp>
+#include <DataSeries/RowAnalysisModule.hpp>
+#include <DataSeries/TypeIndexModule.hpp>
+
+using namespace std;
+using boost::format;
+using dataseries::ColumnSpan;
+
+const string type_xml(
+        "<ExtentType namespace=\"ssd.hpl.hp.com\" name=\"Test::ColumnSpan\" version=\"1.0\">\n"
+        "  <field type=\"bool\" name=\"flag\" />\n"
+        "  <field type=\"byte\" name=\"small\" />\n"
+        "  <field type=\"int32\" name=\"maybe\" opt_nullable=\"yes\" />\n"
+        "  <field type=\"int64\" name=\"bytes\" />\n"
+        "  <field type=\"double\" name=\"latency\" />\n"
+        "</ExtentType>\n");
+
+const unsigned nextents = 40, nrecords = 20000;
+
+void writeFile() {
+    ExtentTypeLibrary library;
+    const ExtentType::Ptr type(library.registerTypePtr(type_xml));
+    DataSeriesSink sink("column-span.ds",
+                        Extent::compression_algs[Extent::compress_mode_lzf].compress_flag);
+    sink.writeExtentLibrary(library);
+    for (unsigned i = 0; i < nextents; ++i) {
+        Extent::Ptr extent(new Extent(type));
+        ExtentSeries s(extent);
+        BoolField flag(s, "flag");
+        ByteField small(s, "small");
+        Int32Field maybe(s, "maybe", Field::flag_nullable);
+        Int64Field bytes(s, "bytes");
+        DoubleField latency(s, "latency");
+        for (unsigned j = 0; j < nrecords; ++j) {
+            s.newRecord();
+            flag.set(j % 2 == 0);
+            small.set(j % 200);
+            if (j % 5 == 3) {
+                maybe.setNull();
+            } else {
+                maybe.set(j * 3 - 1000);
+            }
+            bytes.set(static_cast<int64_t>(i) * 1000000 + j * 7);
+            latency.set(j * 0.25);
+        }
+        sink.writeExtent(*extent, NULL);
+    }
+    sink.close();
+}
+
+// The spans agree with val() and isNull() on every row.
+void checkSpans() {
+    TypeIndexModule source("Test::ColumnSpan");
+    source.addSource("column-span.ds");
+    ExtentSeries s;
+    ByteField small(s, "small");
+    Int32Field maybe(s, "maybe", Field::flag_nullable);
+    Int64Field bytes(s, "bytes");
+    DoubleField latency(s, "latency");
+    unsigned nnull = 0;
+    while (true) {
+        Extent::Ptr e = source.getSharedExtent();
+        if (e == NULL) {
+            break;
+        }
+        s.setExtent(e);
+        ColumnSpan<uint8_t> small_col(small.column());
+        ColumnSpan<int32_t> maybe_col(maybe.column(*e));
+        ColumnSpan<int64_t> bytes_col(bytes.column(*e));
+        ColumnSpan<double> latency_col(latency.column(*e));
+        SINVARIANT(bytes_col.size() == nrecords && !bytes_col.dense()
+                   && bytes_col.stride() == e->getTypePtr()->fixedrecordsize());
+        SINVARIANT(maybe_col.nullable() && !bytes_col.nullable());
+
+        vector<uint64_t> bitmap;
+        maybe_col.nullBitmap(bitmap);
+        SINVARIANT(bitmap.size() == (nrecords + 63) / 64);
+
+        int64_t maybe_sum = 0, small_sum = 0;
+        for (size_t row = 0; s.more(); s.next(), ++row) {
+            SINVARIANT(small_col[row] == small.val());
+            small_sum += small.val();
+            SINVARIANT(bytes_col[row] == bytes.val());
+            SINVARIANT(latency_col[row] == latency.val());
+            bool is_null = (bitmap[row / 64] >> (row % 64)) & 1;
+            SINVARIANT(maybe_col.isNull(row) == maybe.isNull() && is_null == maybe.isNull());
+            if (maybe.isNull()) {
+                ++nnull;
+            } else {
+                SINVARIANT(maybe_col[row] == maybe.val());
+                maybe_sum += maybe.val();
+            }
+        }
+        SINVARIANT(maybe_col.sum() == maybe_sum);
+        // far more than a byte holds
+        SINVARIANT(small_col.sum() == small_sum);
+    }
+    SINVARIANT(nnull == nextents * nrecords / 5);
+    cout << "spans match the fields\n";
+}
+
+class RowSum : public RowAnalysisModule {
+  public:
+    RowSum(DataSeriesModule &source)
+        : RowAnalysisModule(source), bytes(series, "bytes"),
+          maybe(series, "maybe", Field::flag_nullable), bytes_sum(0), maybe_sum(0) { }
+
+    virtual void processRow() {
+        bytes_sum += bytes.val();
+        if (!maybe.isNull()) {
+            maybe_sum += maybe.val();
+        }
+    }
+
+    Int64Field bytes;
+    Int32Field maybe;
+    int64_t bytes_sum, maybe_sum;
+};
+
+class ExtentSum : public RowSum {
+  public:
+    ExtentSum(DataSeriesModule &source) : RowSum(source) { }
+
+    virtual void processExtent(const Extent &e) {
+        ColumnSpan<int64_t> bytes_col(bytes.column(e));
+        bytes_sum += bytes_col.sum();
+        maybe_sum += maybe.column(e).sum();
+        processed_rows += bytes_col.size();
+    }
+};
+
+double now() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec * 1.0e-6;
+}
+
+// Reads the file into memory once, so the times are just the analysis.
+void compareSums() {
+    vector<Extent::Ptr> extents;
+    {
+        TypeIndexModule source("Test::ColumnSpan");
+        source.addSource("column-span.ds");
+        for (Extent::Ptr e = source.getSharedExtent(); e != NULL; e = source.getSharedExtent()) {
+            extents.push_back(e);
+        }
+    }
+
+    class Replay : public DataSeriesModule {
+      public:
+        Replay(const vector<Extent::Ptr> &extents) : extents(extents), pos(0) { }
+        virtual Extent::Ptr getSharedExtent() {
+            return pos < extents.size() ? extents[pos++] : Extent::Ptr();
+        }
+        const vector<Extent::Ptr> &extents;
+        size_t pos;
+    };
+
+    Replay row_source(extents), extent_source(extents);
+    RowSum row_sum(row_source);
+    ExtentSum extent_sum(extent_source);
+    double start = now();
+    row_sum.getAndDeleteShared();
+    double mid = now();
+    extent_sum.getAndDeleteShared();
+    double end = now();
+
+    SINVARIANT(row_sum.bytes_sum == extent_sum.bytes_sum);
+    SINVARIANT(row_sum.maybe_sum == extent_sum.maybe_sum);
+    SINVARIANT(row_sum.processed_rows == extent_sum.processed_rows
+               && row_sum.processed_rows == nextents * nrecords);
+    cerr << format("processRow %.3fs, processExtent %.3fs\n") % (mid - start) % (end - mid);
+    cout << "processExtent sums match processRow\n";
+}
+
+int main() {
+    writeFile();
+    checkSpans();
+    compareSums();
+    cout << "column-span tests passed\n";
+    return 0;
+}
@@ -0,0 +1,116 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Test DataSeriesSink::setDirectIO: files written with direct I/O, through
+    either write engine, are the same as ones written through the page cache.
+*/
+
+#include <stdlib.h>
+
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+#include <Lintel/MersenneTwisterRandom.hpp>
+
+#include <DataSeries/DataSeriesFile.hpp>
+#include <DataSeries/DataSeriesModule.hpp>
+#include <DataSeries/TypeIndexModule.hpp>
+
+using namespace std;
+using boost::format;
+
+const string type_xml(
+        "<ExtentType namespace=\"ssd.hpl.hp.com\" name=\"Test::DirectWrite\" version=\"1.0\">\n"
+        "  <field type=\"int64\" name=\"value\" />\n"
+        "  <field type=\"variable32\" name=\"name\" />\n"
+        "</ExtentType>\n");
+
+// uncompressed and random, so the big files span several staging buffers
+void writeFile(const string &filename, const ExtentTypeLibrary &library,
+               const ExtentType::Ptr type, bool direct, const char *engine,
+               unsigned nextents, unsigned nrecords) {
+    if (engine == NULL) {
+        unsetenv("DATASERIES_WRITE_ENGINE");
+    } else {
+        setenv("DATASERIES_WRITE_ENGINE", engine, 1);
+    }
+    DataSeriesSink sink(filename, Extent::compression_algs[Extent::compress_mode_none].compress_flag);
+    if (direct) {
+        sink.setDirectIO();
+    }
+    sink.setFormatVersion(2); // rewrites the header
+    sink.writeExtentLibrary(library);
+
+    MersenneTwisterRandom rng(1776);
+    for (unsigned i = 0; i < nextents; ++i) {
+        Extent::Ptr extent(new Extent(type));
+        ExtentSeries s(extent);
+        Int64Field value(s, "value");
+        Variable32Field name(s, "name");
+        for (unsigned j = 0; j < nrecords; ++j) {
+            s.newRecord();
+            value.set(rng.randLongLong());
+            name.set(str(format("%d-%d") % i % rng.randInt(1000000)));
+        }
+        sink.writeExtent(*extent, NULL);
+    }
+    sink.close();
+    unsetenv("DATASERIES_WRITE_ENGINE");
+}
+
+string readAll(const string &filename) {
+    ifstream in(filename.c_str(), ios::binary);
+    SINVARIANT(in.good());
+    return string(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+}
+
+void checkRecords(const string &filename, unsigned nextents, unsigned nrecords) {
+    TypeIndexModule source("Test::DirectWrite");
+    source.addSource(filename);
+    ExtentSeries s;
+    Int64Field value(s, "value");
+    unsigned count = 0;
+    while (true) {
+        Extent::Ptr e = source.getSharedExtent();
+        if (e == NULL) {
+            break;
+        }
+        for (s.setExtent(e); s.morerecords(); ++s) {
+            ++count;
+        }
+    }
+    SINVARIANT(count == nextents * nrecords);
+}
+
+void testDirectWrite(const ExtentTypeLibrary &library, const ExtentType::Ptr type,
+                     unsigned nextents, unsigned nrecords) {
+    writeFile("direct-write-buffered.ds", library, type, false, NULL, nextents, nrecords);
+    writeFile("direct-write-pwrite.ds", library, type, true, "pwrite", nextents, nrecords);
+    // io_uring when it is available, otherwise pwrite again
+    writeFile("direct-write-default.ds", library, type, true, NULL, nextents, nrecords);
+
+    string buffered(readAll("direct-write-buffered.ds"));
+    SINVARIANT(buffered.compare(0, 4, "DSv2") == 0);
+    SINVARIANT(readAll("direct-write-pwrite.ds") == buffered);
+    SINVARIANT(readAll("direct-write-default.ds") == buffered);
+    checkRecords("direct-write-default.ds", nextents, nrecords);
+    cout << format("%d extents, %d bytes: same with and without direct I/O\n")
+        % nextents % buffered.size();
+}
+
+int main() {
+    ExtentTypeLibrary library;
+    const ExtentType::Ptr type(library.registerTypePtr(type_xml));
+
+    testDirectWrite(library, type, 3, 10); // smaller than a block
+    testDirectWrite(library, type, 40, 20000); // many staging buffers
+
+    cout << "direct-write tests passed\n";
+    return 0;
+}
@@ -0,0 +1,210 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Test FanoutModule: each branch sees every extent of the source, in
+    order, and the analyses in the branches get the same results as in
+    one sequence.
+*/
+
+#include <iostream>
+
+#include <DataSeries/DataSeriesFile.hpp>
+#include <DataSeries/FanoutModule.hpp>
+#include <DataSeries/RowAnalysisModule.hpp>
+#include <DataSeries/TypeIndexModule.hpp>
+
+using namespace std;
+using boost::format;
+
+const string type_xml(
+        "<ExtentType namespace=\"ssd.hpl.hp.com\" name=\"Test::Fanout\" version=\"1.0\">\n"
+        "  <field type=\"int32\" name=\"key\" />\n"
+        "  <field type=\"int64\" name=\"value\" />\n"
+        "</ExtentType>\n");
+
+const unsigned nextents = 100, nrecords = 500;
+
+void writeFile() {
+    ExtentTypeLibrary library;
+    const ExtentType::Ptr type(library.registerTypePtr(type_xml));
+    DataSeriesSink sink("fanout.ds",
+                        Extent::compression_algs[Extent::compress_mode_lzf].compress_flag);
+    sink.writeExtentLibrary(library);
+    for (unsigned i = 0; i < nextents; ++i) {
+        Extent::Ptr extent(new Extent(type));
+        ExtentSeries s(extent);
+        Int32Field key(s, "key");
+        Int64Field value(s, "value");
+        for (unsigned j = 0; j < nrecords; ++j) {
+            s.newRecord();
+            key.set((i + j) % 13);
+            value.set(static_cast<int64_t>(i) * nrecords + j);
+        }
+        sink.writeExtent(*extent, NULL);
+    }
+    sink.close();
+}
+
+// Sums value for one key, and checks the rows arrive in order.
+class SumKey : public RowAnalysisModule {
+  public:
+    SumKey(DataSeriesModule &source, int32_t want)
+        : RowAnalysisModule(source), key(series, "key"), value(series, "value"),
+          want(want), sum(0), last(-1) { }
+
+    virtual void processRow() {
+        SINVARIANT(value.val() > last);
+        last = value.val();
+        if (key.val() == want) {
+            sum += value.val();
+        }
+    }
+
+    virtual void printResult() {
+        cout << format("key %d: sum %d\n") % want % sum;
+    }
+
+    Int32Field key;
+    Int64Field value;
+    int32_t want;
+    int64_t sum;
+    int64_t last;
+};
+
+// Remembers the extents it was given.
+class RecordExtents : public DataSeriesModule {
+  public:
+    RecordExtents(DataSeriesModule &source) : source(source) { }
+
+    virtual Extent::Ptr getSharedExtent() {
+        Extent::Ptr e = source.getSharedExtent();
+        if (e != NULL) {
+            seen.push_back(e.get());
+        }
+        return e;
+    }
+
+    DataSeriesModule &source;
+    vector<Extent *> seen;
+};
+
+// Stops after limit extents, like a module with a row limit, without
+// reading the rest of its source.
+class FirstExtents : public DataSeriesModule {
+  public:
+    FirstExtents(DataSeriesModule &source, unsigned limit)
+        : source(source), limit(limit), nread(0) { }
+
+    virtual Extent::Ptr getSharedExtent() {
+        if (nread == limit) {
+            return Extent::Ptr();
+        }
+        ++nread;
+        return source.getSharedExtent();
+    }
+
+    DataSeriesModule &source;
+    const unsigned limit;
+    unsigned nread;
+};
+
+// Branches that stop early, including all of them, don't hold back the
+// others or the reader.
+void testEarlyStop(unsigned max_lag) {
+    TypeIndexModule source("Test::Fanout");
+    source.addSource("fanout.ds");
+    FanoutModule fanout(source, max_lag);
+    SequenceModule &early(fanout.addBranch());
+    early.addModule(new FirstExtents(early.tail(), 3));
+    early.addModule(new RecordExtents(early.tail()));
+    SequenceModule &none(fanout.addBranch());
+    none.addModule(new FirstExtents(none.tail(), 0));
+    SequenceModule &full(fanout.addBranch());
+    full.addModule(new RecordExtents(full.tail()));
+
+    unsigned nread = 0;
+    while (fanout.getSharedExtent() != NULL) {
+        ++nread;
+    }
+    SINVARIANT(nread == nextents);
+    SINVARIANT(dynamic_cast<RecordExtents &>(early.tail()).seen.size() == 3);
+    SINVARIANT(dynamic_cast<RecordExtents &>(full.tail()).seen.size() == nextents);
+
+    TypeIndexModule all_source("Test::Fanout");
+    all_source.addSource("fanout.ds");
+    FanoutModule all_early(all_source, max_lag);
+    for (unsigned i = 0; i < 3; ++i) {
+        SequenceModule &branch(all_early.addBranch());
+        branch.addModule(new FirstExtents(branch.tail(), i));
+    }
+    nread = 0;
+    while (all_early.getSharedExtent() != NULL) {
+        ++nread;
+    }
+    SINVARIANT(nread == nextents);
+    cout << format("early stopping branches with max lag %d ok\n") % max_lag;
+}
+
+void testFanout(unsigned nbranches, unsigned max_lag) {
+    vector<int64_t> expected;
+    {
+        TypeIndexModule source("Test::Fanout");
+        source.addSource("fanout.ds");
+        SequenceModule sequence(new RecordExtents(source)); // the sequence owns its head
+        for (unsigned i = 0; i < nbranches; ++i) {
+            sequence.addModule(new SumKey(sequence.tail(), i));
+        }
+        sequence.getAndDeleteShared();
+        for (SequenceModule::iterator i = sequence.begin() + 1; i != sequence.end(); ++i) {
+            expected.push_back(dynamic_cast<SumKey &>(**i).sum);
+        }
+    }
+
+    TypeIndexModule source("Test::Fanout");
+    source.addSource("fanout.ds");
+    FanoutModule fanout(source, max_lag);
+    vector<SequenceModule *> branches;
+    for (unsigned i = 0; i < nbranches; ++i) {
+        SequenceModule &branch(fanout.addBranch());
+        branch.addModule(new RecordExtents(branch.tail()));
+        branch.addModule(new SumKey(branch.tail(), i));
+        branches.push_back(&branch);
+    }
+    vector<Extent *> read;
+    while (true) {
+        Extent::Ptr e = fanout.getSharedExtent();
+        if (e == NULL) {
+            break;
+        }
+        read.push_back(e.get());
+    }
+    SINVARIANT(read.size() == nextents);
+
+    for (unsigned i = 0; i < nbranches; ++i) {
+        SequenceModule::iterator mod = branches[i]->begin() + 1;
+        // the same extents, not copies
+        SINVARIANT(dynamic_cast<RecordExtents &>(**mod).seen == read);
+        ++mod;
+        SumKey &sum(dynamic_cast<SumKey &>(**mod));
+        SINVARIANT(sum.sum == expected[i] && sum.processed_rows == nextents * nrecords);
+    }
+    SINVARIANT(RowAnalysisModule::printAllResults(*branches.back(), 2) == 2);
+    cout << format("%d branches with max lag %d ok\n") % nbranches % max_lag;
+}
+
+int main() {
+    writeFile();
+    testFanout(1, 1);
+    testFanout(4, 1);
+    testFanout(6, 8);
+    testFanout(3, 1000);
+    testEarlyStop(1);
+    testEarlyStop(8);
+    cout << "fanout tests passed\n";
+    return 0;
+}
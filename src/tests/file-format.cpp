@@ -0,0 +1,145 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Test writing and reading DSv1 and DSv2 files, and packing extents
+    with either kind of checksum.
+*/
+
+#include <stdlib.h>
+
+#include <iostream>
+
+#include <DataSeries/DataSeriesFile.hpp>
+#include <DataSeries/DataSeriesModule.hpp>
+#include <DataSeries/TypeIndexModule.hpp>
+
+using namespace std;
+using boost::format;
+
+const string type_xml =
+        "<ExtentType namespace=\"ssd.hpl.hp.com\" name=\"Test::FileFormat\" version=\"1.0\">\n"
+        "  <field type=\"int64\" name=\"i64\" pack_relative=\"i64\" />\n"
+        "  <field type=\"int32\" name=\"i32\" opt_nullable=\"yes\" />\n"
+        "  <field type=\"variable32\" name=\"v32\" pack_unique=\"yes\" />\n"
+        "</ExtentType>\n";
+
+const unsigned nextents = 10;
+const unsigned nrecords = 5000;
+
+string v32Val(unsigned i) { return str(format("record %d") % (i % 1000)); }
+
+void fill(ExtentSeries &s, unsigned first) {
+    Int64Field i64(s, "i64");
+    Int32Field i32(s, "i32", Field::flag_nullable);
+    Variable32Field v32(s, "v32");
+    for (unsigned i = first; i < first + nrecords; ++i) {
+        s.newRecord();
+        i64.set(1000LL * i);
+        if (i % 3 == 0) {
+            i32.setNull();
+        } else {
+            i32.set(i);
+        }
+        v32.set(v32Val(i));
+    }
+}
+
+void check(ExtentSeries &s, unsigned first) {
+    Int64Field i64(s, "i64");
+    Int32Field i32(s, "i32", Field::flag_nullable);
+    Variable32Field v32(s, "v32");
+    unsigned i = first;
+    for (; s.more(); s.next(), ++i) {
+        SINVARIANT(i64.val() == 1000LL * i && v32.stringval() == v32Val(i));
+        SINVARIANT(i % 3 == 0 ? i32.isNull() : i32.val() == static_cast<int32_t>(i));
+    }
+    SINVARIANT(i == first + nrecords);
+}
+
+void testPackUnpack(const ExtentType::Ptr type, Extent::byte checksum_kind) {
+    ExtentSeries s(type);
+    Extent::Ptr e(new Extent(type));
+    s.setExtent(e);
+    fill(s, 0);
+
+    Extent::ByteArray packed;
+    uint32_t lzf = Extent::compression_algs[Extent::compress_mode_lzf].compress_flag;
+    e->packData(packed, lzf, 9, NULL, NULL, NULL, 0, NULL, 0, checksum_kind);
+    SINVARIANT(packed[6*4+3] == checksum_kind);
+
+    Extent::Ptr unpacked(new Extent(type));
+    unpacked->unpackData(packed, false);
+    s.setExtent(unpacked);
+    check(s, 0);
+}
+
+void writeFile(const string &filename, const ExtentTypeLibrary &library,
+               const ExtentType::Ptr type, int format_version) {
+    DataSeriesSink sink(filename, Extent::compression_algs[Extent::compress_mode_lzf].compress_flag);
+    if (format_version > 0) {
+        sink.setFormatVersion(format_version);
+    }
+    sink.writeExtentLibrary(library);
+    for (unsigned e = 0; e < nextents; ++e) {
+        ExtentSeries s(type);
+        Extent::Ptr extent(new Extent(type));
+        s.setExtent(extent);
+        fill(s, e * nrecords);
+        sink.writeExtent(*extent, NULL);
+    }
+    sink.close();
+}
+
+// Checks the file header says DSv<version>, and that the extents were
+// written with the matching checksums.
+void readFile(const string &filename, char version) {
+    // the file header, then the type extent's header
+    FILE *f = fopen(filename.c_str(), "r");
+    SINVARIANT(f != NULL);
+    char header[2*4 + 4*8 + 6*4 + 4];
+    SINVARIANT(fread(header, 1, sizeof(header), f) == sizeof(header));
+    fclose(f);
+    INVARIANT(string(header, 4) == string("DSv") + version,
+              format("%s: expected DSv%c, got %s") % filename % version % string(header, 4));
+    SINVARIANT(header[sizeof(header) - 1]
+               == (version == '1' ? Extent::checksum_v1 : Extent::checksum_crc32c));
+
+    TypeIndexModule module("Test::FileFormat");
+    module.addSource(filename);
+    ExtentSeries s;
+    unsigned e = 0;
+    for (; Extent::Ptr extent = module.getSharedExtent(); ++e) {
+        s.setExtent(extent);
+        check(s, e * nrecords);
+    }
+    SINVARIANT(e == nextents);
+}
+
+int main() {
+    Extent::setReadChecksFromEnv(true);
+    ExtentTypeLibrary library;
+    const ExtentType::Ptr type = library.registerTypePtr(type_xml);
+
+    testPackUnpack(type, Extent::checksum_v1);
+    testPackUnpack(type, Extent::checksum_crc32c);
+
+    writeFile("file-format-default.ds", library, type, 0);
+    readFile("file-format-default.ds", '1');
+    writeFile("file-format-v1.ds", library, type, 1);
+    readFile("file-format-v1.ds", '1');
+    writeFile("file-format-v2.ds", library, type, 2);
+    readFile("file-format-v2.ds", '2');
+
+    setenv("DATASERIES_FORMAT_VERSION", "2", 1);
+    writeFile("file-format-env.ds", library, type, 0);
+    readFile("file-format-env.ds", '2');
+    unsetenv("DATASERIES_FORMAT_VERSION");
+
+    cout << "Passed file format tests\n";
+    return 0;
+}
@@ -0,0 +1,139 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Test reading extents from a mapped file with DataSeriesSource::setUseMmap.
+*/
+
+#include <stdlib.h>
+
+#include <iostream>
+
+#include <DataSeries/DataSeriesFile.hpp>
+#include <DataSeries/DataSeriesModule.hpp>
+#include <DataSeries/TypeIndexModule.hpp>
+
+using namespace std;
+using boost::format;
+
+const string plain_xml =
+        "<ExtentType namespace=\"ssd.hpl.hp.com\" name=\"Test::MmapPlain\" version=\"1.0\">\n"
+        "  <field type=\"int64\" name=\"i64\" />\n"
+        "  <field type=\"int32\" name=\"i32\" />\n"
+        "  <field type=\"variable32\" name=\"v32\" />\n"
+        "</ExtentType>\n";
+
+const string relative_xml =
+        "<ExtentType namespace=\"ssd.hpl.hp.com\" name=\"Test::MmapRelative\" version=\"1.0\">\n"
+        "  <field type=\"int64\" name=\"i64\" pack_relative=\"i64\" />\n"
+        "  <field type=\"int32\" name=\"i32\" />\n"
+        "  <field type=\"variable32\" name=\"v32\" />\n"
+        "</ExtentType>\n";
+
+const unsigned nextents = 5;
+const unsigned nrecords = 10000;
+
+int64_t i64Val(unsigned i) { return 1000LL * i + (i % 7); }
+string v32Val(unsigned i) { return str(format("record %d") % (i % 100)); }
+
+void writeFile(const string &filename, uint32_t compression_modes) {
+    ExtentTypeLibrary library;
+    const ExtentType::Ptr plain = library.registerTypePtr(plain_xml);
+    const ExtentType::Ptr relative = library.registerTypePtr(relative_xml);
+    DataSeriesSink sink(filename, compression_modes);
+    sink.setFormatVersion(2); // for the zone map extent
+    sink.writeExtentLibrary(library);
+    for (unsigned e = 0; e < 2 * nextents; ++e) {
+        ExtentSeries s(e % 2 == 0 ? plain : relative);
+        Extent::Ptr extent(new Extent(s.getTypePtr()));
+        s.setExtent(extent);
+        Int64Field i64(s, "i64");
+        Int32Field i32(s, "i32");
+        Variable32Field v32(s, "v32");
+        for (unsigned i = (e / 2) * nrecords; i < (e / 2 + 1) * nrecords; ++i) {
+            s.newRecord();
+            i64.set(i64Val(i));
+            i32.set(i);
+            v32.set(v32Val(i));
+        }
+        sink.writeExtent(*extent, NULL);
+    }
+    sink.close();
+}
+
+void checkExtent(const Extent::Ptr &e, unsigned first) {
+    ExtentSeries s(e);
+    Int64Field i64(s, "i64");
+    Int32Field i32(s, "i32");
+    Variable32Field v32(s, "v32");
+    unsigned i = first;
+    for (; s.more(); s.next(), ++i) {
+        SINVARIANT(i64.val() == i64Val(i) && i32.val() == static_cast<int32_t>(i)
+                   && v32.stringval() == v32Val(i));
+    }
+    SINVARIANT(i == first + nrecords);
+}
+
+// Reads the file with a mapped source; returns the number of extents whose
+// data stayed in the mapping, which includes the relative packed ones.
+unsigned readMapped(const string &filename) {
+    DataSeriesSource source(filename);
+    source.setUseMmap(true);
+    unsigned borrowed = 0;
+    for (unsigned e = 0; e < 2 * nextents; ++e) {
+        Extent::Ptr extent(source.readExtent());
+        SINVARIANT(extent != NULL);
+        checkExtent(extent, (e / 2) * nrecords);
+        if (extent->fixeddata.getOwner() != NULL) {
+            ++borrowed;
+            SINVARIANT(extent->variabledata.getOwner() != NULL);
+        }
+
+        // Changes go to private copies; growing the extent copies it out.
+        ExtentSeries s(extent);
+        Int32Field i32(s, "i32");
+        i32.set(-1);
+        s.newRecord();
+        i32.set(-2);
+        SINVARIANT(extent->fixeddata.getOwner() == NULL);
+    }
+    Extent::Ptr zone_map(source.readExtent());
+    SINVARIANT(zone_map != NULL
+               && zone_map->getTypePtr() == ExtentType::getDataSeriesZoneMapTypePtr());
+    Extent::Ptr index(source.readExtent());
+    SINVARIANT(index != NULL
+               && index->getTypePtr() == ExtentType::getDataSeriesIndexTypeV0Ptr());
+    SINVARIANT(source.readExtent() == NULL);
+    return borrowed;
+}
+
+int main() {
+    writeFile("mmap-source-none.ds", 0);
+    SINVARIANT(readMapped("mmap-source-none.ds") == 2 * nextents);
+    // the changes to the mapped extents must not have changed the file
+    SINVARIANT(readMapped("mmap-source-none.ds") == 2 * nextents);
+
+    uint32_t lzf = Extent::compression_algs[Extent::compress_mode_lzf].compress_flag;
+    writeFile("mmap-source-lzf.ds", lzf);
+    SINVARIANT(readMapped("mmap-source-lzf.ds") == 0);
+
+    // Extents mapped in the prefetch thread outlive their source.
+    setenv("DATASERIES_READ_MMAP", "1", 1);
+    TypeIndexModule source("Test::MmapPlain");
+    source.addSource("mmap-source-none.ds");
+    vector<Extent::Ptr> extents;
+    while (Extent::Ptr e = source.getSharedExtent()) {
+        SINVARIANT(e->fixeddata.getOwner() != NULL);
+        extents.push_back(e);
+    }
+    SINVARIANT(extents.size() == nextents);
+    for (unsigned e = 0; e < nextents; ++e) {
+        checkExtent(extents[e], e * nrecords);
+    }
+    cout << "Passed mmap source tests\n";
+    return 0;
+}
@@ -0,0 +1,169 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Test pack_bitwidth="auto" fields: the values survive packing with
+    either layout and every kernel level, and the file shrinks.
+*/
+
+#include <iostream>
+#include <limits>
+
+#include <Lintel/MersenneTwisterRandom.hpp>
+
+#include <DataSeries/DataSeriesFile.hpp>
+#include <DataSeries/DataSeriesModule.hpp>
+#include <DataSeries/TypeIndexModule.hpp>
+
+#include <base/PackKernels.hpp>
+
+#include "pack-test-util.hpp"
+
+using namespace std;
+using boost::format;
+using namespace dataseries;
+
+const string type_xml(
+        "<ExtentType namespace=\"ssd.hpl.hp.com\" name=\"Test::PackBitwidth\" version=\"1.0\"%s>\n"
+        "  <field type=\"int32\" name=\"small\" pack_bitwidth=\"auto\" />\n"
+        "  <field type=\"int32\" name=\"negative\" pack_bitwidth=\"auto\" opt_nullable=\"yes\" />\n"
+        "  <field type=\"int32\" name=\"constant\" pack_bitwidth=\"auto\" />\n"
+        "  <field type=\"int64\" name=\"time\" pack_relative=\"time\" pack_bitwidth=\"auto\" />\n"
+        "  <field type=\"int64\" name=\"wide\" pack_bitwidth=\"auto\" />\n"
+        "  <field type=\"byte\" name=\"byte\" pack_bitwidth=\"auto\" />\n"
+        "  <field type=\"bool\" name=\"flag\" />\n"
+        "  <field type=\"double\" name=\"dbl\" />\n"
+        "  <field type=\"variable32\" name=\"v32\" pack_unique=\"yes\" />\n"
+        "</ExtentType>\n");
+
+string typeXml(bool bitwidth, bool columnar) {
+    string ret(str(format(type_xml) % (columnar ? " pack_layout=\"columnar\"" : "")));
+    return bitwidth ? ret : plainTypeXml(ret, "pack_bitwidth", "PackBitwidth");
+}
+
+const int64_t wide_values[] = { numeric_limits<int64_t>::min(), numeric_limits<int64_t>::max(),
+                                -1, 0 };
+
+void fill(ExtentSeries &s, unsigned nrecords, unsigned seed) {
+    Int32Field small(s, "small");
+    Int32Field negative(s, "negative", Field::flag_nullable);
+    Int32Field constant(s, "constant");
+    Int64Field time(s, "time");
+    Int64Field wide(s, "wide");
+    ByteField byte(s, "byte");
+    BoolField flag(s, "flag");
+    DoubleField dbl(s, "dbl");
+    Variable32Field v32(s, "v32");
+
+    MersenneTwisterRandom rng(seed);
+    int64_t base = 1000000000LL * seed;
+    for (unsigned i = 0; i < nrecords; ++i) {
+        s.newRecord();
+        base += rng.randInt(100000);
+        small.set(rng.randInt(1000));
+        if (rng.randInt(4) == 0) {
+            negative.setNull();
+        } else {
+            negative.set(-static_cast<int32_t>(rng.randInt(70000)));
+        }
+        constant.set(42);
+        time.set(base);
+        // mostly narrow, with an occasional block needing all 64 bits
+        wide.set(i % 3000 == 7 ? wide_values[(i / 3000) % 4] : rng.randInt(16));
+        byte.set(rng.randInt(256));
+        flag.set(rng.randInt(2) == 0);
+        dbl.set(rng.randDouble());
+        v32.set(str(format("value-%d") % rng.randInt(50)));
+    }
+}
+
+// Packs with the scalar kernels, and checks every level unpacks the
+// original records and packs identical bytes.
+void testPackUnpack(unsigned nrecords, bool columnar) {
+    const ExtentType::Ptr type
+            (ExtentTypeLibrary::sharedExtentTypePtr(typeXml(true, columnar)));
+    Extent::Ptr expect(expectedExtent(fill, ExtentTypeLibrary::sharedExtentTypePtr
+                                      (typeXml(false, columnar)), nrecords, 1));
+    Extent::Ptr e(new Extent(type));
+    ExtentSeries s(e);
+    fill(s, nrecords, 1);
+
+    SINVARIANT(pack_kernels::setLevel(pack_kernels::LevelScalar));
+    Extent::ByteArray scalar_packed;
+    e->packData(scalar_packed, 0, 0, NULL, NULL, NULL);
+    for (int l = pack_kernels::LevelScalar; l <= pack_kernels::LevelAVX2; ++l) {
+        if (!pack_kernels::setLevel(static_cast<pack_kernels::Level>(l))) {
+            continue;
+        }
+        Extent::ByteArray packed;
+        e->packData(packed, 0, 0, NULL, NULL, NULL);
+        SINVARIANT(sameBytes(packed, scalar_packed));
+
+        Extent::Ptr unpacked(new Extent(type));
+        unpacked->unpackData(packed, false);
+        SINVARIANT(sameData(*unpacked, *expect));
+    }
+    SINVARIANT(pack_kernels::setLevel(pack_kernels::LevelScalar));
+}
+
+// Every width from 0 to 64, at every offset in the first words.
+void testKernels() {
+    vector<int64_t> values(300), got(values.size());
+    vector<uint64_t> words(values.size() + 1);
+    MersenneTwisterRandom rng(64);
+    for (unsigned width = 0; width <= 64; ++width) {
+        for (unsigned i = 0; i < values.size(); ++i) {
+            uint64_t v = rng.randLongLong();
+            values[i] = width == 64 ? v : -5 + static_cast<int64_t>(v & ((1ULL << width) - 1));
+        }
+        values[0] = -5; // the reference
+        for (int l = pack_kernels::LevelScalar; l <= pack_kernels::LevelAVX2; ++l) {
+            const pack_kernels::Kernels *k
+                    = pack_kernels::kernels(static_cast<pack_kernels::Level>(l));
+            if (k == NULL) {
+                continue;
+            }
+            for (uint32_t n = 0; n <= values.size(); n += (n < 20 ? 1 : 37)) {
+                int64_t reference;
+                unsigned got_width = k->bitPack8(reinterpret_cast<uint8_t *>(&values[0]), 8, n,
+                                                 &reference, &words[0]);
+                SINVARIANT(got_width <= width);
+                got.assign(got.size(), 0);
+                k->bitUnpack8(&words[0], got_width, reference,
+                              reinterpret_cast<uint8_t *>(&got[0]), 8, n);
+                SINVARIANT(equal(values.begin(), values.begin() + n, got.begin()));
+            }
+        }
+    }
+}
+
+int main() {
+    Extent::setReadChecksFromEnv(true);
+    testKernels();
+    unsigned sizes[] = { 0, 1, 17, 1023, 1024, 1025, 10000 };
+    for (unsigned i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        testPackUnpack(sizes[i], false);
+        testPackUnpack(sizes[i], true);
+    }
+
+    ExtentTypeLibrary library;
+    const ExtentType::Ptr type = library.registerTypePtr(typeXml(true, false));
+    const ExtentType::Ptr plain_type = library.registerTypePtr(typeXml(false, false));
+    SINVARIANT(type->hasBitwidthFields() && !plain_type->hasBitwidthFields());
+    // the bit-packed fields are in the same place in the unpacked records
+    SINVARIANT(type->fixedrecordsize() == plain_type->fixedrecordsize());
+
+    off64_t bitwidth_size = writePackTestFile("pack-bitwidth.ds", library, type, fill, 5, 10000);
+    off64_t plain_size = writePackTestFile("pack-bitwidth-plain.ds", library, plain_type, fill,
+                                           5, 10000);
+    INVARIANT(bitwidth_size < plain_size, format("%d >= %d") % bitwidth_size % plain_size);
+    cout << format("bitwidth %d bytes, plain %d bytes\n") % bitwidth_size % plain_size;
+    checkPackTestFile("pack-bitwidth.ds", type, plain_type, fill, 5, 10000);
+
+    cout << "Passed pack bitwidth tests\n";
+    return 0;
+}
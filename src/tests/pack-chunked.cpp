@@ -0,0 +1,88 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Test packing extents with the fixed and variable data split into
+    independently compressed blocks.
+*/
+
+#include <iostream>
+
+#include <DataSeries/Extent.hpp>
+#include <DataSeries/ExtentField.hpp>
+
+#include "pack-test-util.hpp"
+
+using namespace std;
+using boost::format;
+
+const string fields_xml =
+        "  <field type=\"int64\" name=\"i64\" pack_relative=\"i64\" />\n"
+        "  <field type=\"int32\" name=\"i32\" opt_nullable=\"yes\" />\n"
+        "  <field type=\"variable32\" name=\"v32\" />\n"
+        "</ExtentType>\n";
+
+Extent::Ptr makeExtent(unsigned nrecords, const string &null_compact) {
+    string xml(str(format("<ExtentType name=\"Test::Chunked-%s\" pack_null_compact=\"%s\">\n")
+                   % null_compact % null_compact));
+    const ExtentType::Ptr type(ExtentTypeLibrary::sharedExtentTypePtr(xml + fields_xml));
+    Extent::Ptr e(new Extent(type));
+    ExtentSeries s(e);
+    Int64Field i64(s, "i64");
+    Int32Field i32(s, "i32", Field::flag_nullable);
+    Variable32Field v32(s, "v32");
+
+    for (unsigned i = 0; i < nrecords; ++i) {
+        s.newRecord();
+        i64.set(1000000LL * i + (i % 13));
+        if (i % 7 == 0) {
+            i32.setNull();
+        } else {
+            i32.set(i * 31);
+        }
+        v32.set(str(format("record %d of %d") % i % nrecords));
+    }
+    return e;
+}
+
+void testChunked(unsigned nrecords, uint32_t compression_modes, uint32_t block_size,
+                 const string &null_compact = "no") {
+    Extent::Ptr expect(makeExtent(nrecords, null_compact));
+    Extent::Ptr e(makeExtent(nrecords, null_compact));
+
+    Extent::ByteArray packed;
+    uint32_t fixed_packed;
+    e->packData(packed, compression_modes, 1, NULL, &fixed_packed, NULL, block_size);
+    bool fixed_chunked = fixed_packed > block_size;
+    bool variable_chunked = expect->variabledata.size() - 4 > block_size;
+    SINVARIANT(((packed[6*4] & Extent::compress_mode_chunked) != 0) == fixed_chunked);
+    SINVARIANT(((packed[6*4+1] & Extent::compress_mode_chunked) != 0) == variable_chunked);
+
+    if (!fixed_chunked && !variable_chunked) {
+        Extent::ByteArray unchunked;
+        e->packData(unchunked, compression_modes, 1, NULL, NULL, NULL, 0);
+        SINVARIANT(sameBytes(packed, unchunked));
+    }
+
+    e->unpackData(packed, false);
+    SINVARIANT(sameBytes(e->fixeddata, expect->fixeddata));
+    SINVARIANT(sameBytes(e->variabledata, expect->variabledata));
+}
+
+int main() {
+    uint32_t lzf = Extent::compression_algs[Extent::compress_mode_lzf].compress_flag;
+    uint32_t zlib = Extent::compression_algs[Extent::compress_mode_zlib].compress_flag;
+
+    testChunked(10, lzf, 64*1024);
+    testChunked(100000, 0, 64*1024);
+    testChunked(100000, lzf, 64*1024);
+    testChunked(100000, zlib | lzf, 100000);
+    testChunked(100000, Extent::compress_all, 1024*1024);
+    testChunked(100000, lzf, 64*1024, "non_bool");
+    cout << "Passed chunked packing tests\n";
+    return 0;
+}
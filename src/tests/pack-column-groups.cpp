@@ -0,0 +1,210 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Test column groups: extents unpack to the same records as without
+    them, and unpacking a subset of the columns leaves the others out.
+*/
+
+#include <algorithm>
+#include <iostream>
+
+#include <boost/assign/list_of.hpp>
+
+#include <Lintel/MersenneTwisterRandom.hpp>
+
+#include <DataSeries/DataSeriesFile.hpp>
+#include <DataSeries/DataSeriesModule.hpp>
+#include <DataSeries/TypeIndexModule.hpp>
+
+#include "pack-test-util.hpp"
+
+using namespace std;
+using boost::format;
+using boost::assign::list_of;
+
+const string type_xml(
+        "<ExtentType namespace=\"ssd.hpl.hp.com\" name=\"Test::ColumnGroups\" version=\"1.0\"%s>\n"
+        "  <field type=\"int64\" name=\"time\" pack_relative=\"time\" pack_group=\"time\" />\n"
+        "  <field type=\"int64\" name=\"latency\" pack_relative=\"time\" pack_group=\"latency\" />\n"
+        "  <field type=\"int32\" name=\"small\" pack_group=\"latency\" />\n"
+        "  <field type=\"double\" name=\"dbl\" opt_nullable=\"yes\" />\n"
+        "  <field type=\"bool\" name=\"flag\" />\n"
+        "  <field type=\"byte\" name=\"op\" />\n"
+        "  <field type=\"variable32\" name=\"path\" pack_unique=\"yes\" pack_group=\"path\" />\n"
+        "</ExtentType>\n");
+
+string typeXml(bool groups, bool auto_groups) {
+    string ret(str(format(type_xml) % (auto_groups ? " pack_column_groups=\"auto\"" : "")));
+    return groups ? ret : plainTypeXml(ret, "pack_group", "ColumnGroups");
+}
+
+void fill(ExtentSeries &s, unsigned nrecords, unsigned seed) {
+    Int64Field time(s, "time");
+    Int64Field latency(s, "latency");
+    Int32Field small(s, "small");
+    DoubleField dbl(s, "dbl", Field::flag_nullable);
+    BoolField flag(s, "flag");
+    ByteField op(s, "op");
+    Variable32Field path(s, "path");
+
+    MersenneTwisterRandom rng(seed);
+    int64_t t = 1000000000LL * seed;
+    for (unsigned i = 0; i < nrecords; ++i) {
+        s.newRecord();
+        t += rng.randInt(100000);
+        time.set(t);
+        latency.set(t + rng.randInt(5000));
+        small.set(rng.randInt(1000));
+        if (rng.randInt(4) == 0) {
+            dbl.setNull();
+        } else {
+            dbl.set(rng.randDouble());
+        }
+        flag.set(rng.randInt(2) == 0);
+        op.set(rng.randInt(20));
+        path.set(str(format("/home/user%d/file-%d") % rng.randInt(10) % rng.randInt(100)));
+    }
+}
+
+bool selected(const vector<string> &columns, const string &column) {
+    return columns.empty() || find(columns.begin(), columns.end(), column) != columns.end();
+}
+
+// Checks got has the columns it should: the selected ones (and time,
+// which latency is relative to), the ones sharing their groups, and the
+// ones in group 0, which is always unpacked.
+void checkColumns(const Extent::Ptr &got, const Extent::Ptr &expect, const vector<string> &columns,
+                  bool auto_groups) {
+    ExtentSeries g(got), e(expect);
+    Int64Field g_time(g, "time"), e_time(e, "time");
+    Int64Field g_latency(g, "latency"), e_latency(e, "latency");
+    Int32Field g_small(g, "small"), e_small(e, "small");
+    DoubleField g_dbl(g, "dbl", Field::flag_nullable), e_dbl(e, "dbl", Field::flag_nullable);
+    BoolField g_flag(g, "flag"), e_flag(e, "flag");
+    ByteField g_op(g, "op"), e_op(e, "op");
+    Variable32Field g_path(g, "path"), e_path(e, "path");
+
+    bool latency = selected(columns, "latency");
+    bool time = latency || selected(columns, "time");
+    bool small = selected(columns, "small") || latency;
+    // the fields without a pack_group only get their own with auto
+    bool dbl = !auto_groups || selected(columns, "dbl");
+    bool op = !auto_groups || selected(columns, "op");
+    bool path = selected(columns, "path");
+    SINVARIANT(got->nRecords() == expect->nRecords());
+    for (; g.morerecords(); ++g, ++e) {
+        SINVARIANT(g_time.val() == (time ? e_time.val() : 0));
+        if (latency) {
+            SINVARIANT(g_latency.val() == e_latency.val());
+        }
+        SINVARIANT(g_small.val() == (small ? e_small.val() : 0));
+        SINVARIANT(g_dbl.isNull() == e_dbl.isNull()); // the null bits are in group 0
+        SINVARIANT(g_dbl.val() == (dbl ? e_dbl.val() : 0));
+        SINVARIANT(g_flag.val() == e_flag.val());
+        SINVARIANT(g_op.val() == (op ? e_op.val() : 0));
+        SINVARIANT(g_path.stringval() == (path ? e_path.stringval() : string()));
+    }
+}
+
+void testPackUnpack(unsigned nrecords, bool auto_groups, uint32_t block_size) {
+    const ExtentType::Ptr type
+            (ExtentTypeLibrary::sharedExtentTypePtr(typeXml(true, auto_groups)));
+    SINVARIANT(type->hasColumnGroups());
+    Extent::Ptr expect(expectedExtent(fill, ExtentTypeLibrary::sharedExtentTypePtr
+                                      (typeXml(false, false)), nrecords, 1));
+    Extent::Ptr e(new Extent(type));
+    ExtentSeries s(e);
+    fill(s, nrecords, 1);
+
+    uint32_t lzf = Extent::compression_algs[Extent::compress_mode_lzf].compress_flag;
+    Extent::ByteArray packed;
+    e->packData(packed, lzf, 9, NULL, NULL, NULL, block_size);
+    SINVARIANT((packed[6*4] & Extent::compress_mode_grouped) != 0);
+    Extent::Ptr unpacked(new Extent(type));
+    unpacked->unpackData(packed, false);
+    SINVARIANT(sameData(*unpacked, *expect));
+
+    vector<vector<string> > selections;
+    selections.push_back(list_of("latency"));
+    selections.push_back(list_of("small")("flag"));
+    selections.push_back(list_of("path")("op"));
+    selections.push_back(list_of("dbl")("not-a-column"));
+    for (unsigned i = 0; i < selections.size(); ++i) {
+        ExtentType::ColumnSelection selection(type->selectColumns(selections[i]));
+        SINVARIANT(selection.groups.size() > 1 && selection.groups[0]);
+        SINVARIANT(selection.variable == selected(selections[i], "path"));
+        e->packData(packed, lzf, 9, NULL, NULL, NULL, block_size);
+        unpacked.reset(new Extent(type));
+        unpacked->unpackData(packed, false, &selection);
+        checkColumns(unpacked, expect, selections[i], auto_groups);
+    }
+}
+
+// Any type can leave out the variable data.
+void testSkipVariable() {
+    const ExtentType::Ptr type(ExtentTypeLibrary::sharedExtentTypePtr(typeXml(false, false)));
+    SINVARIANT(!type->hasColumnGroups());
+    Extent::Ptr expect(expectedExtent(fill, type, 1000, 2));
+    Extent::Ptr e(expectedExtent(fill, type, 1000, 2));
+    Extent::ByteArray packed;
+    e->packData(packed);
+    vector<string> columns(list_of("time")("latency")("small"));
+    ExtentType::ColumnSelection selection(type->selectColumns(columns));
+    SINVARIANT(selection.groups.empty() && !selection.variable);
+    Extent::Ptr unpacked(new Extent(type));
+    unpacked->unpackData(packed, false, &selection);
+    SINVARIANT(unpacked->variabledata.size() == 4);
+    checkColumns(unpacked, expect, columns, false);
+}
+
+void testFile() {
+    ExtentTypeLibrary library;
+    const ExtentType::Ptr type = library.registerTypePtr(typeXml(true, true));
+    const ExtentType::Ptr plain_type = library.registerTypePtr(typeXml(false, false));
+    {
+        DataSeriesSink sink("pack-column-groups.ds",
+                            Extent::compression_algs[Extent::compress_mode_lzf].compress_flag
+                            | Extent::compression_algs[Extent::compress_mode_zlib].compress_flag);
+        sink.writeExtentLibrary(library);
+        for (unsigned i = 0; i < 5; ++i) {
+            Extent::Ptr extent(new Extent(type));
+            ExtentSeries s(extent);
+            fill(s, 10000, i + 1);
+            sink.writeExtent(*extent, NULL);
+        }
+        sink.close();
+    }
+
+    vector<string> all, columns(list_of("small")("path"));
+    for (unsigned pass = 0; pass < 2; ++pass) {
+        const vector<string> &select(pass == 0 ? all : columns);
+        TypeIndexModule module(type->getName());
+        module.addSource("pack-column-groups.ds");
+        module.setColumns(select);
+        unsigned i = 0;
+        for (; Extent::Ptr extent = module.getSharedExtent(); ++i) {
+            checkColumns(extent, expectedExtent(fill, plain_type, 10000, i + 1), select, true);
+        }
+        SINVARIANT(i == 5);
+    }
+}
+
+int main() {
+    Extent::setReadChecksFromEnv(true);
+    unsigned sizes[] = { 0, 1, 17, 10000 };
+    for (unsigned i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        testPackUnpack(sizes[i], false, 0);
+        testPackUnpack(sizes[i], true, 0);
+        testPackUnpack(sizes[i], true, 4096); // some groups chunked
+    }
+    testSkipVariable();
+    testFile();
+
+    cout << "Passed pack column groups tests\n";
+    return 0;
+}
@@ -0,0 +1,194 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Test pack_dictionary variable32 fields: the values survive writing
+    and reading, equal values get equal codes, and the file shrinks.
+*/
+
+#include <sys/stat.h>
+
+#include <iostream>
+
+#include <DataSeries/DataSeriesFile.hpp>
+#include <DataSeries/DataSeriesModule.hpp>
+#include <DataSeries/TypeIndexModule.hpp>
+
+#include "pack-test-util.hpp"
+
+using namespace std;
+using boost::format;
+
+const string type_xml(
+        "<ExtentType namespace=\"ssd.hpl.hp.com\" name=\"Test::PackDictionary\" version=\"1.0\">\n"
+        "  <field type=\"int32\" name=\"i\" />\n"
+        "  <field type=\"variable32\" name=\"host\" pack_dictionary=\"yes\" />\n"
+        "  <field type=\"variable32\" name=\"queue\" pack_dictionary=\"yes\" pack_unique=\"yes\""
+        " opt_nullable=\"yes\" />\n"
+        "</ExtentType>\n");
+
+const unsigned nextents = 8;
+const unsigned nrecords = 10000;
+
+// later extents add hosts, so the dictionary grows across the file
+string hostVal(unsigned i) {
+    unsigned nhosts = 10 + 5 * (i / nrecords);
+    return i % 17 == 0 ? string() : str(format("host%d.example.com") % (i % nhosts));
+}
+
+string queueVal(unsigned i) { return str(format("queue-%d") % (i % 3)); }
+
+string typeXml(bool dictionary) {
+    return dictionary ? type_xml : plainTypeXml(type_xml, "pack_dictionary", "PackDictionary");
+}
+
+void fill(ExtentSeries &s, unsigned first) {
+    Int32Field i(s, "i");
+    Variable32Field host(s, "host");
+    Variable32Field queue(s, "queue", Field::flag_nullable);
+    for (unsigned j = first; j < first + nrecords; ++j) {
+        s.newRecord();
+        i.set(j);
+        host.set(hostVal(j));
+        if (j % 5 == 0) {
+            queue.setNull();
+        } else {
+            queue.set(queueVal(j));
+        }
+    }
+}
+
+void check(ExtentSeries &s, unsigned first, map<string, int32_t> &codes) {
+    Int32Field i(s, "i");
+    Variable32Field host(s, "host");
+    Variable32Field queue(s, "queue", Field::flag_nullable);
+    unsigned j = first;
+    for (; s.more(); s.next(), ++j) {
+        SINVARIANT(i.val() == static_cast<int32_t>(j));
+        INVARIANT(host.stringval() == hostVal(j),
+                  format("%d: %s != %s") % j % host.stringval() % hostVal(j));
+        if (host.size() == 0) {
+            SINVARIANT(host.code() == 0);
+        } else {
+            SINVARIANT(host.code() > 0);
+            map<string, int32_t>::iterator k = codes.find(host.stringval());
+            if (k == codes.end()) {
+                codes[host.stringval()] = host.code();
+            } else {
+                SINVARIANT(k->second == host.code());
+            }
+        }
+        if (j % 5 == 0) {
+            SINVARIANT(queue.isNull() && queue.code() == 0);
+        } else {
+            SINVARIANT(queue.stringval() == queueVal(j) && queue.code() > 0);
+        }
+    }
+    SINVARIANT(j == first + nrecords);
+}
+
+// Without dictionaries, packData keeps the values, even if the records
+// have codes.
+void testPackWithoutDictionaries(const ExtentType::Ptr type) {
+    ExtentSeries s(type);
+    Extent::Ptr e(new Extent(type));
+    s.setExtent(e);
+    fill(s, 0);
+    e->encodeDictionaryFields(dataseries::FieldDictionaries::Ptr(new dataseries::FieldDictionaries()));
+    e->dictionaries.reset();
+
+    Extent::ByteArray packed;
+    e->packData(packed);
+    Extent::Ptr unpacked(new Extent(type));
+    unpacked->unpackData(packed, false);
+    s.setExtent(unpacked);
+    Variable32Field host(s, "host");
+    for (unsigned j = 0; s.more(); s.next(), ++j) {
+        SINVARIANT(host.stringval() == hostVal(j) && host.code() == 0);
+    }
+}
+
+off64_t writeFile(const string &filename, const ExtentTypeLibrary &library,
+                  const ExtentType::Ptr type) {
+    DataSeriesSink sink(filename, Extent::compression_algs[Extent::compress_mode_lzf].compress_flag);
+    sink.writeExtentLibrary(library);
+    for (unsigned e = 0; e < nextents; ++e) {
+        ExtentSeries s(type);
+        Extent::Ptr extent(new Extent(type));
+        s.setExtent(extent);
+        fill(s, e * nrecords);
+        sink.writeExtent(*extent, NULL);
+    }
+    sink.close();
+    struct stat buf;
+    SINVARIANT(stat(filename.c_str(), &buf) == 0);
+    return buf.st_size;
+}
+
+void readFile(const string &filename, const string &type_name) {
+    map<string, int32_t> codes;
+    TypeIndexModule module(type_name);
+    module.addSource(filename);
+    ExtentSeries s;
+    unsigned e = 0;
+    for (; Extent::Ptr extent = module.getSharedExtent(); ++e) {
+        s.setExtent(extent);
+        check(s, e * nrecords, codes);
+    }
+    SINVARIANT(e == nextents);
+}
+
+// Reads without the index, so the dictionary entries are picked up on
+// the way.
+void readSequential(const string &filename) {
+    DataSeriesSource source(filename, false, false);
+    map<string, int32_t> codes;
+    unsigned e = 0;
+    while (true) {
+        Extent *extent = source.readExtent();
+        if (extent == NULL) {
+            break;
+        }
+        Extent::Ptr p(extent);
+        if (p->type->getName() != "Test::PackDictionary") {
+            continue;
+        }
+        ExtentSeries s(p);
+        check(s, e * nrecords, codes);
+        if (e == 0) { // setting a value drops its code
+            s.setExtent(p);
+            s.next(); // record 0 is empty
+            Variable32Field host(s, "host");
+            SINVARIANT(host.code() != 0);
+            host.set("somewhere.else");
+            SINVARIANT(host.code() == 0);
+        }
+        ++e;
+    }
+    SINVARIANT(e == nextents);
+}
+
+int main() {
+    Extent::setReadChecksFromEnv(true);
+    ExtentTypeLibrary library;
+    const ExtentType::Ptr type = library.registerTypePtr(typeXml(true));
+    const ExtentType::Ptr plain_type = library.registerTypePtr(typeXml(false));
+    SINVARIANT(type->getDictionary("host") && !plain_type->getDictionary("host"));
+
+    testPackWithoutDictionaries(type);
+
+    off64_t dictionary_size = writeFile("pack-dictionary.ds", library, type);
+    off64_t plain_size = writeFile("pack-dictionary-plain.ds", library, plain_type);
+    INVARIANT(dictionary_size < plain_size, format("%d >= %d") % dictionary_size % plain_size);
+    cout << format("dictionary %d bytes, plain %d bytes\n") % dictionary_size % plain_size;
+
+    readFile("pack-dictionary.ds", "Test::PackDictionary");
+    readSequential("pack-dictionary.ds");
+
+    cout << "Passed pack dictionary tests\n";
+    return 0;
+}
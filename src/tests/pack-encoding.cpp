@@ -0,0 +1,179 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Test pack_encoding="xor" and "delta2" fields: the encodings are
+    lossless for any values, and they shrink time series data.
+*/
+
+#include <string.h>
+
+#include <iostream>
+#include <limits>
+
+#include <Lintel/MersenneTwisterRandom.hpp>
+
+#include <DataSeries/DataSeriesFile.hpp>
+#include <DataSeries/DataSeriesModule.hpp>
+#include <DataSeries/TypeIndexModule.hpp>
+
+#include <base/PackEncoding.hpp>
+
+#include "pack-test-util.hpp"
+
+using namespace std;
+using boost::format;
+using namespace dataseries;
+
+const string type_xml(
+        "<ExtentType namespace=\"ssd.hpl.hp.com\" name=\"Test::PackEncoding\" version=\"1.0\"%s>\n"
+        "  <field type=\"int64\" name=\"time\" pack_encoding=\"delta2\" />\n"
+        "  <field type=\"double\" name=\"seconds\" pack_encoding=\"delta2\" />\n"
+        "  <field type=\"double\" name=\"bandwidth\" pack_encoding=\"xor\" />\n"
+        "  <field type=\"double\" name=\"usage\" pack_encoding=\"xor\" opt_nullable=\"yes\" />\n"
+        "  <field type=\"int64\" name=\"counter\" pack_encoding=\"xor\" />\n"
+        "  <field type=\"int32\" name=\"pid\" />\n"
+        "  <field type=\"variable32\" name=\"host\" pack_unique=\"yes\" />\n"
+        "</ExtentType>\n");
+
+string typeXml(bool encoded, bool columnar) {
+    string ret(str(format(type_xml) % (columnar ? " pack_layout=\"columnar\"" : "")));
+    return encoded ? ret : plainTypeXml(ret, "pack_encoding", "PackEncoding");
+}
+
+// Per-second samples of one process, as from a monitoring agent.
+void fill(ExtentSeries &s, unsigned nrecords, unsigned seed) {
+    Int64Field time(s, "time");
+    DoubleField seconds(s, "seconds");
+    DoubleField bandwidth(s, "bandwidth");
+    DoubleField usage(s, "usage", Field::flag_nullable);
+    Int64Field counter(s, "counter");
+    Int32Field pid(s, "pid");
+    Variable32Field host(s, "host");
+
+    MersenneTwisterRandom rng(seed);
+    int64_t t = 1300000000LL * 1000000000LL + seed * 1000000000LL * nrecords;
+    double cur_usage = 0.5, cur_bandwidth = 0;
+    int64_t count = 0;
+    for (unsigned i = 0; i < nrecords; ++i) {
+        s.newRecord();
+        t += 1000000000LL + rng.randInt(3) - 1; // jitter of a nanosecond
+        time.set(t);
+        seconds.set(t / 1.0e9);
+        if (rng.randInt(4) == 0) {
+            cur_bandwidth = 1500.0 * rng.randInt(10000);
+        }
+        bandwidth.set(cur_bandwidth);
+        if (rng.randInt(20) == 0) {
+            usage.setNull();
+        } else {
+            if (rng.randInt(3) == 0) {
+                cur_usage = rng.randInt(200) * 0.5;
+            }
+            usage.set(cur_usage);
+        }
+        count += rng.randInt(1000);
+        counter.set(count);
+        pid.set(1000 + seed);
+        host.set("host.example.com");
+    }
+}
+
+void testPackUnpack(unsigned nrecords, bool columnar) {
+    const ExtentType::Ptr type
+            (ExtentTypeLibrary::sharedExtentTypePtr(typeXml(true, columnar)));
+    Extent::Ptr expect(expectedExtent(fill, ExtentTypeLibrary::sharedExtentTypePtr
+                                      (typeXml(false, columnar)), nrecords, 1));
+    Extent::Ptr e(new Extent(type));
+    ExtentSeries s(e);
+    fill(s, nrecords, 1);
+
+    Extent::ByteArray packed;
+    uint32_t lzf = Extent::compression_algs[Extent::compress_mode_lzf].compress_flag;
+    e->packData(packed, lzf, 9, NULL, NULL, NULL);
+    Extent::Ptr unpacked(new Extent(type));
+    unpacked->unpackData(packed, false);
+    SINVARIANT(sameData(*unpacked, *expect));
+}
+
+// Encodes and decodes one sequence with both encodings.
+void checkEncodings(const vector<uint64_t> &values) {
+    uint32_t n = values.size();
+    vector<uint64_t> words(pack_encoding::maxEncodedWords(n) + 1), got(n);
+    const uint8_t *col = reinterpret_cast<const uint8_t *>(n == 0 ? NULL : &values[0]);
+    uint8_t *got_col = reinterpret_cast<uint8_t *>(n == 0 ? NULL : &got[0]);
+
+    size_t nwords = pack_encoding::encodeXor(col, 8, n, &words[0]);
+    SINVARIANT(nwords <= pack_encoding::maxEncodedWords(n));
+    pack_encoding::decodeXor(&words[0], nwords, got_col, 8, n);
+    SINVARIANT(got == values);
+
+    nwords = pack_encoding::encodeDelta2(col, 8, n, &words[0]);
+    SINVARIANT(nwords <= pack_encoding::maxEncodedWords(n));
+    pack_encoding::decodeDelta2(&words[0], nwords, got_col, 8, n);
+    SINVARIANT(got == values);
+}
+
+uint64_t doubleBits(double d) {
+    uint64_t ret;
+    memcpy(&ret, &d, 8);
+    return ret;
+}
+
+void testEncodings() {
+    vector<uint64_t> values;
+    checkEncodings(values);
+
+    // the extremes, which need the longest codes
+    const uint64_t extremes[] = {
+        0, ~static_cast<uint64_t>(0), 1ULL << 63, (1ULL << 63) - 1, 1, 0x5555555555555555ULL,
+        doubleBits(-0.0), doubleBits(numeric_limits<double>::quiet_NaN()),
+        doubleBits(numeric_limits<double>::infinity()), doubleBits(1e-308), 0 };
+    for (unsigned i = 0; i < sizeof(extremes) / sizeof(extremes[0]); ++i) {
+        values.push_back(extremes[i]);
+        checkEncodings(values);
+    }
+
+    // deltas at every delta2 bucket boundary, in both directions
+    MersenneTwisterRandom rng(1972);
+    for (unsigned bits = 0; bits <= 64; ++bits) {
+        uint64_t delta = bits == 64 ? ~static_cast<uint64_t>(0) : (1ULL << bits) - 1;
+        values.push_back(values.back() + delta);
+        values.push_back(values.back() - delta);
+        values.push_back(values.back() + (rng.randLongLong() >> (64 - max(bits, 1U))));
+    }
+    checkEncodings(values);
+    for (unsigned i = 0; i < 10000; ++i) {
+        values.push_back(rng.randInt(3) == 0 ? rng.randLongLong() : values.back());
+    }
+    checkEncodings(values);
+}
+
+int main() {
+    Extent::setReadChecksFromEnv(true);
+    testEncodings();
+    unsigned sizes[] = { 0, 1, 2, 3, 1000 };
+    for (unsigned i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        testPackUnpack(sizes[i], false);
+        testPackUnpack(sizes[i], true);
+    }
+
+    ExtentTypeLibrary library;
+    const ExtentType::Ptr type = library.registerTypePtr(typeXml(true, false));
+    const ExtentType::Ptr plain_type = library.registerTypePtr(typeXml(false, false));
+    SINVARIANT(type->hasEncodedFields() && !plain_type->hasEncodedFields());
+
+    off64_t encoded_size = writePackTestFile("pack-encoding.ds", library, type, fill, 5, 10000);
+    off64_t plain_size = writePackTestFile("pack-encoding-plain.ds", library, plain_type, fill,
+                                           5, 10000);
+    INVARIANT(encoded_size < plain_size, format("%d >= %d") % encoded_size % plain_size);
+    cout << format("encoded %d bytes, plain %d bytes\n") % encoded_size % plain_size;
+    checkPackTestFile("pack-encoding.ds", type, plain_type, fill, 5, 10000);
+
+    cout << "Passed pack encoding tests\n";
+    return 0;
+}
@@ -0,0 +1,176 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Verify that every compiled-in set of pack/unpack kernels produces
+    identical packed extents and identical unpacked data.
+*/
+
+#include <iostream>
+
+#include <Lintel/MersenneTwisterRandom.hpp>
+
+#include <DataSeries/Extent.hpp>
+#include <DataSeries/ExtentField.hpp>
+
+#include <base/PackKernels.hpp>
+
+#include "pack-test-util.hpp"
+
+using namespace std;
+using boost::format;
+using namespace dataseries;
+
+const string test_xml =
+        "<ExtentType name=\"Test::PackKernels\" pack_null_compact=\"non_bool\""
+        " pack_pad_record=\"max_column_size\">\n"
+        "  <field type=\"int32\" name=\"i32\" pack_relative=\"i32\" opt_nullable=\"yes\" />\n"
+        "  <field type=\"int32\" name=\"i32-other\" pack_relative=\"i32\" />\n"
+        "  <field type=\"int64\" name=\"i64\" pack_relative=\"i64\" />\n"
+        "  <field type=\"int64\" name=\"i64-other\" pack_relative=\"i64\" opt_nullable=\"yes\" />\n"
+        "  <field type=\"double\" name=\"dbl\" pack_relative=\"dbl\" pack_scale=\"0.001\" />\n"
+        "  <field type=\"double\" name=\"dbl-other\" pack_relative=\"dbl\" />\n"
+        "  <field type=\"double\" name=\"scaled\" pack_scale=\"0.25\" pack_scale_warn=\"no\" />\n"
+        "  <field type=\"byte\" name=\"byte\" opt_nullable=\"yes\" />\n"
+        "  <field type=\"variable32\" name=\"v32\" pack_unique=\"yes\" />\n"
+        "</ExtentType>\n";
+
+Extent::Ptr makeExtent(unsigned nrecords) {
+    const ExtentType::Ptr type(ExtentTypeLibrary::sharedExtentTypePtr(test_xml));
+    Extent::Ptr e(new Extent(type));
+    ExtentSeries s(e);
+    Int32Field i32(s, "i32", Field::flag_nullable);
+    Int32Field i32_other(s, "i32-other");
+    Int64Field i64(s, "i64");
+    Int64Field i64_other(s, "i64-other", Field::flag_nullable);
+    DoubleField dbl(s, "dbl");
+    DoubleField dbl_other(s, "dbl-other");
+    DoubleField scaled(s, "scaled");
+    ByteField byte(s, "byte", Field::flag_nullable);
+    Variable32Field v32(s, "v32");
+
+    MersenneTwisterRandom rng(1776);
+    int64_t base = 1000000000LL;
+    for (unsigned i = 0; i < nrecords; ++i) {
+        s.newRecord();
+        base += rng.randInt(100000);
+        i32.set(rng.randInt());
+        if (rng.randInt(4) == 0) {
+            i32.setNull();
+        }
+        i32_other.set(rng.randInt(1000));
+        i64.set(base);
+        i64_other.set(base + rng.randInt(1000));
+        if (rng.randInt(3) == 0) {
+            i64_other.setNull();
+        }
+        dbl.set(base * 0.001 + rng.randInt(10) * 0.001);
+        dbl_other.set(rng.randDouble() * 100);
+        scaled.set(rng.randDouble() * 1000);
+        byte.set(rng.randInt(256));
+        if (rng.randInt(2) == 0) {
+            byte.setNull();
+        }
+        v32.set(str(format("value-%d") % rng.randInt(50)));
+    }
+    return e;
+}
+
+void testLevel(pack_kernels::Level level, unsigned nrecords,
+               const Extent::ByteArray &scalar_packed, const Extent &scalar_unpacked) {
+    if (!pack_kernels::setLevel(level)) {
+        cout << format("skipping unsupported kernel level %d\n") % level;
+        return;
+    }
+    Extent::Ptr e(makeExtent(nrecords));
+    Extent::ByteArray packed;
+    e->packData(packed, 0, 0, NULL, NULL, NULL);
+    SINVARIANT(sameBytes(packed, scalar_packed));
+
+    e->unpackData(packed, false);
+    SINVARIANT(sameBytes(e->fixeddata, scalar_unpacked.fixeddata));
+    SINVARIANT(sameBytes(e->variabledata, scalar_unpacked.variabledata));
+}
+
+void testPackUnpack(unsigned nrecords) {
+    SINVARIANT(pack_kernels::setLevel(pack_kernels::LevelScalar));
+    Extent::Ptr e(makeExtent(nrecords));
+    Extent::ByteArray scalar_packed;
+    e->packData(scalar_packed, 0, 0, NULL, NULL, NULL);
+    Extent::ByteArray copy;
+    copy.resize(scalar_packed.size(), false);
+    memcpy(copy.begin(), scalar_packed.begin(), scalar_packed.size());
+    e->unpackData(copy, false);
+
+    testLevel(pack_kernels::LevelSSE42, nrecords, scalar_packed, *e);
+    testLevel(pack_kernels::LevelAVX2, nrecords, scalar_packed, *e);
+}
+
+void testFlip(unsigned len) {
+    vector<uint32_t> expect(len), got(len);
+    MersenneTwisterRandom rng(len);
+    for (unsigned i = 0; i < len; ++i) {
+        expect[i] = got[i] = rng.randInt();
+    }
+    pack_kernels::kernels(pack_kernels::LevelScalar)->flip4Contiguous(&expect[0], len);
+    for (int l = pack_kernels::LevelSSE42; l <= pack_kernels::LevelAVX2; ++l) {
+        const pack_kernels::Kernels *k = pack_kernels::kernels(static_cast<pack_kernels::Level>(l));
+        if (k == NULL) {
+            continue;
+        }
+        vector<uint32_t> tmp(got);
+        k->flip4Contiguous(&tmp[0], len);
+        SINVARIANT(tmp == expect);
+    }
+    for (unsigned i = 0; i < len; ++i) {
+        SINVARIANT(expect[i] == Extent::flip4bytes(got[i]));
+    }
+}
+
+void testCrc32c() {
+    const char *check = "123456789"; // the standard check value
+    SINVARIANT(pack_kernels::kernels(pack_kernels::LevelScalar)->crc32c
+               (0, reinterpret_cast<const uint8_t *>(check), 9) == 0xE3069283);
+
+    vector<uint8_t> buf(40009); // long enough to be split into stripes
+    MersenneTwisterRandom rng(1972);
+    for (unsigned i = 0; i < buf.size(); ++i) {
+        buf[i] = rng.randInt();
+    }
+    const pack_kernels::Kernels *scalar = pack_kernels::kernels(pack_kernels::LevelScalar);
+    for (int l = pack_kernels::LevelScalar; l <= pack_kernels::LevelAVX2; ++l) {
+        const pack_kernels::Kernels *k = pack_kernels::kernels(static_cast<pack_kernels::Level>(l));
+        if (k == NULL) {
+            continue;
+        }
+        SINVARIANT(k->crc32c(0, reinterpret_cast<const uint8_t *>(check), 9) == 0xE3069283);
+        // every alignment and length, and continuing from a previous crc
+        for (unsigned start = 0; start < 9; ++start) {
+            for (unsigned len = 0; len < 40; ++len) {
+                SINVARIANT(k->crc32c(0, &buf[start], len) == scalar->crc32c(0, &buf[start], len));
+            }
+            uint32_t whole = k->crc32c(0, &buf[start], buf.size() - start);
+            uint32_t split = k->crc32c(0, &buf[start], 1000);
+            split = k->crc32c(split, &buf[start + 1000], buf.size() - start - 1000);
+            SINVARIANT(whole == split && whole == scalar->crc32c(0, &buf[start],
+                                                                 buf.size() - start));
+        }
+    }
+}
+
+int main() {
+    testCrc32c();
+    testPackUnpack(1);
+    testPackUnpack(17);
+    testPackUnpack(10000);
+    for (unsigned len = 1; len < 40; ++len) {
+        testFlip(len);
+    }
+    testFlip(100001);
+    cout << "Passed pack kernels tests\n";
+    return 0;
+}
@@ -0,0 +1,106 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2012, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Test the pack_layout options
+*/
+
+#include <iostream>
+
+#include <DataSeries/Extent.hpp>
+#include <DataSeries/ExtentField.hpp>
+
+#include "pack-test-util.hpp"
+
+using namespace std;
+using boost::format;
+
+const string fields_xml =
+        "  <field type=\"int64\" name=\"i64\" pack_relative=\"i64\" />\n"
+        "  <field type=\"variable32\" name=\"v32\" pack_unique=\"yes\" />\n"
+        "  <field type=\"bool\" name=\"bool\" />\n"
+        "  <field type=\"int32\" name=\"i32\" opt_nullable=\"yes\" />\n"
+        "  <field type=\"double\" name=\"dbl\" pack_scale=\"0.5\" />\n"
+        "  <field type=\"byte\" name=\"byte\" />\n"
+        "  <field type=\"fixedwidth\" name=\"fw\" size=\"3\" />\n"
+        "</ExtentType>\n";
+
+Extent::Ptr makeExtent(const string &layout, unsigned nrecords) {
+    string xml(str(format("<ExtentType name=\"Test::Layout\" pack_layout=\"%s\">\n") % layout));
+    const ExtentType::Ptr type(ExtentTypeLibrary::sharedExtentTypePtr(xml + fields_xml));
+
+    Extent::Ptr e(new Extent(type));
+    ExtentSeries s(e);
+    Int64Field i64(s, "i64");
+    Variable32Field v32(s, "v32");
+    BoolField b(s, "bool");
+    Int32Field i32(s, "i32", Field::flag_nullable);
+    DoubleField dbl(s, "dbl");
+    ByteField byte(s, "byte");
+    FixedWidthField fw(s, "fw");
+
+    for (unsigned i = 0; i < nrecords; ++i) {
+        s.newRecord();
+        i64.set(1000000000LL * i + 17);
+        v32.set(str(format("value-%d") % (i % 7)));
+        b.set(i % 3 == 0);
+        if (i % 5 == 0) {
+            i32.setNull();
+        } else {
+            i32.set(i * 3);
+        }
+        dbl.set(i * 0.5);
+        byte.set(i & 0xFF);
+        uint8_t fw_val[3] = { static_cast<uint8_t>(i), 0, static_cast<uint8_t>(i >> 8) };
+        fw.set(fw_val, sizeof(fw_val));
+    }
+    return e;
+}
+
+void testRoundTrip(unsigned nrecords, uint32_t compression_modes) {
+    Extent::Ptr row(makeExtent("row_major", nrecords));
+    Extent::Ptr col(makeExtent("columnar", nrecords));
+    // same field offsets, so the in-memory extents should be identical.
+    SINVARIANT(sameData(*row, *col));
+
+    Extent::ByteArray row_packed, col_packed;
+    row->packData(row_packed, compression_modes, 9, NULL, NULL, NULL);
+    col->packData(col_packed, compression_modes, 9, NULL, NULL, NULL);
+    if (nrecords > 1 && compression_modes == 0) {
+        SINVARIANT(row_packed.size() == col_packed.size());
+        SINVARIANT(memcmp(row_packed.begin(), col_packed.begin(), row_packed.size()) != 0);
+    }
+
+    row->unpackData(row_packed, false);
+    col->unpackData(col_packed, false);
+    SINVARIANT(sameData(*row, *col));
+
+    ExtentSeries s(col);
+    Int64Field i64(s, "i64");
+    Variable32Field v32(s, "v32");
+    Int32Field i32(s, "i32", Field::flag_nullable);
+    ByteField byte(s, "byte");
+    for (unsigned i = 0; i < nrecords; ++i, s.next()) {
+        SINVARIANT(s.morerecords());
+        SINVARIANT(i64.val() == static_cast<int64_t>(1000000000LL * i + 17));
+        SINVARIANT(v32.stringval() == str(format("value-%d") % (i % 7)));
+        SINVARIANT(i32.isNull() == (i % 5 == 0));
+        SINVARIANT(byte.val() == (i & 0xFF));
+    }
+    SINVARIANT(!s.morerecords());
+}
+
+int main() {
+    uint32_t lzf = Extent::compression_algs[Extent::compress_mode_lzf].compress_flag;
+    testRoundTrip(0, lzf);
+    testRoundTrip(1, lzf);
+    testRoundTrip(1000, 0);
+    testRoundTrip(1000, lzf);
+    testRoundTrip(1000, Extent::compress_all);
+    cout << "Passed pack_layout tests\n";
+    return 0;
+}
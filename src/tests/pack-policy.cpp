@@ -0,0 +1,153 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Test choosing compression algorithms with an Extent::CompressionPolicy.
+*/
+
+#include <iostream>
+
+#include <DataSeries/DataSeriesFile.hpp>
+#include <DataSeries/DataSeriesModule.hpp>
+#include <DataSeries/TypeIndexModule.hpp>
+
+#include "pack-test-util.hpp"
+
+using namespace std;
+using boost::format;
+
+const string type_xml =
+        "<ExtentType namespace=\"ssd.hpl.hp.com\" name=\"Test::PackPolicy\" version=\"1.0\">\n"
+        "  <field type=\"int64\" name=\"i64\" pack_relative=\"i64\" />\n"
+        "  <field type=\"variable32\" name=\"v32\" />\n"
+        "</ExtentType>\n";
+
+void fillExtent(ExtentSeries &s, unsigned first, unsigned nrecords) {
+    Int64Field i64(s, "i64");
+    Variable32Field v32(s, "v32");
+    for (unsigned i = first; i < first + nrecords; ++i) {
+        s.newRecord();
+        i64.set(1000LL * i + (i % 7));
+        v32.set(str(format("record %d") % (i % 100)));
+    }
+}
+
+Extent::Ptr makeExtent(unsigned nrecords) {
+    Extent::Ptr e(new Extent(ExtentTypeLibrary::sharedExtentTypePtr(type_xml)));
+    ExtentSeries s(e);
+    fillExtent(s, 0, nrecords);
+    return e;
+}
+
+void testFromName() {
+    SINVARIANT(!Extent::CompressionPolicy::fromName("smallest").timed());
+    SINVARIANT(Extent::CompressionPolicy::fromName("balanced").timed());
+    Extent::CompressionPolicy read = Extent::CompressionPolicy::fromName("read-optimized");
+    SINVARIANT(read.timed() && read.size_weight == 1 && !read.use_section_modes);
+    Extent::CompressionPolicy cost = Extent::CompressionPolicy::fromName("cost:2.5,0.5");
+    SINVARIANT(cost.decompress_weight == 2.5 && cost.size_weight == 0.5);
+}
+
+void checkUnpack(Extent::ByteArray &packed, unsigned nrecords) {
+    Extent::Ptr expect(makeExtent(nrecords));
+    Extent::Ptr e(new Extent(expect->getTypePtr()));
+    e->unpackData(packed, false);
+    SINVARIANT(sameBytes(e->fixeddata, expect->fixeddata));
+    SINVARIANT(sameBytes(e->variabledata, expect->variabledata));
+}
+
+void testExtentPolicy(unsigned nrecords, uint32_t block_size) {
+    uint32_t lzf = Extent::compression_algs[Extent::compress_mode_lzf].compress_flag;
+    uint32_t zlib = Extent::compression_algs[Extent::compress_mode_zlib].compress_flag;
+
+    // The default policy is the same as passing none.
+    Extent::ByteArray smallest, with_default;
+    makeExtent(nrecords)->packData(smallest, zlib | lzf, 9, NULL, NULL, NULL, block_size);
+    Extent::CompressionPolicy default_policy;
+    makeExtent(nrecords)->packData(with_default, zlib | lzf, 9, NULL, NULL, NULL, block_size,
+                                   &default_policy);
+    SINVARIANT(sameBytes(smallest, with_default));
+
+    // Timed policies may pick anything, but it has to unpack.
+    Extent::ByteArray timed;
+    Extent::CompressionPolicy read = Extent::CompressionPolicy::fromName("read-optimized");
+    makeExtent(nrecords)->packData(timed, zlib | lzf, 9, NULL, NULL, NULL, block_size, &read);
+    checkUnpack(timed, nrecords);
+
+    // Section modes override compression_modes separately for the fixed
+    // and variable data.
+    Extent::ByteArray sections;
+    read.use_section_modes = true;
+    read.fixed_modes = lzf;
+    read.variable_modes = 0;
+    makeExtent(nrecords)->packData(sections, Extent::compress_all, 9, NULL, NULL, NULL,
+                                   block_size, &read);
+    SINVARIANT((sections[6*4] & ~Extent::compress_mode_chunked) == Extent::compress_mode_lzf);
+    SINVARIANT((sections[6*4+1] & ~Extent::compress_mode_chunked) == Extent::compress_mode_none);
+    checkUnpack(sections, nrecords);
+
+    // Non-trial extents in DataSeriesSink use the modes of the last trial
+    // even when timing them again would prefer leaving the data
+    // uncompressed.
+    Extent::ByteArray chosen;
+    Extent::CompressionPolicy slow_reads(1e12, 1e-12);
+    slow_reads.use_section_modes = true;
+    slow_reads.fixed_modes = lzf;
+    slow_reads.variable_modes = lzf;
+    makeExtent(nrecords)->packData(chosen, Extent::compress_all, 9, NULL, NULL, NULL,
+                                   block_size, &slow_reads);
+    SINVARIANT((chosen[6*4] & ~Extent::compress_mode_chunked) == Extent::compress_mode_lzf);
+    SINVARIANT((chosen[6*4+1] & ~Extent::compress_mode_chunked) == Extent::compress_mode_lzf);
+    checkUnpack(chosen, nrecords);
+}
+
+void testSink() {
+    ExtentTypeLibrary library;
+    const ExtentType::Ptr type = library.registerTypePtr(type_xml);
+    unsigned nrecords = 0;
+    {
+        DataSeriesSink sink("pack-policy.ds");
+        Extent::CompressionPolicy policy = Extent::CompressionPolicy::fromName("balanced");
+        policy.sample_interval = 3;
+        sink.setCompressionPolicy(policy);
+        sink.writeExtentLibrary(library);
+
+        ExtentSeries series(type);
+        for (unsigned i = 0; i < 10; ++i) {
+            Extent::Ptr e(new Extent(type));
+            series.setExtent(e);
+            fillExtent(series, nrecords, 1000 + 100 * i);
+            nrecords += 1000 + 100 * i;
+            sink.writeExtent(*e, NULL);
+        }
+        sink.close();
+    }
+
+    TypeIndexModule source("Test::PackPolicy");
+    source.addSource("pack-policy.ds");
+    ExtentSeries s;
+    Int64Field i64(s, "i64");
+    Variable32Field v32(s, "v32");
+    unsigned i = 0;
+    while (Extent::Ptr e = source.getSharedExtent()) {
+        for (s.setExtent(e); s.more(); s.next(), ++i) {
+            SINVARIANT(i64.val() == 1000LL * i + (i % 7));
+            SINVARIANT(v32.stringval() == str(format("record %d") % (i % 100)));
+        }
+    }
+    SINVARIANT(i == nrecords);
+}
+
+int main() {
+    testFromName();
+    testExtentPolicy(1000, 0);
+    testExtentPolicy(50000, 0);
+    testExtentPolicy(50000, 64*1024);
+    testSink();
+    cout << "Passed compression policy tests\n";
+    return 0;
+}
@@ -0,0 +1,96 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Helpers shared by the tests of the packing options.  A test fills
+    extents from a seed with its own fill function, and compares them
+    with the same values in a plain type that lacks the option.
+*/
+
+#ifndef DATASERIES_TESTS_PACK_TEST_UTIL_HPP
+#define DATASERIES_TESTS_PACK_TEST_UTIL_HPP
+
+#include <string.h>
+#include <sys/stat.h>
+
+#include <string>
+
+#include <DataSeries/DataSeriesFile.hpp>
+#include <DataSeries/TypeIndexModule.hpp>
+
+typedef void (*PackTestFill)(ExtentSeries &s, unsigned nrecords, unsigned seed);
+
+inline bool sameBytes(const Extent::ByteArray &a, const Extent::ByteArray &b) {
+    return a.size() == b.size() && memcmp(a.begin(), b.begin(), a.size()) == 0;
+}
+
+inline bool sameData(const Extent &a, const Extent &b) {
+    return sameBytes(a.fixeddata, b.fixeddata) && sameBytes(a.variabledata, b.variabledata);
+}
+
+/// Returns @param xml with every @param attribute="..." removed and the
+/// type renamed from @param name to Plain.
+inline std::string plainTypeXml(std::string xml, const std::string &attribute,
+                                const std::string &name) {
+    std::string find(" " + attribute + "=\"");
+    size_t pos;
+    while ((pos = xml.find(find)) != std::string::npos) {
+        xml.erase(pos, xml.find('"', pos + find.size()) + 1 - pos);
+    }
+    xml.replace(xml.find(name), name.size(), "Plain");
+    return xml;
+}
+
+/// Packing moves the variable32 values, so the expected records are the
+/// same values in @param plain_type, packed and unpacked.
+inline Extent::Ptr expectedExtent(PackTestFill fill, const ExtentType::Ptr plain_type,
+                                  unsigned nrecords, unsigned seed) {
+    Extent::Ptr e(new Extent(plain_type));
+    ExtentSeries s(e);
+    fill(s, nrecords, seed);
+    Extent::ByteArray packed;
+    e->packData(packed, 0, 0, NULL, NULL, NULL);
+    e->unpackData(packed, false);
+    return e;
+}
+
+/// Writes @param nextents extents of @param nrecords records, with seeds
+/// 1, 2, ..., compressed with lzf; returns the size of the file.
+inline off64_t writePackTestFile(const std::string &filename, const ExtentTypeLibrary &library,
+                                 const ExtentType::Ptr type, PackTestFill fill,
+                                 unsigned nextents, unsigned nrecords) {
+    DataSeriesSink sink(filename, Extent::compression_algs[Extent::compress_mode_lzf].compress_flag);
+    sink.writeExtentLibrary(library);
+    for (unsigned i = 0; i < nextents; ++i) {
+        ExtentSeries s(type);
+        Extent::Ptr extent(new Extent(type));
+        s.setExtent(extent);
+        fill(s, nrecords, i + 1);
+        sink.writeExtent(*extent, NULL);
+    }
+    sink.close();
+    struct stat buf;
+    SINVARIANT(stat(filename.c_str(), &buf) == 0);
+    return buf.st_size;
+}
+
+/// Checks the file from writePackTestFile reads back as the fixed data
+/// of the plain type.
+inline void checkPackTestFile(const std::string &filename, const ExtentType::Ptr type,
+                              const ExtentType::Ptr plain_type, PackTestFill fill,
+                              unsigned nextents, unsigned nrecords) {
+    TypeIndexModule module(type->getName());
+    module.addSource(filename);
+    unsigned i = 0;
+    for (; Extent::Ptr extent = module.getSharedExtent(); ++i) {
+        SINVARIANT(sameBytes(extent->fixeddata,
+                             expectedExtent(fill, plain_type, nrecords, i + 1)->fixeddata));
+    }
+    SINVARIANT(i == nextents);
+}
+
+#endif
@@ -0,0 +1,184 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Test zstd compression, with and without a trained dictionary.
+*/
+
+#include <iostream>
+
+#include <Lintel/MersenneTwisterRandom.hpp>
+
+#include <DataSeries/DataSeriesFile.hpp>
+#include <DataSeries/DataSeriesModule.hpp>
+#include <DataSeries/TypeIndexModule.hpp>
+
+using namespace std;
+using boost::format;
+
+const string type_xml =
+        "<ExtentType namespace=\"ssd.hpl.hp.com\" name=\"Test::PackZstd\" version=\"1.0\">\n"
+        "  <field type=\"int64\" name=\"time\" pack_relative=\"time\" />\n"
+        "  <field type=\"int32\" name=\"size\" />\n"
+        "  <field type=\"variable32\" name=\"path\" />\n"
+        "</ExtentType>\n";
+
+const uint32_t zstd = Extent::compression_algs[Extent::compress_mode_zstd].compress_flag;
+
+// Small extents of similar records, the case dictionaries help with.
+void fillExtent(ExtentSeries &s, unsigned seed, unsigned nrecords) {
+    Int64Field time(s, "time");
+    Int32Field size(s, "size");
+    Variable32Field path(s, "path");
+    MersenneTwisterRandom rng(seed);
+    int64_t now = 1000000000LL * seed;
+    for (unsigned i = 0; i < nrecords; ++i) {
+        s.newRecord();
+        now += rng.randInt(100000);
+        time.set(now);
+        size.set(rng.randInt(8) * 4096);
+        path.set(str(format("/home/user%d/projects/dataseries/src/base/file%d.cpp")
+                     % rng.randInt(10) % rng.randInt(50)));
+    }
+}
+
+Extent::Ptr makeExtent(unsigned seed, unsigned nrecords) {
+    Extent::Ptr e(new Extent(ExtentTypeLibrary::sharedExtentTypePtr(type_xml)));
+    ExtentSeries s(e);
+    fillExtent(s, seed, nrecords);
+    return e;
+}
+
+void checkSeries(ExtentSeries &s, unsigned seed, unsigned nrecords) {
+    Int64Field time(s, "time");
+    Int32Field size(s, "size");
+    Variable32Field path(s, "path");
+    Extent::Ptr expect(makeExtent(seed, nrecords));
+    ExtentSeries e(expect);
+    Int64Field e_time(e, "time");
+    Int32Field e_size(e, "size");
+    Variable32Field e_path(e, "path");
+    for (; e.more(); e.next(), s.next()) {
+        SINVARIANT(s.more());
+        SINVARIANT(time.val() == e_time.val() && size.val() == e_size.val()
+                   && path.stringval() == e_path.stringval());
+    }
+    SINVARIANT(!s.more());
+}
+
+uint32_t packedSize(unsigned seed, uint32_t dictionary_id) {
+    Extent::ByteArray packed;
+    makeExtent(seed, 100)->packData(packed, zstd, 9, NULL, NULL, NULL, 0, NULL, dictionary_id);
+    SINVARIANT(packed[6*4] == Extent::compress_mode_zstd);
+
+    Extent::Ptr e(new Extent(ExtentTypeLibrary::sharedExtentTypePtr(type_xml)));
+    e->unpackData(packed, false);
+    ExtentSeries s(e);
+    checkSeries(s, seed, 100);
+    return packed.size();
+}
+
+string trainDictionary() {
+    vector<Extent::Ptr> samples;
+    for (unsigned i = 0; i < 200; ++i) {
+        samples.push_back(makeExtent(1000 + i, 100));
+    }
+    string dictionary = Extent::trainCompressionDictionary(samples, 8192);
+    SINVARIANT(!dictionary.empty() && dictionary.size() <= 8192);
+    return dictionary;
+}
+
+void testSink(const string &dictionary) {
+    ExtentTypeLibrary library;
+    const ExtentType::Ptr type = library.registerTypePtr(type_xml);
+    {
+        DataSeriesSink sink("pack-zstd.ds", zstd);
+        sink.setFormatVersion(2);
+        sink.setCompressionDictionary(type, dictionary);
+        sink.writeExtentLibrary(library);
+        ExtentSeries series(type);
+        for (unsigned i = 0; i < 10; ++i) {
+            Extent::Ptr e(new Extent(type));
+            series.setExtent(e);
+            fillExtent(series, i, 100);
+            sink.writeExtent(*e, NULL);
+        }
+        sink.close();
+    }
+
+    TypeIndexModule source("Test::PackZstd");
+    source.addSource("pack-zstd.ds");
+    for (unsigned i = 0; i < 10; ++i) {
+        Extent::Ptr e = source.getSharedExtent();
+        SINVARIANT(e != NULL);
+        ExtentSeries s(e);
+        checkSeries(s, i, 100);
+    }
+    SINVARIANT(source.getSharedExtent() == NULL);
+}
+
+// DSv1 files are for older readers, so a sink writing one never uses zstd.
+void testFormatV1() {
+    ExtentTypeLibrary library;
+    const ExtentType::Ptr type = library.registerTypePtr(type_xml);
+    {
+        DataSeriesSink sink("pack-zstd-v1.ds", zstd);
+        sink.setFormatVersion(1);
+        sink.writeExtentLibrary(library);
+        ExtentSeries series(type);
+        Extent::Ptr e(new Extent(type));
+        series.setExtent(e);
+        fillExtent(series, 1, 1000);
+        sink.writeExtent(*e, NULL);
+        sink.close();
+    }
+
+    DataSeriesSource source("pack-zstd-v1.ds");
+    ExtentSeries s(source.index_extent);
+    Variable32Field extenttype(s, "extenttype");
+    Int64Field offset(s, "offset");
+    unsigned nextents = 0;
+    for (; s.more(); s.next()) {
+        if (extenttype.stringval() == "Test::PackZstd") {
+            off64_t pos = offset.val();
+            Extent::ByteArray packed;
+            SINVARIANT(source.preadCompressed(pos, packed));
+            SINVARIANT(packed[6*4] == Extent::compress_mode_none
+                       && packed[6*4+1] == Extent::compress_mode_none);
+            ++nextents;
+        }
+    }
+    SINVARIANT(nextents == 1);
+}
+
+int main() {
+    // only used when asked for by name
+    SINVARIANT((Extent::compress_all & zstd) == 0
+               && (Extent::compress_all & Extent::compress_v1_modes) == Extent::compress_all);
+    Extent::ByteArray packed;
+    makeExtent(1, 1000)->packData(packed, zstd);
+    if (packed[6*4] != Extent::compress_mode_zstd) {
+        cout << "zstd support not compiled in, skipping zstd tests\n";
+        return 0;
+    }
+
+    string dictionary = trainDictionary();
+    uint32_t dictionary_id = Extent::registerCompressionDictionary(dictionary);
+    SINVARIANT(dictionary_id != 0);
+    SINVARIANT(Extent::registerCompressionDictionary(dictionary) == dictionary_id);
+    for (unsigned seed = 1; seed < 5; ++seed) {
+        uint32_t plain = packedSize(seed, 0);
+        uint32_t with_dictionary = packedSize(seed, dictionary_id);
+        cout << format("extent %d: %d bytes without dictionary, %d with\n")
+            % seed % plain % with_dictionary;
+        SINVARIANT(with_dictionary < plain);
+    }
+    testSink(dictionary);
+    testFormatV1();
+    cout << "Passed zstd tests\n";
+    return 0;
+}
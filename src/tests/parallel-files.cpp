@@ -0,0 +1,108 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Test opening input files in parallel with TypeIndexModule::setParallelFiles.
+*/
+
+#include <iostream>
+
+#include <DataSeries/DataSeriesFile.hpp>
+#include <DataSeries/DataSeriesModule.hpp>
+#include <DataSeries/TypeIndexModule.hpp>
+
+using namespace std;
+using boost::format;
+
+const string type_xml =
+        "<ExtentType namespace=\"ssd.hpl.hp.com\" name=\"Test::ParallelFiles\" version=\"1.0\">\n"
+        "  <field type=\"int32\" name=\"file\" />\n"
+        "  <field type=\"int32\" name=\"row\" />\n"
+        "</ExtentType>\n";
+
+const unsigned nfiles = 20;
+const unsigned nrecords = 100;
+
+string fileName(unsigned file) { return str(format("parallel-files-%d.ds") % file); }
+
+// File f has f % 4 + 1 extents, of nrecords rows each.
+unsigned fileExtents(unsigned file) { return file % 4 + 1; }
+
+void writeFile(unsigned file) {
+    ExtentTypeLibrary library;
+    const ExtentType::Ptr type = library.registerTypePtr(type_xml);
+    DataSeriesSink sink(fileName(file),
+                        Extent::compression_algs[Extent::compress_mode_lzf].compress_flag);
+    sink.writeExtentLibrary(library);
+    for (unsigned e = 0; e < fileExtents(file); ++e) {
+        ExtentSeries s(type);
+        Extent::Ptr extent(new Extent(type));
+        s.setExtent(extent);
+        Int32Field f(s, "file");
+        Int32Field row(s, "row");
+        for (unsigned i = e * nrecords; i < (e + 1) * nrecords; ++i) {
+            s.newRecord();
+            f.set(file);
+            row.set(i);
+        }
+        sink.writeExtent(*extent, NULL);
+    }
+    sink.close();
+}
+
+// Reads all the files twice (the second time after resetPos) and checks
+// that each file's rows come together and in order, and, if
+// keep_file_order, that the files come in the order they were added.
+void readFiles(unsigned parallel, bool keep_file_order) {
+    TypeIndexModule source("Test::ParallelFiles");
+    for (unsigned f = 0; f < nfiles; ++f) {
+        source.addSource(fileName(f));
+    }
+    source.setParallelFiles(parallel, keep_file_order);
+    source.startPrefetching();
+
+    for (unsigned pass = 0; pass < 2; ++pass) {
+        ExtentSeries s;
+        Int32Field f(s, "file");
+        Int32Field row(s, "row");
+        vector<bool> seen(nfiles, false);
+        unsigned files = 0, cur = nfiles, cur_row = 0;
+        while (Extent::Ptr e = source.getSharedExtent()) {
+            for (s.setExtent(e); s.more(); s.next()) {
+                if (row.val() == 0) {
+                    SINVARIANT(cur == nfiles || cur_row == fileExtents(cur) * nrecords);
+                    cur = f.val();
+                    SINVARIANT(cur < nfiles && !seen[cur]);
+                    SINVARIANT(!keep_file_order || cur == files);
+                    seen[cur] = true;
+                    cur_row = 0;
+                    ++files;
+                }
+                SINVARIANT(static_cast<unsigned>(f.val()) == cur
+                           && static_cast<unsigned>(row.val()) == cur_row);
+                ++cur_row;
+            }
+        }
+        SINVARIANT(files == nfiles && cur_row == fileExtents(cur) * nrecords);
+        source.resetPos();
+    }
+    source.close();
+    cout << format("parallel files %d %s order ok\n") % parallel
+        % (keep_file_order ? "file" : "completion");
+}
+
+int main() {
+    for (unsigned f = 0; f < nfiles; ++f) {
+        writeFile(f);
+    }
+    readFiles(1, true);
+    readFiles(4, true);
+    readFiles(4, false);
+    readFiles(nfiles + 5, false);
+    cout << "Passed parallel files tests\n";
+    return 0;
+}
@@ -0,0 +1,138 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Test RowAnalysisModule::setParallel: a module run on several workers
+    gets the same results as one run on a single thread.
+*/
+
+#include <iostream>
+#include <map>
+
+#include <DataSeries/DataSeriesFile.hpp>
+#include <DataSeries/DataSeriesModule.hpp>
+#include <DataSeries/RowAnalysisModule.hpp>
+#include <DataSeries/TypeIndexModule.hpp>
+
+using namespace std;
+using boost::format;
+
+const string type_xml(
+        "<ExtentType namespace=\"ssd.hpl.hp.com\" name=\"Test::ParallelRows\" version=\"1.0\">\n"
+        "  <field type=\"int32\" name=\"key\" />\n"
+        "  <field type=\"int64\" name=\"value\" />\n"
+        "</ExtentType>\n");
+
+const unsigned nextents = 200, nrecords = 1000;
+
+void writeFile() {
+    ExtentTypeLibrary library;
+    const ExtentType::Ptr type(library.registerTypePtr(type_xml));
+    DataSeriesSink sink("parallel-row-analysis.ds",
+                        Extent::compression_algs[Extent::compress_mode_lzf].compress_flag);
+    sink.writeExtentLibrary(library);
+    for (unsigned i = 0; i < nextents; ++i) {
+        Extent::Ptr extent(new Extent(type));
+        ExtentSeries s(extent);
+        Int32Field key(s, "key");
+        Int64Field value(s, "value");
+        for (unsigned j = 0; j < nrecords; ++j) {
+            s.newRecord();
+            key.set((i * 7 + j) % 37);
+            value.set(static_cast<int64_t>(i) * nrecords + j);
+        }
+        sink.writeExtent(*extent, NULL);
+    }
+    sink.close();
+}
+
+class SumByKey : public ParallelRowAnalysisModule<SumByKey> {
+  public:
+    SumByKey(DataSeriesModule &source)
+        : ParallelRowAnalysisModule<SumByKey>(source),
+          key(series, "key"), value(series, "value"), nextents(0), nprepared(0) { }
+
+    virtual void newExtentHook(const Extent &e) {
+        ++nextents;
+    }
+
+    virtual void prepareForProcessing() {
+        ++nprepared;
+    }
+
+    virtual void processRow() {
+        sums[key.val()] += value.val();
+    }
+
+    void merge(const SumByKey &other) {
+        for (map<int32_t, int64_t>::const_iterator i = other.sums.begin();
+             i != other.sums.end(); ++i) {
+            sums[i->first] += i->second;
+        }
+        nextents += other.nextents;
+        nprepared += other.nprepared;
+    }
+
+    Int32Field key;
+    Int64Field value;
+    map<int32_t, int64_t> sums;
+    unsigned nextents, nprepared;
+
+  protected:
+    virtual RowAnalysisModule *newWorker() {
+        return new SumByKey(source);
+    }
+};
+
+void runAnalysis(unsigned nworkers, const string &where, SumByKey *&result) {
+    TypeIndexModule source("Test::ParallelRows");
+    source.addSource("parallel-row-analysis.ds");
+    result = new SumByKey(source);
+    if (!where.empty()) {
+        result->setWhereExpr(where);
+    }
+    if (nworkers > 0) {
+        result->setParallel(nworkers);
+    }
+    // extents come back while the workers are still reading them
+    unsigned nreturned = 0;
+    while (true) {
+        Extent::Ptr e = result->getSharedExtent();
+        if (e == NULL) {
+            break;
+        }
+        SINVARIANT(e->nRecords() == nrecords);
+        ++nreturned;
+    }
+    SINVARIANT(nreturned == nextents && result->nextents == nextents);
+}
+
+void testParallel(const string &where) {
+    SumByKey *sequential, *parallel;
+    runAnalysis(0, where, sequential);
+    SINVARIANT(sequential->nprepared == 1);
+    for (unsigned nworkers = 1; nworkers <= 4; nworkers += 3) {
+        runAnalysis(nworkers, where, parallel);
+        SINVARIANT(parallel->sums == sequential->sums);
+        SINVARIANT(parallel->processed_rows == sequential->processed_rows);
+        SINVARIANT(parallel->ignored_rows == sequential->ignored_rows);
+        // this module, and each worker that saw an extent
+        SINVARIANT(parallel->nprepared > 1 && parallel->nprepared <= 1 + nworkers);
+        delete parallel;
+    }
+    cout << format("where '%s': %d rows processed, %d ignored, same on 1 and 4 workers\n")
+        % where % sequential->processed_rows % sequential->ignored_rows;
+    delete sequential;
+}
+
+int main() {
+    writeFile();
+    testParallel("");
+    testParallel("key < 10");
+    cout << "parallel-row-analysis tests passed\n";
+    return 0;
+}
@@ -0,0 +1,256 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Test dataseries::Pipeline: stream operators, breakers with per-task
+    state, and pull modules run inside a pipeline.
+*/
+
+#include <iostream>
+#include <map>
+
+#include <boost/bind.hpp>
+
+#include <DataSeries/DataSeriesFile.hpp>
+#include <DataSeries/DataSeriesModule.hpp>
+#include <DataSeries/Pipeline.hpp>
+#include <DataSeries/TypeIndexModule.hpp>
+
+using namespace std;
+using namespace dataseries;
+using boost::format;
+
+const string type_xml(
+        "<ExtentType namespace=\"ssd.hpl.hp.com\" name=\"Test::Pipeline\" version=\"1.0\">\n"
+        "  <field type=\"int32\" name=\"key\" />\n"
+        "  <field type=\"int64\" name=\"value\" />\n"
+        "</ExtentType>\n");
+
+const string sum_xml(
+        "<ExtentType namespace=\"ssd.hpl.hp.com\" name=\"Test::PipelineSum\" version=\"1.0\">\n"
+        "  <field type=\"int32\" name=\"key\" />\n"
+        "  <field type=\"int64\" name=\"sum\" />\n"
+        "</ExtentType>\n");
+
+const unsigned nextents = 150, nrecords = 1000, nkeys = 37;
+
+void writeFile() {
+    ExtentTypeLibrary library;
+    const ExtentType::Ptr type(library.registerTypePtr(type_xml));
+    DataSeriesSink sink("pipeline.ds",
+                        Extent::compression_algs[Extent::compress_mode_lzf].compress_flag);
+    sink.writeExtentLibrary(library);
+    for (unsigned i = 0; i < nextents; ++i) {
+        Extent::Ptr extent(new Extent(type));
+        ExtentSeries s(extent);
+        Int32Field key(s, "key");
+        Int64Field value(s, "value");
+        for (unsigned j = 0; j < nrecords; ++j) {
+            s.newRecord();
+            key.set((i * 7 + j) % nkeys);
+            value.set(static_cast<int64_t>(i) * nrecords + j);
+        }
+        sink.writeExtent(*extent, NULL);
+    }
+    sink.close();
+}
+
+// Sums value by key, with a partial sum in each task merged at the end.
+class SumByKey : public BreakerOperator {
+  public:
+    SumByKey() : done(false) { }
+
+    struct SumLocal : public Local {
+        SumLocal() : key(series, "key"), value(series, "value") { }
+        ExtentSeries series;
+        Int32Field key;
+        Int64Field value;
+        map<int32_t, int64_t> sums;
+    };
+
+    virtual Local *newLocal() {
+        return new SumLocal();
+    }
+
+    virtual void consume(Local *local, uint64_t seq, const Extent::Ptr &in) {
+        SumLocal &l(*static_cast<SumLocal *>(local));
+        for (l.series.setExtent(in); l.series.more(); l.series.next()) {
+            l.sums[l.key.val()] += l.value.val();
+        }
+        l.series.clearExtent();
+    }
+
+    virtual void finishLocal(Local *local) {
+        SumLocal &l(*static_cast<SumLocal *>(local));
+        for (map<int32_t, int64_t>::iterator i = l.sums.begin(); i != l.sums.end(); ++i) {
+            sums[i->first] += i->second;
+        }
+    }
+
+    virtual Extent::Ptr produce() {
+        if (done) {
+            return Extent::Ptr();
+        }
+        done = true;
+        ExtentTypeLibrary library;
+        ExtentSeries s(library.registerTypePtr(sum_xml));
+        Int32Field key(s, "key");
+        Int64Field sum(s, "sum");
+        s.newExtent();
+        for (map<int32_t, int64_t>::iterator i = sums.begin(); i != sums.end(); ++i) {
+            s.newRecord();
+            key.set(i->first);
+            sum.set(i->second);
+        }
+        return s.getSharedExtent();
+    }
+
+    map<int32_t, int64_t> sums;
+    bool done;
+};
+
+// A pull module that checks it sees the rows in the order of the file.
+class CheckOrderModule : public DataSeriesModule {
+  public:
+    CheckOrderModule(DataSeriesModule &source)
+        : source(source), value(series, "value"), last(-1), rows(0) { }
+
+    virtual Extent::Ptr getSharedExtent() {
+        Extent::Ptr e = source.getSharedExtent();
+        if (e != NULL) {
+            for (series.setExtent(e); series.more(); series.next()) {
+                SINVARIANT(value.val() > last);
+                last = value.val();
+                ++rows;
+            }
+            series.clearExtent();
+        }
+        return e;
+    }
+
+    DataSeriesModule &source;
+    ExtentSeries series;
+    Int64Field value;
+    int64_t last;
+    uint64_t rows;
+};
+
+CheckOrderModule *check_order;
+
+DataSeriesModule::Ptr makeCheckOrder(DataSeriesModule &source) {
+    check_order = new CheckOrderModule(source);
+    return DataSeriesModule::Ptr(check_order);
+}
+
+uint64_t expectedRows(int32_t max_key) {
+    uint64_t ret = 0;
+    for (unsigned i = 0; i < nextents; ++i) {
+        for (unsigned j = 0; j < nrecords; ++j) {
+            if (static_cast<int32_t>((i * 7 + j) % nkeys) < max_key) {
+                ++ret;
+            }
+        }
+    }
+    return ret;
+}
+
+// A select, the output read in order by a pull module.
+void testSelect(unsigned max_in_flight) {
+    TypeIndexModule source("Test::Pipeline");
+    source.addSource("pipeline.ds");
+    Pipeline pipeline(source);
+    pipeline.add(StreamOperator::Ptr(new SelectOperator("key < 10")));
+    pipeline.setMaxInFlight(max_in_flight);
+
+    CheckOrderModule check(pipeline);
+    check.getAndDeleteShared();
+    SINVARIANT(check.rows == expectedRows(10));
+}
+
+// A select makes an extent of each morsel however few rows match;
+// merged, they fill one extent, and only a select matching nothing
+// returns an empty one.
+void testMerge() {
+    TypeIndexModule source("Test::Pipeline");
+    source.addSource("pipeline.ds");
+    Pipeline pipeline(source);
+    pipeline.add(StreamOperator::Ptr(new SelectOperator("key == 3")));
+    ExtentMergeModule merge(pipeline);
+    CheckOrderModule check(merge);
+    unsigned nmerged = 0;
+    while (Extent::Ptr e = check.getSharedExtent()) {
+        SINVARIANT(e->nRecords() > 0);
+        ++nmerged;
+    }
+    SINVARIANT(check.rows == expectedRows(4) - expectedRows(3));
+    // about 4000 rows of 16 bytes fit in one extent of 96KiB
+    SINVARIANT(nmerged == 1);
+
+    TypeIndexModule none_source("Test::Pipeline");
+    none_source.addSource("pipeline.ds");
+    Pipeline none(none_source);
+    none.add(StreamOperator::Ptr(new SelectOperator("key < 0")));
+    ExtentMergeModule none_merge(none);
+    Extent::Ptr e = none_merge.getSharedExtent();
+    SINVARIANT(e != NULL && e->nRecords() == 0 && e->getTypePtr()->getName() == "Test::Pipeline");
+    SINVARIANT(none_merge.getSharedExtent() == NULL);
+}
+
+// Two stages: a select feeding an aggregation, then a select on the sums;
+// and a pull module in the middle of the first stage.
+void testBreakers(unsigned max_in_flight) {
+    TypeIndexModule source("Test::Pipeline");
+    source.addSource("pipeline.ds");
+    Pipeline pipeline(source);
+    boost::shared_ptr<SumByKey> sum_by_key(new SumByKey());
+    pipeline.add(StreamOperator::Ptr(new SelectOperator("key >= 5")))
+        .add(BreakerOperator::Ptr(new ModuleOperator(makeCheckOrder)))
+        .add(StreamOperator::Ptr(new SelectOperator("key < 20")))
+        .add(sum_by_key)
+        .add(StreamOperator::Ptr(new SelectOperator("key < 15")));
+    pipeline.setMaxInFlight(max_in_flight);
+
+    ExtentSeries s;
+    Int32Field key(s, "key");
+    Int64Field sum(s, "sum");
+    map<int32_t, int64_t> sums;
+    while (true) {
+        Extent::Ptr e = pipeline.getSharedExtent();
+        if (e == NULL) {
+            break;
+        }
+        for (s.setExtent(e); s.more(); s.next()) {
+            sums[key.val()] = sum.val();
+        }
+    }
+    SINVARIANT(check_order->rows == expectedRows(nkeys) - expectedRows(5));
+    SINVARIANT(sum_by_key->sums.size() == 15);
+
+    map<int32_t, int64_t> expected;
+    for (unsigned i = 0; i < nextents; ++i) {
+        for (unsigned j = 0; j < nrecords; ++j) {
+            int32_t k = (i * 7 + j) % nkeys;
+            if (k >= 5 && k < 15) {
+                expected[k] += static_cast<int64_t>(i) * nrecords + j;
+            }
+        }
+    }
+    SINVARIANT(sums == expected);
+    cout << format("%d in flight: %d keys summed\n") % max_in_flight % sums.size();
+}
+
+int main() {
+    writeFile();
+    testSelect(1);
+    testSelect(4);
+    testSelect(0);
+    testMerge();
+    testBreakers(1);
+    testBreakers(4);
+    cout << "pipeline tests passed\n";
+    return 0;
+}
@@ -0,0 +1,216 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Test the ring that hands extents from the DataSeriesSink producers to
+    the compressors and the writer, and a sink with many producers.
+*/
+
+#include <iostream>
+
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+
+#include <Lintel/MersenneTwisterRandom.hpp>
+
+#include <DataSeries/DataSeriesFile.hpp>
+#include <DataSeries/DataSeriesModule.hpp>
+#include <DataSeries/TypeIndexModule.hpp>
+
+#include <base/SequencedRing.hpp>
+
+using namespace std;
+using boost::format;
+using dataseries::SequencedRing;
+
+class FunctionThread : public PThread {
+  public:
+    FunctionThread(const boost::function<void ()> &fn) : fn(fn) { }
+    virtual void *run() {
+        fn();
+        return NULL;
+    }
+    boost::function<void ()> fn;
+};
+
+void runThreads(const vector<boost::function<void ()> > &fns) {
+    vector<FunctionThread *> threads;
+    for (unsigned i = 0; i < fns.size(); ++i) {
+        threads.push_back(new FunctionThread(fns[i]));
+        threads.back()->start();
+    }
+    for (unsigned i = 0; i < threads.size(); ++i) {
+        threads[i]->join();
+        delete threads[i];
+    }
+}
+
+const unsigned nproducers = 4, nworkers = 3, nitems = 20000;
+
+struct Item {
+    unsigned producer, seq;
+};
+
+void produce(SequencedRing<Item> *ring, unsigned producer) {
+    for (unsigned i = 0; i < nitems; ++i) {
+        Item *item = new Item();
+        item->producer = producer;
+        item->seq = i;
+        ring->push(item);
+    }
+}
+
+// Finishes in a scrambled order, so the consumer has to wait for the front.
+void work(SequencedRing<Item> *ring, unsigned *remaining, unsigned seed) {
+    MersenneTwisterRandom rng(seed);
+    vector<pair<uint64_t, Item *> > claimed;
+    while (__atomic_load_n(remaining, __ATOMIC_SEQ_CST) > 0 || !claimed.empty()) {
+        uint64_t ticket;
+        Item *item = ring->claim(ticket);
+        if (item != NULL) {
+            claimed.push_back(make_pair(ticket, item));
+            __atomic_sub_fetch(remaining, 1, __ATOMIC_SEQ_CST);
+        }
+        if (!claimed.empty() && (item == NULL || rng.randInt(3) == 0)) {
+            unsigned i = rng.randInt(claimed.size());
+            ring->finish(claimed[i].first);
+            claimed[i] = claimed.back();
+            claimed.pop_back();
+        }
+    }
+}
+
+void consume(SequencedRing<Item> *ring, bool *keep_going) {
+    vector<unsigned> next(nproducers, 0);
+    unsigned total = 0;
+    while (total < nproducers * nitems) {
+        ring->waitFront(*keep_going);
+        unsigned n = 0;
+        for (uint64_t ticket = ring->front(); ; ++ticket, ++n) {
+            Item *item = ring->getFinished(ticket);
+            if (item == NULL) {
+                break;
+            }
+            // each producer's items come out in the order it pushed them
+            SINVARIANT(item->seq == next[item->producer]);
+            ++next[item->producer];
+            delete item;
+        }
+        ring->pop(n);
+        total += n;
+    }
+}
+
+// Producers, workers and a consumer all at once through a small ring, so
+// that everyone has to wait for everyone else.
+void testRing() {
+    SequencedRing<Item> ring(5);
+    SINVARIANT(ring.capacity() == 8);
+    unsigned remaining = nproducers * nitems;
+    bool keep_going = true;
+    vector<boost::function<void ()> > fns;
+    for (unsigned i = 0; i < nproducers; ++i) {
+        fns.push_back(boost::bind(produce, &ring, i));
+    }
+    for (unsigned i = 0; i < nworkers; ++i) {
+        fns.push_back(boost::bind(work, &ring, &remaining, 1776 + i));
+    }
+    fns.push_back(boost::bind(consume, &ring, &keep_going));
+    runThreads(fns);
+    SINVARIANT(ring.empty() && ring.back() == nproducers * nitems);
+    cout << "ring ok\n";
+}
+
+const string type_xml(
+        "<ExtentType namespace=\"ssd.hpl.hp.com\" name=\"Test::SinkRing\" version=\"1.0\">\n"
+        "  <field type=\"int32\" name=\"producer\" />\n"
+        "  <field type=\"int32\" name=\"seq\" />\n"
+        "  <field type=\"variable32\" name=\"name\" />\n"
+        "</ExtentType>\n");
+
+const unsigned nextents = 300, nrecords = 50;
+
+void writeExtents(DataSeriesSink *sink, const ExtentType::Ptr type, unsigned producer,
+                  DataSeriesSink::Stats *stats) {
+    for (unsigned i = 0; i < nextents; ++i) {
+        Extent::Ptr extent(new Extent(type));
+        ExtentSeries s(extent);
+        Int32Field producer_field(s, "producer");
+        Int32Field seq(s, "seq");
+        Variable32Field name(s, "name");
+        for (unsigned j = 0; j < nrecords; ++j) {
+            s.newRecord();
+            producer_field.set(producer);
+            seq.set(i);
+            name.set(str(format("record %d of %d") % j % i));
+        }
+        sink->writeExtent(*extent, stats);
+    }
+}
+
+void testSink(int compressors) {
+    DataSeriesSink::setCompressorCount(compressors);
+    ExtentTypeLibrary library;
+    const ExtentType::Ptr type(library.registerTypePtr(type_xml));
+    vector<DataSeriesSink::Stats> stats(nproducers);
+    {
+        DataSeriesSink sink("sink-ring.ds",
+                            Extent::compression_algs[Extent::compress_mode_lzf].compress_flag);
+        sink.writeExtentLibrary(library);
+        vector<boost::function<void ()> > fns;
+        for (unsigned i = 0; i < nproducers; ++i) {
+            fns.push_back(boost::bind(writeExtents, &sink, type, i, &stats[i]));
+        }
+        if (compressors == 0) {
+            // without compressors, only one thread may write
+            for (unsigned i = 0; i < fns.size(); ++i) {
+                fns[i]();
+            }
+        } else {
+            runThreads(fns);
+        }
+        sink.flushPending();
+        for (unsigned i = 0; i < nproducers; ++i) {
+            SINVARIANT(stats[i].extents == nextents && stats[i].use_count == 0);
+            sink.removeStatsUpdate(&stats[i]);
+        }
+        sink.close();
+    }
+
+    TypeIndexModule source("Test::SinkRing");
+    source.addSource("sink-ring.ds");
+    ExtentSeries s;
+    Int32Field producer(s, "producer");
+    Int32Field seq(s, "seq");
+    vector<int32_t> next(nproducers, 0);
+    unsigned count = 0;
+    while (true) {
+        Extent::Ptr e = source.getSharedExtent();
+        if (e == NULL) {
+            break;
+        }
+        s.setExtent(e);
+        int32_t extent_producer = producer.val(), extent_seq = seq.val();
+        SINVARIANT(extent_seq == next[extent_producer]);
+        ++next[extent_producer];
+        for (; s.morerecords(); ++s) {
+            SINVARIANT(producer.val() == extent_producer && seq.val() == extent_seq);
+            ++count;
+        }
+    }
+    SINVARIANT(count == nproducers * nextents * nrecords);
+    cout << format("sink with %d compressors ok\n") % compressors;
+}
+
+int main() {
+    testRing();
+    testSink(0);
+    testSink(1);
+    testSink(-1);
+    cout << "sink-ring tests passed\n";
+    return 0;
+}
@@ -0,0 +1,165 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Test the task pool shared by the sources and sinks.
+*/
+
+#include <iostream>
+
+#include <boost/bind.hpp>
+
+#include <DataSeries/DataSeriesFile.hpp>
+#include <DataSeries/DataSeriesModule.hpp>
+#include <DataSeries/TaskPool.hpp>
+#include <DataSeries/TypeIndexModule.hpp>
+
+using namespace std;
+using boost::format;
+using dataseries::TaskPool;
+
+PThreadMutex mutex;
+vector<int> started;
+
+void record(int id) {
+    PThreadScopedLock lock(mutex);
+    started.push_back(id);
+}
+
+void nested(TaskPool *pool, unsigned depth) {
+    vector<TaskPool::Task> tasks;
+    for (unsigned i = 0; i < 4; ++i) {
+        if (depth == 0) {
+            tasks.push_back(boost::bind(record, 0));
+        } else {
+            tasks.push_back(boost::bind(nested, pool, depth - 1));
+        }
+    }
+    pool->runAll(tasks);
+}
+
+// Each queue's tasks start in order, and a queue that submits after
+// another has a long backlog doesn't wait for all of it.
+void testOrderAndFairness() {
+    TaskPool pool(1);
+    {
+        TaskPool::Queue a(pool), b(pool);
+        PThreadScopedLock lock(mutex); // nothing can start until we are done
+        for (int i = 0; i < 100; ++i) {
+            a.submit(boost::bind(record, i));
+        }
+        for (int i = 0; i < 3; ++i) {
+            b.submit(boost::bind(record, 1000 + i));
+        }
+    }
+    SINVARIANT(started.size() == 103);
+    int next_a = 0, next_b = 1000;
+    for (unsigned i = 0; i < started.size(); ++i) {
+        if (started[i] < 1000) {
+            SINVARIANT(started[i] == next_a++);
+        } else {
+            SINVARIANT(started[i] == next_b++);
+            SINVARIANT(i <= 6); // alternates with a until b is empty
+        }
+    }
+    cout << "order and fairness ok\n";
+}
+
+// Tasks that run tasks can't deadlock, even with a single thread.
+void testNested() {
+    started.clear();
+    TaskPool pool(1);
+    TaskPool::Queue q(pool);
+    for (unsigned i = 0; i < 4; ++i) {
+        q.submit(boost::bind(nested, &pool, 2));
+    }
+    q.wait();
+    SINVARIANT(started.size() == 4 * 4 * 4 * 4);
+    cout << "nested ok\n";
+}
+
+const string type_xml =
+        "<ExtentType namespace=\"ssd.hpl.hp.com\" name=\"Test::TaskPool\" version=\"1.0\">\n"
+        "  <field type=\"int32\" name=\"file\" />\n"
+        "  <field type=\"int64\" name=\"row\" pack_relative=\"row\" />\n"
+        "</ExtentType>\n";
+
+const unsigned nfiles = 4, nextents = 20, nrecords = 5000;
+
+// Many sinks and sources at once share the small pool.
+void testSharedPool() {
+    TaskPool::setSharedThreads(3);
+    ExtentTypeLibrary library;
+    const ExtentType::Ptr type = library.registerTypePtr(type_xml);
+    uint32_t lzf = Extent::compression_algs[Extent::compress_mode_lzf].compress_flag;
+    vector<DataSeriesSink *> sinks;
+    for (unsigned f = 0; f < nfiles; ++f) {
+        sinks.push_back(new DataSeriesSink(str(format("task-pool-%d.ds") % f), lzf));
+        sinks.back()->writeExtentLibrary(library);
+    }
+    for (unsigned e = 0; e < nextents; ++e) {
+        for (unsigned f = 0; f < nfiles; ++f) {
+            ExtentSeries s(type);
+            Extent::Ptr extent(new Extent(type));
+            s.setExtent(extent);
+            Int32Field file(s, "file");
+            Int64Field row(s, "row");
+            for (unsigned i = e * nrecords; i < (e + 1) * nrecords; ++i) {
+                s.newRecord();
+                file.set(f);
+                row.set(i);
+            }
+            sinks[f]->writeExtent(*extent, NULL);
+        }
+    }
+    for (unsigned f = 0; f < nfiles; ++f) {
+        sinks[f]->close();
+        delete sinks[f];
+    }
+
+    vector<TypeIndexModule *> sources;
+    for (unsigned f = 0; f < nfiles; ++f) {
+        sources.push_back(new TypeIndexModule("Test::TaskPool"));
+        sources.back()->addSource(str(format("task-pool-%d.ds") % f));
+        sources.back()->startPrefetching(1024 * 1024, 1024 * 1024);
+    }
+    vector<unsigned> rows(nfiles, 0);
+    for (bool more = true; more; ) {
+        more = false;
+        for (unsigned f = 0; f < nfiles; ++f) {
+            Extent::Ptr e = sources[f]->getSharedExtent();
+            if (e == NULL) {
+                continue;
+            }
+            more = true;
+            ExtentSeries s(e);
+            Int32Field file(s, "file");
+            Int64Field row(s, "row");
+            for (; s.more(); s.next(), ++rows[f]) {
+                SINVARIANT(file.val() == static_cast<int32_t>(f) && row.val() == rows[f]);
+            }
+        }
+    }
+    for (unsigned f = 0; f < nfiles; ++f) {
+        SINVARIANT(rows[f] == nextents * nrecords);
+        delete sources[f];
+    }
+    // Asking again for the size the pool has is fine after it started.
+    SINVARIANT(TaskPool::shared().nThreads() == 3);
+    TaskPool::setSharedThreads(3);
+    SINVARIANT(TaskPool::getSharedThreads() == 3);
+    SINVARIANT(TaskPool::shared().nThreads() == 3);
+    cout << "shared pool ok\n";
+}
+
+int main() {
+    testOrderAndFairness();
+    testNested();
+    testSharedPool();
+    cout << "Passed task pool tests\n";
+    return 0;
+}
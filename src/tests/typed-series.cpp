@@ -0,0 +1,141 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Test TypedSeries: it reads the same values as the fields, over two
+    versions of a type with the fields in a different order.
+*/
+
+#include <iostream>
+
+#include <DataSeries/BoolField.hpp>
+#include <DataSeries/ByteField.hpp>
+#include <DataSeries/DoubleField.hpp>
+#include <DataSeries/Int32Field.hpp>
+#include <DataSeries/Int64Field.hpp>
+#include <DataSeries/TypedSeries.hpp>
+
+using namespace std;
+using dataseries::TypedSeries;
+
+// as written by dstypes2cxx -o schema; the variable32 field is left out
+struct Test__TypedSeriesSchema {
+    static const char *typeName() { return "Test::TypedSeries"; }
+    enum { nfields = 5 };
+    static const dataseries::SchemaField &field(unsigned i) {
+        static const dataseries::SchemaField fields[nfields] = {
+            { "flag", ExtentType::ft_bool, false },
+            { "small", ExtentType::ft_byte, false },
+            { "maybe", ExtentType::ft_int32, true },
+            { "bytes", ExtentType::ft_int64, false },
+            { "latency", ExtentType::ft_double, false },
+        };
+        return fields[i];
+    }
+    typedef dataseries::SchemaColumn<0, bool> flag;
+    typedef dataseries::SchemaColumn<1, uint8_t> small;
+    typedef dataseries::SchemaColumn<2, int32_t, true> maybe;
+    typedef dataseries::SchemaColumn<3, int64_t> bytes;
+    typedef dataseries::SchemaColumn<4, double> latency;
+    // variable32 fields, not in the schema: name
+};
+
+typedef Test__TypedSeriesSchema Schema;
+
+const string type_xml_v1(
+        "<ExtentType namespace=\"ssd.hpl.hp.com\" name=\"Test::TypedSeries\" version=\"1.0\">\n"
+        "  <field type=\"bool\" name=\"flag\" />\n"
+        "  <field type=\"byte\" name=\"small\" />\n"
+        "  <field type=\"int32\" name=\"maybe\" opt_nullable=\"yes\" />\n"
+        "  <field type=\"int64\" name=\"bytes\" />\n"
+        "  <field type=\"double\" name=\"latency\" />\n"
+        "  <field type=\"variable32\" name=\"name\" />\n"
+        "</ExtentType>\n");
+
+// same fields, other order, extra bools so flag isn't bit 0, maybe not nullable
+const string type_xml_v2(
+        "<ExtentType namespace=\"ssd.hpl.hp.com\" name=\"Test::TypedSeries\" version=\"2.0\">\n"
+        "  <field type=\"double\" name=\"latency\" />\n"
+        "  <field type=\"bool\" name=\"other\" />\n"
+        "  <field type=\"int32\" name=\"maybe\" />\n"
+        "  <field type=\"bool\" name=\"another\" />\n"
+        "  <field type=\"bool\" name=\"flag\" />\n"
+        "  <field type=\"int64\" name=\"bytes\" />\n"
+        "  <field type=\"byte\" name=\"small\" />\n"
+        "</ExtentType>\n");
+
+const unsigned nrecords = 1000;
+
+Extent::Ptr makeExtent(const ExtentType::Ptr &type, unsigned version) {
+    Extent::Ptr extent(new Extent(type));
+    ExtentSeries s(extent);
+    BoolField flag(s, "flag");
+    ByteField small(s, "small");
+    Int32Field maybe(s, "maybe", Field::flag_nullable);
+    Int64Field bytes(s, "bytes");
+    DoubleField latency(s, "latency");
+    for (unsigned j = 0; j < nrecords; ++j) {
+        s.newRecord();
+        flag.set(j % 3 == version);
+        small.set((j + version) % 250);
+        if (type->getNullable("maybe") && j % 5 == 3) {
+            maybe.setNull();
+        } else {
+            maybe.set(j * 3 - 1000);
+        }
+        bytes.set(static_cast<int64_t>(version) * 1000000000000LL + j * 7);
+        latency.set(j * 0.25 + version);
+    }
+    return extent;
+}
+
+// the two versions can't be in one library, so the extents aren't written out
+void checkValues() {
+    ExtentTypeLibrary library_v1, library_v2;
+    const ExtentType::Ptr v1(library_v1.registerTypePtr(type_xml_v1));
+    const ExtentType::Ptr v2(library_v2.registerTypePtr(type_xml_v2));
+    vector<Extent::Ptr> extents;
+    for (unsigned i = 0; i < 4; ++i) {
+        extents.push_back(makeExtent(i % 2 == 0 ? v1 : v2, 1 + i % 2));
+    }
+
+    ExtentSeries s(ExtentSeries::typeLoose);
+    BoolField flag(s, "flag");
+    ByteField small(s, "small");
+    Int32Field maybe(s, "maybe", Field::flag_nullable);
+    Int64Field bytes(s, "bytes");
+    DoubleField latency(s, "latency");
+    TypedSeries<Schema> t;
+    unsigned nrows = 0, nnull = 0;
+    for (vector<Extent::Ptr>::iterator e = extents.begin(); e != extents.end(); ++e) {
+        s.setExtent(*e);
+        for (t.setExtent(*e); s.more(); s.next(), t.next()) {
+            SINVARIANT(t.more());
+            SINVARIANT(t.val<Schema::flag>() == flag.val());
+            SINVARIANT(t.val<Schema::small>() == small.val());
+            SINVARIANT(t.val<Schema::bytes>() == bytes.val());
+            SINVARIANT(t.val<Schema::latency>() == latency.val());
+            SINVARIANT(t.isNull<Schema::maybe>() == maybe.isNull());
+            if (maybe.isNull()) {
+                SINVARIANT(t.val<Schema::maybe>() == 0);
+                ++nnull;
+            } else {
+                SINVARIANT(t.val<Schema::maybe>() == maybe.val());
+            }
+            ++nrows;
+        }
+        SINVARIANT(!t.more());
+    }
+    SINVARIANT(nrows == 4 * nrecords && nnull == 2 * nrecords / 5);
+    cout << "typed series matches the fields\n";
+}
+
+int main() {
+    checkValues();
+    cout << "typed-series tests passed\n";
+    return 0;
+}
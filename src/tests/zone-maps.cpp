@@ -0,0 +1,309 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Test zone maps: DSv2 files carry the min/max and null count of each
+    numeric field of each extent, and TypeIndexModule::addRangeFilter
+    and where expressions pushed down to it skip the extents that can't
+    match.
+*/
+
+#include <math.h>
+
+#include <iostream>
+
+#include <DataSeries/DataSeriesFile.hpp>
+#include <DataSeries/DSExpr.hpp>
+#include <DataSeries/DataSeriesModule.hpp>
+#include <DataSeries/RowAnalysisModule.hpp>
+#include <DataSeries/TypeIndexModule.hpp>
+
+using namespace std;
+using boost::format;
+using dataseries::ZoneMap;
+
+const string type_xml(
+        "<ExtentType namespace=\"ssd.hpl.hp.com\" name=\"Test::ZoneMaps\" version=\"1.0\">\n"
+        "  <field type=\"int64\" name=\"time\" pack_relative=\"time\" />\n"
+        "  <field type=\"double\" name=\"value\" />\n"
+        "  <field type=\"int32\" name=\"count\" opt_nullable=\"yes\" />\n"
+        "  <field type=\"byte\" name=\"op\" />\n"
+        "  <field type=\"bool\" name=\"flag\" />\n"
+        "  <field type=\"variable32\" name=\"name\" />\n"
+        "</ExtentType>\n");
+
+const unsigned nextents = 10, nrecords = 1000;
+
+// Extent i has times [i*nrecords, (i+1)*nrecords), values around i, and
+// counts that are null in the odd extents.
+void fill(ExtentSeries &s, unsigned i) {
+    Int64Field time(s, "time");
+    DoubleField value(s, "value");
+    Int32Field count(s, "count", Field::flag_nullable);
+    ByteField op(s, "op");
+    BoolField flag(s, "flag");
+    Variable32Field name(s, "name");
+    for (unsigned j = 0; j < nrecords; ++j) {
+        s.newRecord();
+        time.set(i * nrecords + j);
+        value.set(i + j / static_cast<double>(nrecords));
+        if (i % 2 == 1) {
+            count.setNull();
+        } else {
+            count.set(-static_cast<int32_t>(j));
+        }
+        op.set(i);
+        flag.set(j % 2 == 0);
+        name.set("x");
+    }
+}
+
+unsigned nwritten;
+
+// The zone map extent is not one of the extents the callback sees.
+void countWrite(off64_t offset, Extent &e) {
+    SINVARIANT(e.getTypePtr() != ExtentType::getDataSeriesZoneMapTypePtr());
+    ++nwritten;
+}
+
+void writeFile(const string &filename, const ExtentTypeLibrary &library,
+               const ExtentType::Ptr type, uint32_t format_version) {
+    DataSeriesSink sink(filename, Extent::compression_algs[Extent::compress_mode_lzf].compress_flag);
+    sink.setFormatVersion(format_version);
+    nwritten = 0;
+    sink.setExtentWriteCallback(&countWrite);
+    sink.writeExtentLibrary(library);
+    for (unsigned i = 0; i < nextents; ++i) {
+        Extent::Ptr extent(new Extent(type));
+        ExtentSeries s(extent);
+        fill(s, i);
+        sink.writeExtent(*extent, NULL);
+    }
+    sink.close();
+    SINVARIANT(nwritten == 1 + nextents + 1); // the type library and the index
+}
+
+void checkZoneMap(const string &filename) {
+    DataSeriesSource source(filename);
+    const ZoneMap &zone_map(source.getZoneMap());
+    SINVARIANT(!zone_map.empty());
+    ExtentSeries s(source.index_extent);
+    Int64Field offset(s, "offset");
+    Variable32Field extenttype(s, "extenttype");
+    unsigned i = 0;
+    for (; s.morerecords(); ++s) {
+        if (extenttype.stringval() != "Test::ZoneMaps") {
+            SINVARIANT(zone_map.find(offset.val(), "time") == NULL);
+            continue;
+        }
+        const ZoneMap::Zone *time = zone_map.find(offset.val(), "time");
+        SINVARIANT(time != NULL && time->have_values && !time->is_double);
+        SINVARIANT(time->min_int == i * nrecords && time->max_int == (i + 1) * nrecords - 1);
+        SINVARIANT(time->null_count == 0);
+
+        const ZoneMap::Zone *value = zone_map.find(offset.val(), "value");
+        SINVARIANT(value != NULL && value->have_values && value->is_double);
+        SINVARIANT(value->min_double == i && value->max_double < i + 1);
+
+        const ZoneMap::Zone *count = zone_map.find(offset.val(), "count");
+        SINVARIANT(count != NULL);
+        if (i % 2 == 1) {
+            SINVARIANT(!count->have_values && count->null_count == static_cast<int>(nrecords));
+        } else {
+            SINVARIANT(count->have_values && count->null_count == 0);
+            SINVARIANT(count->min_int == 1 - static_cast<int>(nrecords) && count->max_int == 0);
+        }
+
+        const ZoneMap::Zone *op = zone_map.find(offset.val(), "op");
+        SINVARIANT(op != NULL && op->min_int == i && op->max_int == i);
+        SINVARIANT(zone_map.find(offset.val(), "flag") == NULL);
+        SINVARIANT(zone_map.find(offset.val(), "name") == NULL);
+        ++i;
+    }
+    SINVARIANT(i == nextents);
+}
+
+GeneralValue int64Value(int64_t v) {
+    GeneralValue ret;
+    ret.setInt64(v);
+    return ret;
+}
+
+GeneralValue doubleValue(double v) {
+    GeneralValue ret;
+    ret.setDouble(v);
+    return ret;
+}
+
+// Returns the first time in each of the extents returned.
+vector<int64_t> readFiltered(const string &filename, const string &field,
+                             const GeneralValue &min, const GeneralValue &max) {
+    TypeIndexModule module("Test::ZoneMaps");
+    module.addSource(filename);
+    module.addRangeFilter(field, min, max);
+    vector<int64_t> ret;
+    while (Extent::Ptr e = module.getSharedExtent()) {
+        ExtentSeries s(e);
+        Int64Field time(s, "time");
+        ret.push_back(time.val());
+    }
+    return ret;
+}
+
+void checkFiltered(const vector<int64_t> &got, unsigned first, unsigned last) {
+    INVARIANT(got.size() == last + 1 - first, format("%d != %d") % got.size() % (last + 1 - first));
+    for (unsigned i = 0; i < got.size(); ++i) {
+        SINVARIANT(got[i] == (first + i) * nrecords);
+    }
+}
+
+void testRangeFilter(const string &filename, bool have_zone_map) {
+    unsigned first = have_zone_map ? 3 : 0, last = have_zone_map ? 4 : nextents - 1;
+    // the ends of the range are inclusive
+    checkFiltered(readFiltered(filename, "time", int64Value(3 * nrecords + 10),
+                               int64Value(5 * nrecords - 1)), first, last);
+    checkFiltered(readFiltered(filename, "value", doubleValue(3.5), doubleValue(4.0)),
+                  first, last);
+    checkFiltered(readFiltered(filename, "time", doubleValue(3 * nrecords - 0.5),
+                               doubleValue(4 * nrecords + 0.5)), first, last);
+    checkFiltered(readFiltered(filename, "op", int64Value(3), int64Value(4)), first, last);
+    // columns without zones never skip
+    checkFiltered(readFiltered(filename, "name", int64Value(100), int64Value(200)),
+                  0, nextents - 1);
+
+    // the odd extents have only null counts
+    vector<int64_t> got(readFiltered(filename, "count", int64Value(-5), int64Value(5)));
+    SINVARIANT(got.size() == (have_zone_map ? nextents / 2 : nextents));
+
+    got = readFiltered(filename, "time", int64Value(nextents * nrecords), int64Value(1LL << 40));
+    SINVARIANT(got.size() == (have_zone_map ? 0 : nextents));
+}
+
+void checkRange(const DSExpr::FieldRange &range, const string &field, double min, double max) {
+    INVARIANT(range.field == field, format("%s != %s") % range.field % field);
+    // the ranges are widened slightly
+    SINVARIANT(range.min <= min && (min == -Double::Inf || range.min > min - 1.0e-6 * nrecords));
+    SINVARIANT(range.max >= max && (max == Double::Inf || range.max < max + 1.0e-6 * nrecords));
+}
+
+void testImpliedRanges() {
+    DSExpr::FieldRanges ranges(DSExpr::impliedRanges("time >= 3000 && 5000 > time"));
+    SINVARIANT(ranges.size() == 2);
+    checkRange(ranges[0], "time", 3000, Double::Inf);
+    checkRange(ranges[1], "time", -Double::Inf, 5000);
+
+    ranges = DSExpr::impliedRanges("(value == -2 && op + 1 < 3) && !(count > 3) && -5 <= op");
+    SINVARIANT(ranges.size() == 2);
+    checkRange(ranges[0], "value", -2, -2);
+    checkRange(ranges[1], "op", -5, Double::Inf);
+
+    SINVARIANT(DSExpr::impliedRanges("time < 5 || value > 2").empty());
+    SINVARIANT(DSExpr::impliedRanges("name == \"x\"").empty());
+}
+
+class CountRows : public RowAnalysisModule {
+  public:
+    CountRows(DataSeriesModule &source) : RowAnalysisModule(source) { }
+    virtual void processRow() { }
+};
+
+// Returns the number of extents read, checking that skipping extents
+// doesn't change which rows match.
+unsigned readWhere(const string &filename, const string &where, uint64_t expected_rows) {
+    TypeIndexModule module("Test::ZoneMaps");
+    module.addSource(filename);
+    CountRows rows(module);
+    rows.setWhereExpr(where, true);
+    unsigned ret = 0;
+    for (; rows.getSharedExtent() != NULL; ++ret) { }
+    INVARIANT(rows.processed_rows == expected_rows,
+              format("%d != %d") % rows.processed_rows % expected_rows);
+    return ret;
+}
+
+void testWhereFilter(const string &filename, bool have_zone_map) {
+    SINVARIANT(readWhere(filename, "time >= 3010 && time < 4990 && flag == 1", 990)
+               == (have_zone_map ? 2 : nextents));
+    SINVARIANT(readWhere(filename, "value > 7.5", 2499) == (have_zone_map ? 3 : nextents));
+    SINVARIANT(readWhere(filename, "op == 4 || op == 6", 2 * nrecords) == nextents);
+    // a null count compares as 0, so the odd extents can't be skipped
+    SINVARIANT(readWhere(filename, "count == 0", nrecords / 2 * nextents + nextents / 2)
+               == nextents);
+    SINVARIANT(readWhere(filename, "count < -990 && op < 6", 9 * 3)
+               == (have_zone_map ? 7 : nextents));
+}
+
+const string scaled_xml(
+        "<ExtentType namespace=\"ssd.hpl.hp.com\" name=\"Test::ZoneMapsScaled\" version=\"1.0\">\n"
+        "  <field type=\"double\" name=\"x\" pack_scale=\"0.1\" pack_scale_warn=\"no\" />\n"
+        "</ExtentType>\n");
+
+// Packing rounds pack_scale fields, so extent i holds i + 1.04, which
+// reads back as i + 1.0; filtering on the value read must still find it.
+void testPackScale() {
+    ExtentTypeLibrary library;
+    const ExtentType::Ptr type = library.registerTypePtr(scaled_xml);
+    SINVARIANT(type->getPackScale("x") == 0.1);
+    {
+        DataSeriesSink sink("zone-maps-scaled.ds",
+                            Extent::compression_algs[Extent::compress_mode_lzf].compress_flag);
+        sink.setFormatVersion(2);
+        sink.writeExtentLibrary(library);
+        for (unsigned i = 0; i < 3; ++i) {
+            Extent::Ptr extent(new Extent(type));
+            ExtentSeries s(extent);
+            DoubleField x(s, "x");
+            for (unsigned j = 0; j < nrecords; ++j) {
+                s.newRecord();
+                x.set(i + 1.04);
+            }
+            sink.writeExtent(*extent, NULL);
+        }
+        sink.close();
+    }
+
+    TypeIndexModule module("Test::ZoneMapsScaled");
+    module.addSource("zone-maps-scaled.ds");
+    module.addRangeFilter("x", doubleValue(0.9), doubleValue(1.02));
+    unsigned nextents = 0;
+    while (Extent::Ptr e = module.getSharedExtent()) {
+        ExtentSeries s(e);
+        DoubleField x(s, "x");
+        SINVARIANT(fabs(x.val() - 1.0) < 1e-9);
+        ++nextents;
+    }
+    SINVARIANT(nextents == 1);
+
+    TypeIndexModule where_module("Test::ZoneMapsScaled");
+    where_module.addSource("zone-maps-scaled.ds");
+    CountRows rows(where_module);
+    rows.setWhereExpr("x <= 1.02", true);
+    while (rows.getSharedExtent() != NULL) { }
+    SINVARIANT(rows.processed_rows == nrecords);
+}
+
+int main() {
+    testImpliedRanges();
+
+    ExtentTypeLibrary library;
+    const ExtentType::Ptr type = library.registerTypePtr(type_xml);
+
+    writeFile("zone-maps.ds", library, type, 2);
+    checkZoneMap("zone-maps.ds");
+    testRangeFilter("zone-maps.ds", true);
+    testWhereFilter("zone-maps.ds", true);
+
+    writeFile("zone-maps-v1.ds", library, type, 1);
+    SINVARIANT(DataSeriesSource("zone-maps-v1.ds").getZoneMap().empty());
+    testRangeFilter("zone-maps-v1.ds", false);
+    testWhereFilter("zone-maps-v1.ds", false);
+
+    testPackScale();
+
+    cout << "Passed zone map tests\n";
+    return 0;
+}